@@ -0,0 +1,344 @@
+/*
+ * Benchmark suite for the BDD image operations.
+ *
+ * Generates reproducible synthetic images of several kinds and sizes,
+ * times each core operation on them, and prints one JSON object per line
+ * to the standard output, for tracking across releases.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "bdd.h"
+#include "const.h"
+
+/* Largest size to which each incompressible kind is run, so that the
+   BDDs built during a run stay well within BDD_NODES_MAX. */
+#define NOISY_SIZE_MAX 512
+#define TEXT_SIZE_MAX 2048
+
+typedef struct image_kind {
+    char *name;
+    int size_max;
+    void (*gen)(unsigned char *raster, int n);
+} IMAGE_KIND;
+
+static unsigned int seed;
+
+static unsigned int xorshift(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static void gen_uniform(unsigned char *raster, int n) {
+    for (long i = 0; i < (long)n*n; i++) {
+        raster[i] = 128;
+    }
+}
+
+static void gen_hgradient(unsigned char *raster, int n) {
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            raster[(long)i*n + j] = (long)j * 256 / n;
+        }
+    }
+}
+
+static void gen_dgradient(unsigned char *raster, int n) {
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            raster[(long)i*n + j] = (i + j) & 0xFF;
+        }
+    }
+}
+
+static void gen_checker(unsigned char *raster, int n) {
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            raster[(long)i*n + j] = ((i>>3) ^ (j>>3)) & 1 ? 255 : 0;
+        }
+    }
+}
+
+/*
+ * A page of "text": lines of 8x8 glyph cells, drawn from a small alphabet
+ * of pseudo-random glyphs, on a white background with margins.
+ */
+static void gen_text(unsigned char *raster, int n) {
+    for (long i = 0; i < (long)n*n; i++) {
+        raster[i] = 255;
+    }
+    int margin = n/16;
+    for (int line = margin; line + 8 <= n - margin; line += 16) {
+        for (int cell = margin; cell + 8 <= n - margin; cell += 8) {
+            unsigned int glyph = xorshift() % 40;
+            if (glyph >= 32) {
+                continue;
+            }
+            for (int i = 1; i < 7; i++) {
+                unsigned int bits = (glyph * 2654435761u) >> (i * 4);
+                for (int j = 1; j < 7; j++) {
+                    if ((bits >> j) & 1) {
+                        raster[(long)(line + i)*n + cell + j] = 0;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void gen_noise(unsigned char *raster, int n) {
+    for (long i = 0; i < (long)n*n; i++) {
+        raster[i] = xorshift() & 0xFF;
+    }
+}
+
+/*
+ * A "scanned" page: text with paper grain and sensor noise.
+ */
+static void gen_scan(unsigned char *raster, int n) {
+    gen_text(raster, n);
+    for (long i = 0; i < (long)n*n; i++) {
+        int v = raster[i] == 0 ? 40 : 225;
+        raster[i] = v + (int)(xorshift() % 9) - 4;
+    }
+}
+
+static IMAGE_KIND kinds[] = {
+    {"uniform", 8192, gen_uniform},
+    {"hgradient", 8192, gen_hgradient},
+    {"dgradient", 8192, gen_dgradient},
+    {"checker", 8192, gen_checker},
+    {"text", TEXT_SIZE_MAX, gen_text},
+    {"noise", NOISY_SIZE_MAX, gen_noise},
+    {"scan", NOISY_SIZE_MAX, gen_scan},
+};
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Hardware counter of cache misses of this process, or -1 if the kernel
+   does not provide one (as in many virtual machines and containers). */
+static int misses_fd = -1;
+
+static void open_cache_misses(void) {
+    struct perf_event_attr attr = {0};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    misses_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long long cache_misses(void) {
+    long long count;
+    if (misses_fd == -1 || read(misses_fd, &count, sizeof(count)) != sizeof(count)) {
+        return -1;
+    }
+    return count;
+}
+
+static long peak_rss_kb(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+static int count_nodes(int index, char *seen) {
+    if (index < BDD_NUM_LEAVES || seen[index]) {
+        return 0;
+    }
+    seen[index] = 1;
+    return 1 + count_nodes(bdd_nodes[index].left, seen)
+        + count_nodes(bdd_nodes[index].right, seen);
+}
+
+static void report(char *kind, int n, char *op, double ns, long long misses, int nodes) {
+    double bytes = (double)n * n;
+    printf("{\"image\": \"%s\", \"size\": %d, \"op\": \"%s\", \"ns\": %.0f, "
+           "\"mb_per_s\": %.2f, \"cache_misses\": %lld, \"nodes\": %d, \"ns_per_node\": %.2f, "
+           "\"peak_rss_kb\": %ld}\n",
+           kind, n, op, ns, bytes / (ns / 1e9) / 1e6, misses, nodes,
+           nodes ? ns / nodes : 0.0, peak_rss_kb());
+    fflush(stdout);
+}
+
+static unsigned char invert(unsigned char v) {
+    return 255 - v;
+}
+
+/*
+ * Apply n*n bdd_apply() lookups at pseudo-random coordinates.
+ */
+static void apply_random(BDD_NODE *root, int n, unsigned char *out) {
+    unsigned int acc = 0;
+    for (long i = 0; i < (long)n*n; i++) {
+        acc += bdd_apply(root, xorshift() % n, xorshift() % n);
+    }
+    *out = acc;
+}
+
+static void bench_image(IMAGE_KIND *kind, int n, int reps, unsigned char *out) {
+    seed = 2463534242u + n;
+    kind->gen(raster_data, n);
+    int level = bdd_min_level(n, n);
+    double best[19];
+    long long best_misses[19];
+    char *ops[] = {"from_raster", "to_raster", "serialize", "deserialize", "map",
+                   "rotate", "zoom_in", "zoom_out", "apply",
+                   "relayout", "to_raster_relayout", "apply_relayout",
+                   "to_planes", "planes_threshold",
+                   "to_hybrid", "to_raster_hybrid", "apply_hybrid",
+                   "set_pixel", "fill_rect"};
+    int nops = sizeof(ops) / sizeof(*ops);
+    int nodes = 0;
+    BDD_NODE *planes[BDD_PLANES];
+    BDD_LAYOUT layout = {BDD_ORDER_RC, 0, 0, 0};
+    bdd_layout_fit(&layout, n, n);
+    for (int k = 0; k < nops; k++) {
+        best[k] = -1;
+    }
+    for (int rep = 0; rep < reps; rep++) {
+        FILE *tmp = tmpfile();
+        if (tmp == NULL) {
+            return;
+        }
+        for (int k = 0; k < nops; k++) {
+            // Start every operation from a fresh table holding only the input.
+            bdd_reset();
+            long long m0 = cache_misses();
+            double t0 = now_ns();
+            BDD_NODE *root = bdd_from_raster(n, n, raster_data);
+            double t1 = now_ns();
+            long long m1 = cache_misses();
+            if (k == 0) {
+                char *seen = calloc(BDD_NODES_MAX, 1);
+                nodes = count_nodes(root - bdd_nodes, seen);
+                free(seen);
+            }
+            else {
+                if (k == 3) {
+                    bdd_reset();
+                    rewind(tmp);
+                }
+                else if (k == 10 || k == 11) {
+                    root = bdd_relayout(root, BDD_RELAYOUT_DFS);
+                }
+                else if (k == 13) {
+                    bdd_to_planes(root, planes);
+                }
+                else if (k == 15 || k == 16) {
+                    root = bdd_to_hybrid(root, &layout, 6);
+                }
+                m0 = cache_misses();
+                t0 = now_ns();
+                if (k == 1 || k == 10 || k == 15) {
+                    bdd_to_raster(root, n, n, out);
+                }
+                else if (k == 2) {
+                    rewind(tmp);
+                    bdd_serialize(root, tmp);
+                    fflush(tmp);
+                }
+                else if (k == 3) {
+                    bdd_deserialize(tmp);
+                }
+                else if (k == 4) {
+                    bdd_map(root, invert);
+                }
+                else if (k == 5) {
+                    bdd_rotate(root, level);
+                }
+                else if (k == 6) {
+                    bdd_zoom(root, level, 1);
+                }
+                else if (k == 7) {
+                    bdd_zoom(root, level, -1 & 0xFF);
+                }
+                else if (k == 9) {
+                    bdd_relayout(root, BDD_RELAYOUT_DFS);
+                }
+                else if (k == 12) {
+                    bdd_to_planes(root, planes);
+                }
+                else if (k == 13) {
+                    // Pixels of at least 16.
+                    bdd_planes_threshold(planes, 4);
+                }
+                else if (k == 14) {
+                    // Tiles of 8x8 pixels.
+                    bdd_to_hybrid(root, &layout, 6);
+                }
+                else if (k == 17) {
+                    // One edit per row, each on the result of the last.
+                    for (int i = 0; i < n; i++) {
+                        root = bdd_set_pixel(root, &layout, xorshift() % n, xorshift() % n, i);
+                    }
+                }
+                else if (k == 18) {
+                    // 64 rectangles of up to an eighth of the side.
+                    for (int i = 0; i < 64; i++) {
+                        BDD_RECT rect = {xorshift() % n, xorshift() % n, 0, 0};
+                        rect.r1 = rect.r0 + 1 + xorshift() % (n/8);
+                        rect.c1 = rect.c0 + 1 + xorshift() % (n/8);
+                        root = bdd_fill_rect(root, &layout, &rect, i);
+                    }
+                }
+                else {
+                    // One lookup per pixel, at pseudo-random coordinates.
+                    apply_random(root, n, out);
+                }
+                t1 = now_ns();
+                m1 = cache_misses();
+            }
+            if (best[k] < 0 || t1 - t0 < best[k]) {
+                best[k] = t1 - t0;
+                best_misses[k] = m0 == -1 || m1 == -1 ? -1 : m1 - m0;
+            }
+        }
+        fclose(tmp);
+    }
+    for (int k = 0; k < nops; k++) {
+        report(kind->name, n, ops[k], best[k], best_misses[k], nodes);
+    }
+}
+
+int main(int argc, char **argv) {
+    int size_max = 8192;
+    int reps = 1;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-' && argv[i][1] == 'm' && i+1 < argc) {
+            size_max = atoi(argv[++i]);
+        }
+        else if (argv[i][0] == '-' && argv[i][1] == 'r' && i+1 < argc) {
+            reps = atoi(argv[++i]);
+        }
+        else {
+            fprintf(stderr, "USAGE: %s [-m MAX_SIZE] [-r REPETITIONS]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    unsigned char *out = malloc(RASTER_SIZE_MAX);
+    open_cache_misses();
+    if (out == NULL) {
+        return EXIT_FAILURE;
+    }
+    for (int k = 0; k < (int)(sizeof(kinds) / sizeof(*kinds)); k++) {
+        for (int n = 256; n <= size_max && n <= kinds[k].size_max; n *= 2) {
+            bench_image(&kinds[k], n, reps < 1 ? 1 : reps, out);
+        }
+    }
+    free(out);
+    return EXIT_SUCCESS;
+}
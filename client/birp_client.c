@@ -0,0 +1,113 @@
+/*
+ * Client for the conversion daemon (see daemon.h), for testing.
+ *
+ *   birp_client SOCKET [OPTIONS]... < input > output
+ *
+ * Sends the options and the standard input to the daemon listening on
+ * SOCKET, writes the converted image to the standard output and any
+ * diagnostics to the standard error, and exits with the status of the
+ * conversion.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "daemon.h"
+
+static int write_all(int fd, const char *buf, size_t n) {
+    while (n > 0) {
+        ssize_t k = write(fd, buf, n);
+        if (k <= 0) {
+            return -1;
+        }
+        buf += k;
+        n -= k;
+    }
+    return 0;
+}
+
+/* Copy n bytes from the socket to a stream. */
+static int copy_out(int fd, size_t n, FILE *out) {
+    char buf[65536];
+    while (n > 0) {
+        ssize_t k = read(fd, buf, n < sizeof(buf) ? n : sizeof(buf));
+        if (k <= 0 || fwrite(buf, 1, k, out) != (size_t)k) {
+            return -1;
+        }
+        n -= k;
+    }
+    return fflush(out);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "USAGE: %s SOCKET [OPTIONS]... < input > output\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    char line[DAEMON_LINE_MAX + 1];
+    size_t len = 0;
+    for (int i = 2; i < argc; i++) {
+        size_t n = strlen(argv[i]);
+        if (n == 0 || strpbrk(argv[i], " \n") != NULL || len + n + 1 > DAEMON_LINE_MAX) {
+            fprintf(stderr, "%s: option cannot be sent: '%s'\n", argv[0], argv[i]);
+            return EXIT_FAILURE;
+        }
+        if (len > 0) {
+            line[len++] = ' ';
+        }
+        memcpy(line + len, argv[i], n);
+        len += n;
+    }
+    line[len++] = '\n';
+
+    struct sockaddr_un addr = {AF_UNIX};
+    if (strlen(argv[1]) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    strcpy(addr.sun_path, argv[1]);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    // The daemon reads the whole input before replying, so it can all be
+    // sent before anything is read back.
+    char buf[65536];
+    ssize_t n;
+    if (write_all(fd, line, len) == -1) {
+        perror("write");
+        return EXIT_FAILURE;
+    }
+    while ((n = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
+        if (write_all(fd, buf, n) == -1) {
+            perror("write");
+            return EXIT_FAILURE;
+        }
+    }
+    shutdown(fd, SHUT_WR);
+
+    char header[64];
+    size_t h = 0;
+    while (h + 1 < sizeof(header) && read(fd, header + h, 1) == 1 && header[h] != '\n') {
+        h++;
+    }
+    header[h] = '\0';
+    int status;
+    size_t olen, elen;
+    if (sscanf(header, "%d %zu %zu", &status, &olen, &elen) != 3) {
+        fprintf(stderr, "%s: bad reply from daemon\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (copy_out(fd, olen, stdout) == -1 || copy_out(fd, elen, stderr) == -1) {
+        fprintf(stderr, "%s: reply truncated\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    close(fd);
+    return status;
+}
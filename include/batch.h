@@ -0,0 +1,46 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+/*
+ * Batch conversion of many files, with reading, conversion and writing
+ * overlapped.  A reader thread loads input files into memory, a pool of
+ * worker threads converts them, and the calling thread writes the results,
+ * the stages being joined by bounded queues so that a slow stage holds
+ * back the ones before it rather than letting memory grow.  Each worker
+ * has its own BDD manager and raster (see bdd_manager_use() and
+ * birp_raster), so that conversions proceed in parallel.
+ */
+
+/* Number of files that may wait in each queue, per worker. */
+#define BATCH_QUEUE_PER_WORKER 2
+
+/*
+ * Batch settings, set by validargs: the input (a directory, or a file
+ * listing one input path per line), the output directory (NULL if not in
+ * batch mode), and the number of workers (0 for one per online processor).
+ */
+extern __thread char *batch_input;
+extern __thread char *batch_output;
+extern __thread int batch_jobs;
+
+/**
+ * Convert every file of the input, as selected by the global options,
+ * writing each result to the output directory under the name of the input
+ * file with its extension replaced by that of the output format (".pgm",
+ * ".ppm", ".birp", or ".txt" for ASCII art and statistics).  Hidden files and
+ * subdirectories of an input directory are skipped.  An input whose output
+ * file would be that of an earlier input (as for "a.pgm" and "a.ppm") is
+ * reported and counted as failed, rather than overwriting it.  A report of the
+ * number of files converted and failed, and of the throughput in files/s
+ * and MB/s (of input), is written as JSON to the standard error.
+ *
+ * @param input  The input directory or file list.
+ * @param output  The output directory, which is created if it does not
+ * exist.
+ * @param jobs  The number of worker threads, or 0 for one per processor.
+ * @return  0 if every file was converted, -1 otherwise, or if the output
+ * directory could not be created or the threads could not be started.
+ */
+int birp_batch(char *input, char *output, int jobs);
+
+#endif
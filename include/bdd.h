@@ -16,6 +16,17 @@ typedef struct bdd_node {
     int right;
 } BDD_NODE;
 
+/*
+ * A rectangle of pixels, consisting of the rows in [r0, r1) and the
+ * columns in [c0, c1).
+ */
+typedef struct bdd_rect {
+    int r0;
+    int c0;
+    int r1;
+    int c1;
+} BDD_RECT;
+
 /*
  * Each BDD node represents a function on some number of boolean arguments.
  * We refer to the number of arguments as the "level" of the node.
@@ -24,6 +35,9 @@ typedef struct bdd_node {
  */
 #define BDD_LEVELS_MAX 32
 
+/* The greatest width or height of an image that a BDD can cover. */
+#define BDD_SIDE_MAX (1<<(BDD_LEVELS_MAX/2))
+
 /*
  * We are using a variant of BDDs called "multi-terminal" BDDs or MTBDDs,
  * for short.  Traditional BDDs represent boolean-valued functions of boolean
@@ -68,6 +82,80 @@ BDD_NODE *bdd_hash_map[BDD_HASH_SIZE];
  */
 int bdd_index_map[BDD_NODES_MAX];
 
+/*
+ * A BDD manager owns the state needed to build and operate on BDDs: the
+ * node table, the hash map used to keep nodes unique, the map used in
+ * serialization and deserialization.
+ * Operations allocate their scratch memory and caches per call, or keep
+ * them in the manager, so that with one manager per thread, unrelated
+ * images can be processed at the same time on separate cores.
+ *
+ * Every BDD function acts on the manager that the calling thread is using
+ * (see bdd_manager_use()), and node pointers are only meaningful for the
+ * manager that created them.  Each thread starts out using the default
+ * manager, whose tables are the global arrays above, so that programs that
+ * do not create managers are unaffected.
+ */
+typedef struct bdd_manager {
+    BDD_NODE *nodes;        // node table (see bdd_nodes)
+    BDD_NODE **hash_map;    // unique table (see bdd_hash_map)
+    int *index_map;         // serialization map (see bdd_index_map)
+    int unused;             // index of the first free entry of the node table
+    int serial;             // last serial number used in (de)serialization
+    unsigned char *tiles;   // pool of dense tiles, allocated when first used
+    int tile_units;         // number of units of the pool in use
+    int *tile_hash;         // map from the contents of tiles to tiles
+    struct bdd_store *store;    // node store for thin BDDs (see store.h), or NULL
+    int generation;         // number of resets, so that caches of nodes held
+                            // elsewhere can tell when they are stale
+    int *memo;              // per-node memo tables of walks over the table,
+                            // allocated when first used
+    int walk[2];            // stamp of the last walk begun on each pair of
+                            // memo tables
+    unsigned long long *wide;   // per-node memo values too wide for an int,
+                                // allocated when first used
+} BDD_MANAGER;
+
+/**
+ * Create a BDD manager with empty tables of its own, of the same sizes as
+ * the global ones.
+ *
+ * @return  The new manager, or NULL if memory could not be allocated.
+ */
+BDD_MANAGER *bdd_manager_new(void);
+
+/**
+ * Free a manager created by bdd_manager_new(), invalidating all nodes
+ * belonging to it.  If the calling thread is using the manager, it goes
+ * back to using the default one.  The default manager is not freed.
+ *
+ * @param mgr  The manager to free.
+ */
+void bdd_manager_free(BDD_MANAGER *mgr);
+
+/**
+ * Select the manager on which BDD functions called by the calling thread
+ * are to act.  A manager must not be used by two threads at once.
+ *
+ * @param mgr  The manager to use, or NULL for the default manager.
+ * @return  The manager that the thread was using before.
+ */
+BDD_MANAGER *bdd_manager_use(BDD_MANAGER *mgr);
+
+/**
+ * Obtain the manager that the calling thread is using.
+ *
+ * @return  The manager in use.
+ */
+BDD_MANAGER *bdd_manager_current(void);
+
+/**
+ * Discard all non-leaf nodes from the node table, so that it can be reused
+ * for an unrelated image.  Any BDD node pointers obtained previously are
+ * invalidated.
+ */
+void bdd_reset(void);
+
 /**
  * Determine the minimum number of levels required to cover a raster
  * with a specified width w and height h.
@@ -75,6 +163,8 @@ int bdd_index_map[BDD_NODES_MAX];
  * @param w  The width of the raster to be covered.
  * @param h  The height of the raster to be covered.
  * @return  The least value l >=0 such that w <= 2^(l/2) and h <= 2^(l/2).
+ * This exceeds BDD_LEVELS_MAX for a raster that no BDD can cover, one with
+ * a side above BDD_SIDE_MAX.
  */
 int bdd_min_level(int w, int h);
 
@@ -95,6 +185,179 @@ int bdd_min_level(int w, int h);
  */
 BDD_NODE *bdd_from_raster(int w, int h, unsigned char *raster);
 
+/**
+ * Build, in a single pass over a raster, the BDD that would be obtained by
+ * applying bdd_map_table() and then bdd_dihedral() to the result of
+ * bdd_from_raster().  Values are remapped through the lookup table as
+ * leaves are created (including the zero values of the padding region),
+ * and the symmetry is realized by the order in which the raster is
+ * traversed, so no intermediate BDD is constructed.
+ *
+ * @param w  The width (number of columns) of the array of data.
+ * @param h  The height (number of rows) of the array of data.
+ * @param raster  An array of h x w one-byte values, stored in row-major order.
+ * @param lut  An array of BDD_NUM_LEAVES values giving the result for each
+ * possible raster value, or NULL for the identity mapping.
+ * @param op  One of the codes BDD_IDENTITY through BDD_ANTITRANSPOSE
+ * (see bdd_dihedral()).
+ * @return  A BDD node representing the transformed 2^d x 2^d array,
+ * or NULL if any error occurs.
+ */
+BDD_NODE *bdd_from_raster_mapped(int w, int h, unsigned char *raster, unsigned char *lut, int op);
+
+/*
+ * Variable orders.  The order of a BDD determines, for each level, whether
+ * a node at that level splits its rectangle of pixels into top and bottom
+ * halves (a row variable) or into left and right halves (a column variable).
+ * Within each axis, bits are always tested from the most significant down.
+ * BDD_ORDER_RC is the original order, in which row and column bits alternate
+ * starting with a row bit; it is the order assumed by all functions that do
+ * not take a layout argument.  An order is recorded in the header of a BIRP
+ * file (see img_write_birp_layout()).
+ */
+#define BDD_ORDER_RC 0    // Interleaved, row bit first (Morton order)
+#define BDD_ORDER_CR 1    // Interleaved, column bit first
+#define BDD_ORDER_ROWS 2  // All row bits above all column bits
+#define BDD_ORDER_COLS 3  // All column bits above all row bits
+#define BDD_ORDER_COUNT 4
+
+/**
+ * Determine which levels split rows in a given variable order.  When there
+ * are more variables of one axis than of the other, the surplus ones are
+ * placed above the levels at which the order applies.
+ *
+ * @param order  The variable order.
+ * @param rbits  The number of row variables (bits of a row index).
+ * @param cbits  The number of column variables.
+ * @return  A mask in which bit l-1 is set if and only if level l, for
+ * 1 <= l <= rbits+cbits, is a row variable.
+ */
+unsigned int bdd_order_mask(int order, int rbits, int cbits);
+
+/*
+ * The layout of the variables of a BDD: their order, and the numbers of row
+ * and column variables, so that the BDD represents a 2^rbits x 2^cbits array
+ * at level rbits + cbits.  A square layout, as used by all functions that do
+ * not take a layout argument, has rbits == cbits, and an image of any other
+ * shape is padded to the smallest enclosing square.  A rectangular layout
+ * (rect != 0) instead has the least rbits and cbits covering the image, so
+ * that long strips are not padded, and the surplus variables of the longer
+ * axis are placed at the top (see bdd_order_mask()).
+ */
+typedef struct bdd_layout {
+    int order;
+    int rbits;
+    int cbits;
+    int rect;
+} BDD_LAYOUT;
+
+/**
+ * Set the numbers of row and column variables of a layout to those required
+ * to cover a w x h image, according to whether the layout is rectangular.
+ *
+ * @param layout  The layout, whose order and rect fields have been set.
+ * @param w  The width of the image.
+ * @param h  The height of the image.
+ */
+void bdd_layout_fit(BDD_LAYOUT *layout, int w, int h);
+
+/**
+ * Obtain the name of a variable order, as used in BIRP headers and on the
+ * command line: "rc", "cr", "rows" or "cols".
+ *
+ * @param order  The variable order.
+ * @return  The name of the order, or NULL if it is not a valid order.
+ */
+const char *bdd_order_name(int order);
+
+/**
+ * Obtain the variable order having a specified name.
+ *
+ * @param name  The name of the order (see bdd_order_name()).
+ * @return  The order, or -1 if there is no order with that name.
+ */
+int bdd_order_parse(const char *name);
+
+/**
+ * Build, as bdd_from_raster_mapped(), a BDD for the transformed raster,
+ * but with its variables in a specified layout.
+ *
+ * @param w  The width (number of columns) of the array of data.
+ * @param h  The height (number of rows) of the array of data.
+ * @param raster  An array of h x w one-byte values, in row-major order.
+ * @param lut  A table of 256 values to substitute for the pixel values,
+ * or NULL to leave pixel values unchanged.
+ * @param op  The symmetry of the square to apply (see bdd_dihedral()),
+ * which must be BDD_IDENTITY unless the layout is square.
+ * @param layout  The layout of the result, which must cover the raster
+ * (see bdd_layout_fit()).
+ * @return  A BDD node representing the transformed array in the given
+ * layout, or NULL if any error occurs.
+ */
+BDD_NODE *bdd_from_raster_ordered(int w, int h, unsigned char *raster, unsigned char *lut,
+                                  int op, BDD_LAYOUT *layout);
+
+/**
+ * Build, as bdd_from_raster_ordered(), a BDD that approximates the
+ * transformed raster to within a specified per-pixel error.  Every block
+ * of the raster corresponding to a subtree whose values differ by at most
+ * twice the tolerance is replaced by a single leaf, chosen where possible
+ * from a fixed set of values spaced 2*tol+1 apart so that similar blocks
+ * share their leaves; isolated pixels are rounded to the same values.
+ * The result therefore differs from the exact BDD by at most tol in any
+ * pixel, while noise no larger than the tolerance no longer gives one
+ * node per pixel.
+ *
+ * @param w  The width (number of columns) of the array of data.
+ * @param h  The height (number of rows) of the array of data.
+ * @param raster  An array of h x w one-byte values, in row-major order.
+ * @param lut  A table of 256 values to substitute for the pixel values,
+ * or NULL to leave pixel values unchanged.  The error is measured
+ * against the substituted values.
+ * @param op  The symmetry of the square to apply, as for
+ * bdd_from_raster_ordered().
+ * @param layout  The layout of the result, which must cover the raster.
+ * @param tol  The greatest permitted error in any pixel; 0 gives the
+ * exact BDD.
+ * @param errp  If not NULL, set to the greatest error actually incurred,
+ * which is at most tol.
+ * @return  A BDD node representing the approximated array in the given
+ * layout, or NULL if any error occurs.
+ */
+BDD_NODE *bdd_from_raster_lossy(int w, int h, unsigned char *raster, unsigned char *lut,
+                                int op, BDD_LAYOUT *layout, int tol, int *errp);
+
+/**
+ * Build a BDD for a raster too large to be held in memory at once, by
+ * reading it in bands of tile x tile squares.  Each tile is built on its
+ * own, as bdd_from_raster_lossy() would build it, and the tiles are then
+ * joined at the levels above them, so that the result is the same BDD that
+ * would have been built from the whole raster.  Only one band of rows is
+ * held at a time, so the memory needed is that of the band and of the BDD.
+ *
+ * @param w  The width (number of columns) of the raster.
+ * @param h  The height (number of rows) of the raster.
+ * @param tile  The side of a tile, which must be a power of two.
+ * @param band  An array of at least tile x w entries to hold one band.
+ * @param fill  Function called to read the next rows of the raster, in
+ * order, into the band, in row-major order; it is given the band, the
+ * number of rows (tile, except for the last band) and arg, and returns
+ * 0 if successful or -1 if any error occurs.
+ * @param arg  Argument to be passed to fill.
+ * @param lut  A table of 256 values to substitute for the pixel values,
+ * or NULL to leave pixel values unchanged.
+ * @param tol  The greatest permitted error in any pixel, as for
+ * bdd_from_raster_lossy(); 0 gives the exact BDD.
+ * @param errp  If not NULL, set to the greatest error actually incurred.
+ * @return  A BDD node representing the raster in the default layout of a
+ * w x h image (square, with order BDD_ORDER_RC), or NULL if any error
+ * occurs.  Images this large can need more nodes than the node table
+ * holds; the build then fails, with a message on the standard error.
+ */
+BDD_NODE *bdd_from_raster_tiled(int w, int h, int tile, unsigned char *band,
+                                int (*fill)(unsigned char *band, int rows, void *arg), void *arg,
+                                unsigned char *lut, int tol, int *errp);
+
 /**
  * Given a BDD node with level 2*d, a nonnegative integer w, and a nonnegative
  * integer h, interpret the BDD node as representing a 2^d x 2^d square array
@@ -110,6 +373,62 @@ BDD_NODE *bdd_from_raster(int w, int h, unsigned char *raster);
  */
 void bdd_to_raster(BDD_NODE *node, int w, int h, unsigned char *raster);
 
+/**
+ * Store the values of the sub-array having indices in [0, h) x [0, w) of
+ * the array represented by a BDD with a specified layout into an array,
+ * in row-major order.  Regions on which the array is constant are filled
+ * without descending to individual pixels.
+ *
+ * @param node  The BDD node.
+ * @param layout  The layout of the BDD.
+ * @param w  The width (number of columns) of the raster to be stored.
+ * @param h  The height (number of rows) of the raster to be stored.
+ * @param raster  An array, having at least w x h entries, into which the
+ * raster is to be stored in row-major order.
+ * @return  0 if successful, -1 if any error occurs.
+ */
+int bdd_to_raster_ordered(BDD_NODE *node, BDD_LAYOUT *layout, int w, int h,
+                          unsigned char *raster);
+
+/**
+ * Store the rows with indices in [r0, r1) of the w-column array represented
+ * by a BDD with a specified layout, as bdd_to_raster_ordered(), so that an
+ * image too large to be held in memory can be unpacked a band at a time.
+ *
+ * @param node  The BDD node.
+ * @param layout  The layout of the BDD.
+ * @param w  The width (number of columns) of the raster to be stored.
+ * @param r0  The index of the first row to be stored.
+ * @param r1  The index just beyond the last row to be stored.
+ * @param raster  An array, having at least w x (r1-r0) entries, into which
+ * the rows are to be stored in row-major order.
+ * @return  0 if successful, -1 if any error occurs.
+ */
+int bdd_to_raster_rows(BDD_NODE *node, BDD_LAYOUT *layout, int w, int r0, int r1,
+                       unsigned char *raster);
+
+/**
+ * Given a BDD node with level 2*d, a nonnegative integer w, a nonnegative
+ * integer h, and a scale k, store into a specified array a reduced copy of
+ * the sub-array having indices in [0, h) x [0, w), in which each value is
+ * the (rounded) mean of a 2^k x 2^k block of the original, clipped to
+ * [0, h) x [0, w).  The reduced raster has ceil(w/2^k) columns and
+ * ceil(h/2^k) rows, stored in row-major order.  The block means are read
+ * from the nodes at level 2*k (using sums memoized per node), and constant
+ * regions are filled without descending further, so the full-resolution
+ * raster is never produced.  With k = 0 this is a full decode.
+ *
+ * @param node  The BDD node.
+ * @param level  The level at which to interpret the node, which must be 2*d.
+ * @param w  The width (number of columns) of the original raster.
+ * @param h  The height (number of rows) of the original raster.
+ * @param k  The scale, with 0 <= 2*k <= level.
+ * @param raster  An array, having at least ceil(w/2^k) x ceil(h/2^k)
+ * entries, into which the reduced raster is to be stored.
+ * @return  0 if successful, -1 if any error occurs.
+ */
+int bdd_to_raster_scaled(BDD_NODE *node, int level, int w, int h, int k, unsigned char *raster);
+
 /**
  * Serialize a BDD as a sequence of instructions for building the BDD in a
  * bottom-up fashion.  Each instruction begins with a 1-byte opcode, with
@@ -132,17 +451,30 @@ void bdd_to_raster(BDD_NODE *node, int w, int h, unsigned char *raster);
  * the serial numbers of the children of a node will always be less than
  * the serial number of the node itself.
  *
+ * While a node store is attached to the manager (see store.h), the nodes
+ * are instead added to the store, and the BDD is written as the single
+ * instruction '$' followed by the 8-byte hash of its root in the store.
+ *
+ * A stream may hold several serialized BDDs, as the images of a
+ * multi-image BIRP stream, each but the last ended by the instruction
+ * BDD_FRAME_END.  The instruction is written by the caller, once it knows
+ * that another BDD follows; a stream of one BDD is read to its end.
+ *
  * @param node  The node at the root of the BDD to be serialized.
  * @param out  Stream on which to output the serialized BDD.
  * @return  0 if successful, -1 if any error occurs.
  */
 int bdd_serialize(BDD_NODE *node, FILE *out);
 
+#define BDD_FRAME_END '.'
+
 /**
  * Deserialize a BDD from an input stream, which is assumed to have the
  * format described in the documentation for bdd_serialize.  This function
  * should validate the input stream and return an error indication if the
- * input stream does not have the proper format.
+ * input stream does not have the proper format.  Reading stops at the end
+ * of the stream or after an instruction BDD_FRAME_END, so that the BDD of
+ * the next image of a multi-image stream may then be read.
  *
  * @param in  Input stream from which to read the serialized BDD.
  * @return  The BDD node with the greatest serial number in the input stream
@@ -151,6 +483,34 @@ int bdd_serialize(BDD_NODE *node, FILE *out);
  */
 BDD_NODE *bdd_deserialize(FILE *in);
 
+/**
+ * Serialize several BDDs together, as the channels of a colour image, so
+ * that the nodes they share are written once.  The nodes of all the BDDs
+ * are written as for bdd_serialize(), followed by one instruction '=' for
+ * each root in turn, with the 4-byte serial number of the root.  Each such
+ * instruction takes a serial number of its own, so that the roots are the
+ * last n nodes of the stream.  While a node store is attached, the roots
+ * are instead written as n instructions '$'.  A single BDD is serialized
+ * exactly as by bdd_serialize().
+ *
+ * @param roots  The roots of the BDDs to be serialized.
+ * @param n  The number of BDDs, at least 1.
+ * @param out  Stream on which to output the serialized BDDs.
+ * @return  0 if successful, -1 if any error occurs.
+ */
+int bdd_serialize_roots(BDD_NODE **roots, int n, FILE *out);
+
+/**
+ * Deserialize several BDDs written together by bdd_serialize_roots().
+ *
+ * @param in  Input stream from which to read the serialized BDDs.
+ * @param roots  Set to the roots of the n BDDs, being the last n nodes of
+ * the stream.
+ * @param n  The number of BDDs, at least 1.
+ * @return  0 if successful, -1 if there was any error.
+ */
+int bdd_deserialize_roots(FILE *in, BDD_NODE **roots, int n);
+
 /**
  * Given a BDD node that represents an array of values, construct a new
  * BDD node that represents the result of applying a specified function
@@ -166,6 +526,97 @@ BDD_NODE *bdd_deserialize(FILE *in);
  */
 BDD_NODE *bdd_map(BDD_NODE *node, unsigned char (*func)(unsigned char));
 
+/**
+ * Given a BDD node that represents an array of values, construct a new
+ * BDD node that represents the result of replacing each entry v of the
+ * array by entry v of a lookup table.  This is the same operation as
+ * bdd_map(), with the function given by its table of values; a chain of
+ * value transformations can thus be composed into a single table and
+ * applied in one pass.  Results are memoized per node.
+ *
+ * @param node  The BDD node that represents the input array.
+ * @param lut  An array of BDD_NUM_LEAVES values, giving the result for
+ * each possible entry of the input array.
+ * @return  The BDD node that represents the result of the mapping, or NULL
+ * if any error occurs.
+ */
+BDD_NODE *bdd_map_table(BDD_NODE *node, unsigned char *lut);
+
+/*
+ * Bitwise operations on the values of two arrays (see bdd_combine()).
+ */
+#define BDD_AND 0
+#define BDD_OR 1
+#define BDD_XOR 2
+
+/**
+ * Given BDD nodes representing two arrays of values, construct the BDD
+ * node representing the array whose entries are the bitwise AND, OR or XOR
+ * of the corresponding entries.  The operands are walked together from the
+ * top down, stopping wherever the result is decided by one of them (for
+ * example where either operand of AND is 0), and results for pairs of
+ * nodes are cached, so that the cost depends on the sizes of the BDDs
+ * rather than on the number of pixels.  For binary masks (all values 0 or
+ * 1, such as bit planes) these are the set operations on the masks.
+ * The operation is pointwise, so it holds in any layout (see BDD_LAYOUT),
+ * provided that both operands are in the same one; the result is then in
+ * that layout too.
+ *
+ * @param a  A BDD node, which must not be hybrid.
+ * @param b  A BDD node in the same layout as a, which must not be hybrid.
+ * @param op  One of BDD_AND, BDD_OR and BDD_XOR.
+ * @return  The BDD node representing the combined array, or NULL if any
+ * error occurs.
+ */
+BDD_NODE *bdd_combine(BDD_NODE *a, BDD_NODE *b, int op);
+
+/*
+ * Number of bit planes of an image of one-byte values.
+ */
+#define BDD_PLANES 8
+
+/**
+ * Decompose an image into bit planes: binary BDDs, in the same node table
+ * as the image, of which plane k has the value 1 exactly where bit k of
+ * the pixel value is set.  The high planes of smooth images, and most
+ * planes of images with few grey levels, have far fewer nodes than the
+ * image, and plane operations such as bdd_combine() and
+ * bdd_planes_threshold() work on those rather than on the whole image.
+ * The planes are in the layout of the image, whatever it is.
+ *
+ * @param node  A BDD node, which must not be hybrid.
+ * @param planes  An array of BDD_PLANES BDD node pointers, which receives
+ * the planes, least significant first.
+ * @return  0 if successful, -1 if any error occurs.
+ */
+int bdd_to_planes(BDD_NODE *node, BDD_NODE **planes);
+
+/**
+ * Reassemble an image from its bit planes (see bdd_to_planes()).
+ *
+ * @param planes  An array of BDD_PLANES binary BDD nodes, least
+ * significant first, all in the same layout.
+ * @return  The BDD node representing the image, in the layout of the
+ * planes, whose pixel values have the given bits, or NULL if any plane
+ * is missing or has a value other than 0 and 1, or if any other error
+ * occurs.
+ */
+BDD_NODE *bdd_from_planes(BDD_NODE **planes);
+
+/**
+ * Compute, from the bit planes of an image, the binary mask of the pixels
+ * with value at least 2^k: the OR of planes k and above.  Only the planes
+ * involved are visited.
+ *
+ * @param planes  An array of BDD_PLANES binary BDD nodes, least
+ * significant first, all in the same layout.
+ * @param k  The exponent of the threshold, in [0, BDD_PLANES).
+ * @return  The BDD node of the mask (values 0 and 1), in the layout of the
+ * planes, or NULL if any of the planes involved is missing or has a value
+ * other than 0 and 1, or if any other error occurs.
+ */
+BDD_NODE *bdd_planes_threshold(BDD_NODE **planes, int k);
+
 /**
  * Given a BDD node with level 2*d, representing a 2^d x 2^d square image,
  * construct a new BDD node that represents the result of rotating the
@@ -196,6 +647,62 @@ BDD_NODE *bdd_map(BDD_NODE *node, unsigned char (*func)(unsigned char));
  */
 BDD_NODE *bdd_rotate(BDD_NODE *node, int level);
 
+/*
+ * Codes for the eight symmetries of a square (the "dihedral group"),
+ * for use with bdd_dihedral.  Rotations are counterclockwise; FLIP_H
+ * mirrors left-to-right, FLIP_V mirrors top-to-bottom, TRANSPOSE reflects
+ * across the main diagonal and ANTITRANSPOSE across the other diagonal.
+ */
+#define BDD_IDENTITY 0
+#define BDD_ROT90 1
+#define BDD_ROT180 2
+#define BDD_ROT270 3
+#define BDD_FLIP_H 4
+#define BDD_FLIP_V 5
+#define BDD_TRANSPOSE 6
+#define BDD_ANTITRANSPOSE 7
+
+/**
+ * Given a BDD node with level 2*d, representing a 2^d x 2^d square image,
+ * construct a new BDD node that represents the result of applying one of
+ * the symmetries of the square to the image.  Each symmetry is realized
+ * (as for bdd_rotate) by permuting the four quadrants of a square and
+ * recursively transforming each quadrant.  Results are memoized per node,
+ * so the cost is proportional to the number of distinct nodes rather than
+ * to the number of pixels.
+ *
+ * @param node  The BDD node to transform.
+ * @param level  The level at which to interpret the node,
+ * which (due to "skipped levels") might be larger than the level
+ * recorded in the node itself.
+ * @param op  One of the codes BDD_IDENTITY through BDD_ANTITRANSPOSE.
+ * @return  The BDD node resulting from the transformation, or NULL if
+ * any error occurs.
+ */
+BDD_NODE *bdd_dihedral(BDD_NODE *node, int level, int op);
+
+/**
+ * Compose two symmetries of the square.
+ *
+ * @param first  The code of the symmetry applied first.
+ * @param second  The code of the symmetry applied second.
+ * @return  The code of the single symmetry equivalent to applying first
+ * and then second.
+ */
+int bdd_dihedral_compose(int first, int second);
+
+/**
+ * Find where a w x h image with its top-left corner at the origin of an
+ * n x n square lands when a symmetry of the square is applied to it.
+ *
+ * @param op  One of the codes BDD_IDENTITY through BDD_ANTITRANSPOSE.
+ * @param n  The side of the square.
+ * @param w  The width (number of columns) of the image.
+ * @param h  The height (number of rows) of the image.
+ * @param box  Set to the rectangle occupied by the transformed image.
+ */
+void bdd_dihedral_box(int op, int n, int w, int h, BDD_RECT *box);
+
 /**
  * Given a BDD node that represents a 2^d x 2^d image, construct a new
   * BDD node that represents the result of "zooming" by a specified
@@ -224,7 +731,10 @@ BDD_NODE *bdd_zoom(BDD_NODE *node, int level, int factor);
  * Look up, in the node table, a BDD node having the specified level and children,
  * inserting a new node if a matching node does not already exist.
  * The returned value is the index of the existing node or of the newly inserted node.
- * It is the caller's responsibility to ensure that the arguments are valid.
+ * It is the caller's responsibility to ensure that the arguments are valid,
+ * except that a negative child, the result of a lookup that failed, makes
+ * this lookup fail too, so that a failure anywhere in a recursive build
+ * reaches its root.
  *
  * @param level  The level number, in the range [0, BDD_LEVELS_MAX], of the
  * BDD node to be looked up.
@@ -233,7 +743,8 @@ BDD_NODE *bdd_zoom(BDD_NODE *node, int level, int factor);
  * @param left  The index, in the bdd_nodes array, of the right (i.e. "1") child
  * of the BDD node to be looked up.
  * @return  An index in the bdd_nodes array, either of an existing node or
- * of a newly inserted node.
+ * of a newly inserted node, or -1 if the node would have to be inserted and
+ * the table already holds BDD_NODES_MAX nodes, or if a child is negative.
  */
 int bdd_lookup(int level, int left, int right);
 
@@ -265,4 +776,334 @@ int bdd_lookup(int level, int left, int right);
  */
 unsigned char bdd_apply(BDD_NODE *node, int r, int c);
 
+/**
+ * As bdd_apply(), obtain the value at row r and column c of the array
+ * represented by a BDD, but with the variables of the BDD in a specified
+ * layout.
+ *
+ * @param node  A BDD node.
+ * @param layout  The layout of the BDD.
+ * @param r  Row index of the value to be obtained.
+ * @param c  Column index of the value to be obtained.
+ * @return  The value in the array at the specified row and column index,
+ * or 0 if the indices lie outside the array.
+ */
+unsigned char bdd_apply_ordered(BDD_NODE *node, BDD_LAYOUT *layout, int r, int c);
+
+/**
+ * Given a BDD node representing an array of values with its variables in
+ * one layout, construct the BDD representing the same array with its
+ * variables in another layout.  Where the new layout has more row or column
+ * variables, the array is padded with zeros below or to the right; where it
+ * has fewer, the array is cut down to its top-left part.  The result is
+ * built from the top down: the BDD for each node of the result is obtained
+ * by restricting the variable tested at that node in the original, with
+ * restrictions memoized per node, so that the cost depends on the sizes of
+ * the BDDs rather than on the number of pixels.
+ *
+ * @param node  A BDD node.
+ * @param from  The layout of the given BDD.
+ * @param to  The layout of the result.
+ * @return  The BDD node representing the array in the new layout, or NULL
+ * if any error occurs.
+ */
+BDD_NODE *bdd_reorder(BDD_NODE *node, BDD_LAYOUT *from, BDD_LAYOUT *to);
+
+/*
+ * Orders in which bdd_relayout() can place the nodes of a BDD in the node
+ * table.  In depth-first order each node is followed by its left subtree
+ * and then by its right subtree, so that the nodes met on a walk from the
+ * root lie close together; in level order the nodes are placed by distance
+ * from the root, so that the upper levels, through which every walk
+ * passes, share a few cache lines.
+ */
+#define BDD_RELAYOUT_DFS 0
+#define BDD_RELAYOUT_LEVEL 1
+
+/**
+ * Renumber the nodes reachable from a BDD node, placing them at the start
+ * of the node table in a specified order, so that operations that walk the
+ * BDD from the root (such as bdd_apply() and bdd_to_raster()) touch fewer
+ * cache lines.  Children and the hash map are rewritten to match.  All
+ * other nodes are discarded, as by bdd_reset(), so that the BDD given is
+ * the only one left in the table: the roots of any other BDDs, and any
+ * BDD node pointers obtained previously, are invalidated.  Unlike
+ * bdd_reset(), the pool of tiles is kept, so that the BDD may be hybrid.
+ *
+ * @param node  A BDD node.
+ * @param order  BDD_RELAYOUT_DFS or BDD_RELAYOUT_LEVEL.
+ * @return  The BDD node representing the same function in the new layout,
+ * or NULL if any error occurs (in which case the table is unchanged).
+ */
+BDD_NODE *bdd_relayout(BDD_NODE *node, int order);
+
+/*
+ * Hybrid BDDs.  Below a chosen level, the nodes of noisy or textured images
+ * are nearly all distinct, each costing a node (and a hash probe) for as few
+ * as two pixels.  A hybrid BDD may instead represent such a block of pixels
+ * by a tile node: a node of the block's level whose children are both the
+ * same negative number -1-u, where u locates the pixels of the block, stored
+ * row by row, in a pool of tiles belonging to the manager.  The pool is
+ * allocated in units of BDD_TILE_UNIT bytes (an 8x8 block), and tiles with
+ * the same contents are stored once, so that, as for other nodes, equal
+ * blocks are the same node.
+ *
+ * Only the following accept hybrid BDDs: bdd_to_raster() and its variants,
+ * bdd_apply() and bdd_apply_ordered(), bdd_serialize() (which writes each
+ * tile as a record '#', its level and its pixels) and bdd_deserialize(),
+ * bdd_relayout(), bdd_node_count() and bdd_from_hybrid().  Other operations
+ * require the BDD to be converted back with bdd_from_hybrid().  Of these,
+ * bdd_map() and bdd_map_table(), bdd_combine(), bdd_dihedral() and
+ * bdd_rotate(), bdd_crop(), bdd_pad() and bdd_shift(), bdd_fill_rect() and
+ * bdd_set_pixel(), and bdd_diff() fail (returning NULL or -1) on reaching
+ * a tile node.
+ */
+#define BDD_TILE_UNIT 64
+#define BDD_TILE_UNITS_MAX (1<<18)  // 16 MB of tiles
+#define BDD_TILE_HASH_SIZE 524309   // a prime >= 2 * BDD_TILE_UNITS_MAX
+#define BDD_TILE_LEVEL_MIN 6        // 8x8 blocks in the default order
+#define BDD_TILE_LEVEL_MAX 8        // 16x16 blocks in the default order
+
+/**
+ * Convert a BDD into a hybrid BDD, choosing for each block of pixels at a
+ * specified level whether to keep its nodes or to store it as a tile:
+ * a block becomes a tile where the tile (BDD_NODE plus its pixels) takes
+ * fewer bytes than the distinct nodes below the block.  Blocks are
+ * shaped by the layout: in the default order a block at level 6 is 8x8,
+ * and one at level 8 is 16x16.
+ *
+ * @param node  A BDD node, which must not be hybrid.
+ * @param layout  The layout of the BDD.
+ * @param level  The level of the blocks, in [BDD_TILE_LEVEL_MIN,
+ * BDD_TILE_LEVEL_MAX].
+ * @return  The hybrid BDD node representing the same image, or NULL if any
+ * error occurs (including when the pool of tiles is full).
+ */
+BDD_NODE *bdd_to_hybrid(BDD_NODE *node, BDD_LAYOUT *layout, int level);
+
+/**
+ * Convert a hybrid BDD into an ordinary BDD, building the nodes for each
+ * of its tiles.
+ *
+ * @param node  A BDD node, which may be hybrid.
+ * @param layout  The layout of the BDD.
+ * @return  The BDD node representing the same image with no tiles, or NULL
+ * if any error occurs.
+ */
+BDD_NODE *bdd_from_hybrid(BDD_NODE *node, BDD_LAYOUT *layout);
+
+/**
+ * Compare two images held in the same node table and with the same layout.
+ * As nodes are unique, equal subimages are the same node, so the BDDs are
+ * only walked together where their nodes differ, and the cost depends on
+ * the differing structure rather than on the size of the images.  Pixels
+ * outside the w x h image are ignored.
+ *
+ * @param a  A BDD node.
+ * @param b  A BDD node.
+ * @param layout  The layout of both BDDs.
+ * @param w  The width of the images.
+ * @param h  The height of the images.
+ * @param rectsp  Receives an array, to be freed by the caller, of disjoint
+ * rectangles covering exactly the differing pixels, in which the
+ * rectangles of neighbouring blocks have been merged where they line up
+ * (NULL if there are none).
+ * @param countp  Receives the number of rectangles.
+ * @return  The number of differing pixels, or -1 if any error occurs.
+ */
+long long bdd_diff(BDD_NODE *a, BDD_NODE *b, BDD_LAYOUT *layout, int w, int h,
+                   BDD_RECT **rectsp, int *countp);
+
+/**
+ * Count the distinct non-leaf nodes reachable from a BDD node.
+ *
+ * @param node  A BDD node.
+ * @return  The number of non-leaf nodes in the BDD rooted at the node,
+ * or -1 if any error occurs.
+ */
+int bdd_node_count(BDD_NODE *node);
+
+/**
+ * Given a BDD node representing a 2^d x 2^d square array of values,
+ * compute a 256-bin histogram of the values in the sub-array having
+ * indices in [0, h) x [0, w) (i.e. the clip of the original image).
+ * Rather than visiting every pixel, this procedure only descends into
+ * quadrants that straddle the boundary of the clip rectangle.  Quadrants
+ * lying entirely inside the clip contribute their multiplicity to the node
+ * at their root, and these multiplicities are then pushed down to the leaves
+ * in a single pass over the distinct reachable nodes, so that the cost
+ * is proportional to the number of nodes rather than the number of pixels.
+ *
+ * @param node  A BDD node, representing a 2^d x 2^d square array of values.
+ * @param level  The level at which to interpret the node, which must be 2*d.
+ * @param w  The width (number of columns) of the clip rectangle.
+ * @param h  The height (number of rows) of the clip rectangle.
+ * @param hist  An array of BDD_NUM_LEAVES counters, into which the number
+ * of pixels having each value is stored.
+ * @return  0 if successful, -1 if any error occurs.
+ */
+int bdd_histogram(BDD_NODE *node, int level, int w, int h, unsigned long long *hist);
+
+/**
+ * Given a BDD node in a specified layout, compute the smallest rectangle
+ * containing every pixel within a specified clip rectangle whose value
+ * differs from a specified background value.
+ * Subtrees that lie outside the clip rectangle, or whose pixels all have
+ * the background value, are pruned; subtrees that lie entirely inside the
+ * clip rectangle use a bounding box memoized per node.
+ *
+ * @param node  A BDD node.
+ * @param layout  The layout of the BDD, which must have at least the levels
+ * of the node.
+ * @param clip  The rectangle within which to search.
+ * @param bg  The background value.
+ * @param box  Rectangle into which the bounding box is stored.
+ * @return  0 if some pixel in the clip rectangle differs from the background,
+ * -1 if there is no such pixel (i.e. the region is blank) or if any error
+ * occurs.
+ */
+int bdd_bbox(BDD_NODE *node, BDD_LAYOUT *layout, BDD_RECT *clip, unsigned char bg, BDD_RECT *box);
+
+/**
+ * Given a BDD node in a specified layout, find the first pixel in raster
+ * (i.e. row-major) order within a specified clip rectangle whose value
+ * satisfies a specified predicate.
+ *
+ * @param node  A BDD node.
+ * @param layout  The layout of the BDD, as for bdd_bbox().
+ * @param clip  The rectangle within which to search.
+ * @param pred  The predicate, which returns nonzero for matching values.
+ * @param rp  Pointer to a variable into which to store the row index.
+ * @param cp  Pointer to a variable into which to store the column index.
+ * @return  0 if a matching pixel was found, -1 if there is no matching pixel
+ * or if any error occurs.
+ */
+int bdd_find_first(BDD_NODE *node, BDD_LAYOUT *layout, BDD_RECT *clip, int (*pred)(unsigned char),
+                   int *rp, int *cp);
+
+/**
+ * Given a BDD node in a specified layout, compute the sum of the values of
+ * the pixels within a specified rectangle.
+ * Subtrees lying entirely inside the rectangle use a sum memoized per node,
+ * and leaves straddling its boundary contribute their value times the area
+ * of the overlap, so only nodes along the boundary of the rectangle are
+ * visited more than once.
+ *
+ * @param node  A BDD node.
+ * @param layout  The layout of the BDD, as for bdd_bbox().
+ * @param rect  The rectangle over which to sum.
+ * @return  The sum of the pixel values, or 0 if any error occurs.
+ */
+unsigned long long bdd_rect_sum(BDD_NODE *node, BDD_LAYOUT *layout, BDD_RECT *rect);
+
+/**
+ * Given a BDD node in a specified layout, count the pixels within a
+ * specified rectangle whose value differs from a specified background
+ * value, in the manner of bdd_rect_sum().
+ *
+ * @param node  A BDD node.
+ * @param layout  The layout of the BDD, as for bdd_bbox().
+ * @param rect  The rectangle over which to count.
+ * @param bg  The background value.
+ * @return  The number of non-background pixels, or 0 if any error occurs.
+ */
+unsigned long long bdd_rect_count(BDD_NODE *node, BDD_LAYOUT *layout, BDD_RECT *rect,
+                                  unsigned char bg);
+
+/**
+ * Given a BDD node in a specified layout, construct a new BDD node in
+ * a second layout, representing the sub-array having indices in a specified
+ * rectangle, moved so that the top-left corner of the rectangle is at the
+ * origin (the remainder of the array being filled with zeros).  Blocks of
+ * the result that coincide with blocks of the original, in the same
+ * position within the layouts, are shared rather than rebuilt, so for
+ * windows whose corners are aligned to a power of two the cost is roughly
+ * the length of the window boundary rather than its area.
+ *
+ * @param node  A BDD node.
+ * @param layout  The layout of the BDD, which must have at least the levels
+ * of the node.
+ * @param rect  The rectangle to be cut out.
+ * @param dlayout  The layout of the result, which must cover the rectangle
+ * (see bdd_layout_fit()).
+ * @return  A BDD node representing the cropped image in the layout dlayout,
+ * or NULL if any error occurs.
+ */
+BDD_NODE *bdd_crop(BDD_NODE *node, BDD_LAYOUT *layout, BDD_RECT *rect, BDD_LAYOUT *dlayout);
+
+/**
+ * Given a BDD node in a specified layout, construct a new BDD node in
+ * a second (possibly larger) layout, in which the sub-array having indices
+ * in [0, h) x [0, w) is placed with its top-left corner at a specified
+ * position, and all other entries have a specified fill value.  Blocks are
+ * shared with the original as for bdd_crop().
+ *
+ * @param node  A BDD node.
+ * @param layout  The layout of the BDD, as for bdd_crop().
+ * @param w  The width (number of columns) of the image.
+ * @param h  The height (number of rows) of the image.
+ * @param top  The row index at which to place the image.
+ * @param left  The column index at which to place the image.
+ * @param dlayout  The layout of the resulting canvas, which must be large
+ * enough to hold the placed image.
+ * @param fill  The value of the canvas outside the placed image.
+ * @return  The BDD node representing the padded image, or NULL if any
+ * error occurs.
+ */
+BDD_NODE *bdd_pad(BDD_NODE *node, BDD_LAYOUT *layout, int w, int h, int top, int left,
+                  BDD_LAYOUT *dlayout, unsigned char fill);
+
+/**
+ * Given a BDD node in a specified layout, construct a new BDD node in the
+ * same layout in which the image has been translated by dr rows and dc
+ * columns (either of which may be negative).  Pixels moved outside the
+ * array are discarded and vacated pixels are zero.  When dr and dc are
+ * multiples of 2^k, every block of at most 2^k rows and 2^k columns is
+ * shared with the original.
+ *
+ * @param node  A BDD node.
+ * @param layout  The layout of the BDD, as for bdd_crop().
+ * @param dr  The number of rows by which to move the image down.
+ * @param dc  The number of columns by which to move the image right.
+ * @return  The BDD node representing the translated image, or NULL if any
+ * error occurs.
+ */
+BDD_NODE *bdd_shift(BDD_NODE *node, BDD_LAYOUT *layout, int dr, int dc);
+
+/**
+ * Given a BDD node in a specified layout, construct a new BDD node in the
+ * same layout representing the same array with the entries in a specified
+ * rectangle set to a value.  Only the nodes of the blocks that straddle the
+ * edges of the rectangle are rebuilt, all others being shared with the
+ * original, so the cost is about the number of levels times the number of
+ * blocks on the boundary rather than the area.  As nodes are never
+ * modified, the original node remains valid, and keeping it costs only the
+ * nodes that differ.
+ *
+ * @param node  A BDD node, which must not be hybrid.
+ * @param layout  The layout of the BDD, which must have at least the levels
+ * of the node.
+ * @param rect  The rectangle to fill, which is clipped to the array.
+ * @param v  The value to which to set the entries.
+ * @return  The BDD node representing the modified array, or NULL if any
+ * error occurs.
+ */
+BDD_NODE *bdd_fill_rect(BDD_NODE *node, BDD_LAYOUT *layout, BDD_RECT *rect, unsigned char v);
+
+/**
+ * Given a BDD node in a specified layout, construct a new BDD node in the
+ * same layout representing the same array with one entry set to a value,
+ * rebuilding only the nodes on the path to that entry (see
+ * bdd_fill_rect()).
+ *
+ * @param node  A BDD node, which must not be hybrid.
+ * @param layout  The layout of the BDD, as for bdd_fill_rect().
+ * @param r  The row index of the entry.
+ * @param c  The column index of the entry.
+ * @param v  The value to which to set the entry.
+ * @return  The BDD node representing the modified array, or NULL if any
+ * error occurs (including when the entry lies outside the array).
+ */
+BDD_NODE *bdd_set_pixel(BDD_NODE *node, BDD_LAYOUT *layout, int r, int c, unsigned char v);
+
 #endif
@@ -10,7 +10,21 @@
 /**
  * Read a PGM image file from an input stream, construct a BDD
  * representation of the image data, and serialize the BDD representation
- * to an output stream.
+ * to an output stream.  Any transformations specified by the global options
+ * are applied as for birp_to_birp(); value transformations and symmetries
+ * of the square preceding the first zoom are fused into construction
+ * (see bdd_from_raster_mapped()).  If the input is a multi-image stream
+ * (several PGM images concatenated), each image is converted in turn and
+ * the BIRP images are written one after another, each but the last ended
+ * by BDD_FRAME_END (see bdd_serialize()).  The BDD is written in
+ * the variable order selected by the global options (see bdd.h); when the
+ * whole chain is fused, it is built directly in that order.  If a
+ * tolerance has been selected, the BDD is built lossily, with no pixel of
+ * the image as built differing by more than the tolerance from its exact
+ * value (see bdd_from_raster_lossy()); the greatest error incurred is
+ * reported with the statistics.  An image larger than 8192 pixels in
+ * either dimension is read and built in tiles (see bdd_from_raster_tiled()),
+ * and only its value transformations are fused into construction.
  *
  * @param in  Stream from which to read the PGM image data.
  * @param out  Stream to which to write the serialized BDD.
@@ -21,7 +35,9 @@ int pgm_to_birp(FILE *in, FILE *out);
 /**
  * Read a serialized BDD from an input stream, unpack the BDD into a
  * grayscale raster, and write the raster to an output stream in PGM
- * image format.
+ * image format.  An image too large for the raster is unpacked and
+ * written a band of rows at a time.  If the input is a multi-image stream,
+ * each image is converted in turn.
  *
  * @param in  Stream from which to read the serialized BDD.
  * @param out  Stream to which to write the PGM image.
@@ -29,10 +45,49 @@ int pgm_to_birp(FILE *in, FILE *out);
  */
 int birp_to_pgm(FILE *in, FILE *out);
 
+/**
+ * Read a colour image in PPM format from an input stream, construct a BDD
+ * for each of its channels, and write them to an output stream as a colour
+ * BIRP image (see img_write_birp_channels()).  The channels are built in one
+ * node table, so that a subimage common to several channels is a single
+ * subtree, which is stored once.  Transformations are applied as for
+ * birp_to_birp(), each channel in turn.  A lossy encoding, if selected,
+ * bounds the error of each channel as for pgm_to_birp().  If the input is a
+ * multi-image stream, each image is converted in turn.
+ *
+ * @param in  Stream from which to read the PPM image data.
+ * @param out  Stream to which to write the serialized BDDs.
+ * @return  0 if successful, -1 if any error occurs, as when the three
+ * channels of the image do not fit in the raster.
+ */
+int ppm_to_birp(FILE *in, FILE *out);
+
+/**
+ * Read a BIRP image from an input stream, unpack the BDDs of its channels
+ * into rasters, and write them to an output stream in PPM image format.  A
+ * grayscale image is written with its value in every channel.  If the
+ * input is a multi-image stream, each image is converted in turn.
+ *
+ * @param in  Stream from which to read the serialized BDDs.
+ * @param out  Stream to which to write the PPM image.
+ * @return  0 if successful, -1 if any error occurs, as when the three
+ * channels of the image do not fit in the raster.
+ */
+int birp_to_ppm(FILE *in, FILE *out);
+
 /**
  * Read a serialized BDD from an input stream, apply a transformation
  * to the BDD according to global options settings, and serialize the
- * resulting BDD to an output stream.
+ * resulting BDD to an output stream.  The output keeps the variable order
+ * recorded in the input, unless another order is selected by the global
+ * options.  Geometric transformations are applied in the default order, so
+ * a BDD in another order is converted before they are applied.
+ *
+ * A colour image is transformed channel by channel: the geometric
+ * transformations act on every channel, and the value transformations on
+ * the channels selected for them (see the -c option), the BDDs of the
+ * channels remaining in one node table.  If the input is a multi-image
+ * stream, each image is transformed in turn, as for pgm_to_birp().
  *
  * @param in  Stream from which to read serialized BDD input.
  * @param out  Stream to which to write serialized BDD output.
@@ -54,6 +109,8 @@ int birp_to_birp(FILE *in, FILE *out);
  *   128 - 191: '*'
  *   192 - 255: '@'
  *
+ * If the input is a multi-image stream, each image is printed in turn.
+ *
  * @param in  Stream from which to read the PGM image data.
  * @param out  Stream to which to write the ASCII art output
  * @return  0 if successful, -1 if any error occurs.
@@ -68,10 +125,84 @@ int pgm_to_ascii(FILE *in, FILE *out);
  * Each output character represents one pixel in the image as in the
  * specification for pgm_to_ascii().
  *
+ * If a target width has been set (see the -w option), each character
+ * instead represents the mean of a 2^k x 2^k block of pixels, for the least
+ * k giving at most that many columns, so that there may be fewer columns
+ * than the target width.  For BIRP input, the block means are
+ * read from the BDD (see bdd_to_raster_scaled()) without unpacking it at
+ * full resolution.  If the input is a multi-image stream, each image is
+ * printed in turn.
+ *
  * @param in  Stream from which to read the serialized BDD.
  * @param out  Stream to which to write the ASCII art output
  * @return  0 if successful, -1 if any error occurs.
  */
 int birp_to_ascii(FILE *in, FILE *out);
 
+/**
+ * Read a PGM image file from an input stream and print summary statistics
+ * of the pixel values to a specified output stream.  The output consists
+ * of lines of the form "key value", giving the width, height, number of
+ * pixels, minimum, maximum, mean and variance of the pixel values, followed
+ * by one line "bin v n" for each value v that occurs n > 0 times.
+ * If the input is a multi-image stream, statistics are printed for each
+ * image in turn.
+ *
+ * @param in  Stream from which to read the PGM image data.
+ * @param out  Stream to which to write the statistics.
+ * @return  0 if successful, -1 if any error occurs.
+ */
+int pgm_to_stats(FILE *in, FILE *out);
+
+/**
+ * Read a serialized BDD from an input stream and print summary statistics
+ * of the pixel values to a specified output stream, in the format described
+ * for pgm_to_stats().  The statistics are computed directly on the BDD
+ * (see bdd_histogram()), without unpacking it into a raster.  If the
+ * input is a multi-image stream, statistics are printed for each image in
+ * turn.
+ *
+ * @param in  Stream from which to read the serialized BDD.
+ * @param out  Stream to which to write the statistics.
+ * @return  0 if successful, -1 if any error occurs.
+ */
+int birp_to_stats(FILE *in, FILE *out);
+
+/**
+ * Compare the images of two BIRP files, reading both into the node table
+ * so that the comparison follows only the structure in which they differ
+ * (see bdd_diff()).  The report consists of lines of the form "key value":
+ * "identical yes" or "identical no", then the width and height, the number
+ * of differing pixels, and one line "rect r0 c0 r1 c1" for each rectangle,
+ * of the rows in [r0, r1) and the columns in [c0, c1), in which the images
+ * differ.  Images of different sizes differ, and for these the report
+ * gives both widths and both heights instead.  If the files hold
+ * multi-image streams, the first images are compared.
+ *
+ * @param file1  Path of the first BIRP file.
+ * @param file2  Path of the second BIRP file.
+ * @param out  Stream to which to write the report.
+ * @return  0 if the images are identical, 1 if they differ, and -1 if any
+ * error occurs.
+ */
+int birp_compare(char *file1, char *file2, FILE *out);
+
+/**
+ * Read one image from an input stream, in the input format selected by the
+ * global options, and write several outputs of it.  Each output is given
+ * by "--to PATH" followed by the options that would select its conversion
+ * from the input (output format, ASCII width, variable order, shape,
+ * hybrid tiles and transformations).  The BDD of the input is built or
+ * read once, and every output is produced from it in the one node table,
+ * so that nodes common to outputs are shared; a prefix of a chain of
+ * transformations already applied for an earlier output is not applied
+ * again.  The output files are written in turn.
+ *
+ * @param in  Stream from which to read the input image.
+ * @param argc  The number of arguments holding the output specifications.
+ * @param argv  The output specifications, starting with "--to".
+ * @return  0 if every output was written, -1 if any error occurs.
+ */
+int birp_fanout(FILE *in, int argc, char **argv);
+
 #endif
@@ -12,27 +12,177 @@
 
 #define USAGE(program_name, retcode) do { \
 fprintf(stderr, "USAGE: %s %s\n", program_name, \
-"[-h] [-i FORMAT] [-o FORMAT] [-n|-r|-t THRESHOLD|-z FACTOR|-Z FACTOR]\n" \
+"[-h] [--daemon SOCKET] [--compare BIRP1 BIRP2] [--batch INPUT OUTDIR [-j N]] [--stats] [--store PATH [--export]] [-i FORMAT] [-o FORMAT] [-w WIDTH] [-O ORDER] [-S SHAPE] [-q TOL] [-H SIZE] [-c CHANNELS|-n|-r|-R DEGREES|-f AXIS|-T|-A|-t THRESHOLD|-z FACTOR|-Z FACTOR]...\n" \
+"   or: [--stats] [-i FORMAT] --to PATH [OUTPUT-OPTIONS] [--to PATH [OUTPUT-OPTIONS]]...\n" \
 "   -h       Help: displays this help menu.\n" \
-"   -i       Input format: `pgm` or `birp` (default `birp`)\n" \
-"   -o       Output format: `pgm`, `birp`, or `ascii` (default `birp`)\n\n" \
+"   -i       Input format: `pgm`, `ppm` or `birp` (default `birp`)\n" \
+"   -o       Output format: `pgm`, `ppm`, `birp`, `ascii`, or `stats` (default\n" \
+"            `birp`); `ppm` input gives only colour `birp` output, holding the\n" \
+"            three channels in one BDD so that regions alike in several channels\n" \
+"            are stored once; `ppm` output is made only from `birp` input, and\n" \
+"            colour `birp` input is written only as `ppm` or `birp`\n" \
+"   -w       Width: with `-o ascii`, average 2^k x 2^k blocks of pixels into each\n" \
+"            character, for the least k giving at most WIDTH columns; as the\n" \
+"            scale is a power of two, there may be fewer (8 columns for a\n" \
+"            64-pixel-wide image at WIDTH 10)\n" \
+"   -O       Variable order of `birp` output: `rc` (default), `cr`, `rows`, `cols`,\n" \
+"            or `auto` to choose the smallest for a sample of the image\n" \
+"   -S       Shape of `birp` output: `square` pads the image to a power-of-two\n" \
+"            square (default), `rect` uses separate row and column levels, and\n" \
+"            transformations then keep the image at its own size\n" \
+"   -q       Lossy encoding of `pgm` or `ppm` input as `birp`: each pixel may\n" \
+"            differ by up to TOL (in [0, 255]) from its value, so that noise can\n" \
+"            be merged\n" \
+"   -H       Hybrid `birp` output: store each SIZE x SIZE block of pixels (SIZE\n" \
+"            8 or 16) as a tile of raw pixels where that is smaller than its\n" \
+"            nodes, as for noisy regions\n" \
+"   --stats  Report counters and per-phase timings as JSON on the standard error\n" \
+"   --store  Write `birp` output as thin files, holding only a reference into the\n" \
+"            node store PATH (created if need be), which receives the nodes not\n" \
+"            already there, and read thin `birp` input through it\n" \
+"   --export With --store, write `birp` output in full, so that it no longer\n" \
+"            needs the store: the way to turn a thin file into a self-contained one\n" \
+"   --daemon Serve conversions on the Unix socket SOCKET, taking the other options\n" \
+"            with each request (must be the only option)\n" \
+"   --compare Compare the images of two grayscale BIRP files, listing the\n" \
+"            rectangles in which they differ; exits with 0 if they are identical,\n" \
+"            1 if they differ, and 2 on error (must be the only option)\n" \
+"   --batch  Convert each file of INPUT (a directory, or a file listing paths)\n" \
+"            into OUTDIR with the other options, reporting throughput as JSON on\n" \
+"            the standard error (must be the first option)\n" \
+"   -j       Number of conversions run in parallel by --batch (default: one per\n" \
+"            processor)\n" \
+"   --to     Fan-out: read the input once and write each output to its PATH, with\n" \
+"            the options that follow it (-o, -w, -O, -S, -H and transformations);\n" \
+"            the BDD is built once and steps common to outputs are shared\n" \
+"            (`pgm` or grayscale `birp` input only)\n\n" \
 "In all cases, the program reads image data from the standard input and writes\n" \
-"image data to the standard output.  If the input and output formats are both `birp`,\n" \
-"then one of the following transformations may be specified (the default is an\n" \
-"identity transformation; *i.e.* the image is passed unchanged):\n" \
+"image data to the standard output.  If the output format is `birp`,\n" \
+"then any sequence of the following transformations may be specified, to be applied\n" \
+"in the order given (the default is an identity transformation; *i.e.* the image\n" \
+"is passed unchanged):\n" \
 "   -n\tComplement each pixel value\n" \
 "   -r\tRotate the image 90-degrees counterclockwise\n" \
+"   -R\tRotate the image counterclockwise (by DEGREES in {90, 180, 270})\n" \
+"   -f\tFlip the image (AXIS `h` mirrors left-to-right, `v` top-to-bottom)\n" \
+"   -T\tTranspose the image (reflect across the main diagonal)\n" \
+"   -A\tAnti-transpose the image (reflect across the other diagonal)\n" \
 "   -t\tApply a threshold filter (with THRESHOLD in [0, 255]) to the image\n" \
+"   -c\tApply the following -n and -t to the colour CHANNELS only (any of `r`,\n" \
+"     \t`g` and `b`, as in `-c rg`); other transformations act on every channel\n" \
 "   -z\tZoom out (by FACTOR in [0, 16]), producing a smaller raster\n" \
 "   -Z\tZoom in, (by FACTOR in [0, 16]), producing a larger raster\n" \
 ); \
 exit(retcode); \
 } while(0)
 
-/* Options info, set by validargs. */
+/*
+ * Options info, set by validargs.  The options, like the other variables set
+ * by validargs, are kept per thread, so that requests with different options
+ * can be converted at once (see daemon.h); a thread starts out with none, and
+ * may take over those of another with options_save() and options_restore().
+ */
 #define HELP_OPTION (0x80000000)
 
-int global_options;  // Bitmap specifying mode of program operation.
+extern __thread int global_options;  // Bitmap specifying mode of program operation.
+
+/*
+ * Ordered chain of transformations, set by validargs.  Each step holds a
+ * transformation code and its parameter, encoded as in bits 8-11 and 16-23
+ * of global_options (which also records the first step of the chain).
+ */
+typedef struct tform_step {
+    int tform;
+    int param;
+    int channels;   // mask of the colour channels of a value transformation
+                    // (1 red, 2 green, 4 blue), or 0 for all of them
+} TFORM_STEP;
+
+extern __thread TFORM_STEP *tform_chain;
+extern __thread int tform_count;
+
+/*
+ * Colour channels to which value transformations are restricted, set by
+ * validargs, as for TFORM_STEP (0 for all channels).
+ */
+extern __thread int tform_channels;
+
+/* Target width of ASCII art output, set by validargs (0 for full size). */
+extern __thread int ascii_width;
+
+/*
+ * Variable order of BIRP output, set by validargs: one of the BDD_ORDER_*
+ * values of bdd.h, ORDER_KEEP to keep the order of BIRP input (the default
+ * order for PGM input), or ORDER_AUTO to choose one for each image.
+ */
+#define ORDER_KEEP (-1)
+#define ORDER_AUTO (-2)
+extern __thread int birp_order;
+
+/*
+ * Shape of BIRP output, set by validargs: 0 for square, 1 for rectangular
+ * (see BDD_LAYOUT in bdd.h), or SHAPE_KEEP to keep the shape of BIRP input
+ * (square for PGM input).
+ */
+#define SHAPE_KEEP (-1)
+extern __thread int birp_shape;
+
+/*
+ * Greatest per-pixel error permitted when encoding PGM input as BIRP, set
+ * by validargs (0 for exact encoding).
+ */
+extern __thread int birp_tolerance;
+
+/*
+ * Level of the tiles of hybrid BIRP output, set by validargs (0 for
+ * ordinary output; see bdd_to_hybrid() in bdd.h).
+ */
+extern __thread int birp_hybrid;
+
+/* Paths of the BIRP files to compare, set by validargs (NULL if none). */
+extern __thread char *compare_first;
+extern __thread char *compare_second;
+
+/*
+ * Output specifications of a fan-out, set by validargs: the arguments from
+ * the first "--to" on (NULL if none).
+ */
+extern __thread char **fanout_argv;
+extern __thread int fanout_argc;
+
+/*
+ * The options of a thread that select a conversion (see options_save()).
+ */
+typedef struct birp_options {
+    int global_options;
+    TFORM_STEP *tform_chain;
+    int tform_count;
+    int tform_channels;
+    int ascii_width;
+    int order;
+    int shape;
+    int tolerance;
+    int hybrid;
+    char *store_path;
+    int store_export;
+    int stats_enabled;
+} BIRP_OPTIONS;
+
+/**
+ * Copy the options of the calling thread that select a conversion, so that
+ * other threads can make the same conversion.  The chain of transformations
+ * is shared, and still belongs to the calling thread.
+ *
+ * @param opts  Receives the options.
+ */
+void options_save(BIRP_OPTIONS *opts);
+
+/**
+ * Give the calling thread options saved by options_save().
+ *
+ * @param opts  The options.
+ */
+void options_restore(BIRP_OPTIONS *opts);
 
 /*
  * The following global variables have been provided for you.
@@ -44,8 +194,22 @@ int global_options;  // Bitmap specifying mode of program operation.
 
 /* Space for a 64-megapixel 8-bit grayscale image. */
 #define RASTER_SIZE_MAX (8192 * 8192 * sizeof(unsigned char))
+
+/*
+ * Greatest side of a PGM image that is read into the raster in one piece;
+ * larger images are read and built in bands of square tiles of at most this
+ * size (see bdd_from_raster_tiled()).
+ */
+#define TILE_MAX 8192
 unsigned char raster_data[RASTER_SIZE_MAX];
 
+/*
+ * The raster used by conversions in the calling thread, of RASTER_SIZE_MAX
+ * bytes: raster_data, unless the thread has been given one of its own so
+ * that conversions can run in several threads at once (see batch.h).
+ */
+extern __thread unsigned char *birp_raster;
+
 /* See bdd.h for more information about these arrays. */
 extern BDD_NODE bdd_nodes[BDD_NODES_MAX];
 extern BDD_NODE *bdd_hash_map[BDD_HASH_SIZE];
@@ -65,12 +229,19 @@ extern int bdd_index_map[BDD_NODES_MAX];
 /* See birp.c for the specification of the following function. */
 int validargs(int argc, char **argv);
 
+/* See birp.c for the specification of the following function. */
+int convert(FILE *in, FILE *out);
+
 /* See birp.h for specifications of the following functions. */
 int pgm_to_birp(FILE *in, FILE *out);
 int birp_to_pgm(FILE *in, FILE *out);
+int ppm_to_birp(FILE *in, FILE *out);
+int birp_to_ppm(FILE *in, FILE *out);
 int birp_to_birp(FILE *in, FILE *out);
 int pgm_to_ascii(FILE *in, FILE *out);
 int birp_to_ascii(FILE *in, FILE *out);
+int pgm_to_stats(FILE *in, FILE *out);
+int birp_to_stats(FILE *in, FILE *out);
 
 /* See bdd.h for specifications of the following functions. */
 BDD_NODE *bdd_from_raster(int w, int h, unsigned char *raster);
@@ -0,0 +1,57 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+/*
+ * Conversion daemon.  Rather than starting a process for each image, a
+ * client connects to a Unix domain socket and sends:
+ *
+ *   - a request line, of at most DAEMON_LINE_MAX bytes, holding the options
+ *     that would be given to the program (as parsed by validargs), separated
+ *     by single spaces and terminated by a newline;
+ *   - the input image data, after which it shuts down its side of the
+ *     connection for writing.
+ *
+ * The daemon replies with a line "STATUS OUTLEN ERRLEN", where STATUS is
+ * the exit status the program would have had, followed by OUTLEN bytes of
+ * output image data and ERRLEN bytes of diagnostics (the --stats report,
+ * if requested), and then closes the connection.
+ *
+ * The options may not select a mode other than a single conversion of the
+ * data sent (--daemon, --to, --batch or --compare), nor name files of the
+ * daemon (--store).  A request of more than DAEMON_REQUEST_MAX bytes is
+ * refused by closing the connection.
+ *
+ * Connections are handled by a single epoll event loop, so that any number
+ * of clients can be sending input or receiving output at once, and the
+ * loop does nothing but this I/O: each request whose input is complete is
+ * handed to a pool of worker threads, one per online processor, and the
+ * reply is sent by the loop once a worker has served it.  Each worker has
+ * its own BDD manager and raster, as for batch conversion (see batch.h),
+ * whose node table and hash map stay allocated and warm from one request
+ * to the next, and are only emptied (see bdd_reset()) between them.
+ */
+
+/* Longest request line accepted. */
+#define DAEMON_LINE_MAX 4096
+
+/* Longest request accepted, request line and input image together. */
+#define DAEMON_REQUEST_MAX ((size_t)256 << 20)
+
+/* Most events taken from the event loop at a time. */
+#define DAEMON_EVENTS 64
+
+/* Path of the socket on which to serve, set by validargs (NULL if none). */
+extern __thread char *daemon_socket;
+
+/**
+ * Serve conversion requests on a Unix domain socket until the process is
+ * interrupted (SIGINT or SIGTERM), after which the socket is removed.
+ *
+ * @param path  The path at which to create the socket.  Any file already
+ * there is replaced.
+ * @return  0 if the daemon stopped normally, -1 if the socket could not
+ * be set up.
+ */
+int birp_daemon(char *path);
+
+#endif
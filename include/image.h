@@ -23,7 +23,8 @@
  * @param return  0 if the image was read successfully; -1 if any error
  * occurred.  Examples of errors are formatting errors in the PGM file,
  * I/O errors in reading the PGM file, and insufficient size of the raster
- * array to hold the image data.
+ * array to hold the image data.  On success, the stream is left positioned
+ * immediately after the raster data.
  */
 int img_read_pgm(FILE *in, int *wp, int *hp, unsigned char *raster, size_t size);
 
@@ -39,6 +40,105 @@ int img_read_pgm(FILE *in, int *wp, int *hp, unsigned char *raster, size_t size)
  */
 int img_write_pgm(unsigned char *raster, int w, int h, FILE *out);
 
+/**
+ * Read the header of an image in PGM format from an input stream, storing
+ * the width and height of the raster using the "wp" and "hp" pointers,
+ * and leaving the stream positioned at the start of the raster data, so
+ * that an image too large to be held in memory can be read in bands with
+ * img_read_pgm_rows().
+ *
+ * @param in  The stream from which to read PGM input.
+ * @param wp  Pointer to a variable into which to store the raster width.
+ * @param hp  Pointer to a variable into which to store the raster height.
+ * @return  0 if the header was read successfully; -1 if any error occurred.
+ */
+int img_read_pgm_header(FILE *in, int *wp, int *hp);
+
+/**
+ * Read the next rows of the raster of a PGM image whose header has been
+ * read by img_read_pgm_header().
+ *
+ * @param in  The stream from which to read PGM input.
+ * @param w  Width of the image raster.
+ * @param rows  The number of rows to read.
+ * @param raster  Pointer to an array of at least w x rows entries into
+ * which to store the rows, in row-major order.
+ * @return  0 if the rows were read successfully; -1 if any error occurred.
+ */
+int img_read_pgm_rows(FILE *in, int w, int rows, unsigned char *raster);
+
+/**
+ * Write the header of an image in PGM format to an output stream, to be
+ * followed by the raster data written with img_write_pgm_rows().  The
+ * stream is not flushed.
+ *
+ * @param w  Width of the image raster.
+ * @param h  Height of the image raster.
+ * @param out  Stream to which to write the PGM header.
+ * @return  0 if successful, -1 if any error occurs.
+ */
+int img_write_pgm_header(int w, int h, FILE *out);
+
+/**
+ * Write rows of the raster of a PGM image whose header has been written by
+ * img_write_pgm_header().  The stream is not flushed.
+ *
+ * @param raster  Pointer to an array that holds the rows, stored in
+ * row-major order.
+ * @param w  Width of the image raster.
+ * @param rows  The number of rows to write.
+ * @param out  Stream to which to write the PGM data.
+ * @return  0 if successful, -1 if any error occurs.
+ */
+int img_write_pgm_rows(unsigned char *raster, int w, int rows, FILE *out);
+
+/*
+ * Number of channels of a colour image: red, green and blue, in that order.
+ */
+#define IMG_CHANNELS 3
+
+/**
+ * Read a colour image in PPM format (magic "P6") from an input stream,
+ * storing the width and height of the raster using the "wp" and "hp"
+ * pointers, and storing the raster data in the array "raster" as one plane
+ * of w x h entries per channel, in row-major order: the red plane, then the
+ * green plane, then the blue plane.
+ *
+ * @param in  The stream from which to read PPM input.
+ * @param wp  Pointer to a variable into which to store the raster width.
+ * @param hp  Pointer to a variable into which to store the raster height.
+ * @param raster  Pointer to an array into which to store the image data.
+ * @param size  Size (in bytes) of the raster array, which must hold all
+ * three planes.
+ * @return  0 if the image was read successfully; -1 if any error occurred.
+ * On success, the stream is left positioned immediately after the raster
+ * data.
+ */
+int img_read_ppm(FILE *in, int *wp, int *hp, unsigned char *raster, size_t size);
+
+/**
+ * Write a colour image to an output stream in PPM format.  The stream is
+ * flushed (but not closed) after the image has been written.
+ *
+ * @param raster  Pointer to an array that holds the image data, as three
+ * planes in the form read by img_read_ppm().
+ * @param w  Width of the image raster.
+ * @param h  Height of the image raster.
+ * @param out  Stream to which to write the PPM data.
+ * @return  0 if successful, -1 if any error occurs.
+ */
+int img_write_ppm(unsigned char *raster, int w, int h, FILE *out);
+
+/**
+ * Determine whether another image follows in an input stream, as is the
+ * case for multi-image PGM streams (several PGM images concatenated).
+ * Whitespace before the next image is skipped.
+ *
+ * @param in  The stream from which images are being read.
+ * @return  1 if the stream has further data, 0 if it is at end of file.
+ */
+int img_more(FILE *in);
+
 /**
  * Read an image in BIRP format from an input stream, storing the width
  * and height of the raster using the "wp" and "hp" pointers passed
@@ -49,12 +149,50 @@ int img_write_pgm(unsigned char *raster, int w, int h, FILE *out);
  * @param hp  Pointer to a variable into which to store the raster height.
  * @param return  A pointer to the root node of the BDD that represents
  * the image raster, if the image was read successfully; NULL if any error
- * occurred.  Examples of errors are formatting errors in the BIRP file,
- * I/O errors in reading the BIRP file, and the BDD nodes table having
+ * occurred.  If the header records a layout other than the default one
+ * (see img_write_birp_layout()), the BDD is converted to the default layout.
+ * Examples of errors are formatting errors in the BIRP file, I/O errors
+ * in reading the BIRP file, and the BDD nodes table having
  * insufficient size for the deserialized BDD.
  */
 BDD_NODE *img_read_birp(FILE *in, int *wp, int *hp);
 
+/**
+ * Read an image in BIRP format from an input stream, as img_read_birp(),
+ * but return the BDD in the layout recorded in the header, rather than
+ * converting it to the default layout.
+ *
+ * @param in  The stream from which to read BIRP input.
+ * @param wp  Pointer to a variable into which to store the raster width.
+ * @param hp  Pointer to a variable into which to store the raster height.
+ * @param layout  Pointer to a variable into which to store the layout of
+ * the BDD (square, with order BDD_ORDER_RC, if the header does not record
+ * one).
+ * @param return  A pointer to the root node of the BDD, or NULL if any
+ * error occurred.
+ */
+BDD_NODE *img_read_birp_layout(FILE *in, int *wp, int *hp, BDD_LAYOUT *layout);
+
+/**
+ * Read an image in BIRP format from an input stream, as
+ * img_read_birp_layout(), whether it is a grayscale image or a colour one.
+ * A colour BIRP file has the magic "B6" in place of "B5", and holds the
+ * BDDs of its channels serialized together (see bdd_serialize_roots()), in
+ * one layout, so that subimages common to several channels are stored once.
+ *
+ * @param in  The stream from which to read BIRP input.
+ * @param wp  Pointer to a variable into which to store the raster width.
+ * @param hp  Pointer to a variable into which to store the raster height.
+ * @param layout  Pointer to a variable into which to store the layout of
+ * the BDDs.
+ * @param roots  Pointer to an array of IMG_CHANNELS entries, into which to
+ * store the root of the BDD of each channel (only the first, for a
+ * grayscale image).
+ * @return  The number of channels, 1 or IMG_CHANNELS, if the image was
+ * read successfully; -1 if any error occurred.
+ */
+int img_read_birp_channels(FILE *in, int *wp, int *hp, BDD_LAYOUT *layout, BDD_NODE **roots);
+
 /**
  * Write an image to an output stream in BIRP format.  The stream
  * is flushed (but not closed) after the image has been written.
@@ -67,4 +205,40 @@ BDD_NODE *img_read_birp(FILE *in, int *wp, int *hp);
  */
 int img_write_birp(BDD_NODE *node, int w, int h, FILE *out);
 
+/**
+ * Write an image to an output stream in BIRP format, recording in the
+ * header the layout of the BDD.  The layout is given by a comment line
+ * following the magic number, with properties "order NAME" (see
+ * bdd_order_name()) and "shape rect", each of which is omitted when it has
+ * the default value (BDD_ORDER_RC and a square layout, respectively).
+ * The numbers of row and column variables are not recorded, as they are
+ * determined by the width and height of the image.
+ *
+ * @param node  Pointer to the root node of the BDD that holds the
+ * image data.
+ * @param w  Width of the image raster.
+ * @param h  Height of the image raster.
+ * @param layout  The layout of the BDD.
+ * @param out  Stream to which to write the BIRP data.
+ */
+int img_write_birp_layout(BDD_NODE *node, int w, int h, BDD_LAYOUT *layout, FILE *out);
+
+/**
+ * Write an image to an output stream in BIRP format, as
+ * img_write_birp_layout(), but with any number of channels: a single
+ * channel is written as a grayscale image, and IMG_CHANNELS channels as a
+ * colour image (see img_read_birp_channels()).
+ *
+ * @param roots  Pointer to an array of the roots of the BDDs that hold the
+ * channels, all in the same layout.
+ * @param n  The number of channels, 1 or IMG_CHANNELS.
+ * @param w  Width of the image raster.
+ * @param h  Height of the image raster.
+ * @param layout  The layout of the BDDs.
+ * @param out  Stream to which to write the BIRP data.
+ * @return  0 if successful, -1 if any error occurs.
+ */
+int img_write_birp_channels(BDD_NODE **roots, int n, int w, int h, BDD_LAYOUT *layout,
+                            FILE *out);
+
 #endif
@@ -0,0 +1,77 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+/*
+ * Wall-clock time accumulated in one phase of a conversion.
+ */
+typedef struct stats_phase {
+    double ns;      // total time spent in the phase
+    double start;   // time at which the phase was last entered
+} STATS_PHASE;
+
+/*
+ * Counters describing the work done by the BDD operations.  The counters
+ * are plain integer increments in the places where the work is done, and
+ * so cost next to nothing; those of node lookups, which are made for every
+ * node visited by every build, and phase timing, which reads the clock,
+ * are kept only when statistics have been requested.
+ */
+typedef struct bdd_stats {
+    long long lookups;          // calls to bdd_lookup
+    long long collapsed;        // lookups with equal children (no node needed)
+    long long created;          // lookups that inserted a new node
+    long long reused;           // lookups that found an existing node
+    long long probes;           // hash map slots examined by lookups
+    long long probe_max;        // most slots examined by a single lookup
+    long long cache_hits;       // memoized results reused by BDD operations
+    long long cache_misses;     // memoized results computed by BDD operations
+    int depth_max;              // greatest recursion depth (BDD level) reached
+    long long bytes_in;         // image payload bytes read
+    long long bytes_out;        // image payload bytes written
+    int error_max;              // greatest per-pixel error of a lossy encode
+    STATS_PHASE read;           // reading and parsing the input image
+    STATS_PHASE build;          // constructing a BDD from a raster
+    STATS_PHASE transform;      // applying transformations to a BDD
+    STATS_PHASE serialize;      // writing a BDD as BIRP
+    STATS_PHASE decode;         // unpacking a BDD into a raster
+    STATS_PHASE write;          // writing PGM, ASCII or statistics output
+} BDD_STATS;
+
+/* The counters of the calling thread, so that concurrent conversions do not share them. */
+extern __thread BDD_STATS bdd_stats;
+
+/* Nonzero if statistics are to be reported (set by the --stats option). */
+extern __thread int stats_enabled;
+
+#define STATS_DEPTH(l) do { \
+    if ((l) > bdd_stats.depth_max) \
+        bdd_stats.depth_max = (l); \
+} while(0)
+
+/**
+ * Mark the start of a phase.  Has no effect unless statistics are enabled.
+ *
+ * @param phase  The phase, one of the STATS_PHASE members of bdd_stats.
+ */
+void stats_begin(STATS_PHASE *phase);
+
+/**
+ * Mark the end of a phase, adding the time elapsed since the matching
+ * stats_begin() to the total for that phase.
+ *
+ * @param phase  The phase, one of the STATS_PHASE members of bdd_stats.
+ */
+void stats_end(STATS_PHASE *phase);
+
+/**
+ * Write a summary of the statistics, as a single JSON object, to a stream.
+ * In addition to the counters, the summary reports the occupancy of the
+ * node table and of the hash map, and the peak resident set size.
+ *
+ * @param out  Stream to which to write the summary.
+ */
+void stats_report(FILE *out);
+
+#endif
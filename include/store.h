@@ -0,0 +1,95 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include "bdd.h"
+
+/*
+ * Content-addressed node store.  A store is a file of node records shared
+ * by any number of BIRP files, each record being keyed by a Merkle hash of
+ * its level and the hashes of its children (the hash of a leaf is its
+ * value), so that a node has the same key in every image that contains it,
+ * and an identical subimage is stored once however many images share it.
+ *
+ * The file holds BDD_STORE_MAGIC followed by records of BDD_STORE_RECORD
+ * bytes: the hash, the level and the hashes of the left and right children,
+ * hashes being 8 bytes, little-endian.  Records are only ever appended, the
+ * file being locked while they are written, so that several processes (or
+ * threads, each with its own handle) may add to a store at once; a node
+ * added by two of them at the same time is merely recorded twice.
+ *
+ * The records present when the store is opened are mapped into memory and
+ * indexed by hash; nodes built from them are cached per manager, so that
+ * subtrees shared by the images read through one handle are built once.
+ *
+ * While a store is attached to the current manager (see bdd_store_use()),
+ * bdd_serialize() writes a "thin" BDD: the nodes are added to the store and
+ * the output holds only the root, as a record '$' followed by its hash, and
+ * bdd_deserialize() resolves such records through the store.  A thin BDD
+ * read through the store and serialized with the store detached is written
+ * in full, and no longer needs the store.
+ */
+
+#define BDD_STORE_MAGIC "BIRPSTO1"
+#define BDD_STORE_MAGIC_LEN 8
+#define BDD_STORE_RECORD 25
+
+/* Slots in the index of a new store (a power of two). */
+#define BDD_STORE_INDEX_MIN 4096
+
+typedef struct bdd_store BDD_STORE;
+
+/* Path of the store to use for BIRP input and output, set by validargs. */
+extern __thread char *store_path;
+
+/*
+ * Whether BIRP output is written in full rather than thin although a store
+ * is in use, set by validargs.
+ */
+extern __thread int store_export;
+
+/**
+ * Open a store, creating an empty one if the file does not exist.
+ *
+ * @param path  The path of the store.
+ * @return  The store, or NULL if the file could not be opened or is not a
+ * store.
+ */
+BDD_STORE *bdd_store_open(const char *path);
+
+/**
+ * Close a store, releasing its mapping, index and cache.
+ *
+ * @param store  The store, or NULL.
+ */
+void bdd_store_close(BDD_STORE *store);
+
+/**
+ * Attach a store to the manager in use by the calling thread, so that BDDs
+ * are serialized thin and thin BDDs can be deserialized.
+ *
+ * @param store  The store to attach, or NULL to detach any store.
+ * @return  The store previously attached.
+ */
+BDD_STORE *bdd_store_use(BDD_STORE *store);
+
+/**
+ * Add the nodes of a BDD to a store, writing only those not already there.
+ *
+ * @param store  The store.
+ * @param node  A BDD node, which must not be hybrid.
+ * @param hashp  Set to the hash of the node.
+ * @return  The number of nodes written, or -1 if any error occurs.
+ */
+long bdd_store_put(BDD_STORE *store, BDD_NODE *node, unsigned long long *hashp);
+
+/**
+ * Build the BDD with a given hash from a store, in the current manager.
+ *
+ * @param store  The store.
+ * @param hash  The hash of the BDD.
+ * @return  The BDD node, or NULL if the store lacks the node or one of its
+ * descendants, or if any other error occurs.
+ */
+BDD_NODE *bdd_store_get(BDD_STORE *store, unsigned long long hash);
+
+#endif
@@ -0,0 +1,531 @@
+/*
+ * Batch conversion: a reader thread, a pool of worker threads and a writer
+ * joined by bounded queues (see batch.h).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "bdd.h"
+#include "const.h"
+#include "debug.h"
+#include "stats.h"
+
+__thread char *batch_input = NULL;
+__thread char *batch_output = NULL;
+__thread int batch_jobs = 0;
+
+/*
+ * One file on its way through the pipeline.  The data are the contents of
+ * the input file until the file has been converted, and the output after.
+ */
+typedef struct batch_job {
+    char *path;         // path of the input file
+    char *name;         // last component of the path
+    char *data;
+    size_t len;
+    size_t inlen;       // size of the input file
+    int status;         // exit status of the conversion
+} BATCH_JOB;
+
+/*
+ * Bounded queue of jobs.  The queue is open while any of its producers
+ * has yet to finish; a consumer finding it empty and closed is done.
+ */
+typedef struct batch_queue {
+    BATCH_JOB **items;
+    int cap;
+    int head;
+    int count;
+    int producers;
+    pthread_mutex_t lock;
+    pthread_cond_t nonempty;
+    pthread_cond_t nonfull;
+} BATCH_QUEUE;
+
+typedef struct batch_state {
+    BATCH_QUEUE in;     // files read, awaiting conversion
+    BATCH_QUEUE out;    // files converted, awaiting writing
+    char *input;
+    BIRP_OPTIONS options;   // options of the calling thread, for the workers
+    int stop;           // set, under the lock of the input queue, to abandon
+                        // the batch: files are no longer read or converted
+} BATCH_STATE;
+
+/*
+ * Set of the paths of the output files written so far, so that two inputs
+ * with the same name up to the extension are not written to the same file.
+ * Open addressing, with the table doubled when it becomes half full.
+ */
+typedef struct batch_names {
+    char **slots;
+    size_t cap;
+    size_t count;
+} BATCH_NAMES;
+
+static int queue_init(BATCH_QUEUE *q, int cap, int producers) {
+    q->items = malloc(cap * sizeof(BATCH_JOB *));
+    q->cap = cap;
+    q->head = 0;
+    q->count = 0;
+    q->producers = producers;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->nonempty, NULL);
+    pthread_cond_init(&q->nonfull, NULL);
+    return q->items == NULL ? -1 : 0;
+}
+
+static void queue_fini(BATCH_QUEUE *q) {
+    free(q->items);
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->nonempty);
+    pthread_cond_destroy(&q->nonfull);
+}
+
+static void queue_put(BATCH_QUEUE *q, BATCH_JOB *job) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->cap) {
+        pthread_cond_wait(&q->nonfull, &q->lock);
+    }
+    *(q->items + (q->head + q->count) % q->cap) = job;
+    q->count++;
+    pthread_cond_signal(&q->nonempty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static BATCH_JOB *queue_get(BATCH_QUEUE *q) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && q->producers > 0) {
+        pthread_cond_wait(&q->nonempty, &q->lock);
+    }
+    BATCH_JOB *job = NULL;
+    if (q->count > 0) {
+        job = *(q->items + q->head);
+        q->head = (q->head + 1) % q->cap;
+        q->count--;
+        pthread_cond_signal(&q->nonfull);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return job;
+}
+
+static void queue_done(BATCH_QUEUE *q) {
+    pthread_mutex_lock(&q->lock);
+    q->producers--;
+    pthread_cond_broadcast(&q->nonempty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static char *batch_strdup(const char *s) {
+    size_t n = 0;
+    while (*(s + n) != '\0') {
+        n++;
+    }
+    char *t = malloc(n + 1);
+    if (t != NULL) {
+        for (size_t i = 0; i <= n; i++) {
+            *(t + i) = *(s + i);
+        }
+    }
+    return t;
+}
+
+static int batch_stopped(BATCH_STATE *state) {
+    pthread_mutex_lock(&state->in.lock);
+    int stop = state->stop;
+    pthread_mutex_unlock(&state->in.lock);
+    return stop;
+}
+
+static size_t names_hash(const char *s) {
+    size_t h = 14695981039346656037ULL;
+    for (; *s != '\0'; s++) {
+        h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static int names_equal(const char *s, const char *t) {
+    while (*s != '\0' && *s == *t) {
+        s++;
+        t++;
+    }
+    return *s == *t;
+}
+
+/*
+ * Add a path to the set, which takes it over.  Returns 1 if it was added,
+ * 0 if it was there already (in which case it is not taken), and -1 if
+ * memory could not be allocated.
+ */
+static int names_add(BATCH_NAMES *names, char *path) {
+    if (2 * (names->count + 1) > names->cap) {
+        size_t cap = names->cap ? 2 * names->cap : 64;
+        char **slots = calloc(cap, sizeof(char *));
+        if (slots == NULL) {
+            return -1;
+        }
+        for (size_t i = 0; i < names->cap; i++) {
+            char *p = *(names->slots + i);
+            if (p != NULL) {
+                size_t j = names_hash(p) % cap;
+                while (*(slots + j) != NULL) {
+                    j = (j + 1) % cap;
+                }
+                *(slots + j) = p;
+            }
+        }
+        free(names->slots);
+        names->slots = slots;
+        names->cap = cap;
+    }
+    size_t j = names_hash(path) % names->cap;
+    while (*(names->slots + j) != NULL) {
+        if (names_equal(*(names->slots + j), path)) {
+            return 0;
+        }
+        j = (j + 1) % names->cap;
+    }
+    *(names->slots + j) = path;
+    names->count++;
+    return 1;
+}
+
+static void names_free(BATCH_NAMES *names) {
+    for (size_t i = 0; i < names->cap; i++) {
+        free(*(names->slots + i));
+    }
+    free(names->slots);
+}
+
+static void batch_free(BATCH_JOB *job) {
+    free(job->path);
+    free(job->data);
+    free(job);
+}
+
+/*
+ * Read a whole file into a new job.  A file that cannot be read still
+ * gives a job, with no data, so that its failure is reported in order.
+ */
+static BATCH_JOB *batch_load(const char *path) {
+    BATCH_JOB *job = calloc(1, sizeof(BATCH_JOB));
+    if (job == NULL || (job->path = batch_strdup(path)) == NULL) {
+        free(job);
+        return NULL;
+    }
+    job->name = job->path;
+    for (char *p = job->path; *p != '\0'; p++) {
+        if (*p == '/') {
+            job->name = p + 1;
+        }
+    }
+    job->status = EXIT_FAILURE;
+    FILE *f = fopen(path, "r");
+    struct stat st;
+    if (f == NULL || fstat(fileno(f), &st) == -1 || st.st_size == 0
+        || (job->data = malloc(st.st_size)) == NULL
+        || fread(job->data, 1, st.st_size, f) != (size_t)st.st_size) {
+        free(job->data);
+        job->data = NULL;
+    }
+    else {
+        job->len = st.st_size;
+        job->inlen = st.st_size;
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+    return job;
+}
+
+static void batch_enqueue(BATCH_STATE *state, const char *path) {
+    if (batch_stopped(state)) {
+        return;
+    }
+    BATCH_JOB *job = batch_load(path);
+    if (job != NULL) {
+        queue_put(&state->in, job);
+    }
+}
+
+/*
+ * Reader stage: load each input file in turn.
+ */
+static void *batch_reader(void *arg) {
+    BATCH_STATE *state = arg;
+    struct stat st;
+    char *path = NULL;
+    size_t cap = 0;
+    if (stat(state->input, &st) == 0 && S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(state->input);
+        struct dirent *ent;
+        while (dir != NULL && (ent = readdir(dir)) != NULL) {
+            if (*ent->d_name == '.') {
+                continue;
+            }
+            size_t n = snprintf(path, cap, "%s/%s", state->input, ent->d_name) + 1;
+            if (n > cap) {
+                free(path);
+                cap = n;
+                if ((path = malloc(cap)) == NULL) {
+                    break;
+                }
+                snprintf(path, cap, "%s/%s", state->input, ent->d_name);
+            }
+            if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+                batch_enqueue(state, path);
+            }
+        }
+        if (dir != NULL) {
+            closedir(dir);
+        }
+    }
+    else {
+        FILE *list = fopen(state->input, "r");
+        ssize_t n;
+        while (list != NULL && (n = getline(&path, &cap, list)) != -1) {
+            if (n > 0 && *(path + n-1) == '\n') {
+                *(path + --n) = '\0';
+            }
+            if (n > 0) {
+                batch_enqueue(state, path);
+            }
+        }
+        if (list != NULL) {
+            fclose(list);
+        }
+        else {
+            perror(state->input);
+        }
+    }
+    free(path);
+    queue_done(&state->in);
+    return NULL;
+}
+
+/*
+ * Worker stage: convert files, each worker with its own BDD manager and
+ * raster, and with the options of the thread that started the batch.  The tables are emptied before each file, as between the images
+ * of a multi-image stream.
+ */
+static void *batch_worker(void *arg) {
+    BATCH_STATE *state = arg;
+    BDD_MANAGER *mgr = bdd_manager_new();
+    unsigned char *raster = malloc(RASTER_SIZE_MAX);
+    bdd_manager_use(mgr);
+    birp_raster = raster;
+    options_restore(&state->options);
+    BATCH_JOB *job;
+    while ((job = queue_get(&state->in)) != NULL) {
+        if (mgr != NULL && raster != NULL && job->data != NULL && !batch_stopped(state)) {
+            bdd_reset();
+            char *obuf = NULL;
+            size_t olen = 0;
+            FILE *in = fmemopen(job->data, job->len, "r");
+            FILE *out = open_memstream(&obuf, &olen);
+            if (in != NULL && out != NULL) {
+                job->status = convert(in, out);
+            }
+            if (in != NULL) {
+                fclose(in);
+            }
+            if (out != NULL) {
+                fclose(out);
+            }
+            free(job->data);
+            job->data = obuf;
+            job->len = olen;
+        }
+        queue_put(&state->out, job);
+    }
+    queue_done(&state->out);
+    bdd_manager_free(mgr);
+    free(raster);
+    return NULL;
+}
+
+/*
+ * The extension of output files for the output format in the global options.
+ */
+static char *batch_extension(void) {
+    switch ((global_options >> 4) & 0xF) {
+    case 1: return ".pgm";
+    case 2: return ".birp";
+    case 5: return ".ppm";
+    default: return ".txt";
+    }
+}
+
+static double batch_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Make sure that the output directory exists, creating it if need be.
+ */
+static int batch_outdir(char *output) {
+    struct stat st;
+    if (mkdir(output, 0777) == -1 && errno != EEXIST) {
+        perror(output);
+        return -1;
+    }
+    if (stat(output, &st) == -1) {
+        perror(output);
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "%s: not a directory\n", output);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Start the reader and the workers.  If any of them cannot be started, the
+ * batch is abandoned: the threads that did start are stopped, and joined.
+ * Returns 0 if every thread was started, and -1 otherwise.
+ */
+static int batch_start(BATCH_STATE *state, pthread_t *threads, int jobs) {
+    int started = 0, err = 0;
+    while (started <= jobs && err == 0) {
+        err = pthread_create(threads + started, NULL, started ? batch_worker : batch_reader, state);
+        started += err == 0;
+    }
+    if (err == 0) {
+        return 0;
+    }
+    errno = err;
+    perror("pthread_create");
+    pthread_mutex_lock(&state->in.lock);
+    state->stop = 1;
+    pthread_mutex_unlock(&state->in.lock);
+    if (started == 0) {
+        return -1;
+    }
+    // Workers that never started will not finish the output queue, and the
+    // files still waiting for them are dropped here, as the reader may be
+    // waiting for room in the input queue.
+    for (int i = started; i <= jobs; i++) {
+        queue_done(&state->out);
+    }
+    BATCH_JOB *job;
+    while ((job = queue_get(&state->in)) != NULL) {
+        batch_free(job);
+    }
+    while ((job = queue_get(&state->out)) != NULL) {
+        batch_free(job);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(*(threads + i), NULL);
+    }
+    return -1;
+}
+
+int birp_batch(char *input, char *output, int jobs) {
+    if (jobs <= 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = n > 0 ? n : 1;
+    }
+    if (batch_outdir(output) == -1) {
+        return -1;
+    }
+    BATCH_STATE state;
+    state.input = input;
+    state.stop = 0;
+    options_save(&state.options);
+    pthread_t *threads = malloc((jobs + 1) * sizeof(pthread_t));
+    if (threads == NULL || queue_init(&state.in, BATCH_QUEUE_PER_WORKER * jobs, 1) == -1
+        || queue_init(&state.out, BATCH_QUEUE_PER_WORKER * jobs, jobs) == -1) {
+        free(threads);
+        return -1;
+    }
+    double start = batch_clock();
+    if (batch_start(&state, threads, jobs) == -1) {
+        queue_fini(&state.in);
+        queue_fini(&state.out);
+        free(threads);
+        return -1;
+    }
+
+    // Writer stage, in this thread.
+    char *ext = batch_extension();
+    long long files = 0, failed = 0, bytes_in = 0, bytes_out = 0;
+    BATCH_NAMES names = {NULL, 0, 0};
+    BATCH_JOB *job;
+    while ((job = queue_get(&state.out)) != NULL) {
+        int stem = 0, i;
+        for (i = 0; *(job->name + i) != '\0'; i++) {
+            if (*(job->name + i) == '.' && i > 0) {
+                stem = i;
+            }
+        }
+        if (stem == 0) {
+            stem = i;
+        }
+        int n = snprintf(NULL, 0, "%s/%.*s%s", output, stem, job->name, ext) + 1;
+        char *path = malloc(n);
+        FILE *f = NULL;
+        int added = -1, ok = 0;
+        if (path != NULL) {
+            snprintf(path, n, "%s/%.*s%s", output, stem, job->name, ext);
+            added = names_add(&names, path);
+        }
+        // Each output path is claimed by the first input that gives it, even
+        // if that input failed, so that the outcome does not depend on which
+        // of the inputs converts.
+        if (added == 0) {
+            fprintf(stderr, "%s: output %s is also that of another input\n", job->path, path);
+        }
+        else if (added == -1) {
+            perror(job->path);
+        }
+        else if (job->status != EXIT_SUCCESS) {
+            fprintf(stderr, "%s: conversion failed\n", job->path);
+        }
+        else if ((f = fopen(path, "w")) == NULL) {
+            perror(path);
+        }
+        else {
+            ok = fwrite(job->data, 1, job->len, f) == job->len;
+            if (fclose(f) != 0 || !ok) {
+                perror(path);
+                ok = 0;
+            }
+        }
+        if (ok) {
+            files++;
+            bytes_in += job->inlen;
+            bytes_out += job->len;
+        }
+        else {
+            failed++;
+        }
+        if (added != 1) {
+            free(path);
+        }
+        batch_free(job);
+    }
+    for (int i = 0; i <= jobs; i++) {
+        pthread_join(*(threads + i), NULL);
+    }
+    double secs = batch_clock() - start;
+    fprintf(stderr, "{\"files\": %lld, \"failed\": %lld, \"workers\": %d, \"bytes_in\": %lld, "
+            "\"bytes_out\": %lld, \"seconds\": %.3f, \"files_per_s\": %.1f, \"mb_per_s\": %.2f}\n",
+            files, failed, jobs, bytes_in, bytes_out, secs,
+            secs > 0 ? files / secs : 0.0, secs > 0 ? bytes_in / 1e6 / secs : 0.0);
+    names_free(&names);
+    queue_fini(&state.in);
+    queue_fini(&state.out);
+    free(threads);
+    return failed == 0 ? 0 : -1;
+}
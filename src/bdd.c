@@ -3,6 +3,8 @@
 
 #include "bdd.h"
 #include "debug.h"
+#include "stats.h"
+#include "store.h"
 
 /*
  * Macros that take a pointer to a BDD node and obtain pointers to its left
@@ -13,96 +15,777 @@
  * You might find it useful to define macros to do other commonly occurring things;
  * such as converting between BDD node pointers and indices in the BDD node table.
  */
-#define LEFT(np, l) ((l) > (np)->level ? (np) : bdd_nodes + (np)->left)
-#define RIGHT(np, l) ((l) > (np)->level ? (np) : bdd_nodes + (np)->right)
+#define LEFT(np, l) ((l) > (np)->level ? (np) : NODES + (np)->left)
+#define RIGHT(np, l) ((l) > (np)->level ? (np) : NODES + (np)->right)
 
-int unused = BDD_NUM_LEAVES;
-int serial = 0;
+/*
+ * The default manager owns the global tables declared in bdd.h, so that
+ * code which does not create managers of its own behaves as before.  Each
+ * thread starts out using it, and the tables of the manager a thread is
+ * using are reached through the following macros.
+ */
+BDD_MANAGER bdd_default_manager = {bdd_nodes, bdd_hash_map, bdd_index_map, BDD_NUM_LEAVES, 0,
+                                   NULL, 0, NULL, NULL, 0, NULL, {0, 0}, NULL};
+__thread BDD_MANAGER *bdd_current = &bdd_default_manager;
 
-int hash(int level, int left, int right) {
-    return ((((left * right) + level) & 0x7FFFFFFF) % BDD_HASH_SIZE);
+#define NODES (bdd_current->nodes)
+#define HASH_MAP (bdd_current->hash_map)
+#define INDEX_MAP (bdd_current->index_map)
+#define USED (bdd_current->unused)
+#define SERIAL (bdd_current->serial)
+#define TILES (bdd_current->tiles)
+#define TILE_UNITS (bdd_current->tile_units)
+#define TILE_HASH (bdd_current->tile_hash)
+
+/*
+ * Tile nodes of hybrid BDDs (see bdd_to_hybrid()), and their pixels.
+ */
+#define TILE(np) ((np)->left < 0)
+#define TILE_DATA(np) (TILES + (long)(-1 - (np)->left) * BDD_TILE_UNIT)
+
+BDD_MANAGER *bdd_manager_new(void) {
+    BDD_MANAGER *mgr = malloc(sizeof(BDD_MANAGER));
+    if (mgr == NULL) {
+        return NULL;
+    }
+    mgr->nodes = malloc(BDD_NODES_MAX * sizeof(BDD_NODE));
+    mgr->hash_map = calloc(BDD_HASH_SIZE, sizeof(BDD_NODE *));
+    mgr->index_map = malloc(BDD_NODES_MAX * sizeof(int));
+    mgr->unused = BDD_NUM_LEAVES;
+    mgr->serial = 0;
+    mgr->tiles = NULL;
+    mgr->tile_units = 0;
+    mgr->tile_hash = NULL;
+    mgr->store = NULL;
+    mgr->generation = 0;
+    mgr->memo = NULL;
+    *mgr->walk = 0;
+    *(mgr->walk + 1) = 0;
+    mgr->wide = NULL;
+    if (mgr->nodes == NULL || mgr->hash_map == NULL || mgr->index_map == NULL) {
+        bdd_manager_free(mgr);
+        return NULL;
+    }
+    return mgr;
 }
 
-int bdd_lookup(int level, int left, int right) {
-    if (left == right) {
-        return left;
+void bdd_manager_free(BDD_MANAGER *mgr) {
+    if (mgr == NULL || mgr == &bdd_default_manager) {
+        return;
     }
+    if (bdd_current == mgr) {
+        bdd_current = &bdd_default_manager;
+    }
+    free(mgr->nodes);
+    free(mgr->hash_map);
+    free(mgr->index_map);
+    free(mgr->tiles);
+    free(mgr->tile_hash);
+    free(mgr->memo);
+    free(mgr->wide);
+    free(mgr);
+}
+
+BDD_MANAGER *bdd_manager_use(BDD_MANAGER *mgr) {
+    BDD_MANAGER *prev = bdd_current;
+    bdd_current = mgr == NULL ? &bdd_default_manager : mgr;
+    return prev;
+}
+
+BDD_MANAGER *bdd_manager_current(void) {
+    return bdd_current;
+}
+
+int hash(int level, int left, int right) {
+    // Multiplying the fields by distinct odd constants and folding the high
+    // bits down spreads nodes whose children are close in the table (as all
+    // nodes built in one pass are) over the whole map.
+    unsigned int h = (unsigned int)left * 0x9E3779B1u;
+    h ^= (unsigned int)right * 0x85EBCA77u;
+    h ^= (unsigned int)level * 0xC2B2AE3Du;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 13;
+    return h % BDD_HASH_SIZE;
+}
+
+/*
+ * Count the slots of the hash map examined by a lookup that found or
+ * created a node.
+ */
+void bprobes(long long probes, int created) {
+    bdd_stats.created += created;
+    bdd_stats.reused += !created;
+    bdd_stats.probes += probes;
+    bdd_stats.probe_max = probes > bdd_stats.probe_max ? probes : bdd_stats.probe_max;
+}
+
+/*
+ * Find or insert the node with given fields in the hash map, whatever its
+ * children (tile nodes have equal ones), or return -1 if it is not there
+ * and the node table is full.
+ */
+int blookup(int level, int left, int right) {
     int hashVal = hash(level, left, right);
-    BDD_NODE *node = *(bdd_hash_map + hashVal);
+    BDD_NODE *node = *(HASH_MAP + hashVal);
+    long long probes = 1;
     while (node != NULL) {
         if (node->level == level && node->left == left && node->right == right) {
-            return *(bdd_hash_map + hashVal) - bdd_nodes;
+            if (stats_enabled) {
+                bprobes(probes, 0);
+            }
+            return *(HASH_MAP + hashVal) - NODES;
         }
         hashVal = (hashVal+1) % BDD_HASH_SIZE;
-        node = *(bdd_hash_map + hashVal);
+        node = *(HASH_MAP + hashVal);
+        probes++;
+    }
+    if (USED >= BDD_NODES_MAX) {
+        return -1;
+    }
+    if (stats_enabled) {
+        bprobes(probes, 1);
     }
     BDD_NODE newNode = {level, left, right};
-    *(bdd_nodes + unused) = newNode;
-    *(bdd_hash_map + hashVal) = (bdd_nodes + unused);
-    unused++;
-    return *(bdd_hash_map + hashVal) - bdd_nodes;
+    *(NODES + USED) = newNode;
+    *(HASH_MAP + hashVal) = (NODES + USED);
+    USED++;
+    return *(HASH_MAP + hashVal) - NODES;
+}
+
+/*
+ * The node at an index returned by a function that builds nodes, or NULL if
+ * the build failed (see bdd_lookup()).
+ */
+BDD_NODE *bnode(int index) {
+    return index < 0 ? NULL : NODES + index;
+}
+
+/*
+ * Report that the node table is full, once a build has failed for it.
+ */
+void bfull(void) {
+    fprintf(stderr, "BDD node table is full (%d nodes)\n", BDD_NODES_MAX);
+}
+
+int bdd_lookup(int level, int left, int right) {
+    // A failure to build a child fails its parent, and so on up to the root.
+    if (left < 0 || right < 0) {
+        return -1;
+    }
+    if (stats_enabled) {
+        bdd_stats.lookups++;
+        bdd_stats.collapsed += left == right;
+    }
+    if (left == right) {
+        return left;
+    }
+    return blookup(level, left, right);
+}
+
+/*
+ * Empty the node table and its hash map, leaving the pool of tiles as it is.
+ */
+void bnreset(void) {
+    // Every slot holding a node is reached by probing from the node's hash,
+    // so the map can be emptied in time proportional to the number of nodes.
+    for (int i = BDD_NUM_LEAVES; i < USED; i++) {
+        BDD_NODE *node = NODES + i;
+        int hashVal = hash(node->level, node->left, node->right);
+        while (*(HASH_MAP + hashVal) != node) {
+            hashVal = (hashVal+1) % BDD_HASH_SIZE;
+        }
+        *(HASH_MAP + hashVal) = NULL;
+    }
+    USED = BDD_NUM_LEAVES;
+    bdd_current->generation++;
+}
+
+void bdd_reset(void) {
+    bnreset();
+    if (TILE_UNITS > 0) {
+        for (int i = 0; i < BDD_TILE_HASH_SIZE; i++) {
+            *(TILE_HASH + i) = 0;
+        }
+        TILE_UNITS = 0;
+    }
+}
+
+/*
+ * Memo tables of the manager, for walks over the node table: each of
+ * MEMO_PAIRS pairs is a table of BDD_NODES_MAX values and one of their
+ * stamps, in which a value is valid only if its stamp is that of the
+ * current walk on the pair.  Beginning a walk takes a fresh stamp, so that
+ * no table is cleared between walks, and the tables are allocated once per
+ * manager rather than per call.  Stamps of a walk from before a reset are
+ * stale, as they are older than any taken since.  Walks on the same pair
+ * must not nest.
+ */
+#define MEMO_PAIRS 2
+#define MEMO_VALUES(k) (bdd_current->memo + (long)(2*(k)) * BDD_NODES_MAX)
+#define MEMO_STAMPS(k) (bdd_current->memo + (long)(2*(k) + 1) * BDD_NODES_MAX)
+#define MEMO_WALK_MAX 0x3FFFFFFF
+
+/*
+ * Take n consecutive stamps for walks on pair k of the memo tables,
+ * allocating the tables when first used, and return the first, or 0 if
+ * memory cannot be allocated.  The stamps of the pair are cleared when its
+ * counter nears overflow, which is safe as no walk on it is under way.
+ */
+int bwalk(int k, int n) {
+    int *walk = bdd_current->walk + k;
+    if (bdd_current->memo == NULL) {
+        bdd_current->memo = calloc((long)2 * MEMO_PAIRS * BDD_NODES_MAX, sizeof(int));
+        if (bdd_current->memo == NULL) {
+            return 0;
+        }
+        *bdd_current->walk = 0;
+        *(bdd_current->walk + 1) = 0;
+    }
+    if (*walk > MEMO_WALK_MAX - n) {
+        for (int i = 0; i < BDD_NODES_MAX; i++) {
+            *(MEMO_STAMPS(k) + i) = 0;
+        }
+        *walk = 0;
+    }
+    *walk += n;
+    return *walk - n + 1;
+}
+
+/*
+ * The wide memo table, of MEMO_WIDE 64-bit values per node, for walks on
+ * pair 0 whose results do not fit in an int; its values are valid under
+ * the stamps of pair 0.  The table is allocated when first used, and NULL
+ * is returned if memory cannot be allocated.
+ */
+#define MEMO_WIDE 2
+
+unsigned long long *bwide(void) {
+    if (bdd_current->wide == NULL) {
+        bdd_current->wide = malloc((long)MEMO_WIDE * BDD_NODES_MAX * sizeof(unsigned long long));
+    }
+    return bdd_current->wide;
+}
+
+/*
+ * Obtain space at the end of the pool of tiles for a tile of a given level,
+ * allocating the pool when first used.  The tile is added to the pool only
+ * once its pixels have been written there (see btcommit()).
+ */
+unsigned char *btreserve(int level) {
+    if (TILES == NULL) {
+        TILES = malloc((long)BDD_TILE_UNITS_MAX * BDD_TILE_UNIT);
+        TILE_HASH = calloc(BDD_TILE_HASH_SIZE, sizeof(int));
+        if (TILES == NULL || TILE_HASH == NULL) {
+            free(TILES);
+            free(TILE_HASH);
+            TILES = NULL;
+            TILE_HASH = NULL;
+            return NULL;
+        }
+    }
+    if (TILE_UNITS + ((1<<level) / BDD_TILE_UNIT) > BDD_TILE_UNITS_MAX) {
+        return NULL;
+    }
+    return TILES + (long)TILE_UNITS * BDD_TILE_UNIT;
+}
+
+/*
+ * Add the tile of a given level whose pixels have been written at the end
+ * of the pool, unless the pool already holds a tile with the same pixels,
+ * and return the index of the tile node.  Entries of the map of tiles hold
+ * the unit at which a tile starts and its level.
+ */
+int btcommit(int level) {
+    int size = 1<<level;
+    unsigned char *data = TILES + (long)TILE_UNITS * BDD_TILE_UNIT;
+    unsigned int h = 2166136261u ^ level;
+    for (int i = 0; i < size; i++) {
+        h = (h ^ *(data + i)) * 16777619u;
+    }
+    int slot = h % BDD_TILE_HASH_SIZE;
+    int entry;
+    while ((entry = *(TILE_HASH + slot)) != 0) {
+        unsigned char *tile = TILES + (long)(entry >> 4) * BDD_TILE_UNIT;
+        int i = 0;
+        while ((entry & 0xF) == level && i < size && *(tile + i) == *(data + i)) {
+            i++;
+        }
+        if (i == size) {
+            return blookup(level, -1 - (entry >> 4), -1 - (entry >> 4));
+        }
+        slot = (slot + 1) % BDD_TILE_HASH_SIZE;
+    }
+    int unit = TILE_UNITS;
+    *(TILE_HASH + slot) = (unit << 4) | level;
+    TILE_UNITS += size / BDD_TILE_UNIT;
+    return blookup(level, -1 - unit, -1 - unit);
 }
 
 int bdd_min_level(int w, int h) {
+    // The side 2^(l/2) is compared with w and h directly, as their squares
+    // overflow for sides above 46340.
     int l = 0;
-    while (1<<l < w*w || 1<<l < h*h) {
+    while (1LL<<(l/2) < w || 1LL<<(l/2) < h) {
         l += 2;
     }
     return l;
 }
 
-int bfrhelp(int level, int w, int h, int ow, int oh, int rw, int rh, unsigned char *raster) {
+/*
+ * Each symmetry of the n x n square takes the pixel of the result at (r, c)
+ * from the pixel of the original at the coordinates obtained by first
+ * swapping r and c (if DSWAP is set) and then replacing the row index r by
+ * n-1-r (if DFLIPR is set) and the column index c by n-1-c (if DFLIPC is set).
+ */
+#define DSWAP 0x1
+#define DFLIPR 0x2
+#define DFLIPC 0x4
+
+int dmap(int op) {
+    switch (op) {
+    case BDD_ROT90: return DSWAP | DFLIPC;
+    case BDD_ROT180: return DFLIPR | DFLIPC;
+    case BDD_ROT270: return DSWAP | DFLIPR;
+    case BDD_FLIP_H: return DFLIPC;
+    case BDD_FLIP_V: return DFLIPR;
+    case BDD_TRANSPOSE: return DSWAP;
+    case BDD_ANTITRANSPOSE: return DSWAP | DFLIPR | DFLIPC;
+    default: return 0;
+    }
+}
+
+int bdd_dihedral_compose(int first, int second) {
+    int a = dmap(first);
+    int b = dmap(second);
+    // Moving the flips of the second map past the swap of the first
+    // exchanges the roles of its row and column flips.
+    if (a & DSWAP) {
+        b = (b & DSWAP) | (b & DFLIPR ? DFLIPC : 0) | (b & DFLIPC ? DFLIPR : 0);
+    }
+    int m = a ^ b;
+    for (int op = BDD_IDENTITY; op <= BDD_ANTITRANSPOSE; op++) {
+        if (dmap(op) == m) {
+            return op;
+        }
+    }
+    return BDD_IDENTITY;
+}
+
+void bdd_dihedral_box(int op, int n, int w, int h, BDD_RECT *box) {
+    // The map gives, for each destination pixel, the source pixel, so after
+    // a swap the row flip acts on the destination columns and vice versa.
+    int m = dmap(op);
+    int rows = m & DSWAP ? w : h;
+    int cols = m & DSWAP ? h : w;
+    int fliprows = m & DSWAP ? m & DFLIPC : m & DFLIPR;
+    int flipcols = m & DSWAP ? m & DFLIPR : m & DFLIPC;
+    box->r0 = fliprows ? n - rows : 0;
+    box->c0 = flipcols ? n - cols : 0;
+    box->r1 = box->r0 + rows;
+    box->c1 = box->c0 + cols;
+}
+
+/*
+ * Levels above 2*min(rbits, cbits) all belong to the longer axis; below
+ * that, the interleaved orders alternate between the axes.
+ */
+#define LOWMASK(n) ((n) >= 32 ? 0xFFFFFFFFu : (1u<<(n)) - 1)
+
+unsigned int bdd_order_mask(int order, int rbits, int cbits) {
+    int m = rbits < cbits ? rbits : cbits;
+    unsigned int above = rbits > cbits ? LOWMASK(rbits + cbits) & ~LOWMASK(2*m) : 0;
+    switch (order) {
+    case BDD_ORDER_RC: return above | (0xAAAAAAAAu & LOWMASK(2*m));
+    case BDD_ORDER_CR: return above | (0x55555555u & LOWMASK(2*m));
+    case BDD_ORDER_ROWS: return LOWMASK(rbits + cbits) & ~LOWMASK(cbits);
+    case BDD_ORDER_COLS: return LOWMASK(rbits);
+    default: return 0;
+    }
+}
+
+void bdd_layout_fit(BDD_LAYOUT *layout, int w, int h) {
+    if (!layout->rect) {
+        layout->rbits = bdd_min_level(w, h)/2;
+        layout->cbits = layout->rbits;
+        return;
+    }
+    layout->rbits = 0;
+    while (1<<layout->rbits < h) {
+        layout->rbits++;
+    }
+    layout->cbits = 0;
+    while (1<<layout->cbits < w) {
+        layout->cbits++;
+    }
+}
+
+const char *bdd_order_name(int order) {
+    switch (order) {
+    case BDD_ORDER_RC: return "rc";
+    case BDD_ORDER_CR: return "cr";
+    case BDD_ORDER_ROWS: return "rows";
+    case BDD_ORDER_COLS: return "cols";
+    default: return NULL;
+    }
+}
+
+int bdd_order_parse(const char *name) {
+    for (int order = 0; order < BDD_ORDER_COUNT; order++) {
+        const char *s = bdd_order_name(order);
+        const char *t = name;
+        while (*s != '\0' && *s == *t) {
+            s++;
+            t++;
+        }
+        if (*s == '\0' && *t == '\0') {
+            return order;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Number of row variables among levels 1..l of an order with row mask rmask.
+ */
+int rowbits(unsigned int rmask, int l) {
+    return __builtin_popcount(rmask & LOWMASK(l));
+}
+
+/*
+ * A layout is valid if its order is, and it has at most BDD_LEVELS_MAX levels.
+ */
+#define LAYOUT_OK(lp) ((lp) != NULL && (lp)->order >= 0 && (lp)->order < BDD_ORDER_COUNT && \
+                       (lp)->rbits >= 0 && (lp)->cbits >= 0 && \
+                       (lp)->rbits + (lp)->cbits <= BDD_LEVELS_MAX)
+#define LAYOUT_MASK(lp) bdd_order_mask((lp)->order, (lp)->rbits, (lp)->cbits)
+
+/*
+ * State shared by the recursive calls that build a BDD from a raster: the
+ * raster, its dimensions and the distance between its rows, the lookup
+ * table, symmetry and row mask, and, for a lossy build, the tolerance and
+ * the greatest error so far.
+ */
+typedef struct bfr_state {
+    int ow, oh;
+    int stride;
+    unsigned char *raster;
+    unsigned char *lut;
+    int map;
+    int n;
+    unsigned int rmask;
+    int tol;
+    int err;
+} BFR_STATE;
+
+/*
+ * The value with which to replace every pixel of a block whose values lie in
+ * [lo, hi], given that hi - lo <= 2*tol.  Any value in [hi-tol, lo+tol] is
+ * within the tolerance; the centre of a bin of width 2*tol+1 is preferred,
+ * so that blocks with similar values get the same leaf and can be shared.
+ */
+int bfrsnap(int lo, int hi, int tol) {
+    int a = hi - tol < 0 ? 0 : hi - tol;
+    int b = lo + tol > 255 ? 255 : lo + tol;
+    int step = 2*tol + 1;
+    int c = (a > tol ? (a - tol + step - 1)/step : 0)*step + tol;
+    return c <= b ? c : (lo + hi)/2;
+}
+
+/*
+ * Replace a block with values in [lo, hi] by a leaf, recording the error.
+ */
+int bfrleaf(int lo, int hi, BFR_STATE *st) {
+    int v = bfrsnap(lo, hi, st->tol);
+    int e = v - lo > hi - v ? v - lo : hi - v;
+    if (e > st->err) {
+        st->err = e;
+    }
+    return v;
+}
+
+/*
+ * Build the BDD for the w x h block at (rh, rw), setting *lo and *hi to the
+ * least and greatest pixel values in the block.  In a lossy build, a block
+ * whose values lie within twice the tolerance of each other becomes a leaf.
+ * Since the range of a block includes the ranges of its halves, a node is
+ * only created for a block that will not itself be collapsed.
+ */
+int bfrhelp(int level, int w, int h, int rw, int rh, BFR_STATE *st, int *lo, int *hi) {
     if (level == 0) {
-        if (rw >= ow || rh >= oh) {
-            return 0;
+        int sr = st->map & DSWAP ? rw : rh;
+        int sc = st->map & DSWAP ? rh : rw;
+        if (st->map & DFLIPR) {
+            sr = st->n-1 - sr;
         }
-        return *(raster + ow*rh + rw);
+        if (st->map & DFLIPC) {
+            sc = st->n-1 - sc;
+        }
+        int v = (sc >= st->ow || sr >= st->oh) ? 0 : *(st->raster + (long)st->stride*sr + sc);
+        v = st->lut == NULL ? v : *(st->lut + v);
+        *lo = v;
+        *hi = v;
+        return st->tol == 0 ? v : bfrleaf(v, v, st);
     }
-    if (level%2 == 0) {
-        int l = bfrhelp(level-1, w, h/2, ow, oh, rw, rh, raster);
-        int r = bfrhelp(level-1, w, h/2, ow, oh, rw, rh + h/2, raster);
-        return bdd_lookup(level, l, r);
+    int l, r, llo, lhi, rlo, rhi;
+    if ((st->rmask >> (level-1)) & 1) {
+        l = bfrhelp(level-1, w, h/2, rw, rh, st, &llo, &lhi);
+        r = bfrhelp(level-1, w, h/2, rw, rh + h/2, st, &rlo, &rhi);
     } else {
-        int l = bfrhelp(level-1, w/2, h, ow, oh, rw, rh, raster);
-        int r = bfrhelp(level-1, w/2, h, ow, oh, rw + w/2, rh, raster);
-        return bdd_lookup(level, l, r);
+        l = bfrhelp(level-1, w/2, h, rw, rh, st, &llo, &lhi);
+        r = bfrhelp(level-1, w/2, h, rw + w/2, rh, st, &rlo, &rhi);
     }
+    *lo = llo < rlo ? llo : rlo;
+    *hi = lhi > rhi ? lhi : rhi;
+    if (st->tol > 0 && *hi - *lo <= 2*st->tol) {
+        return bfrleaf(*lo, *hi, st);
+    }
+    return bdd_lookup(level, l, r);
 }
 
 BDD_NODE *bdd_from_raster(int w, int h, unsigned char *raster) {
-    if (w > 8192 || h > 8192) {
+    return bdd_from_raster_mapped(w, h, raster, NULL, BDD_IDENTITY);
+}
+
+BDD_NODE *bdd_from_raster_mapped(int w, int h, unsigned char *raster, unsigned char *lut, int op) {
+    BDD_LAYOUT layout = {BDD_ORDER_RC, 0, 0, 0};
+    bdd_layout_fit(&layout, w, h);
+    return bdd_from_raster_ordered(w, h, raster, lut, op, &layout);
+}
+
+BDD_NODE *bdd_from_raster_ordered(int w, int h, unsigned char *raster, unsigned char *lut,
+                                  int op, BDD_LAYOUT *layout) {
+    return bdd_from_raster_lossy(w, h, raster, lut, op, layout, 0, NULL);
+}
+
+BDD_NODE *bdd_from_raster_lossy(int w, int h, unsigned char *raster, unsigned char *lut,
+                                int op, BDD_LAYOUT *layout, int tol, int *errp) {
+    if (w > 8192 || h > 8192 || op < BDD_IDENTITY || op > BDD_ANTITRANSPOSE || !LAYOUT_OK(layout)
+        || w > 1<<layout->cbits || h > 1<<layout->rbits
+        || (op != BDD_IDENTITY && layout->rbits != layout->cbits) || tol < 0) {
+        return NULL;
+    }
+    int level = layout->rbits + layout->cbits;
+    STATS_DEPTH(level);
+    BFR_STATE st = {w, h, w, raster, lut, dmap(op), 1<<layout->rbits, LAYOUT_MASK(layout), tol, 0};
+    int lo, hi;
+    int index = bfrhelp(level, 1<<layout->cbits, 1<<layout->rbits, 0, 0, &st, &lo, &hi);
+    if (errp != NULL) {
+        *errp = st.err;
+    }
+    if (index < 0) {
+        bfull();
+    }
+    return bnode(index);
+}
+
+/*
+ * State for stitching tiles together: the grid of tile roots, with the
+ * least and greatest value in each tile, and the level of a tile.
+ */
+typedef struct bst_state {
+    int *root;
+    int *lo;
+    int *hi;
+    int gw, gh;
+    int tlevel;
+    BFR_STATE *bfr;
+} BST_STATE;
+
+/*
+ * Join the tiles covering the block at tile row tr and tile column tc at a
+ * given level, as bfrhelp() joins pixels, so that the result is the BDD
+ * that would have been built from the whole raster at once.  Tiles beyond
+ * the grid are zero, like the padding of a single raster.
+ */
+int bsthelp(int level, int tr, int tc, BST_STATE *st, int *lo, int *hi) {
+    if (level == st->tlevel) {
+        if (tr >= st->gh || tc >= st->gw) {
+            *lo = 0;
+            *hi = 0;
+            return st->bfr->tol == 0 ? 0 : bfrleaf(0, 0, st->bfr);
+        }
+        *lo = *(st->lo + tr*st->gw + tc);
+        *hi = *(st->hi + tr*st->gw + tc);
+        return *(st->root + tr*st->gw + tc);
+    }
+    BFR_STATE *bfr = st->bfr;
+    int tiles = 1<<(rowbits(bfr->rmask, level) - st->tlevel/2);
+    int l, r, llo, lhi, rlo, rhi;
+    if ((bfr->rmask >> (level-1)) & 1) {
+        l = bsthelp(level-1, tr, tc, st, &llo, &lhi);
+        r = bsthelp(level-1, tr + tiles/2, tc, st, &rlo, &rhi);
+    } else {
+        tiles = 1<<(level - rowbits(bfr->rmask, level) - st->tlevel/2);
+        l = bsthelp(level-1, tr, tc, st, &llo, &lhi);
+        r = bsthelp(level-1, tr, tc + tiles/2, st, &rlo, &rhi);
+    }
+    *lo = llo < rlo ? llo : rlo;
+    *hi = lhi > rhi ? lhi : rhi;
+    if (bfr->tol > 0 && *hi - *lo <= 2*bfr->tol) {
+        return bfrleaf(*lo, *hi, bfr);
+    }
+    return bdd_lookup(level, l, r);
+}
+
+BDD_NODE *bdd_from_raster_tiled(int w, int h, int tile, unsigned char *band,
+                                int (*fill)(unsigned char *band, int rows, void *arg), void *arg,
+                                unsigned char *lut, int tol, int *errp) {
+    int level = bdd_min_level(w, h);
+    if (w <= 0 || h <= 0 || level > BDD_LEVELS_MAX || tile <= 0 || (tile & (tile-1)) != 0
+        || band == NULL || fill == NULL || tol < 0) {
         return NULL;
     }
-    int bml = bdd_min_level(w, h);
-    BDD_NODE *root = (bdd_nodes + bfrhelp(bml, 1<<(bml/2), 1<<(bml/2), w, h, 0, 0, raster));
+    int k = __builtin_ctz(tile);
+    if (k > level/2) {
+        k = level/2;
+        tile = 1<<k;
+    }
+    int gw = (w + tile-1)/tile;
+    int gh = (h + tile-1)/tile;
+    BFR_STATE bfr = {0, 0, w, band, lut, 0, tile, bdd_order_mask(BDD_ORDER_RC, level/2, level/2),
+                     tol, 0};
+    BST_STATE st = {malloc((long)gw*gh * sizeof(int)), malloc((long)gw*gh * sizeof(int)),
+                    malloc((long)gw*gh * sizeof(int)), gw, gh, 2*k, &bfr};
+    BDD_NODE *root = NULL;
+    if (st.root == NULL || st.lo == NULL || st.hi == NULL) {
+        goto done;
+    }
+    STATS_DEPTH(level);
+    for (int tr = 0; tr < gh; tr++) {
+        int rows = h - tr*tile < tile ? h - tr*tile : tile;
+        if (fill(band, rows, arg) == -1) {
+            goto done;
+        }
+        for (int tc = 0; tc < gw; tc++) {
+            int t = tr*gw + tc;
+            bfr.raster = band + (long)tc*tile;
+            bfr.ow = w - tc*tile < tile ? w - tc*tile : tile;
+            bfr.oh = rows;
+            *(st.root + t) = bfrhelp(2*k, tile, tile, 0, 0, &bfr, st.lo + t, st.hi + t);
+        }
+    }
+    int lo, hi;
+    int index = bsthelp(level, 0, 0, &st, &lo, &hi);
+    if (index < 0) {
+        bfull();
+    }
+    root = bnode(index);
+    if (errp != NULL) {
+        *errp = bfr.err;
+    }
+ done:
+    free(st.root);
+    free(st.lo);
+    free(st.hi);
     return root;
 }
 
 void bdd_to_raster(BDD_NODE *node, int w, int h, unsigned char *raster) {
-    for (int i = 0; i < h; i++) {
-        for (int j = 0; j < w; j++) {
-            int a = bdd_apply(node, i, j);
-            *(raster + i*w + j) = a;
+    // The root may lie below the level of the image, if its top halves
+    // coincide; the image level is that of the smallest enclosing square.
+    BDD_LAYOUT layout = {BDD_ORDER_RC, 0, 0, 0};
+    bdd_layout_fit(&layout, w, h);
+    if (2*layout.rbits < node->level) {
+        layout.rbits = (node->level + 1)/2;
+        layout.cbits = layout.rbits;
+    }
+    bdd_to_raster_ordered(node, &layout, w, h, raster);
+}
+
+void btrhelp(BDD_NODE *node, int level, int r, int c, unsigned int rmask, int w, int r0, int h,
+             unsigned char *raster) {
+    int rows = 1<<rowbits(rmask, level);
+    int cols = 1<<(level - rowbits(rmask, level));
+    if (r >= h || r + rows <= r0 || c >= w) {
+        return;
+    }
+    if (node->level == 0) {
+        int r1 = r + rows < h ? r + rows : h;
+        int c1 = c + cols < w ? c + cols : w;
+        for (int i = r < r0 ? r0 : r; i < r1; i++) {
+            unsigned char *p = raster + (long)(i - r0)*w;
+            for (int j = c; j < c1; j++) {
+                *(p + j) = node - NODES;
+            }
+        }
+        return;
+    }
+    if (TILE(node) && level == node->level) {
+        // Rows of a tile are copied whole, as single 8-byte moves for the
+        // 8-pixel rows of the smallest tiles.
+        unsigned char *tile = TILE_DATA(node);
+        int r1 = r + rows < h ? r + rows : h;
+        int n = c + cols < w ? cols : w - c;
+        for (int i = r < r0 ? r0 : r; i < r1; i++) {
+            unsigned char *p = raster + (long)(i - r0)*w + c;
+            unsigned char *q = tile + (i - r)*cols;
+            if (n == 8) {
+                __builtin_memcpy(p, q, 8);
+            }
+            else {
+                __builtin_memcpy(p, q, n);
+            }
         }
+        return;
+    }
+    if ((rmask >> (level-1)) & 1) {
+        btrhelp(LEFT(node, level), level-1, r, c, rmask, w, r0, h, raster);
+        btrhelp(RIGHT(node, level), level-1, r + rows/2, c, rmask, w, r0, h, raster);
+    } else {
+        btrhelp(LEFT(node, level), level-1, r, c, rmask, w, r0, h, raster);
+        btrhelp(RIGHT(node, level), level-1, r, c + cols/2, rmask, w, r0, h, raster);
+    }
+}
+
+int bdd_to_raster_ordered(BDD_NODE *node, BDD_LAYOUT *layout, int w, int h,
+                          unsigned char *raster) {
+    return bdd_to_raster_rows(node, layout, w, 0, h, raster);
+}
+
+int bdd_to_raster_rows(BDD_NODE *node, BDD_LAYOUT *layout, int w, int r0, int r1,
+                       unsigned char *raster) {
+    if (node == NULL || raster == NULL || !LAYOUT_OK(layout)
+        || layout->rbits + layout->cbits < node->level || r0 < 0 || r1 < r0) {
+        return -1;
     }
+    int level = layout->rbits + layout->cbits;
+    STATS_DEPTH(level);
+    btrhelp(node, level, 0, 0, LAYOUT_MASK(layout), w, r0, r1, raster);
+    return 0;
 }
 
 int bshelp(BDD_NODE *node, FILE *out) {
+    if (TILE(node)) {
+        if (*(INDEX_MAP + (node - NODES)) == 0) {
+            unsigned char *tile = TILE_DATA(node);
+            fputc('#', out);
+            fputc(node->level, out);
+            for (int i = 0; i < 1<<node->level; i++) {
+                fputc(*(tile + i), out);
+            }
+            bdd_stats.bytes_out += 2 + (1<<node->level);
+            SERIAL++;
+            *(INDEX_MAP + (node - NODES)) = SERIAL;
+        }
+        return *(INDEX_MAP + (node - NODES));
+    }
     if (node->level == 0) {
-        if (*(bdd_index_map + (node - bdd_nodes)) == 0) {
+        if (*(INDEX_MAP + (node - NODES)) == 0) {
             fputc('@', out);
-            fputc(node - bdd_nodes, out);
-            serial++;
-            *(bdd_index_map + (node - bdd_nodes)) = serial;
-            return serial;
-        }
-        return *(bdd_index_map + (node - bdd_nodes));
-    }
-    if (*(bdd_index_map + bdd_lookup(node->level, node->left, node->right)) == 0) {
-        int l = bshelp(bdd_nodes + node->left, out);
-        int r = bshelp(bdd_nodes + node->right, out);
-        serial++;
-        *(bdd_index_map + bdd_lookup(node->level, node->left, node->right)) = serial;
+            fputc(node - NODES, out);
+            bdd_stats.bytes_out += 2;
+            SERIAL++;
+            *(INDEX_MAP + (node - NODES)) = SERIAL;
+            return SERIAL;
+        }
+        return *(INDEX_MAP + (node - NODES));
+    }
+    if (*(INDEX_MAP + (node - NODES)) == 0) {
+        int l = bshelp(NODES + node->left, out);
+        int r = bshelp(NODES + node->right, out);
+        SERIAL++;
+        *(INDEX_MAP + (node - NODES)) = SERIAL;
         fputc('@' + node->level, out);
         fputc(l & 0xFF, out);
         fputc((l>>8) & 0xFF, out);
@@ -112,45 +795,136 @@ int bshelp(BDD_NODE *node, FILE *out) {
         fputc((r>>8) & 0xFF, out);
         fputc((r>>16) & 0xFF, out);
         fputc((r>>24) & 0xFF, out);
-        return serial;
+        bdd_stats.bytes_out += 9;
+        return SERIAL;
     }
-    return *(bdd_index_map + bdd_lookup(node->level, node->left, node->right));
+    return *(INDEX_MAP + (node - NODES));
 }
 
 int bdd_serialize(BDD_NODE *node, FILE *out) {
     if (node == NULL) {
         return -1;
     }
-    serial = 0;
+    SERIAL = 0;
     for (int i = 0; i < BDD_NODES_MAX; i++) {
-        *(bdd_index_map + i) = 0;
+        *(INDEX_MAP + i) = 0;
+    }
+    // With a store attached, the nodes go to the store and only the root
+    // is written.
+    if (bdd_current->store != NULL) {
+        unsigned long long hash;
+        if (bdd_store_put(bdd_current->store, node, &hash) == -1) {
+            return -1;
+        }
+        fputc('$', out);
+        for (int i = 0; i < 8; i++) {
+            fputc(hash >> (i*8), out);
+        }
+        bdd_stats.bytes_out += 9;
+        return 0;
     }
+    STATS_DEPTH(node->level);
     bshelp(node, out);
     return 0;
 }
 
-BDD_NODE *bdd_deserialize(FILE *in) {
-    if (in == NULL) {
-        return NULL;
+int bdd_serialize_roots(BDD_NODE **roots, int n, FILE *out) {
+    if (n < 1) {
+        return -1;
+    }
+    if (n == 1) {
+        return bdd_serialize(*roots, out);
+    }
+    SERIAL = 0;
+    for (int i = 0; i < BDD_NODES_MAX; i++) {
+        *(INDEX_MAP + i) = 0;
+    }
+    for (int k = 0; k < n; k++) {
+        if (*(roots + k) == NULL) {
+            return -1;
+        }
+    }
+    // With a store attached, each root is a reference into the store,
+    // where the nodes the roots share are stored once.
+    if (bdd_current->store != NULL) {
+        for (int k = 0; k < n; k++) {
+            unsigned long long hash;
+            if (bdd_store_put(bdd_current->store, *(roots + k), &hash) == -1) {
+                return -1;
+            }
+            fputc('$', out);
+            for (int i = 0; i < 8; i++) {
+                fputc(hash >> (i*8), out);
+            }
+            bdd_stats.bytes_out += 9;
+        }
+        return 0;
+    }
+    // The nodes of all the BDDs are written once, whichever BDDs share
+    // them, and are then followed by a reference to each root in turn.
+    int *serials = malloc(n * sizeof(int));
+    if (serials == NULL) {
+        return -1;
+    }
+    for (int k = 0; k < n; k++) {
+        STATS_DEPTH((*(roots + k))->level);
+        *(serials + k) = bshelp(*(roots + k), out);
+    }
+    for (int k = 0; k < n; k++) {
+        int s = *(serials + k);
+        fputc('=', out);
+        fputc(s & 0xFF, out);
+        fputc((s>>8) & 0xFF, out);
+        fputc((s>>16) & 0xFF, out);
+        fputc((s>>24) & 0xFF, out);
+        bdd_stats.bytes_out += 5;
+    }
+    SERIAL += n;
+    free(serials);
+    return 0;
+}
+
+/*
+ * The index of the node with a given serial number, read before the node
+ * with serial number "before", or -1 if there is none.
+ */
+int bdsnode(unsigned int serial, int before) {
+    if (serial < 1 || serial >= (unsigned int)before) {
+        return -1;
     }
-    serial = 0;
+    return *(INDEX_MAP + serial-1);
+}
+
+/*
+ * Read serialized nodes up to the end of the input or of the frame,
+ * leaving SERIAL at the number read and the index of each in the serialization map.  The input
+ * is not trusted: a node is only built if its children were read before
+ * it and lie below it, and if it fits in the node table.
+ */
+int bdshelp(FILE *in) {
+    SERIAL = 0;
     for (int i = 0; i < BDD_NODES_MAX; i++) {
-        *(bdd_index_map + i) = 0;
+        *(INDEX_MAP + i) = 0;
     }
     int c;
     int v;
     do {
         c = fgetc(in);
-        if (feof(in)) {
+        if (feof(in) || c == BDD_FRAME_END) {
             break;
         }
-        serial++;
+        if (SERIAL == BDD_NODES_MAX) {
+            bfull();
+            return -1;
+        }
+        SERIAL++;
         if (c == '@') {
             v = fgetc(in);
             if (feof(in) || v < 0 || v > 255) {
-                return NULL;
+                return -1;
             }
-            *(bdd_index_map + serial-1) = v;
+            *(INDEX_MAP + SERIAL-1) = v;
+            bdd_stats.bytes_in += 2;
         }
         else if ('@' < c && c <= '`') {
             unsigned int vl = 0;
@@ -158,88 +932,448 @@ BDD_NODE *bdd_deserialize(FILE *in) {
             for (int i = 0; i < 4; i++) {
                 v = fgetc(in);
                 if (feof(in) || v < 0 || v > 255) {
-                    return NULL;
+                    return -1;
                 }
                 vl += (v<<(i*8));
             }
             for (int i = 0; i < 4; i++) {
                 v = fgetc(in);
                 if (feof(in) || v < 0 || v > 255) {
-                    return NULL;
+                    return -1;
                 }
                 vr += (v<<(i*8));
             }
-            *(bdd_index_map + serial-1) = bdd_lookup(c-'@', *(bdd_index_map + vl-1), *(bdd_index_map + vr-1)); 
+            int left = bdsnode(vl, SERIAL);
+            int right = bdsnode(vr, SERIAL);
+            if (left == -1 || right == -1 || (NODES + left)->level >= c-'@'
+                || (NODES + right)->level >= c-'@') {
+                return -1;
+            }
+            int index = bdd_lookup(c-'@', left, right);
+            if (index == -1) {
+                bfull();
+                return -1;
+            }
+            *(INDEX_MAP + SERIAL-1) = index;
+            bdd_stats.bytes_in += 9;
+            STATS_DEPTH(c-'@');
         }
-        else {
-            return NULL;
+        else if (c == '$') {
+            // The root of a BDD in the store attached to the manager.
+            unsigned long long hash = 0;
+            for (int i = 0; i < 8; i++) {
+                v = fgetc(in);
+                if (feof(in) || v < 0 || v > 255) {
+                    return -1;
+                }
+                hash |= (unsigned long long)v << (i*8);
+            }
+            BDD_NODE *node = bdd_store_get(bdd_current->store, hash);
+            if (node == NULL) {
+                return -1;
+            }
+            *(INDEX_MAP + SERIAL-1) = node - NODES;
+            bdd_stats.bytes_in += 9;
         }
-    } while (1);
-    return bdd_nodes + *(bdd_index_map + serial-1);
-}
-
-unsigned char bdd_apply(BDD_NODE *node, int r, int c) {
-    if (r >= (1<<((node->level)/2)) || c >= (1<<((node->level)/2)) || r < 0 || c < 0) {
+        else if (c == '#') {
+            // A tile of a hybrid BDD, read straight into the pool.
+            int level = fgetc(in);
+            unsigned char *tile = level < BDD_TILE_LEVEL_MIN || level > BDD_TILE_LEVEL_MAX ? NULL
+                                                                                     : btreserve(level);
+            if (tile == NULL) {
+                return -1;
+            }
+            for (int i = 0; i < 1<<level; i++) {
+                v = fgetc(in);
+                if (feof(in) || v < 0 || v > 255) {
+                    return -1;
+                }
+                *(tile + i) = v;
+            }
+            int index = btcommit(level);
+            if (index == -1) {
+                bfull();
+                return -1;
+            }
+            *(INDEX_MAP + SERIAL-1) = index;
+            bdd_stats.bytes_in += 2 + (1<<level);
+        }
+        else if (c == '=') {
+            // A reference to a node already read, as a root of several BDDs.
+            unsigned int vs = 0;
+            for (int i = 0; i < 4; i++) {
+                v = fgetc(in);
+                if (feof(in) || v < 0 || v > 255) {
+                    return -1;
+                }
+                vs += (v<<(i*8));
+            }
+            int index = bdsnode(vs, SERIAL);
+            if (index == -1) {
+                return -1;
+            }
+            *(INDEX_MAP + SERIAL-1) = index;
+            bdd_stats.bytes_in += 5;
+        }
+        else {
+            return -1;
+        }
+    } while (1);
+    return 0;
+}
+
+BDD_NODE *bdd_deserialize(FILE *in) {
+    if (in == NULL || bdshelp(in) == -1 || SERIAL == 0) {
+        return NULL;
+    }
+    return NODES + *(INDEX_MAP + SERIAL-1);
+}
+
+int bdd_deserialize_roots(FILE *in, BDD_NODE **roots, int n) {
+    if (in == NULL || n < 1 || bdshelp(in) == -1 || SERIAL < n) {
+        return -1;
+    }
+    for (int k = 0; k < n; k++) {
+        *(roots + k) = NODES + *(INDEX_MAP + SERIAL-n+k);
+    }
+    return 0;
+}
+
+unsigned char bdd_apply(BDD_NODE *node, int r, int c) {
+    if (r >= (1<<((node->level)/2)) || c >= (1<<((node->level)/2)) || r < 0 || c < 0) {
         return 0;
     }
     BDD_NODE *n = node;
     while (n->level > 0) {
+        if (TILE(n)) {
+            int rows = 1<<(n->level/2);
+            int cols = 1<<((n->level+1)/2);
+            return *(TILE_DATA(n) + (r & (rows-1))*cols + (c & (cols-1)));
+        }
         if (n->level % 2 == 0) {
             if (((r >> ((n->level - 2) / 2)) & 0x1) == 0) {
-                n = bdd_nodes + n->left;
+                n = NODES + n->left;
             }
             else {
-                n = bdd_nodes + n->right;
+                n = NODES + n->right;
             }
         }
         else {
             if (((c >> ((n->level - 1) / 2)) & 0x1) == 0) {
-                n = bdd_nodes + n->left;
+                n = NODES + n->left;
             }
             else {
-                n = bdd_nodes + n->right;
+                n = NODES + n->right;
             }
         }
     }
-    return n - bdd_nodes;
+    return n - NODES;
 }
 
-int bmhelp(BDD_NODE *node, unsigned char (*func)(unsigned char)) {
+unsigned char bdd_apply_ordered(BDD_NODE *node, BDD_LAYOUT *layout, int r, int c) {
+    unsigned int rmask = LAYOUT_MASK(layout);
+    if (r >= (1<<layout->rbits) || c >= (1<<layout->cbits) || r < 0 || c < 0) {
+        return 0;
+    }
+    BDD_NODE *n = node;
+    while (n->level > 0) {
+        int l = n->level;
+        if (TILE(n)) {
+            int rows = 1<<rowbits(rmask, l);
+            int cols = 1<<(l - rowbits(rmask, l));
+            return *(TILE_DATA(n) + (r & (rows-1))*cols + (c & (cols-1)));
+        }
+        int bit = (rmask >> (l-1)) & 1 ? (r >> rowbits(rmask, l-1)) & 0x1
+                                       : (c >> (l-1 - rowbits(rmask, l-1))) & 0x1;
+        n = NODES + (bit == 0 ? n->left : n->right);
+    }
+    return n - NODES;
+}
+
+int bmhelp(BDD_NODE *node, unsigned char *lut, int *memo, int *stamp, int id) {
     if (node->level == 0) {
-        return func(node - bdd_nodes);
+        return *(lut + (node - NODES));
+    }
+    if (TILE(node)) {
+        return -1;
+    }
+    if (*(stamp + (node - NODES)) == id) {
+        bdd_stats.cache_hits++;
+        return *(memo + (node - NODES));
+    }
+    bdd_stats.cache_misses++;
+    int l = bmhelp(NODES + node->left, lut, memo, stamp, id);
+    int r = bmhelp(NODES + node->right, lut, memo, stamp, id);
+    int result = bdd_lookup(node->level, l, r);
+    *(stamp + (node - NODES)) = id;
+    *(memo + (node - NODES)) = result;
+    return result;
+}
+
+BDD_NODE *bdd_map_table(BDD_NODE *node, unsigned char *lut) {
+    if (node == NULL || lut == NULL) {
+        return NULL;
+    }
+    int id = bwalk(0, 1);
+    if (id == 0) {
+        return NULL;
     }
-    int l = bmhelp(bdd_nodes + node->left, func);
-    int r = bmhelp(bdd_nodes + node->right, func);
-    return bdd_lookup(node->level, l, r);
+    STATS_DEPTH(node->level);
+    return bnode(bmhelp(node, lut, MEMO_VALUES(0), MEMO_STAMPS(0), id));
 }
 
 BDD_NODE *bdd_map(BDD_NODE *node, unsigned char (*func)(unsigned char)) {
     if (node == NULL) {
         return NULL;
     }
-    BDD_NODE *root = (bdd_nodes + bmhelp(node, func));
+    unsigned char *lut = malloc(BDD_NUM_LEAVES);
+    if (lut == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < BDD_NUM_LEAVES; i++) {
+        *(lut + i) = func(i);
+    }
+    BDD_NODE *root = bdd_map_table(node, lut);
+    free(lut);
     return root;
 }
 
-int brhelp(BDD_NODE *node, int level, int r, int c, int d) {
-    if (d == 1) {
-        return bdd_apply(node, r, c);
+/*
+ * Computed table of bdd_combine(): a direct-mapped cache of the results
+ * for pairs of operands, in which a newer entry replaces an older one.
+ */
+typedef struct bco_entry {
+    int a;
+    int b;
+    int result;
+} BCO_ENTRY;
+
+/*
+ * Result of a bitwise operation when it is decided by the operands'
+ * indices alone (both leaves, equal, or one of them 0 or 255), else -1.
+ */
+int bcoterm(int a, int b, int op) {
+    if (a < BDD_NUM_LEAVES && b < BDD_NUM_LEAVES) {
+        return op == BDD_AND ? a & b : op == BDD_OR ? a | b : a ^ b;
+    }
+    if (a == b) {
+        return op == BDD_XOR ? 0 : a;
     }
-    int tl = brhelp(node, level-2, r, c, d/2);
-    int tr = brhelp(node, level-2, r, c + d/2, d/2);
-    int bl = brhelp(node, level-2, r + d/2, c, d/2);
-    int br = brhelp(node, level-2, r + d/2, c + d/2, d/2);
-    int t = bdd_lookup(level-1, tr, br);
-    int b = bdd_lookup(level-1, tl, bl);
-    return bdd_lookup(level, t, b);
+    if (op == BDD_AND) {
+        return a == 0 || b == 0 ? 0 : a == 255 ? b : b == 255 ? a : -1;
+    }
+    if (op == BDD_OR) {
+        return a == 255 || b == 255 ? 255 : a == 0 ? b : b == 0 ? a : -1;
+    }
+    return a == 0 ? b : b == 0 ? a : -1;
+}
+
+int bcohelp(int a, int b, int op, BCO_ENTRY *cache, unsigned int mask) {
+    int result = bcoterm(a, b, op);
+    if (result != -1) {
+        return result;
+    }
+    if (a > b) {
+        int t = a;
+        a = b;
+        b = t;
+    }
+    BCO_ENTRY *entry = cache + (((unsigned int)a * 0x9E3779B1u ^ (unsigned int)b * 0x85EBCA77u) & mask);
+    if (entry->a == a && entry->b == b) {
+        bdd_stats.cache_hits++;
+        return entry->result;
+    }
+    bdd_stats.cache_misses++;
+    BDD_NODE *na = NODES + a;
+    BDD_NODE *nb = NODES + b;
+    if (TILE(na) || TILE(nb)) {
+        return -1;
+    }
+    int level = na->level > nb->level ? na->level : nb->level;
+    int l = bcohelp(LEFT(na, level) - NODES, LEFT(nb, level) - NODES, op, cache, mask);
+    int r = bcohelp(RIGHT(na, level) - NODES, RIGHT(nb, level) - NODES, op, cache, mask);
+    result = bdd_lookup(level, l, r);
+    entry->a = a;
+    entry->b = b;
+    entry->result = result;
+    return result;
+}
+
+BDD_NODE *bdd_combine(BDD_NODE *a, BDD_NODE *b, int op) {
+    if (a == NULL || b == NULL || op < BDD_AND || op > BDD_XOR) {
+        return NULL;
+    }
+    // Entries are zeroed, which no pair of operands reaching the cache
+    // matches, as at least one of them is not a leaf.
+    unsigned int size = 1024;
+    while (size < (unsigned int)USED && size < BDD_NODES_MAX) {
+        size *= 2;
+    }
+    BCO_ENTRY *cache = calloc(size, sizeof(BCO_ENTRY));
+    if (cache == NULL) {
+        return NULL;
+    }
+    STATS_DEPTH(a->level > b->level ? a->level : b->level);
+    BDD_NODE *root = bnode(bcohelp(a - NODES, b - NODES, op, cache, size - 1));
+    free(cache);
+    return root;
+}
+
+int bdd_to_planes(BDD_NODE *node, BDD_NODE **planes) {
+    unsigned char *lut = malloc(BDD_NUM_LEAVES);
+    if (node == NULL || planes == NULL || lut == NULL) {
+        free(lut);
+        return -1;
+    }
+    for (int k = 0; k < BDD_PLANES; k++) {
+        for (int v = 0; v < BDD_NUM_LEAVES; v++) {
+            *(lut + v) = (v >> k) & 1;
+        }
+        if ((*(planes + k) = bdd_map_table(node, lut)) == NULL) {
+            free(lut);
+            return -1;
+        }
+    }
+    free(lut);
+    return 0;
+}
+
+/*
+ * Check that planes k to BDD_PLANES-1 are present and binary: mapping every
+ * value above 1 to 1, and 0 and 1 to 0, gives the leaf 0 only if they are.
+ */
+int bplanescheck(BDD_NODE **planes, int k) {
+    unsigned char *lut = malloc(BDD_NUM_LEAVES);
+    if (planes == NULL || lut == NULL) {
+        free(lut);
+        return -1;
+    }
+    for (int v = 0; v < BDD_NUM_LEAVES; v++) {
+        *(lut + v) = v > 1;
+    }
+    int err = 0;
+    for (int j = k; j < BDD_PLANES && err == 0; j++) {
+        err = *(planes + j) == NULL || bdd_map_table(*(planes + j), lut) != NODES ? -1 : 0;
+    }
+    free(lut);
+    return err;
+}
+
+BDD_NODE *bdd_from_planes(BDD_NODE **planes) {
+    if (bplanescheck(planes, 0) != 0) {
+        return NULL;
+    }
+    unsigned char *lut = calloc(BDD_NUM_LEAVES, 1);
+    if (lut == NULL) {
+        return NULL;
+    }
+    // The planes, scaled to their bit, are disjoint, so their OR is the sum.
+    BDD_NODE *root = NODES;
+    for (int k = 0; k < BDD_PLANES && root != NULL; k++) {
+        *(lut + 1) = 1<<k;
+        BDD_NODE *plane = bdd_map_table(*(planes + k), lut);
+        root = plane == NULL ? NULL : bdd_combine(root, plane, BDD_OR);
+    }
+    free(lut);
+    return root;
+}
+
+BDD_NODE *bdd_planes_threshold(BDD_NODE **planes, int k) {
+    if (k < 0 || k >= BDD_PLANES || bplanescheck(planes, k) != 0) {
+        return NULL;
+    }
+    BDD_NODE *root = NODES;
+    for (int j = BDD_PLANES-1; j >= k && root != NULL; j--) {
+        root = bdd_combine(root, *(planes + j), BDD_OR);
+    }
+    return root;
+}
+
+/*
+ * Each dihedral transformation permutes the four quadrants
+ *
+ *    0  1
+ *    2  3
+ *
+ * of a square (and transforms each of them recursively in the same way).
+ * The permutation is packed two bits per result quadrant: the source of
+ * result quadrant i is given by bits 2i and 2i+1.
+ */
+int dperm(int op) {
+    switch (op) {
+    case BDD_ROT90: return 1 | 3<<2 | 0<<4 | 2<<6;
+    case BDD_ROT180: return 3 | 2<<2 | 1<<4 | 0<<6;
+    case BDD_ROT270: return 2 | 0<<2 | 3<<4 | 1<<6;
+    case BDD_FLIP_H: return 1 | 0<<2 | 3<<4 | 2<<6;
+    case BDD_FLIP_V: return 2 | 3<<2 | 0<<4 | 1<<6;
+    case BDD_TRANSPOSE: return 0 | 2<<2 | 1<<4 | 3<<6;
+    case BDD_ANTITRANSPOSE: return 3 | 1<<2 | 2<<4 | 0<<6;
+    default: return 0 | 1<<2 | 2<<4 | 3<<6;
+    }
+}
+
+#define DQUAD(perm, i, q0, q1, q2, q3) \
+    (((perm)>>(2*(i)) & 0x3) == 0 ? (q0) : ((perm)>>(2*(i)) & 0x3) == 1 ? (q1) : \
+     ((perm)>>(2*(i)) & 0x3) == 2 ? (q2) : (q3))
+
+int bdhelp(BDD_NODE *node, int perm, int *memo, int *stamp, int id) {
+    if (node->level == 0) {
+        return node - NODES;
+    }
+    // A node interpreted above its own level is a tiling of itself, and so
+    // is its transform; only the smallest enclosing square need be computed.
+    int level = node->level + node->level%2;
+    if (*(stamp + (node - NODES)) == id) {
+        bdd_stats.cache_hits++;
+        return *(memo + (node - NODES));
+    }
+    bdd_stats.cache_misses++;
+    if (TILE(node)) {
+        return -1;
+    }
+    BDD_NODE *t = LEFT(node, level);
+    BDD_NODE *b = RIGHT(node, level);
+    if (TILE(t) || TILE(b)) {
+        return -1;
+    }
+    BDD_NODE *q0 = LEFT(t, level-1);
+    BDD_NODE *q1 = RIGHT(t, level-1);
+    BDD_NODE *q2 = LEFT(b, level-1);
+    BDD_NODE *q3 = RIGHT(b, level-1);
+    BDD_NODE *src0 = DQUAD(perm, 0, q0, q1, q2, q3);
+    BDD_NODE *src1 = DQUAD(perm, 1, q0, q1, q2, q3);
+    BDD_NODE *src2 = DQUAD(perm, 2, q0, q1, q2, q3);
+    BDD_NODE *src3 = DQUAD(perm, 3, q0, q1, q2, q3);
+    int top = bdd_lookup(level-1, bdhelp(src0, perm, memo, stamp, id),
+                         bdhelp(src1, perm, memo, stamp, id));
+    int bot = bdd_lookup(level-1, bdhelp(src2, perm, memo, stamp, id),
+                         bdhelp(src3, perm, memo, stamp, id));
+    int result = bdd_lookup(level, top, bot);
+    *(stamp + (node - NODES)) = id;
+    *(memo + (node - NODES)) = result;
+    return result;
+}
+
+BDD_NODE *bdd_dihedral(BDD_NODE *node, int level, int op) {
+    if (node == NULL || level%2 != 0 || level < node->level || op < 0 || op > BDD_ANTITRANSPOSE) {
+        return NULL;
+    }
+    if (op == BDD_IDENTITY) {
+        return node;
+    }
+    int id = bwalk(0, 1);
+    if (id == 0) {
+        return NULL;
+    }
+    STATS_DEPTH(level);
+    return bnode(bdhelp(node, dperm(op), MEMO_VALUES(0), MEMO_STAMPS(0), id));
 }
 
 BDD_NODE *bdd_rotate(BDD_NODE *node, int level) {
     if (node == NULL || level%2 != 0 || level < 0) {
         return NULL;
     }
-    BDD_NODE *root = (bdd_nodes + brhelp(node, level, 0, 0, 1<<(level/2)));
-    return root;
+    return bdd_dihedral(node, level, BDD_ROT90);
 }
 
 int zoom_in(BDD_NODE *node, int level, int r, int c, int w, int h, int factor) {
@@ -291,7 +1425,7 @@ BDD_NODE *bdd_zoom(BDD_NODE *node, int level, int factor) {
         if (level + 2*factor > 32) {
             return NULL;
         }
-        BDD_NODE *root = (bdd_nodes + zoom_in(node, level, 0, 0, 1<<(level/2), 1<<(level/2), 2*factor));
+        BDD_NODE *root = bnode(zoom_in(node, level, 0, 0, 1<<(level/2), 1<<(level/2), 2*factor));
         return root;
     } 
     else {
@@ -299,7 +1433,1124 @@ BDD_NODE *bdd_zoom(BDD_NODE *node, int level, int factor) {
         if (sign > level/2) {
             sign = level/2;
         }
-        BDD_NODE *root = (bdd_nodes + zoom_out(node, level, 0, 0, 1<<(level/2), 1<<(level/2), 2*sign));
+        BDD_NODE *root = bnode(zoom_out(node, level, 0, 0, 1<<(level/2), 1<<(level/2), 2*sign));
         return root;
     }
 }
+
+/*
+ * Number of rows and columns of the region covered by a node interpreted
+ * at a given level.  Even levels split rows and odd levels split columns,
+ * so a level l region is 2^(l/2) rows by 2^((l+1)/2) columns.
+ */
+#define ROWS(l) (1<<((l)/2))
+#define COLS(l) (1<<(((l)+1)/2))
+
+/*
+ * Number of pixels in the intersection of the clip rectangle with the
+ * region of the given size whose top-left corner is at (r, c).
+ */
+unsigned long long rect_overlap(int r, int c, int rows, int cols, BDD_RECT *clip) {
+    int r0 = r > clip->r0 ? r : clip->r0;
+    int c0 = c > clip->c0 ? c : clip->c0;
+    int r1 = r + rows < clip->r1 ? r + rows : clip->r1;
+    int c1 = c + cols < clip->c1 ? c + cols : clip->c1;
+    if (r0 >= r1 || c0 >= c1) {
+        return 0;
+    }
+    return (unsigned long long)(r1 - r0) * (c1 - c0);
+}
+
+/*
+ * The same for a layout with row mask m (see bdd_order_mask()), in which the
+ * variable at level l splits rows if LROWSPLIT(m, l).  ROWS and COLS are
+ * these for the square BDD_ORDER_RC layout, whose row mask is RC_MASK.
+ */
+#define RC_MASK 0xAAAAAAAAu
+#define LROWS(m, l) (1<<rowbits(m, l))
+#define LCOLS(m, l) (1<<((l) - rowbits(m, l)))
+#define LROWSPLIT(m, l) (((m) >> ((l)-1)) & 1)
+
+#define DISJOINT(r, c, rows, cols, clip) \
+    ((r) >= (clip)->r1 || (c) >= (clip)->c1 || (r) + (rows) <= (clip)->r0 || (c) + (cols) <= (clip)->c0)
+#define INSIDE(r, c, rows, cols, clip) \
+    ((r) >= (clip)->r0 && (c) >= (clip)->c0 && (r) + (rows) <= (clip)->r1 && (c) + (cols) <= (clip)->c1)
+
+/*
+ * List the nodes reachable from an index in post-order, skipping those
+ * already listed, and clear their weights as they are first reached.
+ */
+void bhorder(int index, int *order, int *count, unsigned long long *weight, int *stamp, int id) {
+    if (index < BDD_NUM_LEAVES || *(stamp + index) == id) {
+        return;
+    }
+    *(stamp + index) = id;
+    *(weight + MEMO_WIDE*index) = 0;
+    bhorder((NODES + index)->left, order, count, weight, stamp, id);
+    bhorder((NODES + index)->right, order, count, weight, stamp, id);
+    *(order + *count) = index;
+    (*count)++;
+}
+
+void bhhelp(BDD_NODE *node, int level, int r, int c, BDD_RECT *clip, unsigned long long *weight,
+            unsigned long long *hist, int *order, int *count, int *stamp, int id) {
+    int rows = ROWS(level);
+    int cols = COLS(level);
+    if (DISJOINT(r, c, rows, cols, clip)) {
+        return;
+    }
+    if (node->level == 0) {
+        *(hist + (node - NODES)) += rect_overlap(r, c, rows, cols, clip);
+        return;
+    }
+    if (INSIDE(r, c, rows, cols, clip)) {
+        bhorder(node - NODES, order, count, weight, stamp, id);
+        *(weight + MEMO_WIDE*(node - NODES)) += 1ULL<<(level - node->level);
+        return;
+    }
+    if (level%2 == 0) {
+        bhhelp(LEFT(node, level), level-1, r, c, clip, weight, hist, order, count, stamp, id);
+        bhhelp(RIGHT(node, level), level-1, r + rows/2, c, clip, weight, hist, order, count, stamp,
+               id);
+    } else {
+        bhhelp(LEFT(node, level), level-1, r, c, clip, weight, hist, order, count, stamp, id);
+        bhhelp(RIGHT(node, level), level-1, r, c + cols/2, clip, weight, hist, order, count, stamp,
+               id);
+    }
+}
+
+int bdd_histogram(BDD_NODE *node, int level, int w, int h, unsigned long long *hist) {
+    if (node == NULL || hist == NULL || level < node->level || level > BDD_LEVELS_MAX) {
+        return -1;
+    }
+    for (int i = 0; i < BDD_NUM_LEAVES; i++) {
+        *(hist + i) = 0;
+    }
+    // The weights of the nodes are in the wide memo table, and the list of
+    // the nodes in post-order in the values of pair 0, as no node's value
+    // is looked up by the walk.
+    int id = bwalk(0, 1);
+    unsigned long long *weight = bwide();
+    if (id == 0 || weight == NULL) {
+        return -1;
+    }
+    int *order = MEMO_VALUES(0);
+    BDD_RECT clip = {0, 0, h, w};
+    int count = 0;
+    bhhelp(node, level, 0, 0, &clip, weight, hist, order, &count, MEMO_STAMPS(0), id);
+    // Post-order lists children before parents, so walk it backwards.
+    for (int i = count-1; i >= 0; i--) {
+        BDD_NODE *n = NODES + *(order + i);
+        unsigned long long m = *(weight + MEMO_WIDE * *(order + i));
+        int l = n->left;
+        int r = n->right;
+        unsigned long long ml = m<<(n->level - 1 - (NODES + l)->level);
+        unsigned long long mr = m<<(n->level - 1 - (NODES + r)->level);
+        *(l < BDD_NUM_LEAVES ? hist + l : weight + MEMO_WIDE*l) += ml;
+        *(r < BDD_NUM_LEAVES ? hist + r : weight + MEMO_WIDE*r) += mr;
+    }
+    return 0;
+}
+
+/*
+ * Bounding box, relative to the node's own level, of the pixels whose value
+ * is selected by the match table.  The box is stored in the wide memo table
+ * as four ints (r0, c0, r1, c1) with r1 and c1 exclusive; r0 is -1 if
+ * nothing matches.
+ */
+int *bbmemo(int index, unsigned int rmask, char *match, int *memo, int *stamp, int id) {
+    int *box = memo + 4*index;
+    if (*(stamp + index) == id) {
+        bdd_stats.cache_hits++;
+        return box;
+    }
+    bdd_stats.cache_misses++;
+    *(stamp + index) = id;
+    if (index < BDD_NUM_LEAVES) {
+        *box = *(match + index) ? 0 : -1;
+        *(box + 1) = 0;
+        *(box + 2) = 1;
+        *(box + 3) = 1;
+        return box;
+    }
+    BDD_NODE *n = NODES + index;
+    int *lb = bbmemo(n->left, rmask, match, memo, stamp, id);
+    int *rb = bbmemo(n->right, rmask, match, memo, stamp, id);
+    int ll = (NODES + n->left)->level;
+    int rl = (NODES + n->right)->level;
+    int rows = LROWS(rmask, n->level-1);
+    int cols = LCOLS(rmask, n->level-1);
+    // Children interpreted at level-1 are tilings of their own level.
+    int dr = LROWSPLIT(rmask, n->level) ? rows : 0;
+    int dc = LROWSPLIT(rmask, n->level) ? 0 : cols;
+    *box = -1;
+    if (*lb >= 0) {
+        *box = *lb;
+        *(box + 1) = *(lb + 1);
+        *(box + 2) = *(lb + 2) + rows - LROWS(rmask, ll);
+        *(box + 3) = *(lb + 3) + cols - LCOLS(rmask, ll);
+    }
+    if (*rb >= 0) {
+        int r0 = *rb + dr;
+        int c0 = *(rb + 1) + dc;
+        int r1 = *(rb + 2) + rows - LROWS(rmask, rl) + dr;
+        int c1 = *(rb + 3) + cols - LCOLS(rmask, rl) + dc;
+        if (*box < 0) {
+            *box = r0;
+            *(box + 1) = c0;
+            *(box + 2) = r1;
+            *(box + 3) = c1;
+        } else {
+            *box = r0 < *box ? r0 : *box;
+            *(box + 1) = c0 < *(box + 1) ? c0 : *(box + 1);
+            *(box + 2) = r1 > *(box + 2) ? r1 : *(box + 2);
+            *(box + 3) = c1 > *(box + 3) ? c1 : *(box + 3);
+        }
+    }
+    return box;
+}
+
+void bbmerge(BDD_RECT *box, int r0, int c0, int r1, int c1, int *found) {
+    if (!*found) {
+        box->r0 = r0;
+        box->c0 = c0;
+        box->r1 = r1;
+        box->c1 = c1;
+        *found = 1;
+        return;
+    }
+    box->r0 = r0 < box->r0 ? r0 : box->r0;
+    box->c0 = c0 < box->c0 ? c0 : box->c0;
+    box->r1 = r1 > box->r1 ? r1 : box->r1;
+    box->c1 = c1 > box->c1 ? c1 : box->c1;
+}
+
+void bbhelp(BDD_NODE *node, int level, unsigned int rmask, int r, int c, BDD_RECT *clip,
+            char *match, int *memo, int *stamp, int id, BDD_RECT *box, int *found) {
+    int rows = LROWS(rmask, level);
+    int cols = LCOLS(rmask, level);
+    if (DISJOINT(r, c, rows, cols, clip)) {
+        return;
+    }
+    int *nb = bbmemo(node - NODES, rmask, match, memo, stamp, id);
+    if (*nb < 0) {
+        return;
+    }
+    if (node->level == 0) {
+        int r0 = r > clip->r0 ? r : clip->r0;
+        int c0 = c > clip->c0 ? c : clip->c0;
+        int r1 = r + rows < clip->r1 ? r + rows : clip->r1;
+        int c1 = c + cols < clip->c1 ? c + cols : clip->c1;
+        bbmerge(box, r0, c0, r1, c1, found);
+        return;
+    }
+    if (INSIDE(r, c, rows, cols, clip)) {
+        bbmerge(box, r + *nb, c + *(nb + 1), r + *(nb + 2) + rows - LROWS(rmask, node->level),
+                c + *(nb + 3) + cols - LCOLS(rmask, node->level), found);
+        return;
+    }
+    int split = LROWSPLIT(rmask, level);
+    bbhelp(LEFT(node, level), level-1, rmask, r, c, clip, match, memo, stamp, id, box, found);
+    bbhelp(RIGHT(node, level), level-1, rmask, split ? r + rows/2 : r, split ? c : c + cols/2,
+           clip, match, memo, stamp, id, box, found);
+}
+
+int bbfind(BDD_NODE *node, int level, unsigned int rmask, BDD_RECT *clip, char *match,
+           BDD_RECT *box) {
+    if (clip->r0 >= clip->r1 || clip->c0 >= clip->c1) {
+        return -1;
+    }
+    int id = bwalk(0, 1);
+    int *memo = (int *)bwide();
+    if (id == 0 || memo == NULL) {
+        return -1;
+    }
+    int found = 0;
+    bbhelp(node, level, rmask, 0, 0, clip, match, memo, MEMO_STAMPS(0), id, box, &found);
+    return found ? 0 : -1;
+}
+
+/*
+ * A BDD can be given to a function taking a layout if the layout is valid
+ * and has at least the levels of the BDD.
+ */
+#define LAYOUT_FITS(node, lp) ((node) != NULL && LAYOUT_OK(lp) && \
+                               (node)->level <= (lp)->rbits + (lp)->cbits)
+
+int bdd_bbox(BDD_NODE *node, BDD_LAYOUT *layout, BDD_RECT *clip, unsigned char bg, BDD_RECT *box) {
+    if (!LAYOUT_FITS(node, layout) || clip == NULL || box == NULL) {
+        return -1;
+    }
+    char *match = malloc(BDD_NUM_LEAVES);
+    if (match == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < BDD_NUM_LEAVES; i++) {
+        *(match + i) = (i != bg);
+    }
+    int err = bbfind(node, layout->rbits + layout->cbits, LAYOUT_MASK(layout), clip, match, box);
+    free(match);
+    return err;
+}
+
+int bdd_find_first(BDD_NODE *node, BDD_LAYOUT *layout, BDD_RECT *clip, int (*pred)(unsigned char),
+                   int *rp, int *cp) {
+    if (!LAYOUT_FITS(node, layout) || clip == NULL || pred == NULL) {
+        return -1;
+    }
+    char *match = malloc(BDD_NUM_LEAVES);
+    if (match == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < BDD_NUM_LEAVES; i++) {
+        *(match + i) = pred(i) != 0;
+    }
+    // The first match in raster order lies in the topmost matching row,
+    // at the leftmost matching column of that row.
+    int level = layout->rbits + layout->cbits;
+    unsigned int rmask = LAYOUT_MASK(layout);
+    BDD_RECT box;
+    int err = bbfind(node, level, rmask, clip, match, &box);
+    if (err == 0) {
+        BDD_RECT row = {box.r0, clip->c0, box.r0 + 1, clip->c1};
+        err = bbfind(node, level, rmask, &row, match, &box);
+    }
+    if (err == 0) {
+        *rp = box.r0;
+        *cp = box.c0;
+    }
+    free(match);
+    return err;
+}
+
+/*
+ * Sum, over all pixels of a node at its own level, of the per-value weights
+ * in the table "value".
+ */
+unsigned long long rsmemo(int index, unsigned long long *value, unsigned long long *memo, int *stamp,
+                          int id) {
+    if (index < BDD_NUM_LEAVES) {
+        return *(value + index);
+    }
+    if (*(stamp + index) == id) {
+        bdd_stats.cache_hits++;
+        return *(memo + MEMO_WIDE*index);
+    }
+    bdd_stats.cache_misses++;
+    BDD_NODE *n = NODES + index;
+    unsigned long long l = rsmemo(n->left, value, memo, stamp, id);
+    unsigned long long r = rsmemo(n->right, value, memo, stamp, id);
+    l <<= n->level - 1 - (NODES + n->left)->level;
+    r <<= n->level - 1 - (NODES + n->right)->level;
+    *(stamp + index) = id;
+    *(memo + MEMO_WIDE*index) = l + r;
+    return l + r;
+}
+
+unsigned long long rshelp(BDD_NODE *node, int level, unsigned int rmask, int r, int c, BDD_RECT *clip,
+                          unsigned long long *value, unsigned long long *memo, int *stamp, int id) {
+    int rows = LROWS(rmask, level);
+    int cols = LCOLS(rmask, level);
+    if (DISJOINT(r, c, rows, cols, clip)) {
+        return 0;
+    }
+    if (node->level == 0) {
+        return *(value + (node - NODES)) * rect_overlap(r, c, rows, cols, clip);
+    }
+    if (INSIDE(r, c, rows, cols, clip)) {
+        return rsmemo(node - NODES, value, memo, stamp, id)<<(level - node->level);
+    }
+    int split = LROWSPLIT(rmask, level);
+    return rshelp(LEFT(node, level), level-1, rmask, r, c, clip, value, memo, stamp, id)
+        + rshelp(RIGHT(node, level), level-1, rmask, split ? r + rows/2 : r, split ? c : c + cols/2,
+                 clip, value, memo, stamp, id);
+}
+
+unsigned long long rsreduce(BDD_NODE *node, BDD_LAYOUT *layout, BDD_RECT *rect,
+                            unsigned long long *value) {
+    int id = bwalk(0, 1);
+    unsigned long long *memo = bwide();
+    if (id == 0 || memo == NULL) {
+        return 0;
+    }
+    return rshelp(node, layout->rbits + layout->cbits, LAYOUT_MASK(layout), 0, 0, rect, value, memo,
+                  MEMO_STAMPS(0), id);
+}
+
+void btshelp(BDD_NODE *node, int level, int r, int c, BDD_RECT *clip, int k, unsigned char *raster,
+             unsigned long long *value, unsigned long long *memo, int *stamp, int id) {
+    int rows = ROWS(level);
+    int cols = COLS(level);
+    if (DISJOINT(r, c, rows, cols, clip)) {
+        return;
+    }
+    int ow = (clip->c1 + (1<<k) - 1)>>k;
+    int oh = (clip->r1 + (1<<k) - 1)>>k;
+    if (node->level == 0) {
+        // A constant region fills every output pixel it covers.
+        int r1 = (r + rows)>>k < oh ? (r + rows)>>k : oh;
+        int c1 = (c + cols)>>k < ow ? (c + cols)>>k : ow;
+        for (int i = r>>k; i < r1; i++) {
+            for (int j = c>>k; j < c1; j++) {
+                *(raster + i*ow + j) = node - NODES;
+            }
+        }
+        return;
+    }
+    if (level == 2*k) {
+        unsigned long long area = rect_overlap(r, c, rows, cols, clip);
+        unsigned long long sum = rshelp(node, level, RC_MASK, r, c, clip, value, memo, stamp, id);
+        *(raster + (r>>k)*ow + (c>>k)) = (sum + area/2) / area;
+        return;
+    }
+    if (level%2 == 0) {
+        btshelp(LEFT(node, level), level-1, r, c, clip, k, raster, value, memo, stamp, id);
+        btshelp(RIGHT(node, level), level-1, r + rows/2, c, clip, k, raster, value, memo, stamp, id);
+    } else {
+        btshelp(LEFT(node, level), level-1, r, c, clip, k, raster, value, memo, stamp, id);
+        btshelp(RIGHT(node, level), level-1, r, c + cols/2, clip, k, raster, value, memo, stamp, id);
+    }
+}
+
+int bdd_to_raster_scaled(BDD_NODE *node, int level, int w, int h, int k, unsigned char *raster) {
+    if (node == NULL || raster == NULL || level < node->level || level > BDD_LEVELS_MAX
+        || k < 0 || 2*k > level) {
+        return -1;
+    }
+    int id = bwalk(0, 1);
+    unsigned long long *memo = bwide();
+    unsigned long long *value = malloc(BDD_NUM_LEAVES * sizeof(unsigned long long));
+    if (id == 0 || memo == NULL || value == NULL) {
+        free(value);
+        return -1;
+    }
+    for (int i = 0; i < BDD_NUM_LEAVES; i++) {
+        *(value + i) = i;
+    }
+    // Every block sum is a reduction within one walk, so a node's sum is
+    // reused by all the blocks under which it lies.
+    BDD_RECT clip = {0, 0, h, w};
+    btshelp(node, level, 0, 0, &clip, k, raster, value, memo, MEMO_STAMPS(0), id);
+    free(value);
+    return 0;
+}
+
+unsigned long long bdd_rect_sum(BDD_NODE *node, BDD_LAYOUT *layout, BDD_RECT *rect) {
+    if (!LAYOUT_FITS(node, layout) || rect == NULL) {
+        return 0;
+    }
+    unsigned long long *value = malloc(BDD_NUM_LEAVES * sizeof(unsigned long long));
+    if (value == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < BDD_NUM_LEAVES; i++) {
+        *(value + i) = i;
+    }
+    unsigned long long sum = rsreduce(node, layout, rect, value);
+    free(value);
+    return sum;
+}
+
+unsigned long long bdd_rect_count(BDD_NODE *node, BDD_LAYOUT *layout, BDD_RECT *rect,
+                                  unsigned char bg) {
+    if (!LAYOUT_FITS(node, layout) || rect == NULL) {
+        return 0;
+    }
+    unsigned long long *value = malloc(BDD_NUM_LEAVES * sizeof(unsigned long long));
+    if (value == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < BDD_NUM_LEAVES; i++) {
+        *(value + i) = (i != bg);
+    }
+    unsigned long long count = rsreduce(node, layout, rect, value);
+    free(value);
+    return count;
+}
+
+/*
+ * Build the node at the given level of the destination layout, whose row
+ * mask is dmask, covering the region whose top-left corner is at (r, c), in
+ * which the pixel at (i, j) is the source pixel at (i - dr, j - dc) if that
+ * pixel lies in the window "win" (given in source coordinates), and the fill
+ * value otherwise.  Destination blocks that map onto a source block of the
+ * same level and shape, or onto a constant region of the source, are taken
+ * directly from the source, so only the nodes along the window boundary (and
+ * any unaligned interior) are rebuilt.
+ */
+int bwhelp(BDD_NODE *src, int slevel, unsigned int smask, BDD_RECT *win, int dr, int dc, int fill,
+           int level, unsigned int dmask, int r, int c) {
+    int rows = LROWS(dmask, level);
+    int cols = LCOLS(dmask, level);
+    BDD_RECT dwin = {win->r0 + dr, win->c0 + dc, win->r1 + dr, win->c1 + dc};
+    if (DISJOINT(r, c, rows, cols, &dwin)) {
+        return fill;
+    }
+    if (INSIDE(r, c, rows, cols, &dwin)) {
+        int sr = r - dr;
+        int sc = c - dc;
+        BDD_NODE *n = src;
+        int l = slevel;
+        int nr = 0;
+        int nc = 0;
+        while (l > level && n->level > 0) {
+            if (TILE(n)) {
+                return -1;
+            }
+            int split = LROWSPLIT(smask, l);
+            int half = split ? LROWS(smask, l)/2 : LCOLS(smask, l)/2;
+            int lo = split ? sr - nr : sc - nc;
+            int hi = split ? sr + rows - nr : sc + cols - nc;
+            if (hi <= half) {
+                n = LEFT(n, l);
+            } else if (lo >= half) {
+                n = RIGHT(n, l);
+                if (split) {
+                    nr += half;
+                } else {
+                    nc += half;
+                }
+            } else {
+                break;
+            }
+            l--;
+        }
+        if (n->level == 0 || (l == level && nr == sr && nc == sc
+                              && ((smask ^ dmask) & LOWMASK(level)) == 0)) {
+            return n - NODES;
+        }
+    }
+    int split = LROWSPLIT(dmask, level);
+    int left = bwhelp(src, slevel, smask, win, dr, dc, fill, level-1, dmask, r, c);
+    int right = bwhelp(src, slevel, smask, win, dr, dc, fill, level-1, dmask,
+                       split ? r + rows/2 : r, split ? c : c + cols/2);
+    return bdd_lookup(level, left, right);
+}
+
+/*
+ * Clamp a window to the source array and build the translated result.
+ */
+BDD_NODE *bwindow(BDD_NODE *node, BDD_LAYOUT *layout, BDD_RECT *win, int dr, int dc, int fill,
+                  BDD_LAYOUT *dlayout) {
+    if (!LAYOUT_FITS(node, layout) || win == NULL || !LAYOUT_OK(dlayout)) {
+        return NULL;
+    }
+    BDD_RECT clamped = *win;
+    long long rows = 1LL<<layout->rbits;
+    long long cols = 1LL<<layout->cbits;
+    clamped.r0 = clamped.r0 < 0 ? 0 : clamped.r0;
+    clamped.c0 = clamped.c0 < 0 ? 0 : clamped.c0;
+    clamped.r1 = clamped.r1 > rows ? rows : clamped.r1;
+    clamped.c1 = clamped.c1 > cols ? cols : clamped.c1;
+    return bnode(bwhelp(node, layout->rbits + layout->cbits, LAYOUT_MASK(layout), &clamped,
+                        dr, dc, fill, dlayout->rbits + dlayout->cbits, LAYOUT_MASK(dlayout), 0, 0));
+}
+
+BDD_NODE *bdd_crop(BDD_NODE *node, BDD_LAYOUT *layout, BDD_RECT *rect, BDD_LAYOUT *dlayout) {
+    if (rect == NULL || rect->r1 <= rect->r0 || rect->c1 <= rect->c0 || !LAYOUT_OK(dlayout)
+        || rect->r1 - rect->r0 > 1LL<<dlayout->rbits || rect->c1 - rect->c0 > 1LL<<dlayout->cbits) {
+        return NULL;
+    }
+    return bwindow(node, layout, rect, -rect->r0, -rect->c0, 0, dlayout);
+}
+
+BDD_NODE *bdd_pad(BDD_NODE *node, BDD_LAYOUT *layout, int w, int h, int top, int left,
+                  BDD_LAYOUT *dlayout, unsigned char fill) {
+    if (top < 0 || left < 0 || !LAYOUT_OK(dlayout)
+        || (long long)top + h > 1LL<<dlayout->rbits || (long long)left + w > 1LL<<dlayout->cbits) {
+        return NULL;
+    }
+    BDD_RECT rect = {0, 0, h, w};
+    return bwindow(node, layout, &rect, top, left, fill, dlayout);
+}
+
+BDD_NODE *bdd_shift(BDD_NODE *node, BDD_LAYOUT *layout, int dr, int dc) {
+    if (!LAYOUT_OK(layout)) {
+        return NULL;
+    }
+    BDD_RECT rect = {0, 0, 1<<layout->rbits, 1<<layout->cbits};
+    return bwindow(node, layout, &rect, dr, dc, 0, layout);
+}
+
+/*
+ * Set the pixels of the block at (r, c) that lie in a rectangle to a value.
+ * Blocks clear of the rectangle are returned as they are, and those inside
+ * it become a leaf, so only the blocks straddling its edges are rebuilt.
+ */
+int bfillhelp(BDD_NODE *node, int level, unsigned int rmask, BDD_RECT *rect, int r, int c, int v) {
+    int rows = LROWS(rmask, level);
+    int cols = LCOLS(rmask, level);
+    if (DISJOINT(r, c, rows, cols, rect)) {
+        return node - NODES;
+    }
+    if (INSIDE(r, c, rows, cols, rect)) {
+        return v;
+    }
+    if (TILE(node)) {
+        return -1;
+    }
+    int split = LROWSPLIT(rmask, level);
+    int left = bfillhelp(LEFT(node, level), level-1, rmask, rect, r, c, v);
+    int right = bfillhelp(RIGHT(node, level), level-1, rmask, rect,
+                          split ? r + rows/2 : r, split ? c : c + cols/2, v);
+    return bdd_lookup(level, left, right);
+}
+
+BDD_NODE *bdd_fill_rect(BDD_NODE *node, BDD_LAYOUT *layout, BDD_RECT *rect, unsigned char v) {
+    if (!LAYOUT_FITS(node, layout) || rect == NULL) {
+        return NULL;
+    }
+    long long rows = 1LL<<layout->rbits;
+    long long cols = 1LL<<layout->cbits;
+    BDD_RECT clamped = *rect;
+    clamped.r0 = clamped.r0 < 0 ? 0 : clamped.r0;
+    clamped.c0 = clamped.c0 < 0 ? 0 : clamped.c0;
+    clamped.r1 = clamped.r1 > rows ? rows : clamped.r1;
+    clamped.c1 = clamped.c1 > cols ? cols : clamped.c1;
+    if (clamped.r1 <= clamped.r0 || clamped.c1 <= clamped.c0) {
+        return node;
+    }
+    int level = layout->rbits + layout->cbits;
+    STATS_DEPTH(level);
+    return bnode(bfillhelp(node, level, LAYOUT_MASK(layout), &clamped, 0, 0, v));
+}
+
+BDD_NODE *bdd_set_pixel(BDD_NODE *node, BDD_LAYOUT *layout, int r, int c, unsigned char v) {
+    if (!LAYOUT_OK(layout) || r < 0 || c < 0 || r >= 1LL<<layout->rbits || c >= 1LL<<layout->cbits) {
+        return NULL;
+    }
+    BDD_RECT rect = {r, c, r + 1, c + 1};
+    return bdd_fill_rect(node, layout, &rect, v);
+}
+
+/*
+ * Restrict the function represented by a node by fixing the variable at
+ * level sl to the value b.  Results are memoized for the duration of one
+ * restriction, identified by a stamp.
+ */
+int bcofhelp(int index, int sl, int b, int *memo, int *stamp, int id) {
+    BDD_NODE *node = NODES + index;
+    if (index < BDD_NUM_LEAVES || node->level < sl) {
+        return index;
+    }
+    if (node->level == sl) {
+        return b ? node->right : node->left;
+    }
+    if (*(stamp + index) == id) {
+        bdd_stats.cache_hits++;
+        return *(memo + index);
+    }
+    bdd_stats.cache_misses++;
+    int l = bcofhelp(node->left, sl, b, memo, stamp, id);
+    int r = bcofhelp(node->right, sl, b, memo, stamp, id);
+    int result = bdd_lookup(node->level, l, r);
+    *(stamp + index) = id;
+    *(memo + index) = result;
+    return result;
+}
+
+/*
+ * Scratch space for a reordering.  For each level tl of the result, src
+ * gives the level of the same variable in the original layout, or 0 if the
+ * original has no such variable, in which case the array is zero wherever
+ * the variable is set.  The levels of such variables are given by pmask.
+ * The function to be placed below a node of the result at level tl is one
+ * in which all variables above tl have been fixed, so the node built for it
+ * depends only on the function and on tl; it is kept in result, stamped in
+ * at with base + tl.  The restrictions are memoized in memo, each with a
+ * stamp of its own.
+ */
+typedef struct bro_state {
+    int *src;
+    unsigned int pmask;
+    int *result;
+    int *at;
+    int base;
+    int *memo;
+    int *stamp;
+} BRO_STATE;
+
+int brohelp(int index, int tl, BRO_STATE *st) {
+    if (index < 0) {
+        return -1;
+    }
+    if (tl == 0 || (index < BDD_NUM_LEAVES && (st->pmask & LOWMASK(tl)) == 0)) {
+        return index;
+    }
+    if (*(st->at + index) == st->base + tl) {
+        bdd_stats.cache_hits++;
+        return *(st->result + index);
+    }
+    bdd_stats.cache_misses++;
+    int sl = *(st->src + tl);
+    int l, r;
+    if (sl == 0) {
+        l = brohelp(index, tl-1, st);
+        r = 0;
+    } else {
+        int f0 = bcofhelp(index, sl, 0, st->memo, st->stamp, bwalk(1, 1));
+        int f1 = bcofhelp(index, sl, 1, st->memo, st->stamp, bwalk(1, 1));
+        l = brohelp(f0, tl-1, st);
+        r = brohelp(f1, tl-1, st);
+    }
+    int result = bdd_lookup(tl, l, r);
+    *(st->at + index) = st->base + tl;
+    *(st->result + index) = result;
+    return result;
+}
+
+/*
+ * The level of the variable for bit k of a row (row != 0) or column index in
+ * a layout with row mask rmask and the given number of levels, or 0 if the
+ * layout has no such variable.
+ */
+int blevel(unsigned int rmask, int levels, int row, int k) {
+    for (int l = 1; l <= levels; l++) {
+        int lrow = (rmask >> (l-1)) & 1;
+        int lk = lrow ? rowbits(rmask, l-1) : l-1 - rowbits(rmask, l-1);
+        if (lrow == row && lk == k) {
+            return l;
+        }
+    }
+    return 0;
+}
+
+BDD_NODE *bdd_reorder(BDD_NODE *node, BDD_LAYOUT *from, BDD_LAYOUT *to) {
+    if (node == NULL || !LAYOUT_OK(from) || !LAYOUT_OK(to)
+        || from->rbits + from->cbits < node->level) {
+        return NULL;
+    }
+    if (from->order == to->order && from->rbits == to->rbits && from->cbits == to->cbits) {
+        return node;
+    }
+    int flevels = from->rbits + from->cbits;
+    int tlevels = to->rbits + to->cbits;
+    unsigned int fmask = LAYOUT_MASK(from);
+    unsigned int tmask = LAYOUT_MASK(to);
+    // Nodes are created during the reordering, so the scratch tables must
+    // cover the whole node table; those of the manager do, and need no
+    // clearing.
+    BRO_STATE st = {malloc((tlevels + 1) * sizeof(int)), 0, NULL, NULL,
+                    bwalk(0, BDD_LEVELS_MAX + 1) - 1, NULL, NULL};
+    if (st.src == NULL || st.base == -1) {
+        free(st.src);
+        return NULL;
+    }
+    st.result = MEMO_VALUES(0);
+    st.at = MEMO_STAMPS(0);
+    st.memo = MEMO_VALUES(1);
+    st.stamp = MEMO_STAMPS(1);
+    // The variable at level tl of the result is bit k of a row or column
+    // index, where k counts the levels of the same axis below tl.
+    for (int tl = 1; tl <= tlevels; tl++) {
+        int row = (tmask >> (tl-1)) & 1;
+        int k = row ? rowbits(tmask, tl-1) : tl-1 - rowbits(tmask, tl-1);
+        *(st.src + tl) = blevel(fmask, flevels, row, k);
+        if (*(st.src + tl) == 0) {
+            st.pmask |= 1u<<(tl-1);
+        }
+    }
+    // Variables for bits beyond those of the result are fixed at 0, leaving
+    // the top-left part of the original.
+    int index = node - NODES;
+    for (int k = to->rbits; k < from->rbits; k++) {
+        index = bcofhelp(index, blevel(fmask, flevels, 1, k), 0, st.memo, st.stamp, bwalk(1, 1));
+    }
+    for (int k = to->cbits; k < from->cbits; k++) {
+        index = bcofhelp(index, blevel(fmask, flevels, 0, k), 0, st.memo, st.stamp, bwalk(1, 1));
+    }
+    STATS_DEPTH(tlevels);
+    BDD_NODE *root = bnode(brohelp(index, tlevels, &st));
+    free(st.src);
+    return root;
+}
+
+/*
+ * State of bdd_to_hybrid(): the level of the blocks, the result for each
+ * node (plus one, 0 if not yet known), stamps marking the nodes met in the
+ * current block, and the number of distinct blocks in which each node lies.
+ * Each node is only ever met at one level: its own or, if lower, that of
+ * the blocks.
+ */
+typedef struct bhy_state {
+    unsigned int rmask;
+    int level;
+    int *memo;
+    int *stamp;
+    int *refs;
+    int id;
+} BHY_STATE;
+
+/*
+ * Walk the distinct nodes of the current block, counting those that lie in
+ * no other block (or, if refs, counting the block in each node).  Nodes
+ * shared with other blocks are not charged to the block, since they are
+ * likely to be kept for the others anyway.
+ */
+int bhycount(int index, BHY_STATE *st, int refs) {
+    if (index < BDD_NUM_LEAVES || *(st->stamp + index) == st->id) {
+        return 0;
+    }
+    *(st->stamp + index) = st->id;
+    if (refs) {
+        (*(st->refs + index))++;
+    }
+    return (*(st->refs + index) == 1) + bhycount((NODES + index)->left, st, refs)
+           + bhycount((NODES + index)->right, st, refs);
+}
+
+/*
+ * Visit each distinct block once, counting it in its nodes.
+ */
+void bhyscan(int index, int level, BHY_STATE *st) {
+    if (index < BDD_NUM_LEAVES) {
+        return;
+    }
+    BDD_NODE *node = NODES + index;
+    if (node->level < level) {
+        level = node->level > st->level ? node->level : st->level;
+    }
+    if (*(st->memo + index)) {
+        return;
+    }
+    *(st->memo + index) = 1;
+    if (level == st->level) {
+        st->id++;
+        bhycount(index, st, 1);
+    }
+    else {
+        bhyscan(node->left, level-1, st);
+        bhyscan(node->right, level-1, st);
+    }
+}
+
+/*
+ * Write the pixels of a block, at (r, c) within a tile of the given width.
+ */
+void bhyfill(BDD_NODE *node, int level, int r, int c, unsigned int rmask, int width,
+             unsigned char *tile) {
+    int rows = 1<<rowbits(rmask, level);
+    int cols = 1<<(level - rowbits(rmask, level));
+    if (node->level == 0) {
+        for (int i = r; i < r + rows; i++) {
+            for (int j = c; j < c + cols; j++) {
+                *(tile + i*width + j) = node - NODES;
+            }
+        }
+        return;
+    }
+    int row = (rmask >> (level-1)) & 1;
+    bhyfill(LEFT(node, level), level-1, r, c, rmask, width, tile);
+    bhyfill(RIGHT(node, level), level-1, row ? r + rows/2 : r, row ? c : c + cols/2, rmask, width,
+            tile);
+}
+
+int bhyhelp(int index, int level, BHY_STATE *st) {
+    if (index < BDD_NUM_LEAVES) {
+        return index;
+    }
+    BDD_NODE *node = NODES + index;
+    // Levels skipped above a node have equal children, which would collapse.
+    if (node->level < level) {
+        level = node->level > st->level ? node->level : st->level;
+    }
+    if (*(st->memo + index)) {
+        bdd_stats.cache_hits++;
+        return *(st->memo + index) - 1;
+    }
+    bdd_stats.cache_misses++;
+    int result = index;
+    if (level == st->level) {
+        st->id++;
+        if ((1<<level) + sizeof(BDD_NODE) < bhycount(index, st, 0) * sizeof(BDD_NODE)) {
+            unsigned char *tile = btreserve(level);
+            if (tile == NULL) {
+                return -1;
+            }
+            bhyfill(node, level, 0, 0, st->rmask, 1<<(level - rowbits(st->rmask, level)), tile);
+            result = btcommit(level);
+        }
+    }
+    else {
+        int l = bhyhelp(node->left, level-1, st);
+        int r = l == -1 ? -1 : bhyhelp(node->right, level-1, st);
+        if (r == -1) {
+            return -1;
+        }
+        result = bdd_lookup(level, l, r);
+    }
+    *(st->memo + index) = result + 1;
+    return result;
+}
+
+BDD_NODE *bdd_to_hybrid(BDD_NODE *node, BDD_LAYOUT *layout, int level) {
+    if (node == NULL || !LAYOUT_OK(layout) || level < BDD_TILE_LEVEL_MIN
+        || level > BDD_TILE_LEVEL_MAX) {
+        return NULL;
+    }
+    BHY_STATE st = {LAYOUT_MASK(layout), level, calloc(USED, sizeof(int)),
+                    calloc(USED, sizeof(int)), calloc(USED, sizeof(int)), 0};
+    int index = -1;
+    if (st.memo != NULL && st.stamp != NULL && st.refs != NULL) {
+        STATS_DEPTH(node->level);
+        index = node - NODES;
+        if (node->level >= level) {
+            bhyscan(index, node->level, &st);
+            for (int i = 0; i < USED; i++) {
+                *(st.memo + i) = 0;
+            }
+            index = bhyhelp(index, node->level, &st);
+        }
+    }
+    free(st.memo);
+    free(st.stamp);
+    free(st.refs);
+    return index == -1 ? NULL : NODES + index;
+}
+
+/*
+ * Build the nodes for a block of the pixels of a tile, at (r, c) within the
+ * tile of the given width.
+ */
+int bfhtile(unsigned char *tile, int level, int r, int c, unsigned int rmask, int width) {
+    if (level == 0) {
+        return *(tile + r*width + c);
+    }
+    int rows = 1<<rowbits(rmask, level);
+    int cols = 1<<(level - rowbits(rmask, level));
+    int row = (rmask >> (level-1)) & 1;
+    int left = bfhtile(tile, level-1, r, c, rmask, width);
+    int right = bfhtile(tile, level-1, row ? r + rows/2 : r, row ? c : c + cols/2, rmask, width);
+    return bdd_lookup(level, left, right);
+}
+
+int bfhhelp(int index, unsigned int rmask, int *memo, int *stamp, int id) {
+    if (index < BDD_NUM_LEAVES) {
+        return index;
+    }
+    if (*(stamp + index) == id) {
+        bdd_stats.cache_hits++;
+        return *(memo + index);
+    }
+    bdd_stats.cache_misses++;
+    BDD_NODE *node = NODES + index;
+    int result;
+    if (TILE(node)) {
+        int level = node->level;
+        result = bfhtile(TILE_DATA(node), level, 0, 0, rmask, 1<<(level - rowbits(rmask, level)));
+    }
+    else {
+        int l = bfhhelp(node->left, rmask, memo, stamp, id);
+        int r = bfhhelp(node->right, rmask, memo, stamp, id);
+        result = bdd_lookup(node->level, l, r);
+    }
+    *(stamp + index) = id;
+    *(memo + index) = result;
+    return result;
+}
+
+BDD_NODE *bdd_from_hybrid(BDD_NODE *node, BDD_LAYOUT *layout) {
+    if (node == NULL || !LAYOUT_OK(layout)) {
+        return NULL;
+    }
+    // With no tiles in the pool, no BDD is hybrid.
+    if (TILE_UNITS == 0) {
+        return node;
+    }
+    int id = bwalk(0, 1);
+    if (id == 0) {
+        return NULL;
+    }
+    STATS_DEPTH(node->level);
+    return bnode(bfhhelp(node - NODES, LAYOUT_MASK(layout), MEMO_VALUES(0), MEMO_STAMPS(0), id));
+}
+
+/*
+ * State of bdd_diff(): the rectangles found so far, and the number of
+ * differing pixels they cover.
+ */
+typedef struct bdf_state {
+    unsigned int rmask;
+    int w;
+    int h;
+    BDD_RECT *rects;
+    int count;
+    int cap;
+    long long pixels;
+} BDF_STATE;
+
+/*
+ * Add a rectangle of differing pixels, first merging it with the last ones
+ * added for as long as they line up with it.  Blocks are found in the order
+ * of the walk, so that the parts of a larger block come together.
+ */
+int bdfemit(BDF_STATE *st, int r0, int c0, int r1, int c1) {
+    st->pixels += (long long)(r1 - r0) * (c1 - c0);
+    while (st->count > 0) {
+        BDD_RECT *last = st->rects + st->count-1;
+        if (last->r0 == r0 && last->r1 == r1 && last->c1 == c0) {
+            c0 = last->c0;
+        }
+        else if (last->c0 == c0 && last->c1 == c1 && last->r1 == r0) {
+            r0 = last->r0;
+        }
+        else {
+            break;
+        }
+        st->count--;
+    }
+    if (st->count == st->cap) {
+        int cap = st->cap ? 2 * st->cap : 64;
+        BDD_RECT *rects = realloc(st->rects, cap * sizeof(BDD_RECT));
+        if (rects == NULL) {
+            return -1;
+        }
+        st->rects = rects;
+        st->cap = cap;
+    }
+    BDD_RECT rect = {r0, c0, r1, c1};
+    *(st->rects + st->count++) = rect;
+    return 0;
+}
+
+int bdfhelp(int a, int b, int level, int r, int c, BDF_STATE *st) {
+    if (a == b || r >= st->h || c >= st->w) {
+        return 0;
+    }
+    int rows = 1<<rowbits(st->rmask, level);
+    int cols = 1<<(level - rowbits(st->rmask, level));
+    if (a < BDD_NUM_LEAVES && b < BDD_NUM_LEAVES) {
+        return bdfemit(st, r, c, r + rows < st->h ? r + rows : st->h,
+                       c + cols < st->w ? c + cols : st->w);
+    }
+    BDD_NODE *na = NODES + a;
+    BDD_NODE *nb = NODES + b;
+    if (TILE(na) || TILE(nb)) {
+        return -1;
+    }
+    int row = (st->rmask >> (level-1)) & 1;
+    if (bdfhelp(LEFT(na, level) - NODES, LEFT(nb, level) - NODES, level-1, r, c, st) == -1) {
+        return -1;
+    }
+    return bdfhelp(RIGHT(na, level) - NODES, RIGHT(nb, level) - NODES, level-1,
+                   row ? r + rows/2 : r, row ? c : c + cols/2, st);
+}
+
+long long bdd_diff(BDD_NODE *a, BDD_NODE *b, BDD_LAYOUT *layout, int w, int h,
+                   BDD_RECT **rectsp, int *countp) {
+    if (a == NULL || b == NULL || rectsp == NULL || countp == NULL || !LAYOUT_OK(layout)
+        || layout->rbits + layout->cbits < a->level || layout->rbits + layout->cbits < b->level) {
+        return -1;
+    }
+    BDF_STATE st = {LAYOUT_MASK(layout), w, h, NULL, 0, 0, 0};
+    int level = layout->rbits + layout->cbits;
+    STATS_DEPTH(level);
+    if (bdfhelp(a - NODES, b - NODES, level, 0, 0, &st) == -1) {
+        free(st.rects);
+        return -1;
+    }
+    *rectsp = st.rects;
+    *countp = st.count;
+    return st.pixels;
+}
+
+/*
+ * Number the nodes reachable from an index, in depth-first preorder,
+ * skipping those already numbered.
+ */
+void brlhelp(int index, int *map, int *next) {
+    if (index < BDD_NUM_LEAVES || *(map + index)) {
+        return;
+    }
+    *(map + index) = (*next)++;
+    brlhelp((NODES + index)->left, map, next);
+    brlhelp((NODES + index)->right, map, next);
+}
+
+BDD_NODE *bdd_relayout(BDD_NODE *node, int order) {
+    if (node == NULL || (order != BDD_RELAYOUT_DFS && order != BDD_RELAYOUT_LEVEL)) {
+        return NULL;
+    }
+    int index = node - NODES;
+    if (index < BDD_NUM_LEAVES) {
+        bnreset();
+        return node;
+    }
+    // The map takes each old index to its new one (0 if not reachable).
+    int *map = calloc(USED, sizeof(int));
+    int *queue = malloc(USED * sizeof(int));
+    BDD_NODE *moved = malloc(USED * sizeof(BDD_NODE));
+    if (map == NULL || queue == NULL || moved == NULL) {
+        free(map);
+        free(queue);
+        free(moved);
+        return NULL;
+    }
+    int next = BDD_NUM_LEAVES;
+    if (order == BDD_RELAYOUT_DFS) {
+        brlhelp(index, map, &next);
+    }
+    else {
+        // Breadth-first, numbering each node as it is first reached.
+        int head = 0;
+        *queue = index;
+        *(map + index) = next++;
+        while (head < next - BDD_NUM_LEAVES) {
+            BDD_NODE *n = NODES + *(queue + head++);
+            int child = n->left;
+            for (int k = 0; k < 2; k++, child = n->right) {
+                if (child >= BDD_NUM_LEAVES && *(map + child) == 0) {
+                    *(queue + next - BDD_NUM_LEAVES) = child;
+                    *(map + child) = next++;
+                }
+            }
+        }
+    }
+    for (int i = BDD_NUM_LEAVES; i < USED; i++) {
+        if (*(map + i)) {
+            BDD_NODE *n = NODES + i;
+            BDD_NODE m = {n->level, n->left < BDD_NUM_LEAVES ? n->left : *(map + n->left),
+                          n->right < BDD_NUM_LEAVES ? n->right : *(map + n->right)};
+            *(moved + *(map + i) - BDD_NUM_LEAVES) = m;
+        }
+    }
+    // The tiles of a hybrid BDD stay where they are in the pool, as the
+    // tile nodes moved still refer to them.
+    bnreset();
+    for (int i = BDD_NUM_LEAVES; i < next; i++) {
+        BDD_NODE *n = NODES + i;
+        *n = *(moved + i - BDD_NUM_LEAVES);
+        int hashVal = hash(n->level, n->left, n->right);
+        while (*(HASH_MAP + hashVal) != NULL) {
+            hashVal = (hashVal+1) % BDD_HASH_SIZE;
+        }
+        *(HASH_MAP + hashVal) = n;
+    }
+    USED = next;
+    free(map);
+    free(queue);
+    free(moved);
+    // Both orders place the root first.
+    return NODES + BDD_NUM_LEAVES;
+}
+
+int bnhelp(int index, char *seen) {
+    if (index < BDD_NUM_LEAVES || *(seen + index)) {
+        return 0;
+    }
+    *(seen + index) = 1;
+    return 1 + bnhelp((NODES + index)->left, seen) + bnhelp((NODES + index)->right, seen);
+}
+
+int bdd_node_count(BDD_NODE *node) {
+    if (node == NULL) {
+        return -1;
+    }
+    char *seen = calloc(USED, sizeof(char));
+    if (seen == NULL) {
+        return -1;
+    }
+    int count = bnhelp(node - NODES, seen);
+    free(seen);
+    return count;
+}
@@ -2,188 +2,1494 @@
  * BIRP: Binary decision diagram Image RePresentation
  */
 
+#include <stdlib.h>
+
 #include "image.h"
 #include "bdd.h"
 #include "const.h"
+#include "batch.h"
+#include "daemon.h"
 #include "debug.h"
+#include "stats.h"
+#include "store.h"
 
-int pgm_to_birp(FILE *in, FILE *out) {
-    int width, height;
-    if (img_read_pgm(in, &width, &height, raster_data, RASTER_SIZE_MAX) == -1) {
+/*
+ * Wrappers around the image I/O functions that account their time to the
+ * corresponding phase for --stats.
+ */
+int read_pgm(FILE *in, int *wp, int *hp) {
+    stats_begin(&bdd_stats.read);
+    int err = img_read_pgm(in, wp, hp, birp_raster, RASTER_SIZE_MAX);
+    stats_end(&bdd_stats.read);
+    return err;
+}
+
+int read_pgm_header(FILE *in, int *wp, int *hp) {
+    stats_begin(&bdd_stats.read);
+    int err = img_read_pgm_header(in, wp, hp);
+    stats_end(&bdd_stats.read);
+    return err;
+}
+
+int read_pgm_rows(FILE *in, int w, int rows, unsigned char *raster) {
+    stats_begin(&bdd_stats.read);
+    int err = img_read_pgm_rows(in, w, rows, raster);
+    stats_end(&bdd_stats.read);
+    return err;
+}
+
+/*
+ * Read a BIRP file whose BDD may be hybrid, keeping any tiles it holds.
+ */
+BDD_NODE *read_birp_hybrid(FILE *in, int *wp, int *hp, BDD_LAYOUT *layout) {
+    stats_begin(&bdd_stats.read);
+    BDD_NODE *root = img_read_birp_layout(in, wp, hp, layout);
+    stats_end(&bdd_stats.read);
+    return root;
+}
+
+/*
+ * Read a BIRP file, building the nodes for any tiles it holds so that the
+ * BDD may be given to any function.
+ */
+BDD_NODE *read_birp(FILE *in, int *wp, int *hp, BDD_LAYOUT *layout) {
+    BDD_NODE *root = read_birp_hybrid(in, wp, hp, layout);
+    if (root != NULL) {
+        stats_begin(&bdd_stats.read);
+        root = bdd_from_hybrid(root, layout);
+        stats_end(&bdd_stats.read);
+    }
+    return root;
+}
+
+/*
+ * Read a BIRP file of either kind into roots[0..IMG_CHANNELS), keeping any
+ * tiles, and return the number of channels.
+ */
+int read_birp_channels_hybrid(FILE *in, int *wp, int *hp, BDD_LAYOUT *layout, BDD_NODE **roots) {
+    stats_begin(&bdd_stats.read);
+    int n = img_read_birp_channels(in, wp, hp, layout, roots);
+    stats_end(&bdd_stats.read);
+    return n;
+}
+
+/*
+ * Read a BIRP file of either kind, building the nodes for any tiles.
+ */
+int read_birp_channels(FILE *in, int *wp, int *hp, BDD_LAYOUT *layout, BDD_NODE **roots) {
+    int n = read_birp_channels_hybrid(in, wp, hp, layout, roots);
+    stats_begin(&bdd_stats.read);
+    for (int k = 0; k < n; k++) {
+        if ((*(roots + k) = bdd_from_hybrid(*(roots + k), layout)) == NULL) {
+            n = -1;
+        }
+    }
+    stats_end(&bdd_stats.read);
+    return n;
+}
+
+/*
+ * Read a BIRP file for a mode that handles only grayscale images, as read_birp()
+ * does, but saying plainly that a colour image is not supported by the mode.
+ */
+BDD_NODE *read_birp_gray(FILE *in, int *wp, int *hp, BDD_LAYOUT *layout, char *mode) {
+    BDD_NODE **roots = malloc(IMG_CHANNELS * sizeof(BDD_NODE *));
+    if (roots == NULL) {
+        return NULL;
+    }
+    int n = read_birp_channels(in, wp, hp, layout, roots);
+    BDD_NODE *root = n == 1 ? *roots : NULL;
+    if (n == IMG_CHANNELS) {
+        fprintf(stderr, "Colour BIRP files are not supported by %s\n", mode);
+    }
+    free(roots);
+    return root;
+}
+
+int read_ppm(FILE *in, int *wp, int *hp) {
+    stats_begin(&bdd_stats.read);
+    int err = img_read_ppm(in, wp, hp, birp_raster, RASTER_SIZE_MAX);
+    stats_end(&bdd_stats.read);
+    return err;
+}
+
+int write_ppm(unsigned char *raster, int w, int h, FILE *out) {
+    stats_begin(&bdd_stats.write);
+    int err = img_write_ppm(raster, w, h, out);
+    stats_end(&bdd_stats.write);
+    return err;
+}
+
+int write_pgm(unsigned char *raster, int w, int h, FILE *out) {
+    stats_begin(&bdd_stats.write);
+    int err = img_write_pgm(raster, w, h, out);
+    stats_end(&bdd_stats.write);
+    return err;
+}
+
+int write_pgm_rows(unsigned char *raster, int w, int rows, FILE *out) {
+    stats_begin(&bdd_stats.write);
+    int err = img_write_pgm_rows(raster, w, rows, out);
+    stats_end(&bdd_stats.write);
+    return err;
+}
+
+__thread int birp_hybrid = 0;
+
+/*
+ * An exported file is written with the store detached, so that it holds
+ * its nodes rather than a reference to them.
+ */
+int write_birp(BDD_NODE *root, int w, int h, BDD_LAYOUT *layout, FILE *out) {
+    stats_begin(&bdd_stats.serialize);
+    BDD_STORE *store = store_export ? bdd_store_use(NULL) : NULL;
+    if (birp_hybrid) {
+        root = bdd_to_hybrid(root, layout, birp_hybrid);
+    }
+    int err = root == NULL ? -1 : img_write_birp_layout(root, w, h, layout, out);
+    if (store_export) {
+        bdd_store_use(store);
+    }
+    stats_end(&bdd_stats.serialize);
+    return err;
+}
+
+int write_birp_channels(BDD_NODE **roots, int n, int w, int h, BDD_LAYOUT *layout, FILE *out) {
+    stats_begin(&bdd_stats.serialize);
+    BDD_STORE *store = store_export ? bdd_store_use(NULL) : NULL;
+    int err = 0;
+    for (int k = 0; k < n && birp_hybrid; k++) {
+        if ((*(roots + k) = bdd_to_hybrid(*(roots + k), layout, birp_hybrid)) == NULL) {
+            err = -1;
+        }
+    }
+    if (err == 0) {
+        err = img_write_birp_channels(roots, n, w, h, layout, out);
+    }
+    if (store_export) {
+        bdd_store_use(store);
+    }
+    stats_end(&bdd_stats.serialize);
+    return err;
+}
+
+/*
+ * The level at which to interpret the root of the BDD for a w x h image:
+ * that of the smallest enclosing square, unless the root lies above it.
+ */
+int birp_level(BDD_NODE *root, int w, int h) {
+    int bml = bdd_min_level(w, h);
+    return bml < root->level ? root->level + root->level%2 : bml;
+}
+
+__thread unsigned char *birp_raster = raster_data;
+
+__thread int global_options = 0;
+__thread int birp_order = ORDER_KEEP;
+__thread int birp_shape = SHAPE_KEEP;
+__thread int birp_tolerance = 0;
+__thread char *compare_first = NULL;
+__thread char *compare_second = NULL;
+__thread char **fanout_argv = NULL;
+__thread int fanout_argc = 0;
+
+/*
+ * Re-express the w x h image represented by *rootp, whose BDD has the layout
+ * *layout, with a specified variable order and shape.  A square layout is
+ * never made smaller than the BDD, so that a root lying above the level of
+ * the image is interpreted at its own level.
+ */
+int relayout(BDD_NODE **rootp, int w, int h, BDD_LAYOUT *layout, int order, int rect) {
+    BDD_LAYOUT want = {order, 0, 0, rect};
+    bdd_layout_fit(&want, w, h);
+    if (!rect && 2*want.rbits < (*rootp)->level) {
+        want.rbits = ((*rootp)->level + 1)/2;
+        want.cbits = want.rbits;
+    }
+    *rootp = bdd_reorder(*rootp, layout, &want);
+    *layout = want;
+    return *rootp == NULL ? -1 : 0;
+}
+
+/*
+ * Choose the variable order giving the fewest nodes for a sample of the
+ * image represented by a BDD in the default layout, when the image is
+ * stored with a specified shape.  The sample is a window of at most
+ * ORDER_SAMPLE x ORDER_SAMPLE pixels at the centre of the image; ties go to
+ * the earlier order, so that the default order is preferred.
+ */
+#define ORDER_SAMPLE 256
+
+int choose_order(BDD_NODE *root, int w, int h, int rect) {
+    int sw = w < ORDER_SAMPLE ? w : ORDER_SAMPLE;
+    int sh = h < ORDER_SAMPLE ? h : ORDER_SAMPLE;
+    if (sw == 0 || sh == 0) {
+        return BDD_ORDER_RC;
+    }
+    BDD_RECT win = {(h - sh)/2, (w - sw)/2, (h - sh)/2 + sh, (w - sw)/2 + sw};
+    int level = birp_level(root, w, h);
+    BDD_LAYOUT full = {BDD_ORDER_RC, level/2, level/2, 0};
+    BDD_LAYOUT square = {BDD_ORDER_RC, 0, 0, 0};
+    bdd_layout_fit(&square, sw, sh);
+    BDD_NODE *sample = bdd_crop(root, &full, &win, &square);
+    if (sample == NULL) {
+        return BDD_ORDER_RC;
+    }
+    int best = BDD_ORDER_RC;
+    int fewest = -1;
+    for (int order = BDD_ORDER_RC; order < BDD_ORDER_COUNT; order++) {
+        BDD_LAYOUT layout = {order, 0, 0, rect};
+        bdd_layout_fit(&layout, sw, sh);
+        int n = bdd_node_count(bdd_reorder(sample, &square, &layout));
+        if (n >= 0 && (fewest < 0 || n < fewest)) {
+            best = order;
+            fewest = n;
+        }
+    }
+    return best;
+}
+
+/*
+ * Convert the image represented by *rootp to the layout in which it is to
+ * be written, choosing the order first if automatic selection was requested.
+ */
+int encode_layout(BDD_NODE **rootp, int w, int h, BDD_LAYOUT *layout, int order, int rect) {
+    stats_begin(&bdd_stats.transform);
+    int err = 0;
+    if (order == ORDER_AUTO) {
+        err = relayout(rootp, w, h, layout, BDD_ORDER_RC, 0);
+        order = choose_order(*rootp, w, h, rect);
+    }
+    if (err == 0) {
+        err = relayout(rootp, w, h, layout, order, rect);
+    }
+    stats_end(&bdd_stats.transform);
+    return err;
+}
+
+/*
+ * Run a conversion of a single image over each image of a multi-image
+ * stream, starting each image with an empty node table.  Unless it is EOF,
+ * the byte "end" is written after each image that another follows, as
+ * BDD_FRAME_END ends each but the last BDD of a BIRP stream.
+ */
+int convert_frames(FILE *in, FILE *out, int (*frame)(FILE *, FILE *), int end) {
+    int n = 0;
+    do {
+        if (n++ > 0) {
+            bdd_reset();
+        }
+        if (frame(in, out) == -1) {
+            return -1;
+        }
+        if (img_more(in) && end != EOF) {
+            fputc(end, out);
+            bdd_stats.bytes_out++;
+        }
+    } while (img_more(in));
+    return 0;
+}
+
+/*
+ * Unpack an image too large for the raster a band of rows at a time,
+ * writing each band as it is completed.
+ */
+int birp_to_pgm_bands(BDD_NODE *root, int w, int h, BDD_LAYOUT *layout, FILE *out) {
+    int rows = RASTER_SIZE_MAX / w;
+    if (img_write_pgm_header(w, h, out) == -1) {
+        return -1;
+    }
+    for (int r = 0; r < h; r += rows) {
+        int r1 = r + rows < h ? r + rows : h;
+        stats_begin(&bdd_stats.decode);
+        int err = bdd_to_raster_rows(root, layout, w, r, r1, birp_raster);
+        stats_end(&bdd_stats.decode);
+        if (err == -1 || write_pgm_rows(birp_raster, w, r1 - r, out) == -1) {
+            return -1;
+        }
+    }
+    return fflush(out);
+}
+
+/*
+ * Write the w x h image represented by a BDD, with the layout *layout, as
+ * PGM.  An image too large for the raster is written a band at a time.
+ */
+int root_to_pgm(BDD_NODE *root, int w, int h, BDD_LAYOUT *layout, FILE *out) {
+    if ((size_t)w * h > RASTER_SIZE_MAX) {
+        return birp_to_pgm_bands(root, w, h, layout, out);
+    }
+    stats_begin(&bdd_stats.decode);
+    int err = bdd_to_raster_ordered(root, layout, w, h, birp_raster);
+    stats_end(&bdd_stats.decode);
+    if (err == -1 || write_pgm(birp_raster, w, h, out) == -1) {
         return -1;
     }
-    img_write_birp(bdd_from_raster(width, height, raster_data), width, height, out);
     return 0;
 }
 
-int birp_to_pgm(FILE *in, FILE *out) {
+/*
+ * Prepare the only BDD in the node table to be decoded in a number of
+ * passes from its root, renumbering its nodes in depth-first order so that
+ * the nodes under each part of the image lie together in the table.  On a
+ * table too large for the cache, the renumbering costs about as much as
+ * two passes, and saves from a tenth to a half of each pass, the least on
+ * a table just read, whose nodes are already in the order written; on a
+ * table that fits in the cache it saves little.  It is therefore done only
+ * for a large table decoded in many passes.
+ */
+#define RELAYOUT_NODES (1<<15)
+#define RELAYOUT_PASSES 8
+
+BDD_NODE *decode_relayout(BDD_NODE *root, int passes) {
+    if (root == NULL || passes < RELAYOUT_PASSES
+        || bdd_manager_current()->unused - BDD_NUM_LEAVES <= RELAYOUT_NODES) {
+        return root;
+    }
+    stats_begin(&bdd_stats.decode);
+    root = bdd_relayout(root, BDD_RELAYOUT_DFS);
+    stats_end(&bdd_stats.decode);
+    return root;
+}
+
+int birp_frame_to_pgm(FILE *in, FILE *out) {
     int width, height;
-    BDD_NODE *root = img_read_birp(in, &width, &height);
+    BDD_LAYOUT layout;
+    // Tiles of a hybrid BDD are decoded as they are, without building nodes.
+    BDD_NODE *root = read_birp_hybrid(in, &width, &height, &layout);
     if (root == NULL) {
         return -1;
     }
-    bdd_to_raster(root, width, height, raster_data);
-    if (img_write_pgm(raster_data, width, height, out) == -1) {
+    // An image too large for the raster is decoded a band of rows at a time.
+    int rows = width > 0 ? RASTER_SIZE_MAX / width : height;
+    root = decode_relayout(root, rows > 0 ? (height + rows - 1) / rows : 1);
+    if (root == NULL) {
+        return -1;
+    }
+    return root_to_pgm(root, width, height, &layout, out);
+}
+
+int birp_to_pgm(FILE *in, FILE *out) {
+    return convert_frames(in, out, birp_frame_to_pgm, EOF);
+}
+
+int birp_frame_to_ppm(FILE *in, FILE *out) {
+    int width, height;
+    BDD_LAYOUT layout;
+    BDD_NODE **roots = malloc(IMG_CHANNELS * sizeof(BDD_NODE *));
+    if (roots == NULL) {
+        return -1;
+    }
+    int n = read_birp_channels_hybrid(in, &width, &height, &layout, roots);
+    size_t size = (size_t)width * height;
+    if (n != -1 && IMG_CHANNELS * size > RASTER_SIZE_MAX) {
+        fprintf(stderr, "Image too large for PPM output\n");
+        n = -1;
+    }
+    int err = n == -1 ? -1 : 0;
+    stats_begin(&bdd_stats.decode);
+    for (int k = 0; k < n && err == 0; k++) {
+        err = bdd_to_raster_ordered(*(roots + k), &layout, width, height, birp_raster + k * size);
+    }
+    // A grayscale image has the same value in every channel, and is
+    // decoded once.
+    for (size_t i = 0; n == 1 && err == 0 && i < size; i++) {
+        for (int k = 1; k < IMG_CHANNELS; k++) {
+            *(birp_raster + k * size + i) = *(birp_raster + i);
+        }
+    }
+    stats_end(&bdd_stats.decode);
+    free(roots);
+    if (err == -1 || write_ppm(birp_raster, width, height, out) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+int birp_to_ppm(FILE *in, FILE *out) {
+    return convert_frames(in, out, birp_frame_to_ppm, EOF);
+}
+
+__thread TFORM_STEP *tform_chain = NULL;
+__thread int tform_count = 0;
+__thread int tform_channels = 0;
+
+/*
+ * Append a transformation to the chain.  The first transformation is also
+ * recorded in global_options, so that a single transformation is encoded
+ * exactly as before chains were supported.
+ */
+int add_tform(int tform, int param) {
+    TFORM_STEP *chain = realloc(tform_chain, (tform_count + 1) * sizeof(TFORM_STEP));
+    if (chain == NULL) {
+        return -1;
+    }
+    tform_chain = chain;
+    (tform_chain + tform_count)->tform = tform;
+    (tform_chain + tform_count)->param = param;
+    (tform_chain + tform_count)->channels = tform == 1 || tform == 2 ? tform_channels : 0;
+    if (tform_count == 0) {
+        global_options |= (tform << 8);
+        global_options |= (param << 16);
+    }
+    tform_count++;
+    return 0;
+}
+
+/*
+ * Compose a value transformation (negate or threshold) onto a lookup table.
+ */
+void compose_value(unsigned char *lut, int tform, int param) {
+    for (int v = 0; v < BDD_NUM_LEAVES; v++) {
+        unsigned char x = *(lut + v);
+        *(lut + v) = tform == 1 ? 255 - x : (x < param ? 0 : 255);
+    }
+}
+
+/*
+ * Apply a geometric transformation to the image represented by *rootp, in
+ * the default layout, updating the root and the image dimensions.  The
+ * transformations act on the enclosing square; for an image that is to be
+ * stored with a rectangular shape (rect != 0), the result is then cut down
+ * to the transformed image, rather than taking the size of the square.
+ */
+int apply_geometric(BDD_NODE **rootp, int *wp, int *hp, int tform, int param, int rect) {
+    int bml = bdd_min_level(*wp, *hp);
+    if (bml < (*rootp)->level) {
+        bml = (*rootp)->level;
+    }
+    if (tform == 3) {
+        if (param == 0) {
+            return 0;
+        }
+        int sign = (param>>7) & 1;
+        int k = param;
+        if (sign == 1) {
+            k = ((param ^ 0xFF)+1) & 0xFF;
+            if (k > bml/2) {
+                k = bml/2;
+            }
+            k = -k;
+        }
+        *rootp = bdd_zoom(*rootp, bml, param);
+        if (rect) {
+            *wp = k >= 0 ? *wp<<k : (*wp + (1<<-k) - 1)>>-k;
+            *hp = k >= 0 ? *hp<<k : (*hp + (1<<-k) - 1)>>-k;
+            return *rootp == NULL ? -1 : 0;
+        }
+        *wp = 1<<(bml/2 + k);
+        *hp = 1<<(bml/2 + k);
+    }
+    else if (rect && (tform == 4 || tform == 5)) {
+        int op = tform == 4 ? BDD_ROT90 : param;
+        BDD_RECT box;
+        bdd_dihedral_box(op, 1<<(bml/2), *wp, *hp, &box);
+        *rootp = bdd_dihedral(*rootp, bml, op);
+        if (*rootp != NULL && (box.r0 != 0 || box.c0 != 0)) {
+            BDD_LAYOUT square = {BDD_ORDER_RC, bml/2, bml/2, 0};
+            BDD_LAYOUT cropped = {BDD_ORDER_RC, 0, 0, 0};
+            bdd_layout_fit(&cropped, box.c1 - box.c0, box.r1 - box.r0);
+            *rootp = bdd_crop(*rootp, &square, &box, &cropped);
+        }
+        *wp = box.c1 - box.c0;
+        *hp = box.r1 - box.r0;
+    }
+    else if (tform == 4) {
+        *rootp = bdd_rotate(*rootp, bml);
+        *wp = 1<<(bml/2);
+        *hp = 1<<(bml/2);
+    }
+    else if (tform == 5) {
+        *rootp = bdd_dihedral(*rootp, bml, param);
+        if (param == BDD_TRANSPOSE) {
+            int w = *wp;
+            *wp = *hp;
+            *hp = w;
+        }
+        else if (param != BDD_IDENTITY) {
+            *wp = 1<<(bml/2);
+            *hp = 1<<(bml/2);
+        }
+    }
+    return *rootp == NULL ? -1 : 0;
+}
+
+/*
+ * Apply a chain of transformations to the image represented by *rootp,
+ * whose BDD has the layout *layout.  Runs of consecutive value
+ * transformations are composed into a single lookup table and applied in
+ * one pass, in any layout; geometric transformations are applied in turn to
+ * the resulting in-memory BDD, after converting it to the default layout.
+ * The flag rect is as for apply_geometric().
+ */
+int apply_tforms(BDD_NODE **rootp, int *wp, int *hp, BDD_LAYOUT *layout, TFORM_STEP *chain,
+                 int count, int rect) {
+    unsigned char *lut = malloc(BDD_NUM_LEAVES);
+    if (lut == NULL) {
+        return -1;
+    }
+    stats_begin(&bdd_stats.transform);
+    int pending = 0;
+    for (int i = 0; i <= count; i++) {
+        int tform = i < count ? (chain + i)->tform : 0;
+        int param = i < count ? (chain + i)->param : 0;
+        if (tform == 1 || tform == 2) {
+            for (int v = 0; v < BDD_NUM_LEAVES && !pending; v++) {
+                *(lut + v) = v;
+            }
+            compose_value(lut, tform, param);
+            pending = 1;
+            continue;
+        }
+        if (pending) {
+            *rootp = bdd_map_table(*rootp, lut);
+            pending = 0;
+            if (*rootp == NULL) {
+                break;
+            }
+        }
+        if (i < count && (relayout(rootp, *wp, *hp, layout, BDD_ORDER_RC, 0) == -1 ||
+                          apply_geometric(rootp, wp, hp, tform, param, rect) == -1)) {
+            break;
+        }
+        if (i < count) {
+            bdd_layout_fit(layout, *wp, *hp);
+            layout->rbits = birp_level(*rootp, *wp, *hp)/2;
+            layout->cbits = layout->rbits;
+        }
+    }
+    stats_end(&bdd_stats.transform);
+    free(lut);
+    return *rootp == NULL ? -1 : 0;
+}
+
+/*
+ * Apply a chain of transformations to each channel of an image, as
+ * apply_tforms(), skipping the value transformations restricted to other
+ * channels, and convert each to the layout in which it is to be written.
+ * The channels keep the same size and layout throughout.
+ */
+int apply_channels(BDD_NODE **roots, int n, int *wp, int *hp, BDD_LAYOUT *layout,
+                   TFORM_STEP *chain, int count, int order, int rect) {
+    TFORM_STEP *steps = malloc((count + 1) * sizeof(TFORM_STEP));
+    if (steps == NULL) {
+        return -1;
+    }
+    int err = 0;
+    int w = *wp, h = *hp;
+    BDD_LAYOUT first = *layout;
+    for (int k = 0; k < n && err == 0; k++) {
+        int m = 0;
+        for (int i = 0; i < count; i++) {
+            int channels = (chain + i)->channels;
+            if (channels != 0 && n == 1) {
+                fprintf(stderr, "Channels selected for a grayscale image\n");
+                err = -1;
+            }
+            if (channels == 0 || ((channels >> k) & 1)) {
+                *(steps + m++) = *(chain + i);
+            }
+        }
+        int cw = *wp, ch = *hp;
+        BDD_LAYOUT cl = *layout;
+        if (err == 0 && (apply_tforms(roots + k, &cw, &ch, &cl, steps, m, rect) == -1
+                         || encode_layout(roots + k, cw, ch, &cl, order, rect) == -1)) {
+            err = -1;
+        }
+        // An automatic order is chosen for the first channel, and kept for
+        // the others, which must be written in the same layout.
+        if (k == 0) {
+            w = cw;
+            h = ch;
+            first = cl;
+            order = cl.order;
+        }
+        else if (err == 0 && (cw != w || ch != h || cl.rbits != first.rbits
+                              || cl.cbits != first.cbits || cl.rect != first.rect)) {
+            err = -1;
+        }
+    }
+    free(steps);
+    *wp = w;
+    *hp = h;
+    *layout = first;
+    return err;
+}
+
+/*
+ * Source of the bands of a PGM image read in tiles: the stream, positioned
+ * at the next row, and the width of the image.
+ */
+typedef struct pgm_band {
+    FILE *in;
+    int w;
+} PGM_BAND;
+
+/*
+ * Read the next band of a tiled image (see bdd_from_raster_tiled()),
+ * accounting the time to reading rather than to construction.
+ */
+int pgm_fill_band(unsigned char *band, int rows, void *arg) {
+    PGM_BAND *src = arg;
+    stats_end(&bdd_stats.build);
+    int err = read_pgm_rows(src->in, src->w, rows, band);
+    stats_begin(&bdd_stats.build);
+    return err;
+}
+
+int pgm_frame_to_birp(FILE *in, FILE *out) {
+    int width, height;
+    if (read_pgm_header(in, &width, &height) == -1) {
+        return -1;
+    }
+    // An image larger than the raster is read and built in tiles, as large
+    // as will allow a band of them to fit in the raster.
+    int tiled = width > TILE_MAX || height > TILE_MAX;
+    int tile = TILE_MAX;
+    while ((size_t)tile * width > RASTER_SIZE_MAX) {
+        tile /= 2;
+    }
+    if (!tiled && read_pgm_rows(in, width, height, birp_raster) == -1) {
+        return -1;
+    }
+    TFORM_STEP single = {(global_options>>8) & 0xF, (global_options>>16) & 0xFF};
+    TFORM_STEP *chain = tform_count ? tform_chain : &single;
+    int count = tform_count ? tform_count : (single.tform != 0);
+    unsigned char *lut = malloc(BDD_NUM_LEAVES);
+    if (lut == NULL) {
+        return -1;
+    }
+    for (int v = 0; v < BDD_NUM_LEAVES; v++) {
+        *(lut + v) = v;
+    }
+    // Value transformations commute with the symmetries of the square, so
+    // every step up to the first zoom is folded into construction.  For a
+    // rectangular shape, the symmetries are those of the image rather than
+    // of the square, and they are applied after construction, as they are
+    // for a tiled image.
+    int rect = birp_shape == SHAPE_KEEP ? 0 : birp_shape;
+    int n = 1<<(bdd_min_level(width, height)/2);
+    int op = BDD_IDENTITY;
+    int w = width;
+    int h = height;
+    int k = 0;
+    for (; k < count && (chain + k)->tform != 3 && !((rect || tiled) && (chain + k)->tform > 2); k++) {
+        int tform = (chain + k)->tform;
+        int param = (chain + k)->param;
+        if (tform == 1 || tform == 2) {
+            compose_value(lut, tform, param);
+            continue;
+        }
+        int step = tform == 4 ? BDD_ROT90 : param;
+        op = bdd_dihedral_compose(op, step);
+        if (step == BDD_TRANSPOSE) {
+            int t = w;
+            w = h;
+            h = t;
+        }
+        else if (step != BDD_IDENTITY) {
+            w = n;
+            h = n;
+        }
+    }
+    // When the whole chain has been folded, the BDD can be built directly
+    // in an explicitly requested variable order.
+    int want = birp_order == ORDER_KEEP ? BDD_ORDER_RC : birp_order;
+    BDD_LAYOUT layout = {k == count && want != ORDER_AUTO && !tiled ? want : BDD_ORDER_RC, 0, 0,
+                         rect && !tiled};
+    bdd_layout_fit(&layout, w, h);
+    PGM_BAND src = {in, width};
+    int err = 0;
+    stats_begin(&bdd_stats.build);
+    BDD_NODE *root = tiled ? bdd_from_raster_tiled(width, height, tile, birp_raster, pgm_fill_band,
+                                                   &src, lut, birp_tolerance, &err)
+                           : bdd_from_raster_lossy(width, height, birp_raster, lut, op, &layout,
+                                                   birp_tolerance, &err);
+    stats_end(&bdd_stats.build);
+    if (err > bdd_stats.error_max) {
+        bdd_stats.error_max = err;
+    }
+    free(lut);
+    if (root == NULL || apply_tforms(&root, &w, &h, &layout, chain + k, count - k, rect) == -1) {
+        return -1;
+    }
+    if (encode_layout(&root, w, h, &layout, want, rect) == -1) {
+        return -1;
+    }
+    if (write_birp(root, w, h, &layout, out) == -1) {
         return -1;
     }
     return 0;
 }
 
-unsigned char negative(unsigned char value) {
-    return 255 - value;
+int pgm_to_birp(FILE *in, FILE *out) {
+    return convert_frames(in, out, pgm_frame_to_birp, BDD_FRAME_END);
+}
+
+/*
+ * Source of the bands of a channel of a PPM image built in tiles: its plane
+ * of the raster, the width of the image and the next row.
+ */
+typedef struct ppm_band {
+    unsigned char *plane;
+    int w;
+    int row;
+} PPM_BAND;
+
+int ppm_fill_band(unsigned char *band, int rows, void *arg) {
+    PPM_BAND *src = arg;
+    unsigned char *p = src->plane + (size_t)src->row * src->w;
+    for (size_t i = 0; i < (size_t)rows * src->w; i++) {
+        *(band + i) = *(p + i);
+    }
+    src->row += rows;
+    return 0;
+}
+
+/*
+ * Convert the image of a PPM stream.  The channels are built one after
+ * another from their planes of the raster, in the layout to be written
+ * when there are no transformations; otherwise in the default layout.  An
+ * image wider or higher than TILE_MAX is built in tiles, as for PGM input,
+ * from bands copied out of the planes, each band being at most the size of
+ * a plane.
+ */
+int ppm_frame_to_birp(FILE *in, FILE *out) {
+    int width, height;
+    if (read_ppm(in, &width, &height) == -1) {
+        return -1;
+    }
+    BDD_NODE **roots = malloc(IMG_CHANNELS * sizeof(BDD_NODE *));
+    if (roots == NULL) {
+        return -1;
+    }
+    int count = tform_count;
+    int want = birp_order == ORDER_KEEP ? BDD_ORDER_RC : birp_order;
+    int rect = birp_shape == SHAPE_KEEP ? 0 : birp_shape;
+    BDD_LAYOUT layout = {count == 0 && want != ORDER_AUTO ? want : BDD_ORDER_RC, 0, 0,
+                         count == 0 && rect};
+    bdd_layout_fit(&layout, width, height);
+    size_t size = (size_t)width * height;
+    int tiled = width > TILE_MAX || height > TILE_MAX;
+    int tile = TILE_MAX;
+    while (tiled && tile > 1 && (size_t)tile * width > size) {
+        tile /= 2;
+    }
+    unsigned char *band = tiled ? malloc((size_t)tile * width) : NULL;
+    if (tiled) {
+        layout.order = BDD_ORDER_RC;
+        layout.rect = 0;
+        bdd_layout_fit(&layout, width, height);
+    }
+    int err = tiled && band == NULL ? -1 : 0;
+    stats_begin(&bdd_stats.build);
+    for (int k = 0; k < IMG_CHANNELS && err == 0; k++) {
+        int e = 0;
+        PPM_BAND src = {birp_raster + k * size, width, 0};
+        *(roots + k) = tiled ? bdd_from_raster_tiled(width, height, tile, band, ppm_fill_band, &src,
+                                                     NULL, birp_tolerance, &e)
+                             : bdd_from_raster_lossy(width, height, birp_raster + k * size, NULL,
+                                                     BDD_IDENTITY, &layout, birp_tolerance, &e);
+        err = *(roots + k) == NULL ? -1 : 0;
+        if (e > bdd_stats.error_max) {
+            bdd_stats.error_max = e;
+        }
+    }
+    stats_end(&bdd_stats.build);
+    free(band);
+    if (err == 0) {
+        err = apply_channels(roots, IMG_CHANNELS, &width, &height, &layout, tform_chain, count,
+                             want, rect);
+    }
+    if (err == 0) {
+        err = write_birp_channels(roots, IMG_CHANNELS, width, height, &layout, out);
+    }
+    free(roots);
+    return err;
+}
+
+int ppm_to_birp(FILE *in, FILE *out) {
+    return convert_frames(in, out, ppm_frame_to_birp, BDD_FRAME_END);
 }
 
-unsigned char threshold(unsigned char value) {
-    int t = (global_options>>16) & 0xFF;
-    if (value < t) {
-        return 0;
+int birp_frame_to_birp(FILE *in, FILE *out) {
+    int width, height;
+    BDD_LAYOUT layout;
+    BDD_NODE **roots = malloc(IMG_CHANNELS * sizeof(BDD_NODE *));
+    if (roots == NULL) {
+        return -1;
     }
-    return 255;
+    int n = read_birp_channels(in, &width, &height, &layout, roots);
+    // Without a chain from validargs, fall back to the single
+    // transformation encoded in global_options.
+    TFORM_STEP single = {(global_options>>8) & 0xF, (global_options>>16) & 0xFF};
+    TFORM_STEP *chain = tform_count ? tform_chain : &single;
+    int count = tform_count ? tform_count : (single.tform != 0);
+    int want = birp_order == ORDER_KEEP ? layout.order : birp_order;
+    int rect = birp_shape == SHAPE_KEEP ? layout.rect : birp_shape;
+    int err = n == -1 ? -1 : 0;
+    if (err == 0) {
+        err = apply_channels(roots, n, &width, &height, &layout, chain, count, want, rect);
+    }
+    if (err == 0) {
+        err = write_birp_channels(roots, n, width, height, &layout, out);
+    }
+    free(roots);
+    return err;
 }
 
 int birp_to_birp(FILE *in, FILE *out) {
+    return convert_frames(in, out, birp_frame_to_birp, BDD_FRAME_END);
+}
+
+__thread int ascii_width = 0;
+
+/*
+ * Write a raster as ASCII art, mapping each pixel through a character table
+ * and writing each row with a single call.
+ */
+int write_ascii(unsigned char *raster, int width, int height, FILE *out) {
+    char *table = malloc(BDD_NUM_LEAVES);
+    char *row = malloc(width + 1);
+    if (table == NULL || row == NULL) {
+        free(table);
+        free(row);
+        return -1;
+    }
+    for (int v = 0; v < BDD_NUM_LEAVES; v++) {
+        *(table + v) = v < 64 ? ' ' : v < 128 ? '.' : v < 192 ? '*' : '@';
+    }
+    int err = 0;
+    stats_begin(&bdd_stats.write);
+    *(row + width) = '\n';
+    for (int i = 0; i < height && !err; i++) {
+        unsigned char *rp = raster + (size_t)i*width;
+        for (int j = 0; j < width; j++) {
+            *(row + j) = *(table + *(rp + j));
+        }
+        if (fwrite(row, 1, width + 1, out) != (size_t)width + 1) {
+            err = -1;
+        }
+    }
+    bdd_stats.bytes_out += (long long)(width + 1) * height;
+    stats_end(&bdd_stats.write);
+    free(table);
+    free(row);
+    return err;
+}
+
+/*
+ * Least scale k such that an image of the given width, reduced by 2^k,
+ * fits in ascii_width columns (0 if no target width was given).
+ */
+int ascii_scale(int width) {
+    int k = 0;
+    while (ascii_width > 0 && ((width + (1<<k) - 1)>>k) > ascii_width) {
+        k++;
+    }
+    return k;
+}
+
+int pgm_frame_to_ascii(FILE *in, FILE *out) {
     int width, height;
-    BDD_NODE *root = img_read_birp(in, &width, &height);
+    if (read_pgm(in, &width, &height) == -1) {
+        return -1;
+    }
+    int k = ascii_scale(width);
+    if (k == 0) {
+        return write_ascii(birp_raster, width, height, out);
+    }
+    int ow = (width + (1<<k) - 1)>>k;
+    int oh = (height + (1<<k) - 1)>>k;
+    unsigned long long *sums = calloc((size_t)ow*oh, sizeof(unsigned long long));
+    unsigned char *small = malloc((size_t)ow*oh);
+    if (sums == NULL || small == NULL) {
+        free(sums);
+        free(small);
+        return -1;
+    }
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            *(sums + (i>>k)*ow + (j>>k)) += *(birp_raster + (size_t)i*width + j);
+        }
+    }
+    for (int i = 0; i < oh; i++) {
+        for (int j = 0; j < ow; j++) {
+            int bh = ((i+1)<<k) < height ? (1<<k) : height - (i<<k);
+            int bw = ((j+1)<<k) < width ? (1<<k) : width - (j<<k);
+            unsigned long long area = (unsigned long long)bh * bw;
+            *(small + i*ow + j) = (*(sums + i*ow + j) + area/2) / area;
+        }
+    }
+    int err = write_ascii(small, ow, oh, out);
+    free(sums);
+    free(small);
+    return err;
+}
+
+int pgm_to_ascii(FILE *in, FILE *out) {
+    return convert_frames(in, out, pgm_frame_to_ascii, EOF);
+}
+
+/*
+ * Write the w x h image represented by a BDD, with the layout *layout, as
+ * ASCII art, at the scale selected by the global options.
+ */
+int root_to_ascii(BDD_NODE *root, int width, int height, BDD_LAYOUT *layout, FILE *out) {
+    if (relayout(&root, width, height, layout, BDD_ORDER_RC, 0) == -1) {
+        return -1;
+    }
+    int bml = bdd_min_level(width, height);
+    if (bml < root->level) {
+        bml = root->level;
+    }
+    int k = ascii_scale(width);
+    if (2*k > bml) {
+        k = bml/2;
+    }
+    int ow = (width + (1<<k) - 1)>>k;
+    int oh = (height + (1<<k) - 1)>>k;
+    stats_begin(&bdd_stats.decode);
+    int err = bdd_to_raster_scaled(root, bml, width, height, k, birp_raster);
+    stats_end(&bdd_stats.decode);
+    if (err == -1) {
+        return -1;
+    }
+    return write_ascii(birp_raster, ow, oh, out);
+}
+
+int birp_frame_to_ascii(FILE *in, FILE *out) {
+    int width, height;
+    BDD_LAYOUT layout;
+    BDD_NODE *root = read_birp(in, &width, &height, &layout);
     if (root == NULL) {
         return -1;
     }
-    int tform = (global_options>>8) & 0xF;
-    if (tform == 0) {
-        if (img_write_birp(root, width, height, out) == -1) {
-            return -1;
+    return root_to_ascii(root, width, height, &layout, out);
+}
+
+int birp_to_ascii(FILE *in, FILE *out) {
+    return convert_frames(in, out, birp_frame_to_ascii, EOF);
+}
+
+int write_stats(unsigned long long *hist, int width, int height, FILE *out) {
+    unsigned long long pixels = 0;
+    double sum = 0;
+    double sumsq = 0;
+    int min = -1;
+    int max = -1;
+    for (int v = 0; v < BDD_NUM_LEAVES; v++) {
+        unsigned long long n = *(hist + v);
+        if (n == 0) {
+            continue;
+        }
+        if (min < 0) {
+            min = v;
+        }
+        max = v;
+        pixels += n;
+        sum += (double)n * v;
+        sumsq += (double)n * v * v;
+    }
+    stats_begin(&bdd_stats.write);
+    double mean = pixels ? sum / pixels : 0;
+    double variance = pixels ? sumsq / pixels - mean * mean : 0;
+    fprintf(out, "width %d\nheight %d\npixels %llu\n", width, height, pixels);
+    fprintf(out, "min %d\nmax %d\nmean %.6f\nvariance %.6f\n", min, max, mean, variance);
+    for (int v = 0; v < BDD_NUM_LEAVES; v++) {
+        if (*(hist + v) != 0) {
+            fprintf(out, "bin %d %llu\n", v, *(hist + v));
+        }
+    }
+    int err = fflush(out);
+    stats_end(&bdd_stats.write);
+    return err;
+}
+
+int pgm_frame_to_stats(FILE *in, FILE *out) {
+    int width, height;
+    if (read_pgm(in, &width, &height) == -1) {
+        return -1;
+    }
+    unsigned long long *hist = calloc(BDD_NUM_LEAVES, sizeof(unsigned long long));
+    if (hist == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < height*width; i++) {
+        (*(hist + *(birp_raster + i)))++;
+    }
+    int err = write_stats(hist, width, height, out);
+    free(hist);
+    return err;
+}
+
+int pgm_to_stats(FILE *in, FILE *out) {
+    return convert_frames(in, out, pgm_frame_to_stats, EOF);
+}
+
+/*
+ * Write the statistics of the w x h image represented by a BDD, with the
+ * layout *layout.
+ */
+int root_to_stats(BDD_NODE *root, int width, int height, BDD_LAYOUT *layout, FILE *out) {
+    if (relayout(&root, width, height, layout, BDD_ORDER_RC, 0) == -1) {
+        return -1;
+    }
+    unsigned long long *hist = malloc(BDD_NUM_LEAVES * sizeof(unsigned long long));
+    if (hist == NULL) {
+        return -1;
+    }
+    int bml = bdd_min_level(width, height);
+    if (bml < root->level) {
+        bml = root->level;
+    }
+    stats_begin(&bdd_stats.decode);
+    int err = bdd_histogram(root, bml, width, height, hist);
+    stats_end(&bdd_stats.decode);
+    if (err == 0) {
+        err = write_stats(hist, width, height, out);
+    }
+    free(hist);
+    return err;
+}
+
+int birp_frame_to_stats(FILE *in, FILE *out) {
+    int width, height;
+    BDD_LAYOUT layout;
+    BDD_NODE *root = read_birp(in, &width, &height, &layout);
+    if (root == NULL) {
+        return -1;
+    }
+    return root_to_stats(root, width, height, &layout, out);
+}
+
+int birp_to_stats(FILE *in, FILE *out) {
+    return convert_frames(in, out, birp_frame_to_stats, EOF);
+}
+
+int birp_compare(char *file1, char *file2, FILE *out) {
+    FILE *in1 = fopen(file1, "r");
+    FILE *in2 = fopen(file2, "r");
+    int w1, h1, w2, h2;
+    BDD_LAYOUT l1, l2;
+    BDD_NODE *a = in1 == NULL ? NULL : read_birp_gray(in1, &w1, &h1, &l1, "--compare");
+    BDD_NODE *b = in2 == NULL ? NULL : read_birp_gray(in2, &w2, &h2, &l2, "--compare");
+    if (in1 != NULL) {
+        fclose(in1);
+    }
+    if (in2 != NULL) {
+        fclose(in2);
+    }
+    if (a == NULL || b == NULL) {
+        return -1;
+    }
+    if (w1 != w2 || h1 != h2) {
+        fprintf(out, "identical no\nwidth %d %d\nheight %d %d\n", w1, w2, h1, h2);
+        return fflush(out) == 0 ? 1 : -1;
+    }
+    // The second image is brought into the layout of the first if need be.
+    stats_begin(&bdd_stats.decode);
+    if (l1.order != l2.order || l1.rbits != l2.rbits || l1.cbits != l2.cbits) {
+        b = bdd_reorder(b, &l2, &l1);
+    }
+    BDD_RECT *rects = NULL;
+    int count = 0;
+    long long pixels = b == NULL ? -1 : bdd_diff(a, b, &l1, w1, h1, &rects, &count);
+    stats_end(&bdd_stats.decode);
+    if (pixels == -1) {
+        return -1;
+    }
+    stats_begin(&bdd_stats.write);
+    fprintf(out, "identical %s\nwidth %d\nheight %d\npixels %lld\n",
+            pixels ? "no" : "yes", w1, h1, pixels);
+    for (int i = 0; i < count; i++) {
+        BDD_RECT *rect = rects + i;
+        fprintf(out, "rect %d %d %d %d\n", rect->r0, rect->c0, rect->r1, rect->c1);
+    }
+    int err = fflush(out);
+    stats_end(&bdd_stats.write);
+    free(rects);
+    return err ? -1 : pixels != 0;
+}
+
+int streq(char *str1, char *str2) {
+    char s1 = *str1;
+    char s2 = *str2;
+    for (int i = 0; (s1 != 0) && (s2 != 0); i++) {
+        s1 = *(str1+i);
+        s2 = *(str2+i);
+        if (s1 != s2) {
+            return 0;
         }
     }
-    if (tform == 1) {
-        if (img_write_birp(bdd_map(root, negative), width, height, out) == -1) {
+    return s1 == s2;
+}
+
+int strtoint(char *str) {
+    char s = *str;
+    int n = 0;
+    for (int i = 0; ; i++) {
+        if (i > 3) {
             return -1;
         }
+        s = *(str+i);
+        if (!s) {
+            break;
+        }
+        if (s < 48 || s > 57) {
+            return -1;
+        }
+        n *= 10;
+        n += (s - 48);
     }
-    if (tform == 2) {
-        if (img_write_birp(bdd_map(root, threshold), width, height, out) == -1) {
+    return n;
+}
+
+/*
+ * An image, as carried from one step of a fan-out to the next.
+ */
+typedef struct fanout_image {
+    BDD_NODE *root;
+    int w;
+    int h;
+    BDD_LAYOUT layout;
+} FANOUT_IMAGE;
+
+/*
+ * One output of a fan-out: its path, the global options selected for it,
+ * and the image after each step of its chain of transformations that has
+ * been applied, the first being the input image.
+ */
+typedef struct fanout_output {
+    char *path;
+    int options;
+    TFORM_STEP *chain;
+    int count;
+    int ascii_width;
+    int order;
+    int shape;
+    int hybrid;
+    int rect;
+    FANOUT_IMAGE *steps;
+    int applied;
+} FANOUT_OUTPUT;
+
+/*
+ * Read the input image of a fan-out and build its BDD, in the default
+ * layout for PGM input.
+ */
+int fanout_read(FILE *in, int input, FANOUT_IMAGE *image) {
+    if (input != 1) {
+        image->root = read_birp_gray(in, &image->w, &image->h, &image->layout, "--to");
+        return image->root == NULL ? -1 : 0;
+    }
+    int w, h;
+    if (read_pgm_header(in, &w, &h) == -1) {
+        return -1;
+    }
+    int tiled = w > TILE_MAX || h > TILE_MAX;
+    int tile = TILE_MAX;
+    while ((size_t)tile * w > RASTER_SIZE_MAX) {
+        tile /= 2;
+    }
+    if (!tiled && read_pgm_rows(in, w, h, birp_raster) == -1) {
+        return -1;
+    }
+    BDD_LAYOUT layout = {BDD_ORDER_RC, 0, 0, 0};
+    bdd_layout_fit(&layout, w, h);
+    PGM_BAND src = {in, w};
+    int err = 0;
+    stats_begin(&bdd_stats.build);
+    image->root = tiled ? bdd_from_raster_tiled(w, h, tile, birp_raster, pgm_fill_band, &src, NULL,
+                                                0, &err)
+                        : bdd_from_raster_ordered(w, h, birp_raster, NULL, BDD_IDENTITY, &layout);
+    stats_end(&bdd_stats.build);
+    image->w = w;
+    image->h = h;
+    image->layout = layout;
+    return image->root == NULL ? -1 : 0;
+}
+
+/*
+ * Whether any step of a chain is restricted to some colour channels, which
+ * a fan-out, being of a grayscale image, does not have.
+ */
+int fanout_channels(TFORM_STEP *chain, int count) {
+    for (int i = 0; i < count; i++) {
+        if ((chain + i)->channels != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Parse the output specifications of a fan-out, each as the options of a
+ * conversion from the input format, into outputs[0..count).
+ */
+int fanout_parse(int argc, char **argv, int input, FANOUT_OUTPUT *outputs) {
+    char **args = malloc((argc + 4) * sizeof(char *));
+    if (args == NULL) {
+        return -1;
+    }
+    int k = 0;
+    for (int i = 0; i < argc; k++) {
+        FANOUT_OUTPUT *o = outputs + k;
+        if (i + 1 >= argc) {
+            free(args);
             return -1;
         }
+        o->path = *(argv + i + 1);
+        int m = 0;
+        *(args + m++) = "birp";
+        *(args + m++) = "-i";
+        *(args + m++) = input == 1 ? "pgm" : "birp";
+        for (i += 2; i < argc && !streq(*(argv + i), "--to"); i++) {
+            *(args + m++) = *(argv + i);
+        }
+        *(args + m) = NULL;
+        // Options that concern the whole run, or the building of the BDD
+        // shared by all outputs, are not accepted per output.
+        if (validargs(m, args) != 0 || (global_options & HELP_OPTION) || stats_enabled
+            || daemon_socket != NULL || compare_first != NULL || batch_output != NULL
+            || store_path != NULL || birp_tolerance || ((global_options >> 4) & 0xF) == 5
+            || fanout_channels(tform_chain, tform_count)) {
+            fprintf(stderr, "Invalid output specification for %s\n", o->path);
+            free(args);
+            return -1;
+        }
+        o->options = global_options;
+        o->chain = tform_chain;
+        o->count = tform_count;
+        o->ascii_width = ascii_width;
+        o->order = birp_order;
+        o->shape = birp_shape;
+        o->hybrid = birp_hybrid;
+        // The chain now belongs to the output.
+        tform_chain = NULL;
+        tform_count = 0;
     }
-    if (tform == 3) {
-        int factor = (global_options>>16) & 0xFF;
-        if (factor == 0) {
-            img_write_birp(root, width, height, out);
-            return 0;
+    free(args);
+    return 0;
+}
+
+/*
+ * Bring an output to the end of its chain of transformations, starting
+ * from the longest prefix of the chain already applied for an earlier
+ * output (of the same shape), and write it.
+ */
+int fanout_write(FANOUT_OUTPUT *outputs, int j, FANOUT_IMAGE *base, FILE *out) {
+    FANOUT_OUTPUT *o = outputs + j;
+    global_options = o->options;
+    ascii_width = o->ascii_width;
+    birp_order = o->order;
+    birp_shape = o->shape;
+    birp_hybrid = o->hybrid;
+    o->rect = o->shape == SHAPE_KEEP ? base->layout.rect : o->shape;
+    o->steps = malloc((o->count + 1) * sizeof(FANOUT_IMAGE));
+    if (o->steps == NULL) {
+        return -1;
+    }
+    *o->steps = *base;
+    o->applied = 0;
+    for (int q = 0; q < j; q++) {
+        FANOUT_OUTPUT *p = outputs + q;
+        if (p->steps == NULL || p->rect != o->rect) {
+            continue;
         }
-        int sign = (factor>>7) & 1;
-        int bml = bdd_min_level(width, height);
-        if (sign == 0) {
-            if (img_write_birp(bdd_zoom(root, bml, factor), 1<<(bml/2 + factor), 1<<(bml/2 + factor), out) == -1) {
-                return -1;
-            }
+        int s = 0;
+        while (s < o->count && s < p->applied && (o->chain + s)->tform == (p->chain + s)->tform
+               && (o->chain + s)->param == (p->chain + s)->param) {
+            s++;
         }
-        if (sign == 1) {
-            sign = ((factor ^ 0xFF)+1) & 0xFF;
-            if (sign > bml/2) {
-                sign = bml/2;
-            }
-            if (img_write_birp(bdd_zoom(root, bml, factor), 1<<(bml/2 - sign), 1<<(bml/2 - sign), out) == -1) {
-                return -1;
-            }
+        for (int t = o->applied + 1; t <= s; t++) {
+            *(o->steps + t) = *(p->steps + t);
         }
+        o->applied = s > o->applied ? s : o->applied;
     }
-    if (tform == 4) {
-        int bml = bdd_min_level(width, height);
-        if (img_write_birp(bdd_rotate(root, bml), 1<<(bml/2), 1<<(bml/2), out) == -1) {
+    // Each step is applied on its own, so that its result can be shared.
+    for (; o->applied < o->count; o->applied++) {
+        FANOUT_IMAGE image = *(o->steps + o->applied);
+        if (apply_tforms(&image.root, &image.w, &image.h, &image.layout, o->chain + o->applied, 1,
+                         o->rect) == -1) {
             return -1;
         }
+        *(o->steps + o->applied + 1) = image;
+    }
+    FANOUT_IMAGE image = *(o->steps + o->count);
+    switch ((o->options >> 4) & 0xF) {
+    case 1:
+        return root_to_pgm(image.root, image.w, image.h, &image.layout, out);
+    case 2: {
+        int want = o->order == ORDER_KEEP ? base->layout.order : o->order;
+        if (encode_layout(&image.root, image.w, image.h, &image.layout, want, o->rect) == -1) {
+            return -1;
+        }
+        return write_birp(image.root, image.w, image.h, &image.layout, out);
+    }
+    case 3:
+        return root_to_ascii(image.root, image.w, image.h, &image.layout, out);
+    default:
+        return root_to_stats(image.root, image.w, image.h, &image.layout, out);
     }
-    return 0;
 }
 
-int pgm_to_ascii(FILE *in, FILE *out) {
-    int width, height;
-    if (img_read_pgm(in, &width, &height, raster_data, RASTER_SIZE_MAX) == -1) {
+int birp_fanout(FILE *in, int argc, char **argv) {
+    int input = global_options & 0xF;
+    int stats = stats_enabled;
+    int n = 0;
+    for (int i = 0; i < argc; i++) {
+        n += streq(*(argv + i), "--to");
+    }
+    FANOUT_OUTPUT *outputs = calloc(n, sizeof(FANOUT_OUTPUT));
+    if (outputs == NULL) {
         return -1;
     }
-    for (int i = 0; i < height*width; i++) {
-        if (0 <= *(raster_data + i) && *(raster_data + i) <= 63) {
-            fputc(' ', out);
-        }
-        else if (64 <= *(raster_data + i) && *(raster_data + i) <= 127) {
-            fputc('.', out);
-        }
-        else if (128 <= *(raster_data + i) && *(raster_data + i) <= 191) {
-            fputc('*', out);
-        }
-        else if (192 <= *(raster_data + i) && *(raster_data + i) <= 255) {
-            fputc('@', out);
+    FANOUT_IMAGE base;
+    int err = fanout_parse(argc, argv, input, outputs);
+    stats_enabled = stats;
+    if (err == 0) {
+        err = fanout_read(in, input, &base);
+    }
+    if (err == 0) {
+        // Each output without a transformation walks the image read, which
+        // is so far the only BDD in the table.
+        int passes = 0;
+        for (int j = 0; j < n; j++) {
+            passes += (outputs + j)->count == 0;
         }
-        else {
-            return -1;
+        base.root = decode_relayout(base.root, passes);
+        err = base.root == NULL ? -1 : 0;
+    }
+    for (int j = 0; j < n && err == 0; j++) {
+        FILE *out = fopen((outputs + j)->path, "w");
+        int failed = out == NULL || fanout_write(outputs, j, &base, out) == -1;
+        if (out != NULL && fclose(out) == EOF) {
+            failed = 1;
         }
-        if (i % width == width-1) {
-            fputc('\n', out);
+        if (failed) {
+            fprintf(stderr, "%s: conversion failed\n", (outputs + j)->path);
         }
+        err = failed ? -1 : 0;
     }
-    return 0;
+    for (int j = 0; j < n; j++) {
+        free((outputs + j)->chain);
+        free((outputs + j)->steps);
+    }
+    free(outputs);
+    return err;
 }
 
-int birp_to_ascii(FILE *in, FILE *out) {
-    int width, height;
-    BDD_NODE *root = img_read_birp(in, &width, &height);
-    if (root == NULL) {
-        return -1;
+/*
+ * Perform the conversion selected by the global options, reading from one
+ * stream and writing to another.  Returns EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int convert_images(FILE *in, FILE *out) {
+    int conversion = global_options & 0xFF;
+    if (conversion == 0x21) {
+        if (pgm_to_birp(in, out) == -1) {
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
     }
-    bdd_to_raster(root, width, height, raster_data);
-    for (int i = 0; i < height*width; i++) {
-        if (0 <= *(raster_data + i) && *(raster_data + i) <= 63) {
-            fputc(' ', out);
+    if (conversion == 0x12) {
+        if (birp_to_pgm(in, out) == -1) {
+            return EXIT_FAILURE;
         }
-        else if (64 <= *(raster_data + i) && *(raster_data + i) <= 127) {
-            fputc('.', out);
+        return EXIT_SUCCESS;
+    }
+    if (conversion == 0x22) {
+        if (birp_to_birp(in, out) == -1) {
+            return EXIT_FAILURE;
         }
-        else if (128 <= *(raster_data + i) && *(raster_data + i) <= 191) {
-            fputc('*', out);
+        return EXIT_SUCCESS;
+    }
+    if (conversion == 0x23) {
+        if (ppm_to_birp(in, out) == -1) {
+            return EXIT_FAILURE;
         }
-        else if (192 <= *(raster_data + i) && *(raster_data + i) <= 255) {
-            fputc('@', out);
+        return EXIT_SUCCESS;
+    }
+    if (conversion == 0x52) {
+        if (birp_to_ppm(in, out) == -1) {
+            return EXIT_FAILURE;
         }
-        else {
-            return -1;
+        return EXIT_SUCCESS;
+    }
+    if (conversion == 0x31) {
+        if (pgm_to_ascii(in, out) == -1) {
+            return EXIT_FAILURE;
         }
-        if (i % width == width-1) {
-            fputc('\n', out);
+        return EXIT_SUCCESS;
+    }
+    if (conversion == 0x32) {
+        if (birp_to_ascii(in, out) == -1) {
+            return EXIT_FAILURE;
         }
+        return EXIT_SUCCESS;
     }
-    return 0;
-}
-
-int streq(char *str1, char *str2) {
-    char s1 = *str1;
-    char s2 = *str2;
-    for (int i = 0; (s1 != 0) && (s2 != 0); i++) {
-        s1 = *(str1+i);
-        s2 = *(str2+i);
-        if (s1 != s2) {
-            return 0;
+    if (conversion == 0x41) {
+        if (pgm_to_stats(in, out) == -1) {
+            return EXIT_FAILURE;
         }
+        return EXIT_SUCCESS;
     }
-    return s1 == s2;
+    if (conversion == 0x42) {
+        if (birp_to_stats(in, out) == -1) {
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+    return EXIT_FAILURE;
 }
 
-int strtoint(char *str) {
-    char s = *str;
-    int n = 0;
-    for (int i = 0; ; i++) {
-        if (i > 3) {
-            return -1;
-        }
-        s = *(str+i);
-        if (!s) {
-            break;
-        }
-        if (s < 48 || s > 57) {
-            return -1;
-        }
-        n *= 10;
-        n += (s - 48);
+/*
+ * With a store, BIRP input and output go through a handle of its own for
+ * each conversion, attached to the manager for the conversion's length.
+ */
+int convert(FILE *in, FILE *out) {
+    if (store_path == NULL) {
+        return convert_images(in, out);
     }
-    return n;
+    BDD_STORE *store = bdd_store_open(store_path);
+    if (store == NULL) {
+        return EXIT_FAILURE;
+    }
+    BDD_STORE *prev = bdd_store_use(store);
+    int result = convert_images(in, out);
+    bdd_store_use(prev);
+    bdd_store_close(store);
+    return result;
+}
+
+void options_save(BIRP_OPTIONS *opts) {
+    opts->global_options = global_options;
+    opts->tform_chain = tform_chain;
+    opts->tform_count = tform_count;
+    opts->tform_channels = tform_channels;
+    opts->ascii_width = ascii_width;
+    opts->order = birp_order;
+    opts->shape = birp_shape;
+    opts->tolerance = birp_tolerance;
+    opts->hybrid = birp_hybrid;
+    opts->store_path = store_path;
+    opts->store_export = store_export;
+    opts->stats_enabled = stats_enabled;
+}
+
+void options_restore(BIRP_OPTIONS *opts) {
+    global_options = opts->global_options;
+    tform_chain = opts->tform_chain;
+    tform_count = opts->tform_count;
+    tform_channels = opts->tform_channels;
+    ascii_width = opts->ascii_width;
+    birp_order = opts->order;
+    birp_shape = opts->shape;
+    birp_tolerance = opts->tolerance;
+    birp_hybrid = opts->hybrid;
+    store_path = opts->store_path;
+    store_export = opts->store_export;
+    stats_enabled = opts->stats_enabled;
 }
 
 /**
@@ -203,26 +1509,122 @@ int strtoint(char *str) {
  */
 int validargs(int argc, char **argv) {
     global_options = 0;
+    free(tform_chain);
+    tform_chain = NULL;
+    tform_count = 0;
+    tform_channels = 0;
+    ascii_width = 0;
+    birp_order = ORDER_KEEP;
+    birp_shape = SHAPE_KEEP;
+    birp_tolerance = 0;
+    birp_hybrid = 0;
+    store_path = NULL;
+    store_export = 0;
+    stats_enabled = 0;
+    daemon_socket = NULL;
+    compare_first = NULL;
+    compare_second = NULL;
+    fanout_argv = NULL;
+    fanout_argc = 0;
+    batch_input = NULL;
+    batch_output = NULL;
+    batch_jobs = 0;
     int i = 0;
+    int flags = 0;
     char *arg;
     arg = *argv++;
     global_options = 34;
-    int ibirp = 1;
     int obirp = 1;
+    int oascii = 0;
     int input = 1;
     int output = 1;
     int transform = 1;
     while ((i++) < argc-1) {
         arg = *argv++;
-        if (streq(arg, "-h")) {
-            if (i == 1) {
+        if (streq(arg, "--daemon")) {
+            // Only on its own: the options are given with each request.
+            if (i - flags != 1 || argc != 3) {
+                return -1;
+            }
+            daemon_socket = *argv++;
+            i++;
+        }
+        else if (streq(arg, "--compare")) {
+            // Only on its own: both inputs are BIRP files.
+            if (i - flags != 1 || argc != 4) {
+                return -1;
+            }
+            compare_first = *argv++;
+            compare_second = *argv++;
+            i += 2;
+        }
+        else if (streq(arg, "--batch")) {
+            // First, and not counted in the positions of -i/-o.
+            if (i - flags != 1 || i + 2 > argc-1) {
+                return -1;
+            }
+            batch_input = *argv++;
+            batch_output = *argv++;
+            i += 2;
+            flags += 3;
+        }
+        else if (streq(arg, "--to")) {
+            // The rest of the arguments are output specifications, parsed
+            // by birp_fanout(); only input options may precede them.
+            if (!output || !transform || batch_output != NULL || i + 1 > argc-1
+                || (global_options & 0xF) == 3) {
+                return -1;
+            }
+            fanout_argv = argv - 1;
+            fanout_argc = argc - i;
+            break;
+        }
+        else if (streq(arg, "-j")) {
+            if (batch_output == NULL || batch_jobs) {
+                return -1;
+            }
+            arg = *argv++;
+            if (!arg) {
+                return -1;
+            }
+            i++;
+            flags += 2;
+            batch_jobs = strtoint(arg);
+            if (batch_jobs <= 0) {
+                return -1;
+            }
+        }
+        else if (streq(arg, "--store")) {
+            // Accepted anywhere, and not counted in the positions of -i/-o.
+            if (store_path != NULL || !(arg = *argv++)) {
+                return -1;
+            }
+            store_path = arg;
+            i++;
+            flags += 2;
+        }
+        else if (streq(arg, "--export")) {
+            // Accepted anywhere, and not counted in the positions of -i/-o.
+            if (store_export) {
+                return -1;
+            }
+            store_export = 1;
+            flags++;
+        }
+        else if (streq(arg, "--stats")) {
+            // Accepted anywhere, and not counted in the positions of -i/-o.
+            stats_enabled = 1;
+            flags++;
+        }
+        else if (streq(arg, "-h")) {
+            if (i - flags == 1) {
                 global_options = 0x80000000;
                 return 0;
             }
             return -1;
         }
         else if (streq(arg, "-i")) {
-            if ((i > 3) || !input || !transform) {
+            if ((i - flags > 3) || !input || !transform) {
                 return -1;
             }
             arg = *argv++;
@@ -233,7 +1635,11 @@ int validargs(int argc, char **argv) {
             if (streq(arg, "pgm")) {
                 global_options &= 16777200;
                 global_options |= 1;
-                ibirp = 0;
+                input = 0;
+            }
+            else if (streq(arg, "ppm")) {
+                global_options &= 16777200;
+                global_options |= 3;
                 input = 0;
             }
             else if (streq(arg, "birp")) {
@@ -244,7 +1650,7 @@ int validargs(int argc, char **argv) {
             }
         }
         else if (streq(arg, "-o")) {
-            if ((i > 3) || !output || !transform) {
+            if ((i - flags > 3) || !output || !transform) {
                 return -1;
             }
             arg = *argv++;
@@ -258,6 +1664,12 @@ int validargs(int argc, char **argv) {
                 obirp = 0;
                 output = 0;
             }
+            else if (streq(arg, "ppm")) {
+                global_options &= 16776975;
+                global_options |= (5 << 4);
+                obirp = 0;
+                output = 0;
+            }
             else if (streq(arg, "birp")) {
                 output = 0;
             }
@@ -265,100 +1677,280 @@ int validargs(int argc, char **argv) {
                 global_options &= 16776975;
                 global_options |= (3 << 4);
                 obirp = 0;
+                oascii = 1;
+                output = 0;
+            }
+            else if (streq(arg, "stats")) {
+                global_options &= 16776975;
+                global_options |= (4 << 4);
+                obirp = 0;
                 output = 0;
             }
             else {
                 return -1;
             }
         }
-        else if (streq(arg, "-n")) {
-            if (ibirp && obirp && transform) {
-                global_options |= (1 << 8);
-                transform = 0;
+        else if (streq(arg, "-w")) {
+            if (!oascii || ascii_width) {
+                return -1;
+            }
+            arg = *argv++;
+            if (!arg) {
+                return -1;
+            }
+            i++;
+            ascii_width = strtoint(arg);
+            if (ascii_width <= 0) {
+                return -1;
+            }
+        }
+        else if (streq(arg, "-O")) {
+            if (!obirp || birp_order != ORDER_KEEP) {
+                return -1;
+            }
+            arg = *argv++;
+            if (!arg) {
+                return -1;
+            }
+            i++;
+            birp_order = streq(arg, "auto") ? ORDER_AUTO : bdd_order_parse(arg);
+            if (birp_order == -1) {
+                return -1;
+            }
+            transform = 0;
+        }
+        else if (streq(arg, "-S")) {
+            if (!obirp || birp_shape != SHAPE_KEEP) {
+                return -1;
+            }
+            arg = *argv++;
+            if (!arg) {
+                return -1;
+            }
+            i++;
+            if (streq(arg, "square")) {
+                birp_shape = 0;
+            }
+            else if (streq(arg, "rect")) {
+                birp_shape = 1;
             }
             else {
                 return -1;
             }
+            transform = 0;
         }
-        else if (streq(arg, "-r")) {
-            if (ibirp && obirp && transform) {
-                global_options |= (4 << 8);
-                transform = 0;
+        else if (streq(arg, "-q")) {
+            if (!obirp || birp_tolerance) {
+                return -1;
+            }
+            arg = *argv++;
+            if (!arg) {
+                return -1;
+            }
+            i++;
+            birp_tolerance = strtoint(arg);
+            if (birp_tolerance < 0 || birp_tolerance > 255) {
+                return -1;
+            }
+            transform = 0;
+        }
+        else if (streq(arg, "-H")) {
+            if (!obirp || birp_hybrid) {
+                return -1;
+            }
+            arg = *argv++;
+            if (!arg) {
+                return -1;
+            }
+            i++;
+            int size = strtoint(arg);
+            if (size == 8) {
+                birp_hybrid = 6;
+            }
+            else if (size == 16) {
+                birp_hybrid = 8;
             }
             else {
                 return -1;
             }
+            transform = 0;
         }
-        else if (streq(arg, "-t")) {
-            if (ibirp && obirp && transform) {
-                global_options |= (2 << 8);
-                transform = 0;
-                arg = *argv++;
-                if (!arg) {
-                    return -1;
-                }
-                i++;
-                int range = strtoint(arg);
-                if (range >= 0 && range <= 255) {
-                    global_options |= (range << 16);
-                }
-                else {
+        else if (streq(arg, "-c")) {
+            // Only colour input has channels to select.
+            if (!obirp || (global_options & 0xF) == 1) {
+                return -1;
+            }
+            arg = *argv++;
+            if (!arg || !*arg) {
+                return -1;
+            }
+            i++;
+            tform_channels = 0;
+            for (; *arg != '\0'; arg++) {
+                int bit = *arg == 'r' ? 1 : *arg == 'g' ? 2 : *arg == 'b' ? 4 : 0;
+                if (bit == 0 || (tform_channels & bit)) {
                     return -1;
                 }
+                tform_channels |= bit;
+            }
+            if (tform_channels == 7) {
+                tform_channels = 0;
+            }
+            transform = 0;
+        }
+        else if (streq(arg, "-n")) {
+            if (!obirp || add_tform(1, 0)) {
+                return -1;
+            }
+            transform = 0;
+        }
+        else if (streq(arg, "-r")) {
+            if (!obirp || add_tform(4, 0)) {
+                return -1;
+            }
+            transform = 0;
+        }
+        else if (streq(arg, "-R")) {
+            if (!obirp) {
+                return -1;
+            }
+            arg = *argv++;
+            if (!arg) {
+                return -1;
+            }
+            i++;
+            int degrees = strtoint(arg);
+            int op;
+            if (degrees == 90) {
+                op = BDD_ROT90;
+            }
+            else if (degrees == 180) {
+                op = BDD_ROT180;
+            }
+            else if (degrees == 270) {
+                op = BDD_ROT270;
             }
             else {
                 return -1;
             }
+            if (add_tform(5, op)) {
+                return -1;
+            }
+            transform = 0;
         }
-        else if (streq(arg, "-z")) {
-            if (ibirp && obirp && transform) {
-                global_options |= (3 << 8);
-                transform = 0;
-                arg = *argv++;
-                if (!arg) {
-                    return -1;
-                }
-                i++;
-                int range = strtoint(arg);
-                if (range == 0) {
-                    range = 0;
-                }
-                else if (range > 0 && range <= 16) {
-                    range ^= 255;
-                    global_options |= ((range+1) << 16);
-                }
-                else {
-                    return -1;
-                }
+        else if (streq(arg, "-f")) {
+            if (!obirp) {
+                return -1;
+            }
+            arg = *argv++;
+            if (!arg) {
+                return -1;
+            }
+            i++;
+            int op;
+            if (streq(arg, "h")) {
+                op = BDD_FLIP_H;
+            }
+            else if (streq(arg, "v")) {
+                op = BDD_FLIP_V;
             }
             else {
                 return -1;
             }
+            if (add_tform(5, op)) {
+                return -1;
+            }
+            transform = 0;
+        }
+        else if (streq(arg, "-T")) {
+            if (!obirp || add_tform(5, BDD_TRANSPOSE)) {
+                return -1;
+            }
+            transform = 0;
+        }
+        else if (streq(arg, "-A")) {
+            if (!obirp || add_tform(5, BDD_ANTITRANSPOSE)) {
+                return -1;
+            }
+            transform = 0;
+        }
+        else if (streq(arg, "-t")) {
+            if (!obirp) {
+                return -1;
+            }
+            arg = *argv++;
+            if (!arg) {
+                return -1;
+            }
+            i++;
+            int range = strtoint(arg);
+            if (range < 0 || range > 255 || add_tform(2, range)) {
+                return -1;
+            }
+            transform = 0;
+        }
+        else if (streq(arg, "-z")) {
+            if (!obirp) {
+                return -1;
+            }
+            arg = *argv++;
+            if (!arg) {
+                return -1;
+            }
+            i++;
+            int range = strtoint(arg);
+            if (range < 0 || range > 16) {
+                return -1;
+            }
+            if (range > 0) {
+                range ^= 255;
+                range += 1;
+            }
+            if (add_tform(3, range)) {
+                return -1;
+            }
+            transform = 0;
         }
         else if (streq(arg, "-Z")) {
-            if (ibirp && obirp && transform) {
-                global_options |= (3 << 8);
-                transform = 0;
-                arg = *argv++;
-                if (!arg) {
-                    return -1;
-                }
-                i++;
-                int range = strtoint(arg);
-                if (range >= 0 && range <= 16) {
-                    global_options |= (range << 16);
-                }
-                else {
-                    return -1;
-                }
+            if (!obirp) {
+                return -1;
             }
-            else {
+            arg = *argv++;
+            if (!arg) {
+                return -1;
+            }
+            i++;
+            int range = strtoint(arg);
+            if (range < 0 || range > 16 || add_tform(3, range)) {
                 return -1;
             }
+            transform = 0;
         }
         else {
             return -1;
         }
     }
+    // PPM input is converted only to BIRP, and PPM output is made only from
+    // BIRP (colour or grayscale) input.
+    int conversion = global_options & 0xFF;
+    if (((conversion & 0xF) == 3 && conversion != 0x23) || conversion == 0x51) {
+        return -1;
+    }
+    // Lossy encoding applies only when a BDD is built from PGM or PPM input.
+    if (birp_tolerance && (global_options & 0xF) != 1 && (global_options & 0xF) != 3) {
+        return -1;
+    }
+    // Tiles of hybrid BDDs are not kept in a store.
+    if (store_path != NULL && birp_hybrid && !store_export) {
+        return -1;
+    }
+    // Exporting writes from a store to a self-contained BIRP file.
+    if (store_export && (store_path == NULL || ((global_options >> 4) & 0xF) != 2)) {
+        return -1;
+    }
+    // Counters are kept per thread, so a batch has its own report instead.
+    if (stats_enabled && batch_output != NULL) {
+        return -1;
+    }
     return 0;
 }
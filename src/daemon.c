@@ -0,0 +1,464 @@
+/*
+ * Conversion daemon: serves conversions over a Unix domain socket from an
+ * epoll event loop, with a pool of worker threads performing them (see
+ * daemon.h for the protocol).
+ */
+
+#define _GNU_SOURCE     // for accept4
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "batch.h"
+#include "const.h"
+#include "daemon.h"
+#include "debug.h"
+#include "stats.h"
+#include "store.h"
+
+__thread char *daemon_socket = NULL;
+
+/*
+ * State of one connection: the request received so far and, once it has
+ * been served, the reply still to be sent.
+ */
+typedef struct daemon_conn {
+    int fd;
+    char *in;           // request line and input image
+    size_t inlen;
+    size_t incap;
+    char *out;          // reply, once the request has been served
+    size_t outlen;
+    size_t outpos;
+    struct daemon_conn *next;   // next in the list of the pool holding it
+} DAEMON_CONN;
+
+/*
+ * The worker threads and the lists through which connections pass between
+ * them and the event loop.  A connection whose request is complete is taken
+ * off the event loop and queued for the workers; once served, it is put on
+ * the list of replies, and the event loop, woken through an eventfd, watches
+ * it again until the reply has been sent.
+ */
+typedef struct daemon_pool {
+    DAEMON_CONN *queue;         // requests awaiting a worker, oldest first
+    DAEMON_CONN *last;
+    DAEMON_CONN *served;        // requests served, awaiting their replies
+    int stop;
+    int efd;
+    pthread_mutex_t lock;
+    pthread_cond_t nonempty;
+} DAEMON_POOL;
+
+static volatile sig_atomic_t daemon_stop = 0;
+
+static void daemon_signal(int sig) {
+    daemon_stop = 1;
+}
+
+static void daemon_close(DAEMON_CONN *conn) {
+    close(conn->fd);
+    free(conn->in);
+    free(conn->out);
+    free(conn);
+}
+
+/*
+ * Split the request line at the start of the input into an argument
+ * vector, in place.  Returns the number of arguments (including the
+ * program name), with *argvp set to a vector to be freed by the caller and
+ * *datap to the start of the image data, or -1 if the line is malformed.
+ */
+static int daemon_parse(DAEMON_CONN *conn, char ***argvp, char **datap) {
+    size_t end = 0;
+    int argc = 1;
+    while (end < conn->inlen && end < DAEMON_LINE_MAX && *(conn->in + end) != '\n') {
+        if (*(conn->in + end) == ' ') {
+            argc++;
+        }
+        end++;
+    }
+    if (end == conn->inlen || *(conn->in + end) != '\n') {
+        return -1;
+    }
+    if (end == 0) {
+        argc = 0;
+    }
+    char **argv = malloc((argc + 2) * sizeof(char *));
+    if (argv == NULL) {
+        return -1;
+    }
+    *argv = "birp";
+    int n = 1;
+    char *arg = conn->in;
+    for (size_t i = 0; i <= end && argc > 0; i++) {
+        char *p = conn->in + i;
+        if (*p == ' ' || *p == '\n') {
+            *p = '\0';
+            *(argv + n++) = arg;
+            arg = p + 1;
+        }
+    }
+    *(argv + n) = NULL;
+    *argvp = argv;
+    *datap = conn->in + end + 1;
+    return n;
+}
+
+/*
+ * Perform the conversion requested on a connection whose input is complete,
+ * leaving the reply in conn->out.  This runs in a worker thread, whose
+ * node tables are emptied, and counters cleared, before each conversion,
+ * so that requests are independent.
+ */
+static int daemon_serve(DAEMON_CONN *conn) {
+    static const BDD_STATS zero_stats;
+    char **argv = NULL;
+    char *data = NULL;
+    char *obuf = NULL, *ebuf = NULL;
+    size_t olen = 0, elen = 0;
+    int status = EXIT_FAILURE;
+    FILE *out = open_memstream(&obuf, &olen);
+    FILE *err = open_memstream(&ebuf, &elen);
+    if (out == NULL || err == NULL) {
+        goto done;
+    }
+    // Modes that run other than one conversion of the request, or that use
+    // files of the daemon, are refused.
+    int argc = daemon_parse(conn, &argv, &data);
+    if (argc < 0 || validargs(argc, argv) != 0 || (global_options & HELP_OPTION)
+        || daemon_socket != NULL || fanout_argv != NULL || store_path != NULL
+        || batch_output != NULL || compare_first != NULL) {
+        fprintf(err, "Invalid request\n");
+        goto done;
+    }
+    size_t len = conn->inlen - (data - conn->in);
+    FILE *in = len > 0 ? fmemopen(data, len, "r") : fopen("/dev/null", "r");
+    if (in == NULL) {
+        goto done;
+    }
+    bdd_reset();
+    bdd_stats = zero_stats;
+    status = convert(in, out);
+    fclose(in);
+    if (stats_enabled) {
+        stats_report(err);
+    }
+
+ done:
+    free(argv);
+    if (out != NULL) {
+        fclose(out);
+    }
+    if (err != NULL) {
+        fclose(err);
+    }
+    FILE *reply = open_memstream(&conn->out, &conn->outlen);
+    if (reply != NULL) {
+        fprintf(reply, "%d %zu %zu\n", status, olen, elen);
+        fwrite(obuf, 1, olen, reply);
+        fwrite(ebuf, 1, elen, reply);
+        fclose(reply);
+    }
+    free(obuf);
+    free(ebuf);
+    return reply == NULL ? -1 : 0;
+}
+
+/*
+ * Read whatever input is available on a connection.  Returns 1 once the
+ * client has finished sending, 0 if more is to come, and -1 on error or
+ * if the request exceeds DAEMON_REQUEST_MAX bytes.
+ */
+static int daemon_read(DAEMON_CONN *conn) {
+    for (;;) {
+        if (conn->inlen == conn->incap) {
+            // Room is made for one byte past the limit, so that a request
+            // exceeding it is seen as such.
+            if (conn->incap > DAEMON_REQUEST_MAX) {
+                return -1;
+            }
+            size_t cap = conn->incap ? 2 * conn->incap : 65536;
+            if (cap > DAEMON_REQUEST_MAX + 1) {
+                cap = DAEMON_REQUEST_MAX + 1;
+            }
+            char *in = realloc(conn->in, cap);
+            if (in == NULL) {
+                return -1;
+            }
+            conn->in = in;
+            conn->incap = cap;
+        }
+        ssize_t n = read(conn->fd, conn->in + conn->inlen, conn->incap - conn->inlen);
+        if (n > 0) {
+            conn->inlen += n;
+        }
+        else if (n == 0) {
+            return 1;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        else if (errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+/*
+ * Send as much of the reply as the socket will take.  Returns 1 once the
+ * whole reply has been sent, 0 if more is to be sent, and -1 on error.
+ */
+static int daemon_write(DAEMON_CONN *conn) {
+    while (conn->outpos < conn->outlen) {
+        ssize_t n = write(conn->fd, conn->out + conn->outpos, conn->outlen - conn->outpos);
+        if (n > 0) {
+            conn->outpos += n;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        else if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Take the next request from the queue of the pool, waiting for one.
+ * Returns NULL once the pool is stopping.
+ */
+static DAEMON_CONN *daemon_take(DAEMON_POOL *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->queue == NULL && !pool->stop) {
+        pthread_cond_wait(&pool->nonempty, &pool->lock);
+    }
+    DAEMON_CONN *conn = pool->stop ? NULL : pool->queue;
+    if (conn != NULL) {
+        pool->queue = conn->next;
+        conn->next = NULL;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return conn;
+}
+
+/*
+ * Hand a served request back to the event loop.
+ */
+static void daemon_give(DAEMON_POOL *pool, DAEMON_CONN *conn) {
+    uint64_t one = 1;
+    pthread_mutex_lock(&pool->lock);
+    conn->next = pool->served;
+    pool->served = conn;
+    pthread_mutex_unlock(&pool->lock);
+    if (write(pool->efd, &one, sizeof(one)) == -1) {
+        perror("eventfd");
+    }
+}
+
+/*
+ * Worker thread: serve requests, with a BDD manager and raster of its own,
+ * as for batch conversion (see batch.h), so that the tables stay allocated
+ * and warm from one request to the next.
+ */
+static void *daemon_worker(void *arg) {
+    DAEMON_POOL *pool = arg;
+    BDD_MANAGER *mgr = bdd_manager_new();
+    unsigned char *raster = malloc(RASTER_SIZE_MAX);
+    bdd_manager_use(mgr);
+    birp_raster = raster;
+    DAEMON_CONN *conn;
+    while ((conn = daemon_take(pool)) != NULL) {
+        // A request that cannot be served is given back with no reply, and
+        // its connection closed.
+        if (mgr != NULL && raster != NULL) {
+            daemon_serve(conn);
+        }
+        daemon_give(pool, conn);
+    }
+    bdd_manager_free(mgr);
+    free(raster);
+    return NULL;
+}
+
+/*
+ * Handle readiness of a connection.  Returns 0 while the connection is in
+ * progress, and -1 once it is to be closed, having been served or failed.
+ * A connection whose request is complete is taken off the event loop and
+ * queued for the workers.
+ */
+static int daemon_event(int ep, DAEMON_POOL *pool, DAEMON_CONN *conn, unsigned int events) {
+    if (conn->out == NULL) {
+        int done = daemon_read(conn);
+        if (done <= 0) {
+            return done;
+        }
+        if (epoll_ctl(ep, EPOLL_CTL_DEL, conn->fd, NULL) == -1) {
+            return -1;
+        }
+        pthread_mutex_lock(&pool->lock);
+        if (pool->queue == NULL) {
+            pool->queue = conn;
+        }
+        else {
+            pool->last->next = conn;
+        }
+        pool->last = conn;
+        pthread_cond_signal(&pool->nonempty);
+        pthread_mutex_unlock(&pool->lock);
+        return 0;
+    }
+    return daemon_write(conn) == 0 ? 0 : -1;
+}
+
+/*
+ * Watch the connections of served requests again, for their replies to be
+ * sent.
+ */
+static void daemon_replies(int ep, DAEMON_POOL *pool) {
+    uint64_t count;
+    if (read(pool->efd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        perror("eventfd");
+    }
+    pthread_mutex_lock(&pool->lock);
+    DAEMON_CONN *conn = pool->served;
+    pool->served = NULL;
+    pthread_mutex_unlock(&pool->lock);
+    while (conn != NULL) {
+        DAEMON_CONN *next = conn->next;
+        struct epoll_event ev = {EPOLLOUT, {.ptr = conn}};
+        conn->next = NULL;
+        if (conn->out == NULL || epoll_ctl(ep, EPOLL_CTL_ADD, conn->fd, &ev) == -1) {
+            daemon_close(conn);
+        }
+        conn = next;
+    }
+}
+
+static void daemon_accept(int ep, int lfd) {
+    int fd;
+    while ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        DAEMON_CONN *conn = calloc(1, sizeof(DAEMON_CONN));
+        if (conn == NULL) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        struct epoll_event ev = {EPOLLIN, {.ptr = conn}};
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            daemon_close(conn);
+        }
+    }
+}
+
+/*
+ * Start the worker threads of a pool.  Returns the number started, which
+ * is 0 if none could be.
+ */
+static int daemon_start(DAEMON_POOL *pool, pthread_t *threads, int workers) {
+    int started = 0;
+    while (started < workers) {
+        int err = pthread_create(threads + started, NULL, daemon_worker, pool);
+        if (err != 0) {
+            errno = err;
+            perror("pthread_create");
+            break;
+        }
+        started++;
+    }
+    return started;
+}
+
+static void daemon_finish(DAEMON_POOL *pool, pthread_t *threads, int started) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->nonempty);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < started; i++) {
+        pthread_join(*(threads + i), NULL);
+    }
+}
+
+int birp_daemon(char *path) {
+    struct sockaddr_un addr = {AF_UNIX};
+    size_t n = 0;
+    while (*(path + n) != '\0') {
+        if (n + 1 >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "Socket path too long: %s\n", path);
+            return -1;
+        }
+        *(addr.sun_path + n) = *(path + n);
+        n++;
+    }
+    struct sigaction sa = {{0}};
+    sa.sa_handler = daemon_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = cpus > 0 ? cpus : 1;
+    DAEMON_POOL pool = {NULL, NULL, NULL, 0, -1};
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.nonempty, NULL);
+    pool.efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    pthread_t *threads = malloc(workers * sizeof(pthread_t));
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event *events = malloc(DAEMON_EVENTS * sizeof(struct epoll_event));
+    unlink(path);
+    struct epoll_event lev = {EPOLLIN, {.ptr = NULL}};
+    struct epoll_event eev = {EPOLLIN, {.ptr = &pool}};
+    int started = 0;
+    if (lfd == -1 || ep == -1 || pool.efd == -1 || events == NULL || threads == NULL
+        || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(lfd, SOMAXCONN) == -1
+        || epoll_ctl(ep, EPOLL_CTL_ADD, lfd, &lev) == -1
+        || epoll_ctl(ep, EPOLL_CTL_ADD, pool.efd, &eev) == -1) {
+        perror(path);
+        free(threads);
+        free(events);
+        return -1;
+    }
+    // The daemon runs with as many of the workers as could be started.
+    if ((started = daemon_start(&pool, threads, workers)) == 0) {
+        unlink(path);
+        free(threads);
+        free(events);
+        return -1;
+    }
+    while (!daemon_stop) {
+        int count = epoll_wait(ep, events, DAEMON_EVENTS, -1);
+        for (int i = 0; i < count; i++) {
+            struct epoll_event *ev = events + i;
+            if (ev->data.ptr == NULL) {
+                daemon_accept(ep, lfd);
+            }
+            else if (ev->data.ptr == &pool) {
+                daemon_replies(ep, &pool);
+            }
+            else if (daemon_event(ep, &pool, ev->data.ptr, ev->events) != 0) {
+                daemon_close(ev->data.ptr);
+            }
+        }
+    }
+    // Conversions in progress are finished; connections still open are
+    // dropped with the process.
+    daemon_finish(&pool, threads, started);
+    close(lfd);
+    close(ep);
+    close(pool.efd);
+    unlink(path);
+    free(threads);
+    free(events);
+    return 0;
+}
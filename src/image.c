@@ -9,6 +9,7 @@
 
 #include "bdd.h"
 #include "image.h"
+#include "stats.h"
 
 static int skip_whitespace(FILE *f) {
     int c;
@@ -60,6 +61,13 @@ static int img_read_header(FILE *file, char *type, int *wp, int *hp) {
 		type, max);
 	goto bad;
     }
+    // The pixels of any image must be addressable by a BDD of at most
+    // BDD_LEVELS_MAX levels.
+    if(*wp > BDD_SIDE_MAX || *hp > BDD_SIDE_MAX) {
+	fprintf(stderr, "%s image %dx%d is too large (%d max width/height supported)\n",
+		type, *wp, *hp, BDD_SIDE_MAX);
+	goto bad;
+    }
     return 0;
 
 bad:
@@ -67,9 +75,7 @@ bad:
 }
 
 // Spec: http://netpbm.sourceforge.net/doc/pgm.html
-int img_read_pgm(FILE *file, int *wp, int *hp, unsigned char *raster, size_t size) {
-    int c;
-    unsigned int max;
+int img_read_pgm_header(FILE *file, int *wp, int *hp) {
     int err = fscanf(file, "P5 ");
     if(err < 0) {
 	fprintf(stderr, "Invalid PGM file (missing/bad magic)\n");
@@ -77,59 +83,267 @@ int img_read_pgm(FILE *file, int *wp, int *hp, unsigned char *raster, size_t siz
     }
     if((err = img_read_header(file, "PGM", wp, hp)) < 0)
 	goto bad;
-
-    // Check that there is enough space to hold the data.
-    if(*wp * *hp * sizeof(unsigned char) > size)
+    if(*wp < 0 || *hp < 0)
 	goto bad;
-
-    // Read the raster.
-    unsigned char *dp = raster;
-    for(int i = 0; i < *hp; i++) {
-	for(int j = 0; j < *wp; j++) {
-	    if((c = fgetc(file)) == EOF) {
-		fprintf(stderr, "PGM file image data truncated\n");
-		goto bad;
-	    }
-	    *dp++ = c;
-	}
-    }
     return 0;
 
  bad:
     return -1;
 }
 
-int img_write_pgm(unsigned char *data, int w, int h, FILE *file) {
+int img_read_pgm_rows(FILE *file, int w, int rows, unsigned char *raster) {
+    // Read the rows in one call.  For large rasters stdio transfers the
+    // data directly into the destination rather than through its buffer.
+    size_t n = (size_t)w * rows;
+    if(fread(raster, 1, n, file) != n) {
+	fprintf(stderr, "PGM file image data truncated\n");
+	return -1;
+    }
+    bdd_stats.bytes_in += n;
+    return 0;
+}
+
+int img_read_pgm(FILE *file, int *wp, int *hp, unsigned char *raster, size_t size) {
+    if(img_read_pgm_header(file, wp, hp) < 0)
+	return -1;
+
+    // Check that there is enough space to hold the data.
+    if((size_t)*wp * *hp * sizeof(unsigned char) > size)
+	return -1;
+
+    // The stream is left positioned just after the raster, so that
+    // further images in a multi-image stream can be read.
+    return img_read_pgm_rows(file, *wp, *hp, raster);
+}
+
+int img_write_pgm_header(int w, int h, FILE *file) {
     if(file == NULL)
 	return -1;
     fprintf(file, "P5 %d %d 255\n", w, h);
-    for(int i = 0; i < h; i++) {
-	for(int j = 0; j < w; j++) {
-	    fputc(data[i * w + j], file);
+    return 0;
+}
+
+int img_write_pgm_rows(unsigned char *data, int w, int rows, FILE *file) {
+    size_t n = (size_t)w * rows;
+    if(fwrite(data, 1, n, file) != n)
+	return -1;
+    bdd_stats.bytes_out += n;
+    return 0;
+}
+
+int img_write_pgm(unsigned char *data, int w, int h, FILE *file) {
+    if(img_write_pgm_header(w, h, file) < 0 || img_write_pgm_rows(data, w, h, file) < 0)
+	return -1;
+    return fflush(file);
+}
+
+// Spec: http://netpbm.sourceforge.net/doc/ppm.html
+int img_read_ppm(FILE *file, int *wp, int *hp, unsigned char *raster, size_t size) {
+    int err = fscanf(file, "P6 ");
+    if(err < 0) {
+	fprintf(stderr, "Invalid PPM file (missing/bad magic)\n");
+	return -1;
+    }
+    if(img_read_header(file, "PPM", wp, hp) < 0 || *wp < 0 || *hp < 0)
+	return -1;
+    size_t n = (size_t)*wp * *hp;
+    if(IMG_CHANNELS * n > size)
+	return -1;
+    // The pixels are interleaved in the file, and are read a row at a time
+    // and dealt out to the planes of the channels.
+    unsigned char *row = malloc(IMG_CHANNELS * (size_t)*wp + 1);
+    if(row == NULL)
+	return -1;
+    for(int r = 0; r < *hp; r++) {
+	if(fread(row, IMG_CHANNELS, *wp, file) != (size_t)*wp) {
+	    fprintf(stderr, "PPM file image data truncated\n");
+	    free(row);
+	    return -1;
+	}
+	for(int k = 0; k < IMG_CHANNELS; k++) {
+	    unsigned char *plane = raster + k*n + (size_t)r * *wp;
+	    for(int c = 0; c < *wp; c++)
+		*(plane + c) = *(row + c*IMG_CHANNELS + k);
 	}
     }
+    free(row);
+    bdd_stats.bytes_in += IMG_CHANNELS * n;
+    return 0;
+}
+
+int img_write_ppm(unsigned char *raster, int w, int h, FILE *file) {
+    if(file == NULL)
+	return -1;
+    size_t n = (size_t)w * h;
+    unsigned char *row = malloc(IMG_CHANNELS * (size_t)w + 1);
+    if(row == NULL)
+	return -1;
+    fprintf(file, "P6 %d %d 255\n", w, h);
+    for(int r = 0; r < h; r++) {
+	for(int k = 0; k < IMG_CHANNELS; k++) {
+	    unsigned char *plane = raster + k*n + (size_t)r * w;
+	    for(int c = 0; c < w; c++)
+		*(row + c*IMG_CHANNELS + k) = *(plane + c);
+	}
+	if(fwrite(row, IMG_CHANNELS, w, file) != (size_t)w) {
+	    free(row);
+	    return -1;
+	}
+    }
+    free(row);
+    bdd_stats.bytes_out += IMG_CHANNELS * n;
     return fflush(file);
 }
 
+int img_more(FILE *file) {
+    return skip_whitespace(file) != EOF;
+}
+
 BDD_NODE *img_read_birp(FILE *file, int *wp, int *hp) {
-    int c;
-    unsigned int max;
-    int err = fscanf(file, "B5 ");
-    if(err < 0) {
+    BDD_LAYOUT layout;
+    BDD_NODE *node = img_read_birp_layout(file, wp, hp, &layout);
+    if(node == NULL)
+	return NULL;
+    // Callers of this function expect the original, square layout.
+    BDD_LAYOUT square = {BDD_ORDER_RC, 0, 0, 0};
+    bdd_layout_fit(&square, *wp, *hp);
+    if(square.rbits < layout.rbits || square.cbits < layout.cbits) {
+	square.rbits = layout.rbits > layout.cbits ? layout.rbits : layout.cbits;
+	square.cbits = square.rbits;
+    }
+    return bdd_reorder(node, &layout, &square);
+}
+
+static int img_streq(const char *s, const char *t) {
+    while(*s != '\0' && *s == *t) {
+	s++;
+	t++;
+    }
+    return *s == *t;
+}
+
+// Read the layout properties from a header comment, which consists of pairs
+// "order NAME" and "shape square|rect".  Other comments are skipped, and the
+// layout is then the default one.
+static int img_read_layout(FILE *file, BDD_LAYOUT *layout) {
+    int c, n = 0, pos = 0, len = 0;
+    char *line = malloc(64);
+    char *key = malloc(16);
+    char *value = malloc(16);
+    if(line == NULL || key == NULL || value == NULL)
+	goto bad;
+    while((c = fgetc(file)) != '\n' && c != EOF) {
+	if(n < 63)
+	    *(line + n++) = c;
+    }
+    *(line + n) = '\0';
+    if(c == EOF)
+	goto bad;
+    while(sscanf(line + pos, " %15s %15s%n", key, value, &len) == 2) {
+	pos += len;
+	if(img_streq(key, "order")) {
+	    if((layout->order = bdd_order_parse(value)) < 0) {
+		fprintf(stderr, "Invalid BIRP file (unknown variable order %s)\n", value);
+		goto bad;
+	    }
+	}
+	else if(img_streq(key, "shape")) {
+	    if(!img_streq(value, "rect") && !img_streq(value, "square")) {
+		fprintf(stderr, "Invalid BIRP file (unknown shape %s)\n", value);
+		goto bad;
+	    }
+	    layout->rect = img_streq(value, "rect");
+	}
+    }
+    free(line);
+    free(key);
+    free(value);
+    return 0;
+
+ bad:
+    free(line);
+    free(key);
+    free(value);
+    return -1;
+}
+
+// Read the header of a BIRP file, of magic "B5" for a grayscale image and
+// "B6" for a colour one, returning the number of channels.
+static int img_read_birp_header(FILE *file, int *wp, int *hp, BDD_LAYOUT *layout) {
+    int c, channels;
+    if(fgetc(file) != 'B' || ((c = fgetc(file)) != '5' && c != '6')) {
 	fprintf(stderr, "Invalid BIRP file (missing/bad magic)\n");
 	goto bad;
     }
-    if((err = img_read_header(file, "BIRP", wp, hp)) < 0)
+    channels = c == '6' ? IMG_CHANNELS : 1;
+    if(fscanf(file, " ") < 0)
 	goto bad;
+    layout->order = BDD_ORDER_RC;
+    layout->rect = 0;
+    if((c = fgetc(file)) == '#') {
+	if(img_read_layout(file, layout) < 0)
+	    goto bad;
+    }
+    else if(c != EOF)
+	ungetc(c, file);
+    if(img_read_header(file, "BIRP", wp, hp) < 0)
+	goto bad;
+    if(*wp < 0 || *hp < 0)
+	goto bad;
+    bdd_layout_fit(layout, *wp, *hp);
+    return channels;
+
+ bad:
+    return -1;
+}
+
+// Fit the layout to the deepest of the roots read for an image.
+static int img_fit_roots(BDD_NODE **roots, int n, BDD_LAYOUT *layout) {
+    int level = 0;
+    for(int k = 0; k < n; k++) {
+	if((*(roots + k))->level > level)
+	    level = (*(roots + k))->level;
+    }
+    if(level > layout->rbits + layout->cbits) {
+	// A square BDD deeper than its image is interpreted at its own level.
+	if(layout->rect) {
+	    fprintf(stderr, "Invalid BIRP file (BDD too deep for image)\n");
+	    return -1;
+	}
+	layout->rbits = (level + 1)/2;
+	layout->cbits = layout->rbits;
+    }
+    return 0;
+}
+
+BDD_NODE *img_read_birp_layout(FILE *file, int *wp, int *hp, BDD_LAYOUT *layout) {
+    int channels = img_read_birp_header(file, wp, hp, layout);
+    if(channels < 0)
+	goto bad;
+    if(channels != 1) {
+	fprintf(stderr, "BIRP file holds a colour image (PPM or BIRP output only)\n");
+	goto bad;
+    }
 
     // Read the serialized BDD.
     BDD_NODE *node = bdd_deserialize(file);
+    if(node == NULL || img_fit_roots(&node, 1, layout) < 0)
+	goto bad;
     return node;
 
  bad:
     return NULL;
 }
 
+int img_read_birp_channels(FILE *file, int *wp, int *hp, BDD_LAYOUT *layout, BDD_NODE **roots) {
+    int channels = img_read_birp_header(file, wp, hp, layout);
+    if(channels < 0)
+	return -1;
+    if(bdd_deserialize_roots(file, roots, channels) < 0 || img_fit_roots(roots, channels, layout) < 0)
+	return -1;
+    return channels;
+}
+
 int img_write_birp(BDD_NODE *node, int w, int h, FILE *file) {
     if(file == NULL)
 	return -1;
@@ -137,3 +351,39 @@ int img_write_birp(BDD_NODE *node, int w, int h, FILE *file) {
     bdd_serialize(node, file);
     return fflush(file);
 }
+
+// Write the header of a BIRP file with a given magic, recording the layout
+// unless it is the default one, so that such files are unchanged.
+static void img_write_birp_header(char *magic, int w, int h, BDD_LAYOUT *layout, FILE *file) {
+    if(layout->order == BDD_ORDER_RC && !layout->rect) {
+	fprintf(file, "%s %d %d 255\n", magic, w, h);
+	return;
+    }
+    fprintf(file, "%s\n#", magic);
+    if(layout->order != BDD_ORDER_RC)
+	fprintf(file, " order %s", bdd_order_name(layout->order));
+    if(layout->rect)
+	fprintf(file, " shape rect");
+    fprintf(file, "\n%d %d 255\n", w, h);
+}
+
+int img_write_birp_layout(BDD_NODE *node, int w, int h, BDD_LAYOUT *layout, FILE *file) {
+    if(file == NULL || bdd_order_name(layout->order) == NULL)
+	return -1;
+    img_write_birp_header("B5", w, h, layout, file);
+    if(bdd_serialize(node, file) < 0)
+	return -1;
+    return fflush(file);
+}
+
+int img_write_birp_channels(BDD_NODE **roots, int n, int w, int h, BDD_LAYOUT *layout,
+			    FILE *file) {
+    if(n == 1)
+	return img_write_birp_layout(*roots, w, h, layout, file);
+    if(file == NULL || n != IMG_CHANNELS || bdd_order_name(layout->order) == NULL)
+	return -1;
+    img_write_birp_header("B6", w, h, layout, file);
+    if(bdd_serialize_roots(roots, n, file) < 0)
+	return -1;
+    return fflush(file);
+}
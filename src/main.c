@@ -1,8 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "batch.h"
 #include "const.h"
+#include "daemon.h"
 #include "debug.h"
+#include "stats.h"
 
 #ifdef _STRING_H
 #error "Do not #include <string.h>. You will get a ZERO."
@@ -30,36 +33,26 @@ int main(int argc, char **argv) {
         USAGE(*argv, EXIT_SUCCESS);
         return EXIT_SUCCESS;
     }
-    int conversion = global_options & 0xFF;
-    if (conversion == 0x21) {
-        if (pgm_to_birp(stdin, stdout) == -1) {
-            return EXIT_FAILURE;
-        }
-        return EXIT_SUCCESS;
+    if (daemon_socket != NULL) {
+        return birp_daemon(daemon_socket) == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
     }
-    if (conversion == 0x12) {
-        if (birp_to_pgm(stdin, stdout) == -1) {
-            return EXIT_FAILURE;
-        }
-        return EXIT_SUCCESS;
+    if (compare_first != NULL) {
+        int result = birp_compare(compare_first, compare_second, stdout);
+        return result == -1 ? 2 : result;
     }
-    if (conversion == 0x22) {
-        if (birp_to_birp(stdin, stdout) == -1) {
-            return EXIT_FAILURE;
+    if (fanout_argv != NULL) {
+        int result = birp_fanout(stdin, fanout_argc, fanout_argv);
+        if (stats_enabled) {
+            stats_report(stderr);
         }
-        return EXIT_SUCCESS;
+        return result == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
     }
-    if (conversion == 0x31) {
-        if (pgm_to_ascii(stdin, stdout) == -1) {
-            return EXIT_FAILURE;
-        }
-        return EXIT_SUCCESS;
+    if (batch_output != NULL) {
+        return birp_batch(batch_input, batch_output, batch_jobs) == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
     }
-    if (conversion == 0x32) {
-        if (birp_to_ascii(stdin, stdout) == -1) {
-            return EXIT_FAILURE;
-        }
-        return EXIT_SUCCESS;
+    int result = convert(stdin, stdout);
+    if (stats_enabled) {
+        stats_report(stderr);
     }
-    return EXIT_FAILURE;
-}
\ No newline at end of file
+    return result;
+}
@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "bdd.h"
+#include "stats.h"
+
+__thread BDD_STATS bdd_stats;
+__thread int stats_enabled = 0;
+
+double stats_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void stats_begin(STATS_PHASE *phase) {
+    if (stats_enabled) {
+        phase->start = stats_clock();
+    }
+}
+
+void stats_end(STATS_PHASE *phase) {
+    if (stats_enabled) {
+        phase->ns += stats_clock() - phase->start;
+    }
+}
+
+void stats_report(FILE *out) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    long long found = bdd_stats.created + bdd_stats.reused;
+    long long cached = bdd_stats.cache_hits + bdd_stats.cache_misses;
+    int unused = bdd_manager_current()->unused;
+    fprintf(out, "{\"nodes_created\": %lld, \"nodes_reused\": %lld, \"nodes_collapsed\": %lld, ",
+            bdd_stats.created, bdd_stats.reused, bdd_stats.collapsed);
+    fprintf(out, "\"table_nodes\": %d, \"table_capacity\": %d, \"table_load\": %.6f, ",
+            unused - BDD_NUM_LEAVES, BDD_NODES_MAX - BDD_NUM_LEAVES,
+            (double)(unused - BDD_NUM_LEAVES) / (BDD_NODES_MAX - BDD_NUM_LEAVES));
+    fprintf(out, "\"hash_load\": %.6f, \"probe_avg\": %.3f, \"probe_max\": %lld, ",
+            (double)(unused - BDD_NUM_LEAVES) / BDD_HASH_SIZE,
+            found ? (double)bdd_stats.probes / found : 0.0, bdd_stats.probe_max);
+    fprintf(out, "\"cache_hits\": %lld, \"cache_misses\": %lld, \"cache_hit_rate\": %.6f, ",
+            bdd_stats.cache_hits, bdd_stats.cache_misses,
+            cached ? (double)bdd_stats.cache_hits / cached : 0.0);
+    fprintf(out, "\"depth_max\": %d, \"bytes_in\": %lld, \"bytes_out\": %lld, \"error_max\": %d, ",
+            bdd_stats.depth_max, bdd_stats.bytes_in, bdd_stats.bytes_out, bdd_stats.error_max);
+    fprintf(out, "\"time_ns\": {\"read\": %.0f, \"build\": %.0f, \"transform\": %.0f, "
+            "\"serialize\": %.0f, \"decode\": %.0f, \"write\": %.0f}, ",
+            bdd_stats.read.ns, bdd_stats.build.ns, bdd_stats.transform.ns,
+            bdd_stats.serialize.ns, bdd_stats.decode.ns, bdd_stats.write.ns);
+    fprintf(out, "\"peak_rss_kb\": %ld}\n", ru.ru_maxrss);
+    fflush(out);
+}
@@ -0,0 +1,369 @@
+/*
+ * Content-addressed node store (see store.h).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bdd.h"
+#include "stats.h"
+#include "store.h"
+
+__thread char *store_path = NULL;
+__thread int store_export = 0;
+
+struct bdd_store {
+    int fd;
+    unsigned char *map;         // the file as it was when opened
+    size_t maplen;
+    long mapped;                // number of records in the mapping
+    unsigned char *added;       // records added since the store was opened
+    long addcap;
+    long count;                 // number of records, mapped and added
+    long *index;                // map from hashes to record numbers plus one
+    long size;                  // slots in the index, a power of two
+    int *cache;                 // node built for each record, or 0
+    long cachecap;
+    BDD_MANAGER *cache_mgr;     // manager (and generation) of the cache
+    int cache_generation;
+};
+
+#define NODES (bdd_manager_current()->nodes)
+
+static unsigned long long bsload(unsigned char *p) {
+    unsigned long long v = 0;
+    for (int i = 7; i >= 0; i--) {
+        v = (v << 8) | *(p + i);
+    }
+    return v;
+}
+
+static void bsstore(unsigned char *p, unsigned long long v) {
+    for (int i = 0; i < 8; i++) {
+        *(p + i) = v >> (i*8);
+    }
+}
+
+static unsigned char *bsrecord(BDD_STORE *store, long k) {
+    return k < store->mapped ? store->map + BDD_STORE_MAGIC_LEN + k * BDD_STORE_RECORD
+                             : store->added + (k - store->mapped) * BDD_STORE_RECORD;
+}
+
+static unsigned long long bsfmix(unsigned long long h) {
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBull;
+    h ^= h >> 31;
+    return h;
+}
+
+/*
+ * The Merkle hash of a node.  Each child is folded in through a bijective
+ * mix, so that nodes differing in only one child never share a hash.  Nodes
+ * differing in more than that may, though for any two of them the chance is
+ * about 2^-64; a record found by its hash is therefore checked against the
+ * node before it is used (see bsmatch()).  Hashes of nodes are kept clear of
+ * those of leaves, which are their values.
+ */
+static unsigned long long bsmix(int level, unsigned long long left, unsigned long long right) {
+    unsigned long long h = bsfmix(left + level * 0x9E3779B97F4A7C15ull);
+    h = bsfmix(h ^ (right * 0xD6E8FEB86659FD93ull + 0xCA5A826395121157ull));
+    return h < BDD_NUM_LEAVES ? h + BDD_NUM_LEAVES : h;
+}
+
+/*
+ * Whether a record holds a node of the given level and children, so that a
+ * record found by hash is not taken for a different node sharing its hash.
+ */
+static int bsmatch(unsigned char *p, int level, unsigned long long left, unsigned long long right) {
+    return *(p + 8) == level && bsload(p + 9) == left && bsload(p + 17) == right;
+}
+
+/*
+ * The slot of the index holding a hash, or the empty slot where it belongs.
+ */
+static long bsslot(BDD_STORE *store, unsigned long long hash) {
+    long slot = (hash ^ (hash >> 29)) & (store->size - 1);
+    long k;
+    while ((k = *(store->index + slot)) != 0 && bsload(bsrecord(store, k-1)) != hash) {
+        slot = (slot + 1) & (store->size - 1);
+    }
+    return slot;
+}
+
+static long bsfind(BDD_STORE *store, unsigned long long hash) {
+    return *(store->index + bsslot(store, hash)) - 1;
+}
+
+/*
+ * Index record k, unless its hash is already indexed (as when two writers
+ * added the same node).  The index is kept at most half full.
+ */
+static int bsindex(BDD_STORE *store, long k) {
+    if (2 * (store->count + 1) > store->size) {
+        long *old = store->index;
+        long oldsize = store->size;
+        store->size *= 2;
+        store->index = calloc(store->size, sizeof(long));
+        if (store->index == NULL) {
+            store->index = old;
+            store->size = oldsize;
+            return -1;
+        }
+        for (long i = 0; i < oldsize; i++) {
+            long j = *(old + i);
+            if (j != 0) {
+                *(store->index + bsslot(store, bsload(bsrecord(store, j-1)))) = j;
+            }
+        }
+        free(old);
+    }
+    long slot = bsslot(store, bsload(bsrecord(store, k)));
+    if (*(store->index + slot) == 0) {
+        *(store->index + slot) = k + 1;
+    }
+    return 0;
+}
+
+/*
+ * Make the cache cover every record, emptying it if the nodes it holds
+ * belong to another manager, or were removed by bdd_reset().
+ */
+static int bscache(BDD_STORE *store) {
+    BDD_MANAGER *mgr = bdd_manager_current();
+    long from = store->cache_mgr == mgr && store->cache_generation == mgr->generation
+                ? store->cachecap : 0;
+    if (store->count > store->cachecap) {
+        long cap = store->cachecap ? store->cachecap : BDD_STORE_INDEX_MIN;
+        while (cap < store->count) {
+            cap *= 2;
+        }
+        int *cache = realloc(store->cache, cap * sizeof(int));
+        if (cache == NULL) {
+            return -1;
+        }
+        store->cache = cache;
+        store->cachecap = cap;
+    }
+    for (long i = from; i < store->cachecap; i++) {
+        *(store->cache + i) = 0;
+    }
+    store->cache_mgr = mgr;
+    store->cache_generation = mgr->generation;
+    return 0;
+}
+
+BDD_STORE *bdd_store_open(const char *path) {
+    BDD_STORE *store = calloc(1, sizeof(BDD_STORE));
+    if (store == NULL) {
+        return NULL;
+    }
+    struct stat st;
+    store->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (store->fd == -1 || flock(store->fd, LOCK_EX) == -1 || fstat(store->fd, &st) == -1) {
+        goto bad;
+    }
+    if (st.st_size == 0) {
+        if (write(store->fd, BDD_STORE_MAGIC, BDD_STORE_MAGIC_LEN) != BDD_STORE_MAGIC_LEN) {
+            goto bad;
+        }
+        st.st_size = BDD_STORE_MAGIC_LEN;
+    }
+    store->maplen = st.st_size;
+    store->map = mmap(NULL, store->maplen, PROT_READ, MAP_SHARED, store->fd, 0);
+    if (store->map == MAP_FAILED) {
+        store->map = NULL;
+        goto bad;
+    }
+    char *magic = BDD_STORE_MAGIC;
+    for (int i = 0; i < BDD_STORE_MAGIC_LEN; i++) {
+        if (store->maplen < BDD_STORE_MAGIC_LEN || *(store->map + i) != *(magic + i)) {
+            fprintf(stderr, "%s: not a node store\n", path);
+            goto bad;
+        }
+    }
+    // A record cut short by a failed write is dropped.
+    store->mapped = (store->maplen - BDD_STORE_MAGIC_LEN) / BDD_STORE_RECORD;
+    if (BDD_STORE_MAGIC_LEN + store->mapped * BDD_STORE_RECORD != store->maplen
+        && ftruncate(store->fd, BDD_STORE_MAGIC_LEN + store->mapped * BDD_STORE_RECORD) == -1) {
+        goto bad;
+    }
+    flock(store->fd, LOCK_UN);
+    store->size = BDD_STORE_INDEX_MIN;
+    while (store->size < 2 * (store->mapped + 1)) {
+        store->size *= 2;
+    }
+    store->index = calloc(store->size, sizeof(long));
+    if (store->index == NULL) {
+        goto bad;
+    }
+    for (long k = 0; k < store->mapped; k++) {
+        store->count = k + 1;
+        bsindex(store, k);
+    }
+    return store;
+
+ bad:
+    if (store->fd == -1) {
+        perror(path);
+    }
+    bdd_store_close(store);
+    return NULL;
+}
+
+void bdd_store_close(BDD_STORE *store) {
+    if (store == NULL) {
+        return;
+    }
+    if (store->map != NULL) {
+        munmap(store->map, store->maplen);
+    }
+    if (store->fd != -1) {
+        close(store->fd);
+    }
+    free(store->added);
+    free(store->index);
+    free(store->cache);
+    free(store);
+}
+
+BDD_STORE *bdd_store_use(BDD_STORE *store) {
+    BDD_MANAGER *mgr = bdd_manager_current();
+    BDD_STORE *prev = mgr->store;
+    mgr->store = store;
+    return prev;
+}
+
+/*
+ * Add the nodes below a node that are not yet in the store, returning its
+ * hash (memoized per node, 0 if not yet known), or 0 on error.
+ */
+static unsigned long long bsput(BDD_STORE *store, int index, unsigned long long *memo) {
+    if (index < BDD_NUM_LEAVES) {
+        return index;
+    }
+    if (*(memo + index)) {
+        bdd_stats.cache_hits++;
+        return *(memo + index);
+    }
+    bdd_stats.cache_misses++;
+    BDD_NODE *node = NODES + index;
+    // Tiles of hybrid BDDs are not stored.
+    if (node->left < 0) {
+        return 0;
+    }
+    unsigned long long left = bsput(store, node->left, memo);
+    unsigned long long right = left == 0 && node->left != 0 ? 0 : bsput(store, node->right, memo);
+    if ((left == 0 && node->left != 0) || (right == 0 && node->right != 0)) {
+        return 0;
+    }
+    unsigned long long hash = bsmix(node->level, left, right);
+    long k = bsfind(store, hash);
+    if (k != -1 && !bsmatch(bsrecord(store, k), node->level, left, right)) {
+        fprintf(stderr, "Node store: a node has the hash %016llx of another\n", hash);
+        return 0;
+    }
+    if (k == -1) {
+        if (store->count - store->mapped == store->addcap) {
+            long cap = store->addcap ? 2 * store->addcap : BDD_STORE_INDEX_MIN;
+            unsigned char *added = realloc(store->added, cap * BDD_STORE_RECORD);
+            if (added == NULL) {
+                return 0;
+            }
+            store->added = added;
+            store->addcap = cap;
+        }
+        k = store->count++;
+        unsigned char *p = bsrecord(store, k);
+        bsstore(p, hash);
+        *(p + 8) = node->level;
+        bsstore(p + 9, left);
+        bsstore(p + 17, right);
+        if (bsindex(store, k) == -1) {
+            store->count--;
+            return 0;
+        }
+    }
+    if (k < store->cachecap) {
+        *(store->cache + k) = index;
+    }
+    *(memo + index) = hash;
+    return hash;
+}
+
+long bdd_store_put(BDD_STORE *store, BDD_NODE *node, unsigned long long *hashp) {
+    if (store == NULL || node == NULL) {
+        return -1;
+    }
+    int used = bdd_manager_current()->unused;
+    unsigned long long *memo = calloc(used, sizeof(unsigned long long));
+    if (memo == NULL || bscache(store) == -1) {
+        free(memo);
+        return -1;
+    }
+    STATS_DEPTH(node->level);
+    long first = store->count;
+    unsigned long long hash = bsput(store, node - NODES, memo);
+    free(memo);
+    if (hash == 0 && node != NODES) {
+        return -1;
+    }
+    // The new records lie together at the end of those added, and are
+    // appended to the file with a single write.
+    long n = store->count - first;
+    unsigned char *p = n ? bsrecord(store, first) : NULL;
+    size_t len = n * BDD_STORE_RECORD;
+    if (n && (flock(store->fd, LOCK_EX) == -1 || write(store->fd, p, len) != (ssize_t)len)) {
+        flock(store->fd, LOCK_UN);
+        return -1;
+    }
+    if (n) {
+        flock(store->fd, LOCK_UN);
+    }
+    *hashp = hash;
+    return n;
+}
+
+static int bsget(BDD_STORE *store, unsigned long long hash) {
+    if (hash < BDD_NUM_LEAVES) {
+        return hash;
+    }
+    long k = bsfind(store, hash);
+    if (k == -1) {
+        return -1;
+    }
+    if (*(store->cache + k)) {
+        bdd_stats.cache_hits++;
+        return *(store->cache + k);
+    }
+    bdd_stats.cache_misses++;
+    // A record is used only if it is the node its hash is of, and its
+    // children lie below it.
+    unsigned char *p = bsrecord(store, k);
+    int level = *(p + 8);
+    if (level < 1 || level > BDD_LEVELS_MAX || bsmix(level, bsload(p + 9), bsload(p + 17)) != hash) {
+        return -1;
+    }
+    int left = bsget(store, bsload(p + 9));
+    int right = left == -1 ? -1 : bsget(store, bsload(p + 17));
+    if (right == -1 || (NODES + left)->level >= level || (NODES + right)->level >= level) {
+        return -1;
+    }
+    int index = bdd_lookup(level, left, right);
+    *(store->cache + k) = index;
+    return index;
+}
+
+BDD_NODE *bdd_store_get(BDD_STORE *store, unsigned long long hash) {
+    if (store == NULL || bscache(store) == -1) {
+        return NULL;
+    }
+    int index = bsget(store, hash);
+    return index == -1 ? NULL : NODES + index;
+}
@@ -0,0 +1,123 @@
+/*
+ * ASCII art output, at full size and reduced to a target width.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+/*
+ * The ASCII art for a raster, with each 2^k x 2^k block of pixels (clipped
+ * at the edges of the image) averaged into one character.
+ */
+static TEST_BUF ascii_text(unsigned char *raster, int w, int h, int k) {
+    int ow = (w + (1<<k) - 1) >> k, oh = (h + (1<<k) - 1) >> k;
+    TEST_BUF text = {malloc((size_t)(ow + 1) * oh), (size_t)(ow + 1) * oh};
+    CHECK(text.data != NULL, "out of memory");
+    for (int i = 0; i < oh; i++) {
+        for (int j = 0; j < ow; j++) {
+            unsigned long long sum = 0, area = 0;
+            for (int r = i << k; r < h && r < (i+1) << k; r++) {
+                for (int c = j << k; c < w && c < (j+1) << k; c++) {
+                    sum += raster[r*w + c];
+                    area++;
+                }
+            }
+            int v = (sum + area/2) / area;
+            text.data[i*(ow + 1) + j] = v < 64 ? ' ' : v < 128 ? '.' : v < 192 ? '*' : '@';
+        }
+        text.data[i*(ow + 1) + ow] = '\n';
+    }
+    return text;
+}
+
+static void check_same(TEST_BUF *got, TEST_BUF *want, const char *options, int w, int h) {
+    CHECK(got->len == want->len && memcmp(got->data, want->data, got->len) == 0,
+          "\"%s\" on a %dx%d image gives\n%.*s\nexpected\n%.*s", options, w, h,
+          (int)got->len, (char *)got->data, (int)want->len, (char *)want->data);
+}
+
+/*
+ * Render an image with a target width, from PGM and from BIRP files in
+ * several encodings, and check it against the image reduced by the least
+ * power of two that brings it within that width.
+ */
+static void check_width(int w, int h, int width, unsigned seed) {
+    unsigned char *raster = malloc(w * h);
+    CHECK(raster != NULL, "out of memory");
+    test_pattern(raster, w, h, 1, seed);
+    int k = 0;
+    while (width > 0 && (w + (1<<k) - 1) >> k > width) {
+        k++;
+    }
+    TEST_BUF pgm = test_pnm(raster, w, h, 1);
+    TEST_BUF want = ascii_text(raster, w, h, k);
+    char options[64];
+    if (width > 0) {
+        snprintf(options, sizeof(options), "-o ascii -w %d", width);
+    }
+    else {
+        snprintf(options, sizeof(options), "-o ascii");
+    }
+    char pgm_options[80];
+    snprintf(pgm_options, sizeof(pgm_options), "-i pgm %s", options);
+    TEST_BUF got = test_convert(pgm_options, &pgm);
+    check_same(&got, &want, pgm_options, w, h);
+    test_buf_free(&got);
+    const char *encodings[] = {"-i pgm -o birp", "-i pgm -o birp -S rect -O cols", "-i pgm -o birp -H 8"};
+    for (size_t i = 0; i < sizeof(encodings) / sizeof(*encodings); i++) {
+        TEST_BUF birp = test_convert(encodings[i], &pgm);
+        char birp_options[80];
+        snprintf(birp_options, sizeof(birp_options), "-i birp %s", options);
+        got = test_convert(birp_options, &birp);
+        check_same(&got, &want, encodings[i], w, h);
+        test_buf_free(&birp);
+        test_buf_free(&got);
+    }
+    free(raster);
+    test_buf_free(&pgm);
+    test_buf_free(&want);
+}
+
+TEST(ascii, full) {
+    check_width(64, 64, 0, 1);
+    check_width(45, 27, 0, 2);
+    check_width(45, 27, 45, 3);
+    check_width(1, 1, 0, 4);
+}
+
+TEST(ascii, width) {
+    check_width(64, 64, 32, 5);
+    check_width(64, 64, 10, 6);
+    check_width(64, 64, 1, 7);
+    check_width(45, 27, 44, 8);
+    check_width(45, 27, 12, 9);
+    check_width(70, 5, 20, 10);
+    check_width(6, 90, 2, 11);
+}
+
+TEST(ascii, power_of_two) {
+    // The scale is a power of two, so that the output may be narrower than
+    // the width asked for: 64 columns reduced to at most 10 give 8.
+    unsigned char raster[64 * 64];
+    test_pattern(raster, 64, 64, 1, 12);
+    TEST_BUF pgm = test_pnm(raster, 64, 64, 1);
+    TEST_BUF got = test_convert("-i pgm -o ascii -w 10", &pgm);
+    CHECK(got.len == 9 * 8, "64x64 image at width 10 gives %zu bytes, not 8 lines of 8", got.len);
+    CHECK(memchr(got.data, '\n', got.len) == got.data + 8, "64x64 image at width 10 is not 8 columns");
+    test_buf_free(&got);
+    test_buf_free(&pgm);
+}
+
+TEST(ascii, options) {
+    const char *rejected[] = {
+        "-i pgm -o birp -w 8", "-i birp -o pgm -w 8", "-i pgm -o ascii -w 0",
+        "-i pgm -o ascii -w 8 -w 8", "-i pgm -o ascii -w", "-i pgm -o ascii -w x"
+    };
+    TEST_BUF in = {(unsigned char *)"", 0}, out;
+    for (size_t i = 0; i < sizeof(rejected) / sizeof(*rejected); i++) {
+        CHECK(test_run(rejected[i], &in, &out) == -1, "\"%s\" was accepted", rejected[i]);
+    }
+}
@@ -0,0 +1,131 @@
+/*
+ * Batch conversion of a directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "test.h"
+#include "const.h"
+#include "batch.h"
+
+static char dir[64];
+
+static void write_file(const char *name, TEST_BUF *buf) {
+    char path[128];
+    snprintf(path, sizeof(path), "%s/in/%s", dir, name);
+    FILE *f = fopen(path, "w");
+    CHECK(f != NULL && fwrite(buf->data, 1, buf->len, f) == buf->len && fclose(f) == 0,
+          "cannot write %s", path);
+}
+
+static TEST_BUF read_file(const char *path) {
+    TEST_BUF buf = {NULL, 0};
+    FILE *f = fopen(path, "r");
+    CHECK(f != NULL, "%s was not written", path);
+    fseek(f, 0, SEEK_END);
+    buf.len = ftell(f);
+    rewind(f);
+    buf.data = malloc(buf.len + 1);
+    CHECK(fread(buf.data, 1, buf.len, f) == buf.len, "cannot read %s", path);
+    fclose(f);
+    return buf;
+}
+
+/*
+ * Make a directory of inputs, named in the given order, each holding a
+ * different image.
+ */
+static void make_inputs(const char **names, int n) {
+    char path[128];
+    snprintf(dir, sizeof(dir), "/tmp/birp_test_%d", (int)getpid());
+    snprintf(path, sizeof(path), "%s/in", dir);
+    CHECK(mkdir(dir, 0777) == 0 && mkdir(path, 0777) == 0, "cannot make %s", path);
+    for (int i = 0; i < n; i++) {
+        unsigned char raster[40 * 30];
+        test_pattern(raster, 40, 30, 1, i);
+        TEST_BUF pgm = test_pnm(raster, 40, 30, 1);
+        write_file(names[i], &pgm);
+        test_buf_free(&pgm);
+    }
+}
+
+static void remove_dir(void) {
+    char cmd[128];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    CHECK(system(cmd) == 0, "cannot remove %s", dir);
+}
+
+static int run_batch(const char *options) {
+    char args[256];
+    snprintf(args, sizeof(args), "--batch %s/in %s/out/sub %s", dir, dir, options);
+    char *argv[16];
+    int argc = 0;
+    argv[argc++] = "birp";
+    for (char *tok = strtok(args, " "); tok != NULL; tok = strtok(NULL, " ")) {
+        argv[argc++] = tok;
+    }
+    CHECK(validargs(argc, argv) == 0 && batch_output != NULL, "batch options rejected");
+    return birp_batch(batch_input, batch_output, 3);
+}
+
+TEST(batch, same_as_convert) {
+    const char *names[] = {"a.pgm", "b.pgm", "c.pgm", "d.pgm", "e.pgm"};
+    make_inputs(names, 5);
+    char path[128];
+    snprintf(path, sizeof(path), "%s/out", dir);
+    CHECK(mkdir(path, 0777) == 0, "cannot make %s", path);
+    // The output directory is created.
+    CHECK(run_batch("-i pgm -o birp -r") == 0, "batch failed");
+    for (int i = 0; i < 5; i++) {
+        snprintf(path, sizeof(path), "%s/in/%s", dir, names[i]);
+        TEST_BUF in = read_file(path);
+        TEST_BUF want = test_convert("-i pgm -o birp -r", &in);
+        snprintf(path, sizeof(path), "%s/out/sub/%c.birp", dir, names[i][0]);
+        TEST_BUF got = read_file(path);
+        CHECK(got.len == want.len && memcmp(got.data, want.data, got.len) == 0,
+              "%s differs from conversion", path);
+        test_buf_free(&in);
+        test_buf_free(&want);
+        test_buf_free(&got);
+    }
+    remove_dir();
+}
+
+TEST(batch, same_stem) {
+    const char *names[] = {"a.pgm", "a.ppm"};
+    make_inputs(names, 2);
+    char path[128];
+    snprintf(path, sizeof(path), "%s/out", dir);
+    CHECK(mkdir(path, 0777) == 0, "cannot make %s", path);
+    CHECK(run_batch("-i pgm -o stats") == -1, "batch with two outputs a.txt succeeded");
+    // One of the inputs was converted, and its output not overwritten.
+    snprintf(path, sizeof(path), "%s/out/sub/a.txt", dir);
+    TEST_BUF got = read_file(path);
+    int same = 0;
+    for (int i = 0; i < 2; i++) {
+        snprintf(path, sizeof(path), "%s/in/%s", dir, names[i]);
+        TEST_BUF in = read_file(path);
+        TEST_BUF want = test_convert("-i pgm -o stats", &in);
+        same += want.len == got.len && memcmp(want.data, got.data, got.len) == 0;
+        test_buf_free(&want);
+        test_buf_free(&in);
+    }
+    CHECK(same == 1, "a.txt is not the output of one of the inputs");
+    test_buf_free(&got);
+    remove_dir();
+}
+
+TEST(batch, output_under_a_file) {
+    const char *names[] = {"a.pgm"};
+    make_inputs(names, 1);
+    char path[128];
+    snprintf(path, sizeof(path), "%s/out", dir);
+    FILE *f = fopen(path, "w");
+    CHECK(f != NULL && fclose(f) == 0, "cannot make %s", path);
+    CHECK(run_batch("-i pgm -o birp") == -1, "batch under a file succeeded");
+    remove_dir();
+}
@@ -0,0 +1,166 @@
+/*
+ * Chains of transformations given on the command line, against the same
+ * chains applied step by step to the raster.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+typedef struct image {
+    unsigned char *pixels;
+    int w, h;
+} IMAGE;
+
+/*
+ * Replace *img by the image whose pixel (r, c) is the pixel of *img that
+ * the step moves there.  Steps that swap the sides give a w x h image the
+ * size h x w.
+ */
+static void move(IMAGE *img, char step) {
+    int w = img->w, h = img->h;
+    int swap = step == 'r' || step == 'l' || step == 'T' || step == 'A';
+    int nw = swap ? h : w, nh = swap ? w : h;
+    unsigned char *in = img->pixels, *out = malloc(w * h);
+    CHECK(out != NULL, "out of memory");
+    for (int r = 0; r < nh; r++) {
+        for (int c = 0; c < nw; c++) {
+            int sr, sc;
+            switch (step) {
+            case 'r': sr = c; sc = w-1-r; break;
+            case 'u': sr = h-1-r; sc = w-1-c; break;
+            case 'l': sr = h-1-c; sc = r; break;
+            case 'h': sr = r; sc = w-1-c; break;
+            case 'v': sr = h-1-r; sc = c; break;
+            case 'T': sr = c; sc = r; break;
+            default: sr = h-1-c; sc = w-1-r; break;
+            }
+            out[r*nw + c] = in[sr*w + sc];
+        }
+    }
+    free(in);
+    img->pixels = out;
+    img->w = nw;
+    img->h = nh;
+}
+
+/*
+ * Apply to *img each transformation of a chain of options, as birp does.
+ */
+static void apply_chain(IMAGE *img, const char *chain) {
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", chain);
+    for (char *opt = strtok(copy, " "); opt != NULL; opt = strtok(NULL, " ")) {
+        int n = img->w * img->h;
+        if (strcmp(opt, "-n") == 0) {
+            for (int i = 0; i < n; i++) {
+                img->pixels[i] = 255 - img->pixels[i];
+            }
+        } else if (strcmp(opt, "-t") == 0) {
+            int t = atoi(strtok(NULL, " "));
+            for (int i = 0; i < n; i++) {
+                img->pixels[i] = img->pixels[i] < t ? 0 : 255;
+            }
+        } else if (strcmp(opt, "-r") == 0) {
+            move(img, 'r');
+        } else if (strcmp(opt, "-R") == 0) {
+            int deg = atoi(strtok(NULL, " "));
+            move(img, deg == 90 ? 'r' : deg == 180 ? 'u' : 'l');
+        } else if (strcmp(opt, "-f") == 0) {
+            move(img, *strtok(NULL, " "));
+        } else if (strcmp(opt, "-T") == 0 || strcmp(opt, "-A") == 0) {
+            move(img, opt[1]);
+        } else {
+            CHECK(0, "no reference for %s", opt);
+        }
+    }
+}
+
+static const char *chains[] = {
+    "-n", "-t 100", "-r", "-R 90", "-R 180", "-R 270", "-f h", "-f v", "-T", "-A",
+    "-n -n", "-r -r -r -r", "-f h -f v", "-T -A",
+    "-n -f h -T -t 100 -R 180", "-r -f v -n -t 128 -A", "-R 270 -T -n -f h -r",
+    "-t 200 -n -t 30 -R 90 -f v"
+};
+
+#define CHAINS (sizeof(chains) / sizeof(*chains))
+
+/*
+ * Check a chain on a w x h image, converted to rect BIRP and transformed
+ * from there.
+ */
+static void check_chain(int w, int h, const char *chain, unsigned seed) {
+    IMAGE want = {malloc(w * h), w, h};
+    CHECK(want.pixels != NULL, "out of memory");
+    test_pattern(want.pixels, w, h, 1, seed);
+    TEST_BUF pgm = test_pnm(want.pixels, w, h, 1);
+    TEST_BUF birp = test_convert("-i pgm -o birp -S rect", &pgm);
+    char options[320];
+    snprintf(options, sizeof(options), "-i birp -o birp -S rect %s", chain);
+    TEST_BUF moved = test_convert(options, &birp);
+    TEST_BUF back = test_convert("-i birp -o pgm", &moved);
+    apply_chain(&want, chain);
+    unsigned char *got = test_read_pnm(&back, want.w, want.h, 1);
+    test_same_raster(got, want.pixels, want.w, want.h, 1);
+    free(got);
+    free(want.pixels);
+    test_buf_free(&pgm);
+    test_buf_free(&birp);
+    test_buf_free(&moved);
+    test_buf_free(&back);
+}
+
+TEST(chain, square) {
+    for (size_t i = 0; i < CHAINS; i++) {
+        check_chain(32, 32, chains[i], i);
+    }
+}
+
+TEST(chain, rect) {
+    for (size_t i = 0; i < CHAINS; i++) {
+        check_chain(45, 27, chains[i], i);
+        check_chain(70, 3, chains[i], i);
+    }
+}
+
+TEST(chain, bad_step) {
+    TEST_BUF in = {(unsigned char *)"", 0}, out;
+    CHECK(test_run("-i birp -o birp -n -R 45", &in, &out) == -1, "a rotation by 45 was accepted");
+    CHECK(test_run("-i birp -o birp -r -f d", &in, &out) == -1, "a flip d was accepted");
+}
+
+/*
+ * Check that a chain applied as a PGM image is read gives the very file
+ * that applying it to the BIRP file of the image does.
+ */
+static void check_ingest(int w, int h, const char *shape, const char *chain, unsigned seed) {
+    unsigned char *raster = malloc(w * h);
+    CHECK(raster != NULL, "out of memory");
+    test_pattern(raster, w, h, 1, seed);
+    TEST_BUF pgm = test_pnm(raster, w, h, 1);
+    char options[320];
+    snprintf(options, sizeof(options), "-i pgm -o birp -S %s", shape);
+    TEST_BUF birp = test_convert(options, &pgm);
+    snprintf(options, sizeof(options), "-i birp -o birp -S %s %s", shape, chain);
+    TEST_BUF after = test_convert(options, &birp);
+    snprintf(options, sizeof(options), "-i pgm -o birp -S %s %s", shape, chain);
+    TEST_BUF fused = test_convert(options, &pgm);
+    CHECK(fused.len == after.len && memcmp(fused.data, after.data, fused.len) == 0,
+          "chain \"%s\" on a %dx%d %s image differs on ingest", chain, w, h, shape);
+    free(raster);
+    test_buf_free(&pgm);
+    test_buf_free(&birp);
+    test_buf_free(&after);
+    test_buf_free(&fused);
+}
+
+TEST(chain, on_ingest) {
+    for (size_t i = 0; i < CHAINS; i++) {
+        check_ingest(32, 32, "square", chains[i], i);
+        check_ingest(45, 27, "square", chains[i], i);
+        check_ingest(45, 27, "rect", chains[i], i);
+        check_ingest(3, 70, "rect", chains[i], i);
+    }
+}
@@ -0,0 +1,192 @@
+/*
+ * Differences between images, from bdd_diff() and from --compare.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "test.h"
+#include "const.h"
+#include "birp.h"
+
+/*
+ * Check the rectangles given by bdd_diff() for two rasters: they must cover
+ * each differing pixel once and no other pixel.
+ *
+ * @return  The number of rectangles.
+ */
+static int check_diff(unsigned char *a, unsigned char *b, int w, int h, BDD_LAYOUT *layout) {
+    BDD_NODE *na = test_build(a, w, h, layout);
+    BDD_NODE *nb = test_build(b, w, h, layout);
+    BDD_RECT *rects = NULL;
+    int count = -1;
+    long long pixels = bdd_diff(na, nb, layout, w, h, &rects, &count);
+    long long want = 0;
+    for (int i = 0; i < w * h; i++) {
+        want += a[i] != b[i];
+    }
+    CHECK(pixels == want, "%lld pixels of a %dx%d image differ, expected %lld", pixels, w, h, want);
+    CHECK(count >= 0 && (count == 0) == (rects == NULL), "%d rectangles at %p", count, (void *)rects);
+    unsigned char *covered = calloc(w * h, 1);
+    CHECK(covered != NULL, "out of memory");
+    for (int i = 0; i < count; i++) {
+        BDD_RECT *rect = rects + i;
+        CHECK(0 <= rect->r0 && rect->r0 < rect->r1 && rect->r1 <= h
+              && 0 <= rect->c0 && rect->c0 < rect->c1 && rect->c1 <= w,
+              "rectangle %d %d %d %d outside a %dx%d image", rect->r0, rect->c0, rect->r1, rect->c1, w, h);
+        for (int r = rect->r0; r < rect->r1; r++) {
+            for (int c = rect->c0; c < rect->c1; c++) {
+                CHECK(!covered[r*w + c], "pixel (%d, %d) in two rectangles", r, c);
+                CHECK(a[r*w + c] != b[r*w + c], "pixel (%d, %d) is the same but in rectangle %d %d %d %d",
+                      r, c, rect->r0, rect->c0, rect->r1, rect->c1);
+                covered[r*w + c] = 1;
+            }
+        }
+    }
+    for (int i = 0; i < w * h; i++) {
+        CHECK(covered[i] || a[i] == b[i], "pixel (%d, %d) differs but is in no rectangle", i / w, i % w);
+    }
+    free(covered);
+    free(rects);
+    return count;
+}
+
+static void check_pixels(int w, int h, BDD_LAYOUT *layout, unsigned seed) {
+    unsigned char *a = malloc(w * h), *b = malloc(w * h);
+    CHECK(a != NULL && b != NULL, "out of memory");
+    test_pattern(a, w, h, 1, seed);
+    // Scattered pixels, a block and a row changed.
+    memcpy(b, a, w * h);
+    for (int i = seed; i < w * h; i += 37) {
+        b[i] ^= 1;
+    }
+    for (int r = h/4; r < h/2; r++) {
+        for (int c = w/3; c < w/2; c++) {
+            b[r*w + c] += 5;
+        }
+    }
+    for (int c = 0; c < w; c++) {
+        b[(h-1)*w + c] = ~a[(h-1)*w + c];
+    }
+    check_diff(a, b, w, h, layout);
+    CHECK(check_diff(a, a, w, h, layout) == 0, "rectangles for identical images");
+    free(a);
+    free(b);
+}
+
+TEST(compare, pixels) {
+    test_layouts(check_pixels, 0);
+    test_layouts(check_pixels, 1);
+}
+
+TEST(compare, coalesce) {
+    int w = 32, h = 32;
+    unsigned char a[32 * 32], b[32 * 32];
+    test_pattern(a, w, h, 1, 1);
+    BDD_LAYOUT layout = {BDD_ORDER_RC, 0, 0, 0};
+    // A block spanning two quadrants, and the whole image, each come out as
+    // one rectangle rather than one for each block of the walk.
+    memcpy(b, a, sizeof(b));
+    for (int r = 8; r < 16; r++) {
+        for (int c = 8; c < 24; c++) {
+            b[r*w + c] ^= 0x80;
+        }
+    }
+    CHECK(check_diff(a, b, w, h, &layout) == 1, "block of 8x16 pixels not merged into one rectangle");
+    for (int i = 0; i < w * h; i++) {
+        b[i] = ~a[i];
+    }
+    CHECK(check_diff(a, b, w, h, &layout) == 1, "whole image not merged into one rectangle");
+    // The same in a clipped image, where the blocks are cut at its edges.
+    CHECK(check_diff(a, b, 27, 19, &layout) == 1, "whole clipped image not merged into one rectangle");
+}
+
+static char paths[2][64];
+
+/*
+ * Write a BIRP file of a pattern, with some pixels changed, to each path.
+ */
+static void write_birp(int i, int w, int h, int changed, const char *options) {
+    unsigned char *raster = malloc(w * h);
+    CHECK(raster != NULL, "out of memory");
+    test_pattern(raster, w, h, 1, 5);
+    for (int k = 0; k < changed; k++) {
+        raster[k * 7 % (w * h)] ^= 0x40;
+    }
+    TEST_BUF pgm = test_pnm(raster, w, h, 1);
+    TEST_BUF birp = test_convert(options, &pgm);
+    snprintf(paths[i], sizeof(paths[i]), "/tmp/birp_test_%d_%d.birp", (int)getpid(), i);
+    FILE *f = fopen(paths[i], "w");
+    CHECK(f != NULL && fwrite(birp.data, 1, birp.len, f) == birp.len && fclose(f) == 0,
+          "cannot write %s", paths[i]);
+    free(raster);
+    test_buf_free(&pgm);
+    test_buf_free(&birp);
+}
+
+/*
+ * Compare the files written and check the report and the result.
+ */
+static void check_report(int result, const char *want) {
+    TEST_BUF got = {NULL, 0};
+    FILE *f = open_memstream((char **)&got.data, &got.len);
+    CHECK(f != NULL, "out of memory");
+    int status = birp_compare(paths[0], paths[1], f);
+    fclose(f);
+    CHECK(status == result, "comparison gave %d, expected %d", status, result);
+    CHECK(strncmp((char *)got.data, want, strlen(want)) == 0, "report begins\n%.*s\nexpected\n%s",
+          (int)got.len, (char *)got.data, want);
+    test_buf_free(&got);
+}
+
+TEST(compare, report) {
+    write_birp(0, 45, 27, 0, "-i pgm -o birp");
+    write_birp(1, 45, 27, 0, "-i pgm -o birp");
+    check_report(0, "identical yes\nwidth 45\nheight 27\npixels 0\n");
+    // Files of the same image in different layouts are identical.
+    write_birp(1, 45, 27, 0, "-i pgm -o birp -S rect -O cols -H 8");
+    check_report(0, "identical yes\nwidth 45\nheight 27\npixels 0\n");
+    write_birp(1, 45, 27, 3, "-i pgm -o birp -O rows");
+    check_report(1, "identical no\nwidth 45\nheight 27\npixels 3\nrect ");
+    write_birp(1, 27, 45, 0, "-i pgm -o birp");
+    check_report(1, "identical no\nwidth 45 27\nheight 27 45\n");
+    unlink(paths[0]);
+    unlink(paths[1]);
+    check_report(-1, "");
+}
+
+/*
+ * Run birp on the files written, and return its exit status.
+ */
+static int run_compare(void) {
+    pid_t pid = fork();
+    CHECK(pid != -1, "cannot fork");
+    if (pid == 0) {
+        int fd = open("/dev/null", O_WRONLY);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        execl("bin/birp", "birp", "--compare", paths[0], paths[1], (char *)NULL);
+        _exit(127);
+    }
+    int status;
+    CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status), "birp did not exit");
+    CHECK(WEXITSTATUS(status) != 127, "cannot run bin/birp");
+    return WEXITSTATUS(status);
+}
+
+TEST(compare, status) {
+    write_birp(0, 20, 10, 0, "-i pgm -o birp");
+    write_birp(1, 20, 10, 0, "-i pgm -o birp -H 8");
+    CHECK(run_compare() == 0, "identical files do not exit with 0");
+    write_birp(1, 20, 10, 1, "-i pgm -o birp");
+    CHECK(run_compare() == 1, "differing files do not exit with 1");
+    write_birp(1, 10, 20, 0, "-i pgm -o birp");
+    CHECK(run_compare() == 1, "files of different sizes do not exit with 1");
+    unlink(paths[1]);
+    CHECK(run_compare() == 2, "a missing file does not exit with 2");
+    unlink(paths[0]);
+}
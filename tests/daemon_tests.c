@@ -0,0 +1,224 @@
+/*
+ * The conversion daemon, run in a child process of the test.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "test.h"
+#include "const.h"
+#include "daemon.h"
+
+static char sock_path[64];
+
+static pid_t daemon_spawn(void) {
+    snprintf(sock_path, sizeof(sock_path), "/tmp/birp_test_%d.sock", (int)getpid());
+    pid_t pid = fork();
+    CHECK(pid != -1, "cannot fork");
+    if (pid == 0) {
+        exit(birp_daemon(sock_path) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    for (int i = 0; i < 100 && access(sock_path, F_OK) != 0; i++) {
+        usleep(20000);
+    }
+    return pid;
+}
+
+static void daemon_kill(pid_t pid) {
+    int status;
+    kill(pid, SIGTERM);
+    CHECK(waitpid(pid, &status, 0) == pid, "daemon did not exit");
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0, "daemon failed");
+}
+
+/*
+ * Send a request and return the reply, whose status is stored in *statusp;
+ * returns a reply of length 0, with status -1, if the daemon closed the
+ * connection without replying.
+ */
+static TEST_BUF daemon_request(const char *line, TEST_BUF *in, int *statusp) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = {AF_UNIX};
+    strncpy(addr.sun_path, sock_path, sizeof(addr.sun_path) - 1);
+    CHECK(fd != -1 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0,
+          "cannot connect to %s", sock_path);
+    signal(SIGPIPE, SIG_IGN);
+    int sent = write(fd, line, strlen(line)) == (ssize_t)strlen(line) && write(fd, "\n", 1) == 1;
+    for (size_t off = 0; sent && off < in->len; ) {
+        ssize_t k = write(fd, in->data + off, in->len - off);
+        sent = k > 0;
+        off += sent ? k : 0;
+    }
+    shutdown(fd, SHUT_WR);
+    char *data = NULL;
+    size_t len = 0;
+    FILE *reply = open_memstream(&data, &len);
+    char buf[65536];
+    ssize_t k;
+    while ((k = read(fd, buf, sizeof(buf))) > 0) {
+        fwrite(buf, 1, k, reply);
+    }
+    fclose(reply);
+    close(fd);
+    TEST_BUF out = {NULL, 0};
+    size_t olen, elen;
+    int hl = 0;
+    *statusp = -1;
+    if (len > 0 && sscanf(data, "%d %zu %zu%n", statusp, &olen, &elen, &hl) == 3) {
+        hl++;
+        CHECK(len == hl + olen + elen, "reply of %zu bytes, expected %zu", len, hl + olen + elen);
+        out.data = malloc(olen + 1);
+        memcpy(out.data, data + hl, olen);
+        out.len = olen;
+    }
+    free(data);
+    return out;
+}
+
+static TEST_BUF sample(int w, int h) {
+    unsigned char *raster = malloc((size_t)w * h);
+    test_pattern(raster, w, h, 1, 11);
+    TEST_BUF pgm = test_pnm(raster, w, h, 1);
+    free(raster);
+    return pgm;
+}
+
+TEST(daemon, same_as_convert) {
+    TEST_BUF pgm = sample(300, 200);
+    TEST_BUF want = test_convert("-i pgm -o birp -r -n", &pgm);
+    pid_t pid = daemon_spawn();
+    int status;
+    TEST_BUF got = daemon_request("-i pgm -o birp -r -n", &pgm, &status);
+    CHECK(status == 0, "request failed with status %d", status);
+    CHECK(got.len == want.len && memcmp(got.data, want.data, got.len) == 0,
+          "daemon output differs from conversion");
+    daemon_kill(pid);
+    test_buf_free(&got);
+    test_buf_free(&want);
+    test_buf_free(&pgm);
+}
+
+TEST(daemon, concurrent_requests) {
+    TEST_BUF pgm = sample(400, 300);
+    TEST_BUF want = test_convert("-i pgm -o birp -t 100", &pgm);
+    pid_t pid = daemon_spawn();
+    pid_t clients[8];
+    for (int i = 0; i < 8; i++) {
+        if ((clients[i] = fork()) == 0) {
+            int status;
+            TEST_BUF got = daemon_request("-i pgm -o birp -t 100", &pgm, &status);
+            exit(status == 0 && got.len == want.len && memcmp(got.data, want.data, got.len) == 0
+                 ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < 8; i++) {
+        int status;
+        CHECK(waitpid(clients[i], &status, 0) == clients[i] && WIFEXITED(status)
+              && WEXITSTATUS(status) == 0, "client %d got a wrong reply", i);
+    }
+    daemon_kill(pid);
+    test_buf_free(&want);
+    test_buf_free(&pgm);
+}
+
+TEST(daemon, refused_options) {
+    const char *refused[] = {
+        "--store /tmp/birp_test.store -i pgm", "--batch /tmp /tmp -i pgm",
+        "--compare /tmp/a.birp /tmp/b.birp", "--daemon /tmp/other.sock", "-h",
+        "-i pgm --to /tmp/birp_test.pgm -o pgm"
+    };
+    TEST_BUF pgm = sample(16, 16);
+    pid_t pid = daemon_spawn();
+    for (size_t i = 0; i < sizeof(refused) / sizeof(*refused); i++) {
+        int status;
+        TEST_BUF got = daemon_request(refused[i], &pgm, &status);
+        CHECK(status == EXIT_FAILURE && got.len == 0, "\"%s\" was served", refused[i]);
+        test_buf_free(&got);
+    }
+    CHECK(access("/tmp/birp_test.store", F_OK) != 0, "the daemon created a store");
+    daemon_kill(pid);
+    test_buf_free(&pgm);
+}
+
+TEST(daemon, request_too_large) {
+    TEST_BUF big = {calloc(DAEMON_REQUEST_MAX + 1, 1), DAEMON_REQUEST_MAX + 1};
+    CHECK(big.data != NULL, "out of memory");
+    pid_t pid = daemon_spawn();
+    int status;
+    TEST_BUF got = daemon_request("-i pgm -o birp", &big, &status);
+    CHECK(status == -1, "a request of %zu bytes was served", big.len);
+    // The daemon carries on serving.
+    TEST_BUF pgm = sample(16, 16);
+    test_buf_free(&got);
+    got = daemon_request("-i pgm -o stats", &pgm, &status);
+    CHECK(status == 0, "request after a refused one failed");
+    daemon_kill(pid);
+    test_buf_free(&got);
+    test_buf_free(&pgm);
+    test_buf_free(&big);
+}
+
+TEST(daemon, malformed_input) {
+    // BIRP files whose nodes refer to nodes not yet read, to nodes that do
+    // not lie below them, or to a tile of no valid size.
+    const char *bodies[] = {
+        "A\x09\x00\x00\x00\x01\x00\x00\x00",
+        "A\xff\xff\xff\xff\x01\x00\x00\x00",
+        "@\x00@\x01" "A\x01\x00\x00\x00\x02\x00\x00\x00" "A\x03\x00\x00\x00\x01\x00\x00\x00",
+        "@\x00=\x05\x00\x00\x00",
+        "#\x07"
+    };
+    const size_t lens[] = {9, 9, 22, 7, 2};
+    TEST_BUF pgm = sample(16, 16);
+    TEST_BUF want = test_convert("-i pgm -o birp", &pgm);
+    pid_t pid = daemon_spawn();
+    for (size_t i = 0; i < sizeof(bodies) / sizeof(*bodies); i++) {
+        TEST_BUF bad = {malloc(64), 0};
+        bad.len = snprintf((char *)bad.data, 64, "B5\n2 2\n255\n");
+        memcpy(bad.data + bad.len, bodies[i], lens[i]);
+        bad.len += lens[i];
+        int status;
+        TEST_BUF got = daemon_request("-i birp -o pgm", &bad, &status);
+        CHECK(status == EXIT_FAILURE, "malformed file %zu gave status %d", i, status);
+        test_buf_free(&got);
+        test_buf_free(&bad);
+        // The daemon carries on serving.
+        got = daemon_request("-i pgm -o birp", &pgm, &status);
+        CHECK(status == 0 && got.len == want.len && memcmp(got.data, want.data, got.len) == 0,
+              "request after malformed file %zu was not served", i);
+        test_buf_free(&got);
+    }
+    daemon_kill(pid);
+    test_buf_free(&want);
+    test_buf_free(&pgm);
+}
+
+TEST(daemon, frames) {
+    TEST_BUF pgm = sample(16, 16);
+    TEST_BUF two = {malloc(2 * pgm.len), 2 * pgm.len};
+    memcpy(two.data, pgm.data, pgm.len);
+    memcpy(two.data + pgm.len, pgm.data, pgm.len);
+    TEST_BUF birp = test_convert("-i pgm -o birp", &two);
+    TEST_BUF want = test_convert("-i birp -o pgm", &birp);
+    pid_t pid = daemon_spawn();
+    int status;
+    TEST_BUF got = daemon_request("-i pgm -o birp", &two, &status);
+    CHECK(status == 0 && got.len == birp.len && memcmp(got.data, birp.data, got.len) == 0,
+          "two images made BIRP by the daemon differ from the conversion");
+    test_buf_free(&got);
+    got = daemon_request("-i birp -o pgm", &birp, &status);
+    CHECK(status == 0 && got.len == want.len && memcmp(got.data, want.data, got.len) == 0,
+          "two BIRP images decoded by the daemon differ from the conversion");
+    test_buf_free(&got);
+    daemon_kill(pid);
+    test_buf_free(&two);
+    test_buf_free(&birp);
+    test_buf_free(&want);
+    test_buf_free(&pgm);
+}
@@ -0,0 +1,128 @@
+/*
+ * Fan-out conversions, each output against the conversion made on its own.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "const.h"
+#include "birp.h"
+
+#define OUTPUTS_MAX 16
+
+static TEST_BUF read_file(const char *path) {
+    TEST_BUF buf = {NULL, 0};
+    FILE *f = fopen(path, "r");
+    CHECK(f != NULL, "%s was not written", path);
+    fseek(f, 0, SEEK_END);
+    buf.len = ftell(f);
+    rewind(f);
+    buf.data = malloc(buf.len + 1);
+    CHECK(fread(buf.data, 1, buf.len, f) == buf.len, "cannot read %s", path);
+    fclose(f);
+    return buf;
+}
+
+/*
+ * Run a fan-out of an input to the given outputs, each the options of a
+ * conversion from the input format, and check each file written against
+ * the output of that conversion.
+ */
+static void check_fanout(const char *format, TEST_BUF *in, const char **outputs, int n) {
+    char paths[OUTPUTS_MAX][64], args[OUTPUTS_MAX][128];
+    char *argv[8 * OUTPUTS_MAX];
+    int argc = 0;
+    argv[argc++] = "birp";
+    argv[argc++] = "-i";
+    argv[argc++] = (char *)format;
+    for (int j = 0; j < n; j++) {
+        snprintf(paths[j], sizeof(paths[j]), "/tmp/birp_test_%d_%d.out", (int)getpid(), j);
+        argv[argc++] = "--to";
+        argv[argc++] = paths[j];
+        snprintf(args[j], sizeof(args[j]), "%s", outputs[j]);
+        for (char *tok = strtok(args[j], " "); tok != NULL; tok = strtok(NULL, " ")) {
+            argv[argc++] = tok;
+        }
+    }
+    argv[argc] = NULL;
+    CHECK(validargs(argc, argv) == 0 && fanout_argv != NULL, "fan-out options rejected");
+    FILE *f = fmemopen(in->data, in->len, "r");
+    CHECK(f != NULL, "cannot open memory stream");
+    CHECK(birp_fanout(f, fanout_argc, fanout_argv) == 0, "fan-out of %s input failed", format);
+    fclose(f);
+    char options[160];
+    for (int j = 0; j < n; j++) {
+        TEST_BUF got = read_file(paths[j]);
+        snprintf(options, sizeof(options), "-i %s %s", format, outputs[j]);
+        TEST_BUF want = test_convert(options, in);
+        CHECK(got.len == want.len && memcmp(got.data, want.data, got.len) == 0,
+              "output %d of a fan-out (\"%s\") of %zu bytes differs from the conversion (%zu bytes)",
+              j, options, got.len, want.len);
+        unlink(paths[j]);
+        test_buf_free(&got);
+        test_buf_free(&want);
+    }
+}
+
+/*
+ * Outputs of each format, and BIRP outputs with chains of transformations
+ * that share prefixes with those of earlier outputs, of the same shape or
+ * not.
+ */
+static const char *outputs[] = {
+    "-o birp -r -n",
+    "-o birp -r -n -f h",
+    "-o birp -r",
+    "-o pgm",
+    "-o birp -O cols -S rect -r -n",
+    "-o birp -r -n -f h -t 100",
+    "-o birp -r -n -f v -t 50",
+    "-o ascii -w 1",
+    "-o stats",
+    "-o birp -S rect -r -n -f h",
+    "-o birp -H 8 -r -n",
+    "-o birp -n -r",
+    "-o birp -O auto -z 1"
+};
+
+#define OUTPUTS (sizeof(outputs) / sizeof(*outputs))
+
+static void check_image(int w, int h, unsigned seed) {
+    unsigned char *raster = malloc(w * h);
+    CHECK(raster != NULL, "out of memory");
+    test_pattern(raster, w, h, 1, seed);
+    TEST_BUF pgm = test_pnm(raster, w, h, 1);
+    // A PGM image cannot be written as PGM, so the fan-out of PGM input
+    // leaves out that output.
+    check_fanout("pgm", &pgm, outputs, 3);
+    check_fanout("pgm", &pgm, outputs + 4, OUTPUTS - 4);
+    const char *encodings[] = {"-i pgm -o birp", "-i pgm -o birp -S rect -O rows", "-i pgm -o birp -H 8"};
+    for (size_t i = 0; i < sizeof(encodings) / sizeof(*encodings); i++) {
+        TEST_BUF birp = test_convert(encodings[i], &pgm);
+        check_fanout("birp", &birp, outputs, OUTPUTS);
+        test_buf_free(&birp);
+    }
+    free(raster);
+    test_buf_free(&pgm);
+}
+
+TEST(fanout, outputs) {
+    check_image(64, 64, 1);
+    check_image(45, 27, 2);
+    check_image(70, 5, 3);
+}
+
+TEST(fanout, single) {
+    unsigned char raster[20 * 10];
+    test_pattern(raster, 20, 10, 1, 4);
+    TEST_BUF pgm = test_pnm(raster, 20, 10, 1);
+    TEST_BUF birp = test_convert("-i pgm -o birp", &pgm);
+    for (size_t j = 0; j < OUTPUTS; j++) {
+        check_fanout("birp", &birp, outputs + j, 1);
+    }
+    test_buf_free(&pgm);
+    test_buf_free(&birp);
+}
@@ -0,0 +1,82 @@
+/*
+ * Filling rectangles and setting pixels of a BDD, in each layout, against
+ * the same edits to the raster.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "bdd.h"
+
+/*
+ * Check every pixel of the array of a BDD, padding included, against
+ * a raster covering the whole array.
+ */
+static void check_array(BDD_NODE *node, BDD_LAYOUT *layout, unsigned char *want) {
+    CHECK(node != NULL, "no BDD was built");
+    int cols = 1 << layout->cbits;
+    for (int r = 0; r < 1 << layout->rbits; r++) {
+        for (int c = 0; c < cols; c++) {
+            int v = bdd_apply_ordered(node, layout, r, c);
+            CHECK(v == want[r*cols + c], "pixel (%d, %d) in order %d is %d, expected %d",
+                  r, c, layout->order, v, want[r*cols + c]);
+        }
+    }
+}
+
+static void check_fills(int w, int h, BDD_LAYOUT *layout, unsigned seed) {
+    unsigned char *raster = malloc(w * h);
+    CHECK(raster != NULL, "out of memory");
+    test_pattern(raster, w, h, 1, seed);
+    BDD_RECT rects[] = {{1, 2, h - 3, w - 1}, {-4, -4, 3, 5}, {h/2, w/2, 3*h, 3*w}, {5, 5, 5, 9}};
+    BDD_NODE *node = test_build(raster, w, h, layout);
+    int rows = 1 << layout->rbits, cols = 1 << layout->cbits;
+    unsigned char *want = calloc(rows * cols, 1);
+    for (int r = 0; r < h; r++) {
+        memcpy(want + r*cols, raster + r*w, w);
+    }
+    check_array(node, layout, want);
+    // Each edit applies to the result of the one before.
+    for (int i = 0; i < 4; i++) {
+        BDD_RECT *fr = &rects[i];
+        for (int r = fr->r0 < 0 ? 0 : fr->r0; r < fr->r1 && r < rows; r++) {
+            for (int c = fr->c0 < 0 ? 0 : fr->c0; c < fr->c1 && c < cols; c++) {
+                want[r*cols + c] = 50 + i;
+            }
+        }
+        node = bdd_fill_rect(node, layout, fr, 50 + i);
+        check_array(node, layout, want);
+    }
+    for (int i = 0; i < 20; i++) {
+        int r = (i * 7) % rows, c = (i * 13) % cols;
+        want[r*cols + c] = 200 + i;
+        node = bdd_set_pixel(node, layout, r, c, 200 + i);
+        check_array(node, layout, want);
+    }
+    CHECK(bdd_set_pixel(node, layout, 0, 0, want[0]) == node,
+          "setting a pixel to its own value changed the BDD");
+    free(want);
+    free(raster);
+}
+
+TEST(fill, every_layout) {
+    test_layouts(check_fills, 0);
+}
+
+TEST(fill, strips) {
+    test_layouts(check_fills, 1);
+}
+
+TEST(fill, bad_layout) {
+    unsigned char raster[32];
+    test_pattern(raster, 8, 4, 1, 5);
+    BDD_LAYOUT layout = {BDD_ORDER_ROWS, 0, 0, 1};
+    BDD_NODE *node = test_build(raster, 8, 4, &layout);
+    BDD_LAYOUT small = {BDD_ORDER_RC, 1, 1, 0};
+    BDD_RECT rect = {0, 0, 2, 2};
+    CHECK(bdd_fill_rect(node, &small, &rect, 1) == NULL, "a layout with too few levels was taken");
+    CHECK(bdd_fill_rect(node, NULL, &rect, 1) == NULL, "no layout was taken");
+    CHECK(bdd_set_pixel(node, &layout, 4, 0, 1) == NULL, "a pixel below the array was set");
+    CHECK(bdd_set_pixel(node, &layout, 3, 7, 1) != NULL, "the last pixel of the array was refused");
+}
@@ -0,0 +1,93 @@
+/*
+ * Multi-image streams, converted an image at a time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+#define FRAMES 4
+
+static const int sizes[FRAMES][2] = {{20, 10}, {33, 7}, {20, 10}, {1, 1}};
+
+/*
+ * Join files, with the given byte between each and the next unless it is
+ * EOF.
+ */
+static TEST_BUF join(TEST_BUF *bufs, int n, int sep) {
+    TEST_BUF all = {malloc(1), 0};
+    for (int i = 0; i < n; i++) {
+        all.data = realloc(all.data, all.len + bufs[i].len + 1);
+        CHECK(all.data != NULL, "out of memory");
+        memcpy(all.data + all.len, bufs[i].data, bufs[i].len);
+        all.len += bufs[i].len;
+        if (sep != EOF && i + 1 < n) {
+            all.data[all.len++] = sep;
+        }
+    }
+    return all;
+}
+
+static void check_same(TEST_BUF *got, TEST_BUF *want, const char *what) {
+    CHECK(got->len == want->len && memcmp(got->data, want->data, got->len) == 0,
+          "%s of %zu bytes differs from the images converted one at a time (%zu bytes)",
+          what, got->len, want->len);
+}
+
+/*
+ * Convert a stream of the images of sizes[] with the given options, then
+ * the result with the second options, and check each against the images
+ * converted one at a time.  The third and first images are the same, so
+ * that the nodes of the one would be found for the other were the node
+ * table not emptied between them.
+ */
+static void check_frames(int channels, const char *to, const char *from, int sep) {
+    TEST_BUF pnm[FRAMES], conv[FRAMES], back[FRAMES];
+    for (int i = 0; i < FRAMES; i++) {
+        int w = sizes[i][0], h = sizes[i][1];
+        unsigned char *raster = malloc((size_t)w * h * channels);
+        CHECK(raster != NULL, "out of memory");
+        test_pattern(raster, w, h, channels, w);
+        pnm[i] = test_pnm(raster, w, h, channels);
+        conv[i] = test_convert(to, &pnm[i]);
+        back[i] = test_convert(from, &conv[i]);
+        free(raster);
+    }
+    TEST_BUF stream = join(pnm, FRAMES, EOF);
+    TEST_BUF want = join(conv, FRAMES, sep);
+    TEST_BUF got = test_convert(to, &stream);
+    check_same(&got, &want, to);
+    TEST_BUF want_back = join(back, FRAMES, strstr(from, "-o birp") ? BDD_FRAME_END : EOF);
+    TEST_BUF got_back = test_convert(from, &got);
+    check_same(&got_back, &want_back, from);
+    for (int i = 0; i < FRAMES; i++) {
+        test_buf_free(&pnm[i]);
+        test_buf_free(&conv[i]);
+        test_buf_free(&back[i]);
+    }
+    test_buf_free(&stream);
+    test_buf_free(&want);
+    test_buf_free(&got);
+    test_buf_free(&want_back);
+    test_buf_free(&got_back);
+}
+
+TEST(frames, round_trip) {
+    check_frames(1, "-i pgm -o birp", "-i birp -o pgm", BDD_FRAME_END);
+    check_frames(1, "-i pgm -o birp -S rect -O cols", "-i birp -o pgm", BDD_FRAME_END);
+    check_frames(1, "-i pgm -o birp -H 8", "-i birp -o pgm", BDD_FRAME_END);
+    check_frames(3, "-i ppm -o birp", "-i birp -o ppm", BDD_FRAME_END);
+}
+
+TEST(frames, transform) {
+    check_frames(1, "-i pgm -o birp", "-i birp -o birp -r -n", BDD_FRAME_END);
+    check_frames(1, "-i pgm -o birp -H 8", "-i birp -o birp -O rows -f h", BDD_FRAME_END);
+    check_frames(3, "-i ppm -o birp", "-i birp -o birp -R 180", BDD_FRAME_END);
+}
+
+TEST(frames, text) {
+    check_frames(1, "-i pgm -o birp", "-i birp -o ascii", BDD_FRAME_END);
+    check_frames(1, "-i pgm -o birp", "-i birp -o stats", BDD_FRAME_END);
+}
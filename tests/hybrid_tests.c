@@ -0,0 +1,98 @@
+/*
+ * Hybrid BIRP files, with tiles of raw pixels at the bottom levels.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+static const char *layouts[] = {
+    "", " -S rect", " -O cr", " -O rows -S rect", " -O cols", " -O auto -S rect"
+};
+
+#define LAYOUTS (sizeof(layouts) / sizeof(*layouts))
+
+/*
+ * Decode a BIRP file and check that it is the given image.
+ */
+static void check_image(TEST_BUF *birp, unsigned char *raster, int w, int h) {
+    TEST_BUF back = test_convert("-i birp -o pgm", birp);
+    unsigned char *got = test_read_pnm(&back, w, h, 1);
+    test_same_raster(got, raster, w, h, 1);
+    free(got);
+    test_buf_free(&back);
+}
+
+static void check_hybrid(int w, int h, int size) {
+    unsigned char *raster = malloc(w * h);
+    CHECK(raster != NULL, "out of memory");
+    test_pattern(raster, w, h, 1, w * size);
+    TEST_BUF pgm = test_pnm(raster, w, h, 1);
+    char options[128];
+    for (size_t i = 0; i < LAYOUTS; i++) {
+        snprintf(options, sizeof(options), "-i pgm -o birp -H %d%s", size, layouts[i]);
+        TEST_BUF hybrid = test_convert(options, &pgm);
+        check_image(&hybrid, raster, w, h);
+        // Converted without -H, the file is the one written without tiles.
+        snprintf(options, sizeof(options), "-i birp -o birp%s", layouts[i]);
+        TEST_BUF plain = test_convert(options, &hybrid);
+        snprintf(options, sizeof(options), "-i pgm -o birp%s", layouts[i]);
+        TEST_BUF want = test_convert(options, &pgm);
+        CHECK(plain.len == want.len && memcmp(plain.data, want.data, want.len) == 0,
+              "hybrid file with %s made plain differs from the plain file", layouts[i]);
+        test_buf_free(&hybrid);
+        test_buf_free(&plain);
+        test_buf_free(&want);
+    }
+    free(raster);
+    test_buf_free(&pgm);
+}
+
+TEST(hybrid, round_trip) {
+    check_hybrid(64, 64, 8);
+    check_hybrid(64, 64, 16);
+    check_hybrid(45, 27, 8);
+    check_hybrid(45, 27, 16);
+    check_hybrid(70, 3, 8);
+    check_hybrid(5, 5, 16);
+}
+
+TEST(hybrid, noise) {
+    // The noisy corner of the pattern takes fewer bytes as raw tiles.
+    int w = 128, h = 128;
+    unsigned char *raster = malloc(w * h);
+    CHECK(raster != NULL, "out of memory");
+    test_pattern(raster, w, h, 1, 9);
+    TEST_BUF pgm = test_pnm(raster, w, h, 1);
+    TEST_BUF plain = test_convert("-i pgm -o birp", &pgm);
+    TEST_BUF hybrid = test_convert("-i pgm -o birp -H 8", &pgm);
+    CHECK(hybrid.len < plain.len, "hybrid file of %zu bytes, plain one of %zu", hybrid.len, plain.len);
+    // Transformations of a hybrid file give the image they give without tiles.
+    TEST_BUF moved = test_convert("-i birp -o birp -H 16 -r -f v -n", &hybrid);
+    TEST_BUF want = test_convert("-i birp -o birp -r -f v -n", &plain);
+    TEST_BUF got = test_convert("-i birp -o pgm", &moved);
+    TEST_BUF wanted = test_convert("-i birp -o pgm", &want);
+    CHECK(got.len == wanted.len && memcmp(got.data, wanted.data, got.len) == 0,
+          "transformed hybrid file differs from the transformed plain file");
+    free(raster);
+    test_buf_free(&pgm);
+    test_buf_free(&plain);
+    test_buf_free(&hybrid);
+    test_buf_free(&moved);
+    test_buf_free(&want);
+    test_buf_free(&got);
+    test_buf_free(&wanted);
+}
+
+TEST(hybrid, options) {
+    const char *rejected[] = {
+        "-i pgm -o birp -H 4", "-i pgm -o birp -H 32", "-i pgm -o pgm -H 8",
+        "-i pgm -o birp -H 8 -H 8", "-i pgm -o birp -H 8 --store /tmp/birp_hybrid.store"
+    };
+    TEST_BUF in = {(unsigned char *)"", 0}, out;
+    for (size_t i = 0; i < sizeof(rejected) / sizeof(*rejected); i++) {
+        CHECK(test_run(rejected[i], &in, &out) == -1, "\"%s\" was accepted", rejected[i]);
+    }
+}
@@ -0,0 +1,170 @@
+/*
+ * BIRP files in each variable order and shape.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+static const char *orders[] = {"rc", "cr", "rows", "cols", "auto"};
+
+#define ORDERS (sizeof(orders) / sizeof(*orders))
+
+/*
+ * Convert an image with the given options, decode the result, and check
+ * that it is the original image.
+ */
+static void round_trip(unsigned char *raster, int w, int h, const char *options) {
+    TEST_BUF pgm = test_pnm(raster, w, h, 1);
+    TEST_BUF birp = test_convert(options, &pgm);
+    TEST_BUF back = test_convert("-i birp -o pgm", &birp);
+    unsigned char *got = test_read_pnm(&back, w, h, 1);
+    test_same_raster(got, raster, w, h, 1);
+    free(got);
+    test_buf_free(&pgm);
+    test_buf_free(&birp);
+    test_buf_free(&back);
+}
+
+/*
+ * Stripes across the rows or down the columns, each of which one of the
+ * orders with all the bits of one index at the top stores in few nodes.
+ */
+static void stripes(unsigned char *raster, int w, int h, int across) {
+    for (int r = 0; r < h; r++) {
+        for (int c = 0; c < w; c++) {
+            int k = across ? r : c;
+            raster[r*w + c] = (k * 37) & 0xFF;
+        }
+    }
+}
+
+static void check_orders(int w, int h, const char *extra) {
+    unsigned char *raster = malloc(w * h);
+    CHECK(raster != NULL, "out of memory");
+    char options[128];
+    for (int kind = 0; kind < 3; kind++) {
+        if (kind == 0) {
+            test_pattern(raster, w, h, 1, w + h);
+        } else {
+            stripes(raster, w, h, kind == 1);
+        }
+        for (size_t i = 0; i < ORDERS; i++) {
+            snprintf(options, sizeof(options), "-i pgm -o birp -O %s%s", orders[i], extra);
+            round_trip(raster, w, h, options);
+        }
+    }
+    free(raster);
+}
+
+TEST(layout, orders) {
+    check_orders(40, 30, "");
+    check_orders(64, 64, "");
+}
+
+TEST(layout, change_order) {
+    int w = 45, h = 33;
+    unsigned char raster[45 * 33];
+    test_pattern(raster, w, h, 1, 5);
+    TEST_BUF pgm = test_pnm(raster, w, h, 1);
+    TEST_BUF birp = test_convert("-i pgm -o birp", &pgm);
+    char options[64];
+    // Each file is converted to the next order, and back at the end.
+    for (size_t i = 0; i <= ORDERS; i++) {
+        snprintf(options, sizeof(options), "-i birp -o birp -O %s", orders[i % ORDERS]);
+        TEST_BUF next = test_convert(options, &birp);
+        test_buf_free(&birp);
+        birp = next;
+        TEST_BUF back = test_convert("-i birp -o pgm", &birp);
+        unsigned char *got = test_read_pnm(&back, w, h, 1);
+        test_same_raster(got, raster, w, h, 1);
+        free(got);
+        test_buf_free(&back);
+    }
+    TEST_BUF first = test_convert("-i pgm -o birp -O rc", &pgm);
+    CHECK(birp.len == first.len && memcmp(birp.data, first.data, birp.len) == 0,
+          "order rc after a change of orders differs from order rc");
+    test_buf_free(&first);
+    test_buf_free(&birp);
+    test_buf_free(&pgm);
+}
+
+/*
+ * The file written in the order chosen for an image, which must be that of
+ * one of the fixed orders.
+ */
+static int chosen_order(unsigned char *raster, int w, int h) {
+    TEST_BUF pgm = test_pnm(raster, w, h, 1);
+    TEST_BUF chosen = test_convert("-i pgm -o birp -O auto", &pgm);
+    char options[64];
+    int found = -1;
+    for (int i = 0; i < 4 && found < 0; i++) {
+        snprintf(options, sizeof(options), "-i pgm -o birp -O %s", orders[i]);
+        TEST_BUF fixed = test_convert(options, &pgm);
+        if (fixed.len == chosen.len && memcmp(fixed.data, chosen.data, fixed.len) == 0) {
+            found = i;
+        }
+        test_buf_free(&fixed);
+    }
+    CHECK(found >= 0, "order chosen is none of the fixed orders");
+    test_buf_free(&pgm);
+    test_buf_free(&chosen);
+    return found;
+}
+
+TEST(layout, auto_order) {
+    int w = 64, h = 64;
+    unsigned char raster[64 * 64];
+    // Every order stores stripes in as many nodes, and ties go to order rc.
+    stripes(raster, w, h, 1);
+    CHECK(chosen_order(raster, w, h) == 0, "order rc not chosen for stripes");
+    // Rows shifted by the low bits of the column are fewest nodes with all
+    // the row bits at the top.
+    for (int r = 0; r < h; r++) {
+        for (int c = 0; c < w; c++) {
+            raster[r*w + c] = ((r * 37) & 0xFF) >> (c & 3);
+        }
+    }
+    CHECK(chosen_order(raster, w, h) == 2, "order rows not chosen for shifted rows");
+}
+
+TEST(layout, bad_order) {
+    TEST_BUF in = {(unsigned char *)"", 0}, out;
+    CHECK(test_run("-i pgm -o birp -O diagonal", &in, &out) == -1, "an unknown order was accepted");
+}
+
+TEST(layout, rect) {
+    check_orders(40, 30, " -S rect");
+    check_orders(300, 3, " -S rect");
+    check_orders(3, 300, " -S rect");
+    check_orders(1, 1, " -S rect");
+}
+
+TEST(layout, change_shape) {
+    int w = 300, h = 3;
+    unsigned char raster[300 * 3];
+    test_pattern(raster, w, h, 1, 6);
+    TEST_BUF pgm = test_pnm(raster, w, h, 1);
+    TEST_BUF square = test_convert("-i pgm -o birp -S square", &pgm);
+    TEST_BUF rect = test_convert("-i birp -o birp -S rect", &square);
+    // A strip is far from the square that holds it, and its padding costs.
+    CHECK(rect.len < square.len, "rect file of %zu bytes, square one of %zu", rect.len, square.len);
+    TEST_BUF direct = test_convert("-i pgm -o birp -S rect", &pgm);
+    CHECK(rect.len == direct.len && memcmp(rect.data, direct.data, rect.len) == 0,
+          "square file made rect differs from one written rect");
+    TEST_BUF back = test_convert("-i birp -o birp -S square", &rect);
+    CHECK(back.len == square.len && memcmp(back.data, square.data, back.len) == 0,
+          "rect file made square differs from one written square");
+    TEST_BUF out = test_convert("-i birp -o pgm", &rect);
+    unsigned char *got = test_read_pnm(&out, w, h, 1);
+    test_same_raster(got, raster, w, h, 1);
+    free(got);
+    test_buf_free(&pgm);
+    test_buf_free(&square);
+    test_buf_free(&rect);
+    test_buf_free(&direct);
+    test_buf_free(&back);
+    test_buf_free(&out);
+}
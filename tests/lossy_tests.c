@@ -0,0 +1,90 @@
+/*
+ * Lossy BIRP encoding, held to its error tolerance.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "test.h"
+
+/*
+ * Encode an image with a tolerance and the given options, decode it, and
+ * check that no value moved by more than the tolerance.
+ *
+ * @return  The size of the BIRP file.
+ */
+static size_t check_bound(int w, int h, int channels, int tol, const char *extra) {
+    size_t n = (size_t)w * h * channels;
+    unsigned char *raster = malloc(n);
+    CHECK(raster != NULL, "out of memory");
+    test_pattern(raster, w, h, channels, w);
+    TEST_BUF pnm = test_pnm(raster, w, h, channels);
+    const char *format = channels == 1 ? "pgm" : "ppm";
+    char options[128];
+    snprintf(options, sizeof(options), "-i %s -o birp -q %d%s", format, tol, extra);
+    TEST_BUF birp = test_convert(options, &pnm);
+    snprintf(options, sizeof(options), "-i birp -o %s", format);
+    TEST_BUF back = test_convert(options, &birp);
+    unsigned char *got = test_read_pnm(&back, w, h, channels);
+    if (tol == 0) {
+        test_same_raster(got, raster, w, h, channels);
+    }
+    for (size_t i = 0; i < n; i++) {
+        int d = got[i] - raster[i];
+        CHECK(d <= tol && -d <= tol, "value %zu of a %dx%d image is %d, off %d by more than %d",
+              i, w, h, got[i], raster[i], tol);
+    }
+    size_t len = birp.len;
+    free(got);
+    free(raster);
+    test_buf_free(&pnm);
+    test_buf_free(&birp);
+    test_buf_free(&back);
+    return len;
+}
+
+static const int tolerances[] = {0, 1, 2, 4, 16, 60, 255};
+
+#define TOLERANCES (sizeof(tolerances) / sizeof(*tolerances))
+
+TEST(lossy, bound) {
+    const char *extras[] = {"", " -S rect", " -O cols", " -O rows -S rect", " -O auto"};
+    for (size_t i = 0; i < TOLERANCES; i++) {
+        for (size_t j = 0; j < sizeof(extras) / sizeof(*extras); j++) {
+            check_bound(64, 64, 1, tolerances[i], extras[j]);
+            check_bound(45, 27, 1, tolerances[i], extras[j]);
+        }
+    }
+}
+
+TEST(lossy, shrinks) {
+    // The noise in the pattern is merged into fewer nodes as the tolerance grows.
+    size_t last = check_bound(64, 64, 1, 0, "");
+    for (size_t i = 1; i < TOLERANCES; i++) {
+        size_t len = check_bound(64, 64, 1, tolerances[i], "");
+        CHECK(len <= last, "tolerance %d gives %zu bytes, more than %zu", tolerances[i], len, last);
+        last = len;
+    }
+    CHECK(last < check_bound(64, 64, 1, 0, ""), "tolerance 255 gives no smaller file");
+}
+
+TEST(lossy, ppm) {
+    for (size_t i = 0; i < TOLERANCES; i++) {
+        check_bound(40, 30, 3, tolerances[i], "");
+    }
+}
+
+TEST(lossy, tiled) {
+    check_bound(9000, 20, 1, 8, "");
+}
+
+TEST(lossy, options) {
+    const char *rejected[] = {
+        "-i birp -o birp -q 4", "-i pgm -o pgm -q 4", "-i pgm -o birp -q 256",
+        "-i pgm -o birp -q -1", "-i pgm -o birp -q 4 -q 4", "-i pgm -o birp -q"
+    };
+    TEST_BUF in = {(unsigned char *)"", 0}, out;
+    for (size_t i = 0; i < sizeof(rejected) / sizeof(*rejected); i++) {
+        CHECK(test_run(rejected[i], &in, &out) == -1, "\"%s\" was accepted", rejected[i]);
+    }
+}
@@ -0,0 +1,65 @@
+/*
+ * Bitwise operations and bit planes, in each layout, against the same
+ * operations on the raster.
+ */
+
+#include <stdlib.h>
+
+#include "test.h"
+#include "bdd.h"
+
+static void check_planes(int w, int h, BDD_LAYOUT *layout, unsigned seed) {
+    int n = w * h;
+    unsigned char *a = malloc(n), *b = malloc(n), *want = malloc(n);
+    CHECK(a != NULL && b != NULL && want != NULL, "out of memory");
+    test_pattern(a, w, h, 1, seed);
+    test_pattern(b, w, h, 1, seed + 1);
+    BDD_NODE *na = test_build(a, w, h, layout);
+    BDD_NODE *nb = test_build(b, w, h, layout);
+    for (int op = BDD_AND; op <= BDD_XOR; op++) {
+        for (int i = 0; i < n; i++) {
+            want[i] = op == BDD_AND ? a[i] & b[i] : op == BDD_OR ? a[i] | b[i] : a[i] ^ b[i];
+        }
+        test_same_bdd(bdd_combine(na, nb, op), layout, want, w, h);
+    }
+    BDD_NODE *planes[BDD_PLANES];
+    CHECK(bdd_to_planes(na, planes) == 0, "cannot decompose into planes");
+    for (int k = 0; k < BDD_PLANES; k++) {
+        for (int i = 0; i < n; i++) {
+            want[i] = (a[i] >> k) & 1;
+        }
+        test_same_bdd(planes[k], layout, want, w, h);
+        for (int i = 0; i < n; i++) {
+            want[i] = a[i] >= 1 << k;
+        }
+        test_same_bdd(bdd_planes_threshold(planes, k), layout, want, w, h);
+    }
+    // BDDs are canonical, so reassembly gives the very same node.
+    CHECK(bdd_from_planes(planes) == na, "planes reassembled into a different BDD");
+    free(a);
+    free(b);
+    free(want);
+}
+
+TEST(plane, every_layout) {
+    test_layouts(check_planes, 0);
+}
+
+TEST(plane, strips) {
+    test_layouts(check_planes, 1);
+}
+
+TEST(plane, not_binary) {
+    unsigned char raster[64];
+    test_pattern(raster, 8, 8, 1, 5);
+    BDD_LAYOUT layout = {BDD_ORDER_RC, 0, 0, 0};
+    BDD_NODE *node = test_build(raster, 8, 8, &layout);
+    BDD_NODE *planes[BDD_PLANES];
+    CHECK(bdd_to_planes(node, planes) == 0, "cannot decompose into planes");
+    planes[6] = node;
+    CHECK(bdd_from_planes(planes) == NULL, "a plane that is not binary was taken");
+    CHECK(bdd_planes_threshold(planes, 4) == NULL, "a plane that is not binary was thresholded");
+    CHECK(bdd_planes_threshold(planes, 7) != NULL, "planes above the one that is not binary refused");
+    planes[7] = NULL;
+    CHECK(bdd_planes_threshold(planes, 7) == NULL, "a missing plane was taken");
+}
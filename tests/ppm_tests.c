@@ -0,0 +1,95 @@
+/*
+ * PPM input and output, and colour BIRP files.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "const.h"
+#include "birp.h"
+#include "image.h"
+
+static void round_trip(int w, int h, const char *options) {
+    size_t n = (size_t)w * h;
+    unsigned char *raster = malloc(IMG_CHANNELS * n);
+    CHECK(raster != NULL, "out of memory");
+    test_pattern(raster, w, h, IMG_CHANNELS, w + h);
+    TEST_BUF ppm = test_pnm(raster, w, h, IMG_CHANNELS);
+    TEST_BUF birp = test_convert(options, &ppm);
+    CHECK(birp.len > 2 && memcmp(birp.data, "B6", 2) == 0, "output is not a colour BIRP file");
+    TEST_BUF back = test_convert("-i birp -o ppm", &birp);
+    unsigned char *got = test_read_pnm(&back, w, h, IMG_CHANNELS);
+    test_same_raster(got, raster, w, h, IMG_CHANNELS);
+    free(got);
+    free(raster);
+    test_buf_free(&ppm);
+    test_buf_free(&birp);
+    test_buf_free(&back);
+}
+
+TEST(ppm, round_trip) {
+    round_trip(37, 23, "-i ppm -o birp");
+}
+
+TEST(ppm, round_trip_rect) {
+    round_trip(37, 23, "-i ppm -o birp -S rect");
+}
+
+TEST(ppm, round_trip_tiled) {
+    round_trip(9000, 5, "-i ppm -o birp");
+}
+
+TEST(ppm, selected_channels) {
+    int w = 40, h = 30;
+    size_t n = (size_t)w * h;
+    unsigned char *raster = malloc(IMG_CHANNELS * n);
+    test_pattern(raster, w, h, IMG_CHANNELS, 7);
+    TEST_BUF ppm = test_pnm(raster, w, h, IMG_CHANNELS);
+    TEST_BUF birp = test_convert("-i ppm -o birp -c rb -n", &ppm);
+    TEST_BUF back = test_convert("-i birp -o ppm", &birp);
+    unsigned char *got = test_read_pnm(&back, w, h, IMG_CHANNELS);
+    for (size_t i = 0; i < n; i++) {
+        raster[i] = 255 - raster[i];
+        raster[2*n + i] = 255 - raster[2*n + i];
+    }
+    test_same_raster(got, raster, w, h, IMG_CHANNELS);
+    free(got);
+    free(raster);
+    test_buf_free(&ppm);
+    test_buf_free(&birp);
+    test_buf_free(&back);
+}
+
+TEST(ppm, unsupported_conversions) {
+    const char *rejected[] = {
+        "-i ppm -o pgm", "-i ppm -o ascii", "-i ppm -o stats", "-i ppm -o ppm",
+        "-i pgm -o ppm", "-i ppm --to /dev/null"
+    };
+    TEST_BUF in = {(unsigned char *)"", 0}, out;
+    for (size_t i = 0; i < sizeof(rejected) / sizeof(*rejected); i++) {
+        CHECK(test_run(rejected[i], &in, &out) == -1, "\"%s\" was accepted", rejected[i]);
+    }
+}
+
+TEST(ppm, colour_file_unsupported_modes) {
+    int w = 9, h = 9;
+    unsigned char *raster = malloc(IMG_CHANNELS * w * h);
+    test_pattern(raster, w, h, IMG_CHANNELS, 3);
+    TEST_BUF ppm = test_pnm(raster, w, h, IMG_CHANNELS);
+    TEST_BUF birp = test_convert("-i ppm -o birp", &ppm);
+    TEST_BUF out;
+    CHECK(test_run("-i birp -o pgm", &birp, &out) != 0, "colour BIRP converted to PGM");
+    test_buf_free(&out);
+    char path[] = "/tmp/birp_testXXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd != -1 && write(fd, birp.data, birp.len) == (ssize_t)birp.len, "cannot write %s", path);
+    close(fd);
+    CHECK(birp_compare(path, path, stdout) == -1, "colour BIRP files compared");
+    unlink(path);
+    free(raster);
+    test_buf_free(&ppm);
+    test_buf_free(&birp);
+}
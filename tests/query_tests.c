@@ -0,0 +1,129 @@
+/*
+ * Queries over a rectangle of a BDD, in each layout, against the same
+ * queries made pixel by pixel.
+ */
+
+#include <stdlib.h>
+
+#include "test.h"
+#include "bdd.h"
+
+/*
+ * An image that is blank but for a few small blocks, so that bounding
+ * boxes are smaller than the image.
+ */
+static void sparse(unsigned char *raster, int w, int h, unsigned seed) {
+    for (int i = 0; i < w * h; i++) {
+        raster[i] = 0;
+    }
+    for (int k = 0; k < 4; k++) {
+        seed = seed * 1103515245u + 12345u;
+        int r = (seed >> 8) % h;
+        int c = (seed >> 20) % w;
+        for (int i = r; i < r + 3 && i < h; i++) {
+            for (int j = c; j < c + 2 && j < w; j++) {
+                raster[i*w + j] = 1 + (seed + i + j) % 200;
+            }
+        }
+    }
+}
+
+static int nonzero(unsigned char v) {
+    return v != 0;
+}
+
+/*
+ * Rectangles inside, straddling and beyond the edges of the image,
+ * including one that is empty.
+ */
+static BDD_RECT clips(int w, int h, int i) {
+    BDD_RECT all[] = {
+        {0, 0, h, w}, {1, 2, h - 1, w - 3}, {h/3, w/4, h/2 + 1, w - 1}, {-5, -5, h + 9, w + 9},
+        {h/2, 0, h/2 + 1, w}, {0, w/2, h, w/2 + 1}, {3, 3, 3, 9}, {h - 2, w - 2, 2*h, 2*w}
+    };
+    return all[i];
+}
+
+#define CLIPS 8
+
+static void check_queries(unsigned char *raster, int w, int h, BDD_LAYOUT *layout) {
+    BDD_NODE *node = test_build(raster, w, h, layout);
+    int order = layout->order;
+    for (int i = 0; i < CLIPS; i++) {
+        BDD_RECT clip = clips(w, h, i);
+        unsigned long long sum = 0, count = 0;
+        BDD_RECT want = {h, w, -1, -1};
+        int fr = -1, fc = -1;
+        for (int r = clip.r0 < 0 ? 0 : clip.r0; r < clip.r1 && r < h; r++) {
+            for (int c = clip.c0 < 0 ? 0 : clip.c0; c < clip.c1 && c < w; c++) {
+                unsigned char v = raster[r*w + c];
+                sum += v;
+                if (v == 0) {
+                    continue;
+                }
+                count++;
+                if (fr < 0) {
+                    fr = r;
+                    fc = c;
+                }
+                want.r0 = r < want.r0 ? r : want.r0;
+                want.c0 = c < want.c0 ? c : want.c0;
+                want.r1 = r + 1 > want.r1 ? r + 1 : want.r1;
+                want.c1 = c + 1 > want.c1 ? c + 1 : want.c1;
+            }
+        }
+        CHECK(bdd_rect_sum(node, layout, &clip) == sum, "order %d clip %d: sum %llu, expected %llu",
+              order, i, bdd_rect_sum(node, layout, &clip), sum);
+        CHECK(bdd_rect_count(node, layout, &clip, 0) == count,
+              "order %d clip %d: count %llu, expected %llu",
+              order, i, bdd_rect_count(node, layout, &clip, 0), count);
+        BDD_RECT box;
+        int found = bdd_bbox(node, layout, &clip, 0, &box) == 0;
+        CHECK(found == (count > 0), "order %d clip %d: bounding box %sfound", order, i,
+              found ? "" : "not ");
+        CHECK(!found || (box.r0 == want.r0 && box.c0 == want.c0 && box.r1 == want.r1
+                         && box.c1 == want.c1),
+              "order %d clip %d: bounding box [%d, %d) x [%d, %d), expected [%d, %d) x [%d, %d)",
+              order, i, box.r0, box.r1, box.c0, box.c1, want.r0, want.r1, want.c0, want.c1);
+        int r, c;
+        found = bdd_find_first(node, layout, &clip, nonzero, &r, &c) == 0;
+        CHECK(found == (count > 0) && (!found || (r == fr && c == fc)),
+              "order %d clip %d: first pixel (%d, %d), expected (%d, %d)", order, i,
+              found ? r : -1, found ? c : -1, fr, fc);
+    }
+}
+
+/*
+ * Check the queries on a sparse image and on the test pattern.
+ */
+static void check_all(int w, int h, BDD_LAYOUT *layout, unsigned seed) {
+    unsigned char *raster = malloc(w * h);
+    CHECK(raster != NULL, "out of memory");
+    sparse(raster, w, h, seed + layout->order);
+    check_queries(raster, w, h, layout);
+    test_pattern(raster, w, h, 1, seed + layout->order);
+    check_queries(raster, w, h, layout);
+    free(raster);
+}
+
+TEST(query, every_layout) {
+    test_layouts(check_all, 0);
+}
+
+TEST(query, strips) {
+    test_layouts(check_all, 1);
+}
+
+TEST(query, bad_layout) {
+    unsigned char raster[64];
+    sparse(raster, 8, 8, 5);
+    BDD_LAYOUT layout = {BDD_ORDER_RC, 0, 0, 0};
+    BDD_NODE *node = test_build(raster, 8, 8, &layout);
+    BDD_RECT clip = {0, 0, 8, 8}, box;
+    BDD_LAYOUT small = {BDD_ORDER_RC, 1, 1, 0};
+    BDD_LAYOUT bad = {BDD_ORDER_COUNT, 3, 3, 0};
+    CHECK(bdd_bbox(node, &small, &clip, 0, &box) == -1, "a layout with too few levels was taken");
+    CHECK(bdd_bbox(node, &bad, &clip, 0, &box) == -1, "an invalid order was taken");
+    CHECK(bdd_bbox(node, NULL, &clip, 0, &box) == -1, "no layout was taken");
+    CHECK(bdd_rect_sum(node, &small, &clip) == 0, "a layout with too few levels was summed");
+}
@@ -0,0 +1,121 @@
+/*
+ * Renumbering the nodes of a BDD in the node table, in each order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "bdd.h"
+
+static const int orders[] = {BDD_RELAYOUT_DFS, BDD_RELAYOUT_LEVEL};
+
+#define ORDERS (sizeof(orders) / sizeof(*orders))
+
+/*
+ * The serialized BDD, which depends only on the function of the BDD and not
+ * on where its nodes lie in the table.
+ */
+static TEST_BUF serialized(BDD_NODE *node) {
+    TEST_BUF buf = {NULL, 0};
+    FILE *f = open_memstream((char **)&buf.data, &buf.len);
+    CHECK(f != NULL && bdd_serialize(node, f) == 0, "cannot serialize a BDD");
+    fclose(f);
+    return buf;
+}
+
+/*
+ * Decode a BDD, which may be hybrid, and check that it is the given image.
+ */
+static void check_image(BDD_NODE *node, BDD_LAYOUT *layout, unsigned char *want, int w, int h) {
+    unsigned char *got = malloc(w * h);
+    CHECK(got != NULL, "out of memory");
+    CHECK(node != NULL && bdd_to_raster_ordered(node, layout, w, h, got) == 0, "cannot decode a BDD");
+    test_same_raster(got, want, w, h, 1);
+    free(got);
+}
+
+/*
+ * Check that the table holds the nodes of one BDD, with its root first.
+ */
+static void check_alone(BDD_NODE *node) {
+    int used = bdd_manager_current()->unused;
+    CHECK(node == bdd_nodes + BDD_NUM_LEAVES, "root of a renumbered BDD at %ld", (long)(node - bdd_nodes));
+    CHECK(used == BDD_NUM_LEAVES + bdd_node_count(node), "%d nodes left in the table for a BDD of %d",
+          used - BDD_NUM_LEAVES, bdd_node_count(node));
+}
+
+static void check_relayout(int w, int h, unsigned seed) {
+    unsigned char *raster = malloc(w * h), *other = malloc(w * h);
+    CHECK(raster != NULL && other != NULL, "out of memory");
+    test_pattern(raster, w, h, 1, seed);
+    test_pattern(other, w, h, 1, seed + 1);
+    BDD_LAYOUT layout = {BDD_ORDER_RC, 0, 0, 0};
+    bdd_layout_fit(&layout, w, h);
+    BDD_NODE *node = bdd_from_raster_ordered(w, h, raster, NULL, BDD_IDENTITY, &layout);
+    TEST_BUF want = serialized(node);
+    // Each order after each, so that every order starts both from a table
+    // in build order and from one renumbered the other way.
+    for (size_t i = 0; i < ORDERS; i++) {
+        for (size_t j = 0; j < ORDERS; j++) {
+            // Another BDD in the table is discarded.
+            bdd_from_raster_ordered(w, h, other, NULL, BDD_IDENTITY, &layout);
+            node = bdd_relayout(node, orders[i]);
+            check_alone(node);
+            node = bdd_relayout(node, orders[j]);
+            check_alone(node);
+            check_image(node, &layout, raster, w, h);
+            TEST_BUF got = serialized(node);
+            CHECK(got.len == want.len && memcmp(got.data, want.data, got.len) == 0,
+                  "BDD renumbered in order %d then %d serializes differently", orders[i], orders[j]);
+            test_buf_free(&got);
+        }
+    }
+    test_buf_free(&want);
+    free(raster);
+    free(other);
+}
+
+TEST(relayout, round_trip) {
+    check_relayout(64, 64, 1);
+    check_relayout(45, 27, 2);
+    check_relayout(200, 3, 3);
+}
+
+TEST(relayout, leaf) {
+    unsigned char raster[16 * 16];
+    memset(raster, 7, sizeof(raster));
+    BDD_NODE *node = bdd_from_raster(16, 16, raster);
+    CHECK(node == bdd_nodes + 7, "uniform image is not leaf 7");
+    test_pattern(raster, 16, 16, 1, 4);
+    bdd_from_raster(16, 16, raster);
+    CHECK(bdd_relayout(node, BDD_RELAYOUT_DFS) == node, "leaf moved");
+    CHECK(bdd_manager_current()->unused == BDD_NUM_LEAVES, "nodes left in the table with a leaf");
+}
+
+TEST(relayout, hybrid) {
+    int w = 128, h = 128;
+    unsigned char *raster = malloc(w * h), *other = malloc(w * h);
+    CHECK(raster != NULL && other != NULL, "out of memory");
+    test_pattern(raster, w, h, 1, 9);
+    test_pattern(other, w, h, 1, 10);
+    BDD_LAYOUT layout = {BDD_ORDER_RC, 0, 0, 0};
+    bdd_layout_fit(&layout, w, h);
+    for (size_t i = 0; i < ORDERS; i++) {
+        bdd_reset();
+        BDD_NODE *node = bdd_to_hybrid(bdd_from_raster_ordered(w, h, raster, NULL, BDD_IDENTITY, &layout),
+                                       &layout, 6);
+        node = bdd_relayout(node, orders[i]);
+        check_alone(node);
+        check_image(node, &layout, raster, w, h);
+        // Tiles made after the renumbering go after those of the BDD kept.
+        BDD_NODE *next = bdd_to_hybrid(bdd_from_raster_ordered(w, h, other, NULL, BDD_IDENTITY, &layout),
+                                       &layout, 6);
+        check_image(next, &layout, other, w, h);
+        check_image(node, &layout, raster, w, h);
+        check_image(bdd_from_hybrid(node, &layout), &layout, raster, w, h);
+    }
+    free(raster);
+    free(other);
+}
@@ -0,0 +1,213 @@
+/*
+ * Histograms of BDDs and the statistics output, against histograms taken
+ * from the raster, and the counters reported by --stats.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "bdd.h"
+#include "stats.h"
+
+static void raster_histogram(unsigned char *raster, int w, int h, int stride,
+                             unsigned long long *hist) {
+    memset(hist, 0, BDD_NUM_LEAVES * sizeof(*hist));
+    for (int r = 0; r < h; r++) {
+        for (int c = 0; c < w; c++) {
+            hist[raster[r*stride + c]]++;
+        }
+    }
+}
+
+static void check_histogram(int w, int h, unsigned seed) {
+    unsigned char *raster = malloc(w * h);
+    CHECK(raster != NULL, "out of memory");
+    test_pattern(raster, w, h, 1, seed);
+    BDD_NODE *node = bdd_from_raster(w, h, raster);
+    int level = bdd_min_level(w, h);
+    unsigned long long got[BDD_NUM_LEAVES], want[BDD_NUM_LEAVES];
+    // Clips of the image as well as the whole of it, each taken twice so
+    // that the memo tables are reused across walks.
+    int clips[][2] = {{w, h}, {w - w/3, h}, {w, h/2 + 1}, {1, 1}, {w, h}};
+    for (int i = 0; i < 5; i++) {
+        int cw = clips[i][0], ch = clips[i][1];
+        CHECK(bdd_histogram(node, level, cw, ch, got) == 0, "no histogram of a %dx%d clip", cw, ch);
+        raster_histogram(raster, cw, ch, w, want);
+        for (int v = 0; v < BDD_NUM_LEAVES; v++) {
+            CHECK(got[v] == want[v], "%dx%d clip of a %dx%d image: %llu pixels of %d, expected %llu",
+                  cw, ch, w, h, got[v], v, want[v]);
+        }
+        BDD_LAYOUT layout = {BDD_ORDER_RC, level/2, level/2, 0};
+        BDD_RECT rect = {0, 0, ch, cw};
+        bdd_rect_sum(node, &layout, &rect);
+    }
+    free(raster);
+}
+
+TEST(stats, histogram) {
+    check_histogram(37, 23, 1);
+    check_histogram(45, 27, 2);
+    check_histogram(70, 5, 3);
+    check_histogram(3, 100, 4);
+    check_histogram(64, 64, 5);
+    check_histogram(1, 1, 6);
+}
+
+TEST(stats, histogram_after_reset) {
+    check_histogram(37, 23, 7);
+    bdd_reset();
+    check_histogram(45, 27, 8);
+    check_histogram(37, 23, 7);
+}
+
+TEST(stats, bad_level) {
+    unsigned char raster[16 * 16];
+    test_pattern(raster, 16, 16, 1, 9);
+    BDD_NODE *node = bdd_from_raster(16, 16, raster);
+    unsigned long long hist[BDD_NUM_LEAVES];
+    CHECK(bdd_histogram(node, node->level - 1, 16, 16, hist) == -1, "a level below the root was taken");
+    CHECK(bdd_histogram(NULL, 8, 16, 16, hist) == -1, "no BDD was taken");
+}
+
+/*
+ * The statistics output for a raster, as birp prints it.
+ */
+static TEST_BUF stats_text(unsigned char *raster, int w, int h) {
+    unsigned long long hist[BDD_NUM_LEAVES], pixels = 0;
+    raster_histogram(raster, w, h, w, hist);
+    double sum = 0, sumsq = 0;
+    int min = -1, max = -1;
+    for (int v = 0; v < BDD_NUM_LEAVES; v++) {
+        if (hist[v] == 0) {
+            continue;
+        }
+        min = min < 0 ? v : min;
+        max = v;
+        pixels += hist[v];
+        sum += (double)hist[v] * v;
+        sumsq += (double)hist[v] * v * v;
+    }
+    double mean = sum / pixels;
+    TEST_BUF text = {NULL, 0};
+    FILE *f = open_memstream((char **)&text.data, &text.len);
+    CHECK(f != NULL, "out of memory");
+    fprintf(f, "width %d\nheight %d\npixels %llu\n", w, h, pixels);
+    fprintf(f, "min %d\nmax %d\nmean %.6f\nvariance %.6f\n", min, max, mean, sumsq / pixels - mean * mean);
+    for (int v = 0; v < BDD_NUM_LEAVES; v++) {
+        if (hist[v] != 0) {
+            fprintf(f, "bin %d %llu\n", v, hist[v]);
+        }
+    }
+    fclose(f);
+    return text;
+}
+
+static void check_output(int w, int h, unsigned seed) {
+    unsigned char *raster = malloc(w * h);
+    CHECK(raster != NULL, "out of memory");
+    test_pattern(raster, w, h, 1, seed);
+    TEST_BUF pgm = test_pnm(raster, w, h, 1);
+    TEST_BUF want = stats_text(raster, w, h);
+    const char *encodings[] = {"-i pgm -o birp", "-i pgm -o birp -S rect", "-i pgm -o birp -O cols",
+                               "-i pgm -o birp -H 8"};
+    for (size_t i = 0; i < sizeof(encodings) / sizeof(*encodings); i++) {
+        TEST_BUF birp = test_convert(encodings[i], &pgm);
+        TEST_BUF got = test_convert("-i birp -o stats", &birp);
+        CHECK(got.len == want.len && memcmp(got.data, want.data, got.len) == 0,
+              "statistics of a %dx%d image written with \"%s\" differ:\n%.*s", w, h, encodings[i],
+              (int)got.len, (char *)got.data);
+        test_buf_free(&birp);
+        test_buf_free(&got);
+    }
+    TEST_BUF got = test_convert("-i pgm -o stats", &pgm);
+    CHECK(got.len == want.len && memcmp(got.data, want.data, got.len) == 0,
+          "statistics of a %dx%d PGM image differ", w, h);
+    test_buf_free(&got);
+    test_buf_free(&want);
+    test_buf_free(&pgm);
+    free(raster);
+}
+
+TEST(stats, output) {
+    check_output(37, 23, 10);
+    check_output(70, 5, 11);
+    check_output(6, 90, 12);
+    check_output(64, 64, 13);
+}
+
+/*
+ * The value of a key of the --stats report.
+ */
+static double report_value(TEST_BUF *report, const char *key) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+    char *p = strstr((char *)report->data, pattern);
+    CHECK(p != NULL, "no %s in the report:\n%s", key, (char *)report->data);
+    return strtod(p + strlen(pattern), NULL);
+}
+
+/*
+ * Convert a PGM image to BIRP with the given options, starting from zero
+ * counters, and return the --stats report made after it.
+ */
+static TEST_BUF report_of(const char *options, TEST_BUF *pgm, TEST_BUF *birp) {
+    memset(&bdd_stats, 0, sizeof(bdd_stats));
+    bdd_reset();
+    CHECK(test_run(options, pgm, birp) == 0, "\"%s\" failed", options);
+    TEST_BUF report = {NULL, 0};
+    FILE *f = open_memstream((char **)&report.data, &report.len);
+    CHECK(f != NULL, "out of memory");
+    stats_report(f);
+    fclose(f);
+    return report;
+}
+
+TEST(stats, counters) {
+    int w = 37, h = 23;
+    unsigned char raster[37 * 23];
+    test_pattern(raster, w, h, 1, 14);
+    TEST_BUF pgm = test_pnm(raster, w, h, 1);
+    TEST_BUF birp;
+    TEST_BUF report = report_of("--stats -i pgm -o birp", &pgm, &birp);
+    CHECK(report.len > 2 && report.data[0] == '{' && report.data[report.len - 2] == '}'
+          && memchr(report.data, '\n', report.len) == report.data + report.len - 1,
+          "report is not one JSON object on a line:\n%s", (char *)report.data);
+    // The table, emptied first, holds only the nodes of the image.
+    double created = report_value(&report, "nodes_created");
+    CHECK(created > 0 && created == report_value(&report, "table_nodes"),
+          "%.0f nodes created for a table of %.0f", created, report_value(&report, "table_nodes"));
+    CHECK(report_value(&report, "nodes_collapsed") > 0, "no lookups of equal children counted");
+    CHECK(report_value(&report, "probe_max") >= 1 && report_value(&report, "probe_avg") >= 1,
+          "no probes of the hash map counted");
+    CHECK(report_value(&report, "depth_max") == bdd_min_level(w, h), "depth %.0f for an image of %d levels",
+          report_value(&report, "depth_max"), bdd_min_level(w, h));
+    // The payloads exclude the headers.
+    unsigned char *body = memchr(birp.data, '\n', birp.len) + 1;
+    CHECK(report_value(&report, "bytes_in") == w * h, "%.0f bytes read for %d pixels",
+          report_value(&report, "bytes_in"), w * h);
+    size_t payload = birp.len - (body - birp.data);
+    CHECK(report_value(&report, "bytes_out") == payload, "%.0f bytes written for a BDD of %zu",
+          report_value(&report, "bytes_out"), payload);
+    CHECK(report_value(&report, "build") > 0, "no time spent building");
+    test_buf_free(&report);
+    test_buf_free(&birp);
+    test_buf_free(&pgm);
+}
+
+TEST(stats, disabled) {
+    unsigned char raster[37 * 23];
+    test_pattern(raster, 37, 23, 1, 15);
+    TEST_BUF pgm = test_pnm(raster, 37, 23, 1);
+    TEST_BUF birp;
+    TEST_BUF report = report_of("-i pgm -o birp", &pgm, &birp);
+    // Without --stats, lookups are not counted nor phases timed.
+    CHECK(bdd_stats.lookups == 0 && bdd_stats.created == 0 && bdd_stats.reused == 0
+          && bdd_stats.collapsed == 0 && bdd_stats.probes == 0 && bdd_stats.probe_max == 0,
+          "lookups counted without --stats");
+    CHECK(report_value(&report, "build") == 0, "time counted without --stats");
+    test_buf_free(&report);
+    test_buf_free(&birp);
+    test_buf_free(&pgm);
+}
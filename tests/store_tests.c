@@ -0,0 +1,135 @@
+/*
+ * Thin BIRP files written through a node store, and their export.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "test.h"
+#include "store.h"
+
+static char path[64];
+static char options[256];
+
+static const char *with_store(const char *fmt) {
+    snprintf(path, sizeof(path), "/tmp/birp_test_%d.store", (int)getpid());
+    snprintf(options, sizeof(options), fmt, path);
+    return options;
+}
+
+static long store_size(void) {
+    struct stat st;
+    CHECK(stat(path, &st) == 0, "%s was not made", path);
+    return st.st_size;
+}
+
+static TEST_BUF sample(int w, int h, unsigned seed, unsigned char **rasterp) {
+    unsigned char *raster = malloc(w * h);
+    CHECK(raster != NULL, "out of memory");
+    test_pattern(raster, w, h, 1, seed);
+    TEST_BUF pgm = test_pnm(raster, w, h, 1);
+    *rasterp = raster;
+    return pgm;
+}
+
+TEST(store, thin_round_trip) {
+    unsigned char *raster;
+    TEST_BUF pgm = sample(61, 40, 1, &raster);
+    TEST_BUF thin = test_convert(with_store("-i pgm -o birp --store %s"), &pgm);
+    TEST_BUF full = test_convert("-i pgm -o birp", &pgm);
+    CHECK(thin.len < full.len, "thin file of %zu bytes, full one of %zu", thin.len, full.len);
+    TEST_BUF back = test_convert(with_store("-i birp -o pgm --store %s"), &thin);
+    unsigned char *got = test_read_pnm(&back, 61, 40, 1);
+    test_same_raster(got, raster, 61, 40, 1);
+    // The thin file means nothing without its store.
+    TEST_BUF out;
+    CHECK(test_run("-i birp -o pgm", &thin, &out) != 0, "thin file read without its store");
+    test_buf_free(&out);
+    // The nodes of an image already in the store are not added again.
+    long size = store_size();
+    TEST_BUF again = test_convert(with_store("-i pgm -o birp --store %s"), &pgm);
+    CHECK(store_size() == size, "store grew from %ld to %ld bytes", size, store_size());
+    CHECK(again.len == thin.len && memcmp(again.data, thin.data, thin.len) == 0,
+          "same image gave a different thin file");
+    unlink(path);
+    free(got);
+    free(raster);
+    test_buf_free(&pgm);
+    test_buf_free(&thin);
+    test_buf_free(&full);
+    test_buf_free(&back);
+    test_buf_free(&again);
+}
+
+TEST(store, export_full) {
+    unsigned char *raster;
+    TEST_BUF pgm = sample(50, 50, 2, &raster);
+    TEST_BUF thin = test_convert(with_store("-i pgm -o birp -r --store %s"), &pgm);
+    TEST_BUF want = test_convert("-i pgm -o birp -r", &pgm);
+    TEST_BUF exported = test_convert(with_store("-i birp -o birp --store %s --export"), &thin);
+    CHECK(exported.len == want.len && memcmp(exported.data, want.data, want.len) == 0,
+          "exported file differs from one written without a store");
+    // Transformations apply on the way out, as for any conversion.
+    test_buf_free(&exported);
+    exported = test_convert(with_store("-i birp -o birp --export --store %s -n"), &thin);
+    TEST_BUF back = test_convert("-i birp -o pgm", &exported);
+    TEST_BUF rotated = test_convert("-i pgm -o birp -r -n", &pgm);
+    TEST_BUF wback = test_convert("-i birp -o pgm", &rotated);
+    CHECK(back.len == wback.len && memcmp(back.data, wback.data, back.len) == 0,
+          "exported file with a transformation differs from the transformed image");
+    unlink(path);
+    free(raster);
+    test_buf_free(&pgm);
+    test_buf_free(&thin);
+    test_buf_free(&want);
+    test_buf_free(&exported);
+    test_buf_free(&back);
+    test_buf_free(&rotated);
+    test_buf_free(&wback);
+}
+
+TEST(store, export_options) {
+    const char *rejected[] = {
+        "-i birp -o birp --export", "-i birp -o pgm --store %s --export",
+        "-i birp -o birp --store %s --export --export"
+    };
+    TEST_BUF in = {(unsigned char *)"", 0}, out;
+    for (size_t i = 0; i < sizeof(rejected) / sizeof(*rejected); i++) {
+        CHECK(test_run(with_store(rejected[i]), &in, &out) == -1, "\"%s\" was accepted", options);
+    }
+}
+
+/*
+ * Change a child hash of the last record of the store, so that the record
+ * no longer matches the hash it is found by.
+ */
+static void corrupt_last_record(void) {
+    FILE *f = fopen(path, "r+");
+    CHECK(f != NULL, "cannot open %s", path);
+    CHECK(fseek(f, -BDD_STORE_RECORD + 9, SEEK_END) == 0, "cannot seek in %s", path);
+    int c = fgetc(f);
+    fseek(f, -BDD_STORE_RECORD + 9, SEEK_END);
+    fputc(c ^ 1, f);
+    fclose(f);
+}
+
+TEST(store, record_checked) {
+    unsigned char *raster;
+    TEST_BUF pgm = sample(30, 30, 3, &raster);
+    TEST_BUF thin = test_convert(with_store("-i pgm -o birp --store %s"), &pgm);
+    corrupt_last_record();
+    TEST_BUF out;
+    CHECK(test_run(with_store("-i birp -o pgm --store %s"), &thin, &out) != 0,
+          "a thin file was read through a corrupt record");
+    test_buf_free(&out);
+    CHECK(test_run(with_store("-i pgm -o birp --store %s"), &pgm, &out) != 0,
+          "a node was taken to be a record with its hash but other children");
+    test_buf_free(&out);
+    unlink(path);
+    free(raster);
+    test_buf_free(&pgm);
+    test_buf_free(&thin);
+}
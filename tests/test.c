@@ -0,0 +1,247 @@
+/*
+ * The test runner and helpers shared by the tests (see test.h).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "test.h"
+#include "const.h"
+
+static TEST_CASE *test_cases = NULL;
+
+void test_register(TEST_CASE *tc) {
+    // Tests are run in the order they appear in each file.
+    TEST_CASE **tp = &test_cases;
+    while (*tp != NULL) {
+        tp = &(*tp)->next;
+    }
+    tc->next = NULL;
+    *tp = tc;
+}
+
+void test_fail(const char *file, int line, const char *fmt, ...) {
+    va_list ap;
+    fprintf(stderr, "%s:%d: ", file, line);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+void test_buf_free(TEST_BUF *buf) {
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = 0;
+}
+
+int test_run(const char *args, TEST_BUF *in, TEST_BUF *out) {
+    char *copy = malloc(strlen(args) + 6);
+    char *argv[64];
+    int argc = 0;
+    strcpy(copy, "birp ");
+    strcat(copy, args);
+    for (char *tok = strtok(copy, " "); tok != NULL && argc < 63; tok = strtok(NULL, " ")) {
+        argv[argc++] = tok;
+    }
+    argv[argc] = NULL;
+    out->data = NULL;
+    out->len = 0;
+    if (validargs(argc, argv) != 0) {
+        free(copy);
+        return -1;
+    }
+    FILE *inf = fmemopen(in->data, in->len, "r");
+    char *data = NULL;
+    size_t len = 0;
+    FILE *outf = open_memstream(&data, &len);
+    CHECK(inf != NULL && outf != NULL, "cannot open memory streams");
+    int status = convert(inf, outf);
+    fclose(inf);
+    fclose(outf);
+    out->data = (unsigned char *)data;
+    out->len = len;
+    free(copy);
+    return status;
+}
+
+TEST_BUF test_convert(const char *args, TEST_BUF *in) {
+    TEST_BUF out;
+    int status = test_run(args, in, &out);
+    CHECK(status == 0, "conversion \"%s\" failed with status %d", args, status);
+    return out;
+}
+
+void test_pattern(unsigned char *raster, int w, int h, int channels, unsigned seed) {
+    unsigned x = seed * 2654435761u + 1;
+    for (int k = 0; k < channels; k++) {
+        for (int r = 0; r < h; r++) {
+            for (int c = 0; c < w; c++) {
+                x = x * 1103515245u + 12345u;
+                unsigned char v;
+                if (r < h/3) {
+                    v = (r/4 + c/4 + 40*k) & 0xFF;     // gradient
+                } else if (c < w/2) {
+                    v = (seed + 60*k) & 0xFF;          // flat
+                } else {
+                    v = (x >> 16) & 0xFF;              // noise
+                }
+                raster[((size_t)k*h + r)*w + c] = v;
+            }
+        }
+    }
+}
+
+TEST_BUF test_pnm(unsigned char *raster, int w, int h, int channels) {
+    char header[64];
+    int hl = snprintf(header, sizeof(header), "P%d %d %d 255\n", channels == 1 ? 5 : 6, w, h);
+    size_t n = (size_t)w * h;
+    TEST_BUF buf;
+    buf.len = hl + channels * n;
+    buf.data = malloc(buf.len);
+    CHECK(buf.data != NULL, "out of memory");
+    memcpy(buf.data, header, hl);
+    for (size_t i = 0; i < n; i++) {
+        for (int k = 0; k < channels; k++) {
+            buf.data[hl + i*channels + k] = raster[k*n + i];
+        }
+    }
+    return buf;
+}
+
+unsigned char *test_read_pnm(TEST_BUF *buf, int w, int h, int channels) {
+    int gw, gh, max, hl = 0;
+    int magic = channels == 1 ? 5 : 6;
+    char *text = malloc(buf->len + 1);
+    CHECK(text != NULL, "out of memory");
+    memcpy(text, buf->data, buf->len);
+    text[buf->len] = '\0';
+    char fmt[32];
+    snprintf(fmt, sizeof(fmt), "P%d %%d %%d %%d%%n", magic);
+    int got = sscanf(text, fmt, &gw, &gh, &max, &hl);
+    free(text);
+    CHECK(got == 3, "output is not a P%d file", magic);
+    CHECK(gw == w && gh == h, "output is %dx%d, expected %dx%d", gw, gh, w, h);
+    hl++;   // the single whitespace character after the header
+    size_t n = (size_t)w * h;
+    CHECK(buf->len == hl + channels * n, "output holds %zu bytes of pixels, expected %zu",
+          buf->len - hl, channels * n);
+    unsigned char *raster = malloc(channels * n + 1);
+    CHECK(raster != NULL, "out of memory");
+    for (size_t i = 0; i < n; i++) {
+        for (int k = 0; k < channels; k++) {
+            raster[k*n + i] = buf->data[hl + i*channels + k];
+        }
+    }
+    return raster;
+}
+
+void test_same_raster(unsigned char *got, unsigned char *want, int w, int h, int channels) {
+    for (int k = 0; k < channels; k++) {
+        for (int r = 0; r < h; r++) {
+            for (int c = 0; c < w; c++) {
+                size_t i = ((size_t)k*h + r)*w + c;
+                CHECK(got[i] == want[i], "channel %d pixel (%d, %d) is %d, expected %d",
+                      k, r, c, got[i], want[i]);
+            }
+        }
+    }
+}
+
+void test_same_bdd(BDD_NODE *node, BDD_LAYOUT *layout, unsigned char *want, int w, int h) {
+    BDD_LAYOUT square = {BDD_ORDER_RC, 0, 0, 0};
+    if (layout == NULL) {
+        bdd_layout_fit(&square, w, h);
+        layout = &square;
+    }
+    CHECK(node != NULL, "no BDD was built");
+    // Past the image, only the first row and column of padding are checked,
+    // as the array of a square BDD may be far larger than the image.
+    int rows = 1 << layout->rbits;
+    int cols = 1 << layout->cbits;
+    rows = rows > h + 1 ? h + 1 : rows;
+    cols = cols > w + 1 ? w + 1 : cols;
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) {
+            int v = bdd_apply_ordered(node, layout, r, c);
+            int e = r < h && c < w ? want[(size_t)r*w + c] : 0;
+            CHECK(v == e, "BDD pixel (%d, %d) is %d, expected %d", r, c, v, e);
+        }
+    }
+}
+
+BDD_NODE *test_build(unsigned char *raster, int w, int h, BDD_LAYOUT *layout) {
+    bdd_layout_fit(layout, w, h);
+    BDD_NODE *node = bdd_from_raster_ordered(w, h, raster, NULL, BDD_IDENTITY, layout);
+    test_same_bdd(node, layout, raster, w, h);
+    return node;
+}
+
+void test_layouts(void (*check)(int w, int h, BDD_LAYOUT *layout, unsigned seed), int strips) {
+    static const int sizes[][2] = {{37, 23}, {32, 32}, {70, 5}, {6, 90}};
+    for (int i = strips ? 2 : 0; i < (strips ? 4 : 2); i++) {
+        int w = sizes[i][0], h = sizes[i][1];
+        for (int order = 0; order < BDD_ORDER_COUNT; order++) {
+            for (int rect = 0; rect < 2; rect++) {
+                BDD_LAYOUT layout = {order, 0, 0, rect};
+                bdd_layout_fit(&layout, w, h);
+                check(w, h, &layout, i + 1);
+            }
+        }
+    }
+}
+
+static int test_one(TEST_CASE *tc) {
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        alarm(TEST_TIMEOUT);
+        tc->func();
+        exit(EXIT_SUCCESS);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) == -1) {
+        perror("waitpid");
+        return -1;
+    }
+    if (WIFSIGNALED(status)) {
+        fprintf(stderr, "%s::%s: killed by signal %d\n", tc->suite, tc->name, WTERMSIG(status));
+        return -1;
+    }
+    return WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+/*
+ * Run every test, or those of the suites named as arguments.
+ */
+int main(int argc, char **argv) {
+    int run = 0, failed = 0;
+    for (TEST_CASE *tc = test_cases; tc != NULL; tc = tc->next) {
+        int wanted = argc < 2;
+        for (int i = 1; i < argc; i++) {
+            wanted |= strcmp(argv[i], tc->suite) == 0;
+        }
+        if (!wanted) {
+            continue;
+        }
+        run++;
+        if (test_one(tc) == 0) {
+            printf("[PASS] %s::%s\n", tc->suite, tc->name);
+        } else {
+            printf("[FAIL] %s::%s\n", tc->suite, tc->name);
+            failed++;
+        }
+    }
+    printf("Tested: %d | Passing: %d | Failing: %d\n", run, run - failed, failed);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
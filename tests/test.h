@@ -0,0 +1,125 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stddef.h>
+
+#include "bdd.h"
+
+/*
+ * A small self-contained test harness.  Each test is declared with
+ *
+ *     TEST(suite, name) { ... }
+ *
+ * and is registered before main() runs.  Every test runs in a child process
+ * of its own, so that it starts with fresh BDD tables and global options,
+ * and so that a test that fails or crashes does not affect the others.
+ */
+
+typedef struct test_case {
+    const char *suite;
+    const char *name;
+    void (*func)(void);
+    struct test_case *next;
+} TEST_CASE;
+
+/* Seconds that a test may run before it is counted as failed. */
+#define TEST_TIMEOUT 120
+
+void test_register(TEST_CASE *tc);
+
+#define TEST(suite, name) \
+    static void suite##_##name(void); \
+    static TEST_CASE suite##_##name##_case = {#suite, #name, suite##_##name, NULL}; \
+    __attribute__((constructor)) static void suite##_##name##_register(void) { \
+        test_register(&suite##_##name##_case); \
+    } \
+    static void suite##_##name(void)
+
+/**
+ * Report a failed check and end the test.
+ */
+void test_fail(const char *file, int line, const char *fmt, ...)
+    __attribute__((noreturn, format(printf, 3, 4)));
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        test_fail(__FILE__, __LINE__, __VA_ARGS__); \
+    } \
+} while (0)
+
+/*
+ * A buffer of bytes, holding the contents of an image file.
+ */
+typedef struct test_buf {
+    unsigned char *data;
+    size_t len;
+} TEST_BUF;
+
+/**
+ * Run one conversion in the test process, as the program would with the
+ * given arguments (separated by spaces, without the program name), on the
+ * given input.
+ *
+ * @param args  The options of the conversion.
+ * @param in  The input file.
+ * @param out  Receives the output file, which the caller frees with
+ * test_buf_free().
+ * @return  The exit status of the conversion, or -1 if the options were
+ * rejected.
+ */
+int test_run(const char *args, TEST_BUF *in, TEST_BUF *out);
+
+/**
+ * Run a conversion that is expected to succeed, failing the test otherwise.
+ */
+TEST_BUF test_convert(const char *args, TEST_BUF *in);
+
+void test_buf_free(TEST_BUF *buf);
+
+/**
+ * Fill a raster with a pattern mixing flat regions, gradients and noise,
+ * determined by the seed.
+ */
+void test_pattern(unsigned char *raster, int w, int h, int channels, unsigned seed);
+
+/**
+ * Make a PGM file (channels 1) or PPM file (channels 3) of a raster, held
+ * as planes of w x h pixels one after another.
+ */
+TEST_BUF test_pnm(unsigned char *raster, int w, int h, int channels);
+
+/**
+ * Read the PGM or PPM file made by a conversion, failing the test if it is
+ * not of the expected size.
+ *
+ * @return  The raster, held as planes as for test_pnm(), to be freed by the
+ * caller.
+ */
+unsigned char *test_read_pnm(TEST_BUF *buf, int w, int h, int channels);
+
+/**
+ * Check that two rasters are equal, reporting the first difference.
+ */
+void test_same_raster(unsigned char *got, unsigned char *want, int w, int h, int channels);
+
+/**
+ * Check that a BDD in a given layout (NULL for the square layout) gives the
+ * pixels of a w x h raster, and zeros for any padding in its array.
+ */
+void test_same_bdd(BDD_NODE *node, BDD_LAYOUT *layout, unsigned char *want, int w, int h);
+
+/**
+ * Build the BDD of a w x h raster in a layout fitted to the image, and
+ * check it against the raster.
+ */
+BDD_NODE *test_build(unsigned char *raster, int w, int h, BDD_LAYOUT *layout);
+
+/**
+ * Run a check of an operation in every order and shape of layout, fitted
+ * to images of each size shared by such checks, with a seed for the image
+ * that differs from size to size.  The sizes are 37x23 and 32x32, or the
+ * strips 70x5 and 6x90.
+ */
+void test_layouts(void (*check)(int w, int h, BDD_LAYOUT *layout, unsigned seed), int strips);
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * Images larger than the raster, built and decoded in tiles.
+ */
+
+#include <stdlib.h>
+
+#include "test.h"
+#include "const.h"
+
+static void round_trip(int w, int h, const char *options) {
+    unsigned char *raster = malloc((size_t)w * h);
+    CHECK(raster != NULL, "out of memory");
+    test_pattern(raster, w, h, 1, w ^ h);
+    TEST_BUF pgm = test_pnm(raster, w, h, 1);
+    TEST_BUF birp = test_convert(options, &pgm);
+    TEST_BUF back = test_convert("-i birp -o pgm", &birp);
+    unsigned char *got = test_read_pnm(&back, w, h, 1);
+    test_same_raster(got, raster, w, h, 1);
+    free(got);
+    free(raster);
+    test_buf_free(&pgm);
+    test_buf_free(&birp);
+    test_buf_free(&back);
+}
+
+TEST(tiled, wide_strip) {
+    round_trip(9000, 20, "-i pgm -o birp");
+}
+
+TEST(tiled, tall_strip_rect) {
+    round_trip(20, 9000, "-i pgm -o birp -S rect");
+}
+
+TEST(tiled, side_beyond_square_overflow) {
+    // The square of a side above 46340 does not fit in an int.
+    round_trip(50000, 3, "-i pgm -o birp");
+    round_trip(3, 50000, "-i pgm -o birp");
+}
+
+TEST(tiled, greatest_side) {
+    round_trip(BDD_SIDE_MAX, 2, "-i pgm -o birp");
+    round_trip(BDD_SIDE_MAX, 2, "-i pgm -o birp -S rect");
+}
+
+TEST(tiled, side_too_large) {
+    int w = BDD_SIDE_MAX + 1;
+    unsigned char *raster = calloc(w, 1);
+    TEST_BUF pgm = test_pnm(raster, w, 1, 1);
+    TEST_BUF out;
+    CHECK(test_run("-i pgm -o birp", &pgm, &out) != 0, "a %dx1 image was accepted", w);
+    test_buf_free(&out);
+    test_buf_free(&pgm);
+    free(raster);
+}
+
+TEST(tiled, min_level) {
+    CHECK(bdd_min_level(1, 1) == 0, "level of 1x1");
+    CHECK(bdd_min_level(50000, 3) == 32, "level of 50000x3 is %d", bdd_min_level(50000, 3));
+    CHECK(bdd_min_level(BDD_SIDE_MAX, 1) == BDD_LEVELS_MAX, "level of the greatest side");
+    CHECK(bdd_min_level(BDD_SIDE_MAX + 1, 1) > BDD_LEVELS_MAX, "level past the greatest side");
+}
+
+/*
+ * Check that a noisy image with more distinct blocks than the node table
+ * can hold is refused, rather than overrunning the table.
+ */
+static void too_many_nodes(int w, int h) {
+    unsigned char *raster = malloc((size_t)w * h);
+    CHECK(raster != NULL, "out of memory");
+    unsigned x = 1;
+    for (size_t i = 0; i < (size_t)w * h; i++) {
+        x = x * 1103515245u + 12345u;
+        raster[i] = x >> 16;
+    }
+    TEST_BUF pgm = test_pnm(raster, w, h, 1);
+    TEST_BUF out;
+    CHECK(test_run("-i pgm -o birp", &pgm, &out) == EXIT_FAILURE,
+          "a %dx%d image of noise was converted", w, h);
+    test_buf_free(&out);
+    test_buf_free(&pgm);
+    free(raster);
+}
+
+TEST(tiled, node_table_full) {
+    too_many_nodes(8200, 400);
+    bdd_reset();
+    too_many_nodes(4000, 1000);
+}
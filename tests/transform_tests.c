@@ -0,0 +1,168 @@
+/*
+ * Transformations of a BDD against the same transformations of the raster,
+ * repeated across resets of the node table and overflow of the stamps of
+ * the manager's memo tables.
+ */
+
+#include <stdlib.h>
+
+#include "test.h"
+#include "bdd.h"
+
+/*
+ * The pixel of an n x n raster that the symmetry op moves to (r, c).
+ */
+static unsigned char dihedral_pixel(unsigned char *in, int n, int op, int r, int c) {
+    switch (op) {
+    case BDD_ROT90: return in[c*n + n-1-r];
+    case BDD_ROT180: return in[(n-1-r)*n + n-1-c];
+    case BDD_ROT270: return in[(n-1-c)*n + r];
+    case BDD_FLIP_H: return in[r*n + n-1-c];
+    case BDD_FLIP_V: return in[(n-1-r)*n + c];
+    case BDD_TRANSPOSE: return in[c*n + r];
+    case BDD_ANTITRANSPOSE: return in[(n-1-c)*n + n-1-r];
+    default: return in[r*n + c];
+    }
+}
+
+static void check_transforms(int n, unsigned seed) {
+    unsigned char *raster = malloc(n * n), *want = malloc(n * n), lut[BDD_NUM_LEAVES];
+    CHECK(raster != NULL && want != NULL, "out of memory");
+    test_pattern(raster, n, n, 1, seed);
+    BDD_LAYOUT square = {BDD_ORDER_RC, 0, 0, 0};
+    bdd_layout_fit(&square, n, n);
+    int level = square.rbits + square.cbits;
+    BDD_NODE *node = bdd_from_raster_ordered(n, n, raster, NULL, BDD_IDENTITY, &square);
+    for (int op = BDD_IDENTITY; op <= BDD_ANTITRANSPOSE; op++) {
+        for (int r = 0; r < n; r++) {
+            for (int c = 0; c < n; c++) {
+                want[r*n + c] = dihedral_pixel(raster, n, op, r, c);
+            }
+        }
+        test_same_bdd(bdd_dihedral(node, level, op), &square, want, n, n);
+    }
+    for (int v = 0; v < BDD_NUM_LEAVES; v++) {
+        lut[v] = (v * 7 + seed) & 0xFF;
+    }
+    for (int i = 0; i < n * n; i++) {
+        want[i] = lut[raster[i]];
+    }
+    test_same_bdd(bdd_map_table(node, lut), &square, want, n, n);
+    for (int order = 0; order < BDD_ORDER_COUNT; order++) {
+        BDD_LAYOUT layout = {order, 0, 0, 1};
+        // The rows past those of the layout are dropped.
+        bdd_layout_fit(&layout, n, n/2);
+        test_same_bdd(bdd_reorder(node, &square, &layout), &layout, raster, n, n/2);
+    }
+    BDD_LAYOUT cols = {BDD_ORDER_COLS, 0, 0, 0};
+    bdd_layout_fit(&cols, n, n);
+    BDD_NODE *hybrid = bdd_to_hybrid(bdd_reorder(node, &square, &cols), &cols, BDD_TILE_LEVEL_MIN);
+    test_same_bdd(bdd_from_hybrid(hybrid, &cols), &cols, raster, n, n);
+    free(raster);
+    free(want);
+}
+
+TEST(transform, against_raster) {
+    check_transforms(32, 1);
+    check_transforms(64, 2);
+}
+
+TEST(transform, after_reset) {
+    // Nodes built after a reset reuse the indices of those before it, for
+    // which the memo tables still hold results of earlier walks.
+    for (int i = 0; i < 4; i++) {
+        check_transforms(32, 3 + i);
+        bdd_reset();
+    }
+}
+
+TEST(transform, stamps_overflow) {
+    BDD_MANAGER *mgr = bdd_manager_current();
+    check_transforms(16, 7);
+    *mgr->walk = 0x3FFFFFF0;
+    *(mgr->walk + 1) = 0x3FFFFFF0;
+    for (int i = 0; i < 8; i++) {
+        check_transforms(16 << (i % 3), 8 + i);
+    }
+    CHECK(*mgr->walk < 0x3FFFFFF0 && *(mgr->walk + 1) < 0x3FFFFFF0, "stamps did not start over");
+}
+
+TEST(transform, own_manager) {
+    BDD_MANAGER *mgr = bdd_manager_new();
+    CHECK(mgr != NULL, "cannot make a manager");
+    bdd_manager_use(mgr);
+    check_transforms(32, 20);
+    bdd_manager_use(NULL);
+    bdd_manager_free(mgr);
+    check_transforms(32, 21);
+}
+
+TEST(transform, table_full) {
+    unsigned char raster[32 * 32], lut[BDD_NUM_LEAVES];
+    test_pattern(raster, 32, 32, 1, 30);
+    BDD_NODE *node = bdd_from_raster(32, 32, raster);
+    CHECK(node != NULL, "cannot build a BDD");
+    // Fill the rest of the table with nodes of distinct leaves.
+    int level = 1, l = 0, r = 1, last = 0;
+    while (last != -1) {
+        last = bdd_lookup(level, l, r);
+        if (++r == BDD_NUM_LEAVES) {
+            r = 0;
+            if (++l == BDD_NUM_LEAVES) {
+                l = 0;
+                level++;
+            }
+        }
+    }
+    CHECK(bdd_lookup(node->level, node->left, node->right) == node - bdd_nodes,
+          "a node already in the full table was not found");
+    CHECK(bdd_lookup(level, 5, -1) == -1, "a lookup with a failed child succeeded");
+    for (int v = 0; v < BDD_NUM_LEAVES; v++) {
+        lut[v] = 255 - v;
+    }
+    BDD_LAYOUT square = {BDD_ORDER_RC, 5, 5, 0};
+    CHECK(bdd_map_table(node, lut) == NULL, "a map was built in a full table");
+    CHECK(bdd_dihedral(node, 10, BDD_ROT90) == NULL, "a rotation was built in a full table");
+    CHECK(bdd_reorder(node, &square, &(BDD_LAYOUT){BDD_ORDER_COLS, 5, 5, 0}) == NULL,
+          "a reordering was built in a full table");
+    CHECK(bdd_from_raster(32, 32, raster) == node, "a BDD already in the full table was not found");
+    bdd_reset();
+    check_transforms(32, 31);
+}
+
+static unsigned char invert(unsigned char v) {
+    return 255 - v;
+}
+
+TEST(transform, hybrid) {
+    int w = 64, h = 64;
+    unsigned char raster[64 * 64];
+    test_pattern(raster, w, h, 1, 31);
+    BDD_LAYOUT layout = {BDD_ORDER_RC, 0, 0, 0}, tall = {BDD_ORDER_RC, 7, 6, 1};
+    BDD_NODE *node = test_build(raster, w, h, &layout);
+    BDD_NODE *hybrid = bdd_to_hybrid(node, &layout, 6);
+    CHECK(hybrid != NULL && hybrid != node, "no hybrid BDD of a noisy image");
+    // Operations that would descend into a tile fail rather than read its
+    // pixels as nodes.  The rectangle is unaligned and reaches the noisy
+    // corner of the pattern, where the tiles are.
+    BDD_RECT rect = {3, 5, 63, 61};
+    CHECK(bdd_map(hybrid, invert) == NULL, "a hybrid BDD was mapped");
+    CHECK(bdd_combine(hybrid, node, BDD_XOR) == NULL && bdd_combine(node, hybrid, BDD_AND) == NULL,
+          "a hybrid BDD was combined");
+    CHECK(bdd_dihedral(hybrid, 12, BDD_FLIP_H) == NULL && bdd_rotate(hybrid, 12) == NULL,
+          "a hybrid BDD was rotated");
+    CHECK(bdd_crop(hybrid, &layout, &rect, &layout) == NULL, "a hybrid BDD was cropped");
+    CHECK(bdd_pad(hybrid, &layout, w, h, 3, 1, &tall, 7) == NULL, "a hybrid BDD was padded");
+    CHECK(bdd_shift(hybrid, &layout, 3, -5) == NULL, "a hybrid BDD was shifted");
+    CHECK(bdd_fill_rect(hybrid, &layout, &rect, 9) == NULL, "a hybrid BDD was filled");
+    CHECK(bdd_set_pixel(hybrid, &layout, 60, 60, 1) == NULL, "a pixel of a hybrid BDD was set");
+    BDD_RECT *rects = NULL;
+    int count = 0;
+    CHECK(bdd_diff(hybrid, node, &layout, w, h, &rects, &count) == -1, "a hybrid BDD was compared");
+    // Converted back, it is the BDD it was made from.
+    BDD_NODE *plain = bdd_from_hybrid(hybrid, &layout);
+    CHECK(plain == node, "hybrid BDD converted back is not the BDD it was made from");
+    CHECK(bdd_diff(plain, node, &layout, w, h, &rects, &count) == 0 && count == 0,
+          "differences after conversion");
+    CHECK(bdd_map(plain, invert) != NULL && bdd_rotate(plain, 12) != NULL, "plain BDD not transformed");
+}
@@ -0,0 +1,85 @@
+/*
+ * Cropping, padding and shifting a BDD, in each layout, against the same
+ * operations on the raster.
+ */
+
+#include <stdlib.h>
+
+#include "test.h"
+#include "bdd.h"
+
+/*
+ * Check every pixel of the array represented by a BDD against the source
+ * raster moved by (dr, dc), where pixels from outside the window [0, h) x
+ * [0, w) of the source have the fill value.
+ */
+static void check_moved(BDD_NODE *node, BDD_LAYOUT *layout, unsigned char *raster, int w, int h,
+                        int dr, int dc, int fill) {
+    CHECK(node != NULL, "no BDD was built");
+    for (int r = 0; r < 1 << layout->rbits; r++) {
+        for (int c = 0; c < 1 << layout->cbits; c++) {
+            int sr = r - dr, sc = c - dc;
+            int e = sr >= 0 && sr < h && sc >= 0 && sc < w ? raster[sr*w + sc] : fill;
+            int v = bdd_apply_ordered(node, layout, r, c);
+            CHECK(v == e, "pixel (%d, %d) in order %d is %d, expected %d", r, c, layout->order, v, e);
+        }
+    }
+}
+
+static void check_windows(int w, int h, BDD_LAYOUT *layout, unsigned seed) {
+    unsigned char *raster = malloc(w * h);
+    CHECK(raster != NULL, "out of memory");
+    test_pattern(raster, w, h, 1, seed);
+    BDD_RECT rects[] = {{0, 0, h, w}, {1, 3, h - 2, w - 1}, {h/2, w/2, h, w}, {0, w/4, 1, w/4 + 5}};
+    BDD_NODE *node = test_build(raster, w, h, layout);
+    for (int i = 0; i < 4; i++) {
+        BDD_RECT *cr = &rects[i];
+        int cw = cr->c1 - cr->c0, ch = cr->r1 - cr->r0;
+        // Crop into each layout, so that blocks are both shared and rebuilt.
+        for (int dorder = 0; dorder < BDD_ORDER_COUNT; dorder++) {
+            BDD_LAYOUT dlayout = {dorder, 0, 0, !layout->rect};
+            bdd_layout_fit(&dlayout, cw, ch);
+            BDD_NODE *crop = bdd_crop(node, layout, cr, &dlayout);
+            unsigned char *want = malloc(cw * ch);
+            for (int r = 0; r < ch; r++) {
+                for (int c = 0; c < cw; c++) {
+                    want[r*cw + c] = raster[(r + cr->r0)*w + c + cr->c0];
+                }
+            }
+            check_moved(crop, &dlayout, want, cw, ch, 0, 0, 0);
+            free(want);
+        }
+    }
+    BDD_LAYOUT big = {(layout->order + 1) % BDD_ORDER_COUNT, 0, 0, layout->rect};
+    bdd_layout_fit(&big, w + 11, h + 6);
+    check_moved(bdd_pad(node, layout, w, h, 6, 11, &big, 7), &big, raster, w, h, 6, 11, 7);
+    check_moved(bdd_pad(node, layout, w, h, 0, 0, &big, 0), &big, raster, w, h, 0, 0, 0);
+    int shifts[][2] = {{3, -5}, {-4, 8}, {0, 0}, {h, 0}};
+    for (int i = 0; i < 4; i++) {
+        int dr = shifts[i][0], dc = shifts[i][1];
+        check_moved(bdd_shift(node, layout, dr, dc), layout, raster, w, h, dr, dc, 0);
+    }
+    CHECK(bdd_shift(node, layout, 0, 0) == node, "unshifted BDD was rebuilt");
+    free(raster);
+}
+
+TEST(window, every_layout) {
+    test_layouts(check_windows, 0);
+}
+
+TEST(window, strips) {
+    test_layouts(check_windows, 1);
+}
+
+TEST(window, bad_layout) {
+    unsigned char raster[64] = {0};
+    BDD_LAYOUT layout = {BDD_ORDER_RC, 0, 0, 0};
+    BDD_NODE *node = test_build(raster, 8, 8, &layout);
+    BDD_LAYOUT small = {BDD_ORDER_RC, 1, 1, 0};
+    BDD_LAYOUT bad = {BDD_ORDER_COUNT, 3, 3, 0};
+    BDD_RECT rect = {0, 0, 4, 4};
+    CHECK(bdd_crop(node, &layout, &rect, &small) == NULL, "a crop larger than its layout was made");
+    CHECK(bdd_crop(node, &bad, &rect, &layout) == NULL, "an invalid order was taken");
+    CHECK(bdd_pad(node, &layout, 8, 8, 1, 0, &layout, 0) == NULL, "a pad outside its layout was made");
+    CHECK(bdd_shift(node, NULL, 1, 1) == NULL, "no layout was taken");
+}